@@ -993,17 +993,6 @@ void _CFArrayReplaceValues(CFMutableArrayRef array, CFRange range, const void **
     END_MUTATION(array);
 }
 
-struct _acompareContext {
-    CFComparatorFunction func;
-    void *context;
-};
-
-static CFComparisonResult __CFArrayCompareValues(const void *v1, const void *v2, struct _acompareContext *context) {
-    const void **val1 = (const void **)v1;
-    const void **val2 = (const void **)v2;
-    return (CFComparisonResult)(INVOKE_CALLBACK3(context->func, *val1, *val2, context->context));
-}
-
 CF_INLINE void __CFZSort(CFMutableArrayRef array, CFRange range, CFComparatorFunction comparator, void *context) {
     CFIndex cnt = range.length;
     while (1 < cnt) {
@@ -1027,10 +1016,7 @@ CF_PRIVATE void _CFArraySortValues(CFMutableArrayRef array, CFComparatorFunction
     const void **values, *buffer[256];
     values = (range.length <= 256) ? (const void **)buffer : (const void **)CFAllocatorAllocate(kCFAllocatorSystemDefault, range.length * sizeof(void *), 0); // GC OK
     CFArrayGetValues(array, range, values);
-    struct _acompareContext ctx;
-    ctx.func = comparator;
-    ctx.context = context;
-    CFQSortArray(values, range.length, sizeof(void *), (CFComparatorFunction)__CFArrayCompareValues, &ctx);
+    __CFSortValues(values, range.length, comparator, context);
     CFArrayReplaceValues(array, range, values, range.length);
     if (values != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, values);
 }
@@ -1064,10 +1050,7 @@ void CFArraySortValues(CFMutableArrayRef array, CFRange range, CFComparatorFunct
     const void **values, *buffer[256];
     values = (range.length <= 256) ? (const void **)buffer : (const void **)CFAllocatorAllocate(kCFAllocatorSystemDefault, range.length * sizeof(void *), 0); // GC OK
     CFArrayGetValues(array, range, values);
-    struct _acompareContext ctx;
-    ctx.func = comparator;
-    ctx.context = context;
-    CFQSortArray(values, range.length, sizeof(void *), (CFComparatorFunction)__CFArrayCompareValues, &ctx);
+    __CFSortValues(values, range.length, comparator, context);
     if (!immutable) CFArrayReplaceValues(array, range, values, range.length);
     if (values != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, values);
 }
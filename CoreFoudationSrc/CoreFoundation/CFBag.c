@@ -136,6 +136,10 @@ CFTypeID CFBagGetTypeID(void) {
 static CFBasicHashRef __CFBagCreateGeneric(CFAllocatorRef allocator, const CFHashKeyCallBacks *keyCallBacks, const CFHashValueCallBacks *valueCallBacks, Boolean useValueCB) {
     CFOptionFlags flags = kCFBasicHashLinearHashing; // kCFBasicHashExponentialHashing
     flags |= (CFDictionary ? kCFBasicHashHasKeys : 0) | (CFBag ? kCFBasicHashHasCounts : 0);
+    if ((CFDictionary || CFSet) && keyCallBacks && CFEqual == keyCallBacks->equal && CFHash == keyCallBacks->hash) {
+        // the CFType key callbacks, as used for CFString and CFNumber keys, whose CFEqual is worth avoiding
+        flags |= kCFBasicHashGroupHashing;
+    }
 
     if (CF_IS_COLLECTABLE_ALLOCATOR(allocator)) { // all this crap is just for figuring out two flags for GC in the way done historically; it probably simplifies down to three lines, but we let the compiler worry about that
         Boolean set_cb = false;
@@ -235,6 +239,7 @@ CF_PRIVATE CFHashRef __CFBagCreateTransfer(CFAllocatorRef allocator, const_any_p
     CFAssert2(0 <= numValues, __kCFLogAssertion, "%s(): numValues (%ld) cannot be less than zero", __PRETTY_FUNCTION__, numValues);
     CFOptionFlags flags = kCFBasicHashLinearHashing; // kCFBasicHashExponentialHashing
     flags |= (CFDictionary ? kCFBasicHashHasKeys : 0) | (CFBag ? kCFBasicHashHasCounts : 0);
+    flags |= ((CFDictionary || CFSet) ? kCFBasicHashGroupHashing : 0);
 
     CFBasicHashCallbacks callbacks;
     callbacks.retainKey = (uintptr_t (*)(CFAllocatorRef, uintptr_t))kCFTypeBagKeyCallBacks.retain;
@@ -250,10 +255,7 @@ CF_PRIVATE CFHashRef __CFBagCreateTransfer(CFAllocatorRef allocator, const_any_p
 
     CFBasicHashRef ht = CFBasicHashCreate(allocator, flags, &callbacks);
     CFBasicHashSuppressRC(ht);
-    if (0 < numValues) CFBasicHashSetCapacity(ht, numValues);
-    for (CFIndex idx = 0; idx < numValues; idx++) {
-        CFBasicHashAddValue(ht, (uintptr_t)klist[idx], (uintptr_t)vlist[idx]);
-    }
+    CFBasicHashAddValues(ht, numValues, (const uintptr_t *)klist, (const uintptr_t *)vlist);
     CFBasicHashUnsuppressRC(ht);
     CFBasicHashMakeImmutable(ht);
     _CFRuntimeSetInstanceTypeIDAndIsa(ht, typeID);
@@ -273,10 +275,7 @@ CFHashRef CFBagCreate(CFAllocatorRef allocator, const_any_pointer_t *klist, CFIn
     CFAssert2(0 <= numValues, __kCFLogAssertion, "%s(): numValues (%ld) cannot be less than zero", __PRETTY_FUNCTION__, numValues);
     CFBasicHashRef ht = __CFBagCreateGeneric(allocator, keyCallBacks, valueCallBacks, CFDictionary);
     if (!ht) return NULL;
-    if (0 < numValues) CFBasicHashSetCapacity(ht, numValues);
-    for (CFIndex idx = 0; idx < numValues; idx++) {
-        CFBasicHashAddValue(ht, (uintptr_t)klist[idx], (uintptr_t)vlist[idx]);
-    }
+    CFBasicHashAddValues(ht, numValues, (const uintptr_t *)klist, (const uintptr_t *)vlist);
     CFBasicHashMakeImmutable(ht);
     _CFRuntimeSetInstanceTypeIDAndIsa(ht, typeID);
     if (__CFOASafe) __CFSetLastAllocationEventName(ht, "CFBag (immutable)");
@@ -317,10 +316,7 @@ CFHashRef CFBagCreateCopy(CFAllocatorRef allocator, CFHashRef other) {
         CFDictionaryGetKeysAndValues(other, klist, vlist);
 #endif
         ht = __CFBagCreateGeneric(allocator, & kCFTypeBagKeyCallBacks, CFDictionary ? & kCFTypeBagValueCallBacks : NULL, CFDictionary);
-        if (ht && 0 < numValues) CFBasicHashSetCapacity(ht, numValues);
-        for (CFIndex idx = 0; ht && idx < numValues; idx++) {
-            CFBasicHashAddValue(ht, (uintptr_t)klist[idx], (uintptr_t)vlist[idx]);
-        }
+        if (ht) CFBasicHashAddValues(ht, numValues, (const uintptr_t *)klist, (const uintptr_t *)vlist);
         if (klist != kbuffer && klist != vlist) CFAllocatorDeallocate(kCFAllocatorSystemDefault, klist);
         if (vlist != vbuffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, vlist);
     } else {
@@ -352,10 +348,7 @@ CFMutableHashRef CFBagCreateMutableCopy(CFAllocatorRef allocator, CFIndex capaci
         CFDictionaryGetKeysAndValues(other, klist, vlist);
 #endif
         ht = __CFBagCreateGeneric(allocator, & kCFTypeBagKeyCallBacks, CFDictionary ? & kCFTypeBagValueCallBacks : NULL, CFDictionary);
-        if (ht && 0 < numValues) CFBasicHashSetCapacity(ht, numValues);
-        for (CFIndex idx = 0; ht && idx < numValues; idx++) {
-            CFBasicHashAddValue(ht, (uintptr_t)klist[idx], (uintptr_t)vlist[idx]);
-        }
+        if (ht) CFBasicHashAddValues(ht, numValues, (const uintptr_t *)klist, (const uintptr_t *)vlist);
         if (klist != kbuffer && klist != vlist) CFAllocatorDeallocate(kCFAllocatorSystemDefault, klist);
         if (vlist != vbuffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, vlist);
     } else {
@@ -571,6 +564,23 @@ void CFBagAddValue(CFMutableHashRef hc, const_any_pointer_t key) {
     CF_OBJC_KVO_DIDCHANGE(hc, key);
 }
 
+// Adds numValues entries as CFBagAddValue would, growing the table at most once;
+// for the property list parsers, which build many collections from lists of objects.
+#if CFDictionary
+CF_PRIVATE void __CFBagAddValues(CFMutableHashRef hc, const_any_pointer_t *klist, const_any_pointer_t *vlist, CFIndex numValues) {
+#endif
+#if CFSet || CFBag
+CF_PRIVATE void __CFBagAddValues(CFMutableHashRef hc, const_any_pointer_t *klist, CFIndex numValues) {
+    const_any_pointer_t *vlist = klist;
+#endif
+    __CFGenericValidateType(hc, __kCFBagTypeID);
+    CFAssert2(CFBasicHashIsMutable((CFBasicHashRef)hc), __kCFLogAssertion, "%s(): immutable collection %p passed to mutating operation", __PRETTY_FUNCTION__, hc);
+    CFAssert2(0 <= numValues, __kCFLogAssertion, "%s(): numValues (%ld) cannot be less than zero", __PRETTY_FUNCTION__, numValues);
+    CF_OBJC_KVO_WILLCHANGEALL(hc);
+    CFBasicHashAddValues((CFBasicHashRef)hc, numValues, (const uintptr_t *)klist, (const uintptr_t *)vlist);
+    CF_OBJC_KVO_DIDCHANGEALL(hc);
+}
+
 #if CFDictionary
 void CFBagReplaceValue(CFMutableHashRef hc, const_any_pointer_t key, const_any_pointer_t value) {
 #endif
@@ -34,6 +34,13 @@
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED
 #import <dispatch/dispatch.h>
 #endif
+#if defined(__SSE2__)
+#import <emmintrin.h>
+#define __CF_BASICHASH_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#import <arm_neon.h>
+#define __CF_BASICHASH_NEON 1
+#endif
 
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED
 #define __SetLastAllocationEventName(A, B) do { if (__CFOASafe && (A)) __CFSetLastAllocationEventName(A, B); } while (0)
@@ -309,7 +316,7 @@ struct __CFBasicHash {
     CFRuntimeBase base;
     struct { // 192 bits
         uint16_t mutations;
-        uint8_t hash_style:2;
+        uint8_t hash_style:3;
         uint8_t keys_offset:1;
         uint8_t counts_offset:2;
         uint8_t counts_width:2;
@@ -321,6 +328,7 @@ struct __CFBasicHash {
         uint8_t int_values:1;
         uint8_t int_keys:1;
         uint8_t indirect_keys:1;
+        uint8_t control_offset:3;
         uint32_t used_buckets;      /* number of used buckets */
         uint64_t deleted:16;
         uint64_t num_buckets_idx:8; /* index to number of buckets */
@@ -709,6 +717,76 @@ CF_INLINE void __CFBasicHashSetHashes(CFBasicHashRef ht, uintptr_t *ptr) {
     __AssignWithWriteBarrier(&ht->pointers[ht->bits.hashes_offset], ptr);
 }
 
+// Group hashing keeps a control byte per bucket: the top 7 bits of the
+// scrambled hash code for a used bucket, or one of the two marks below.
+// A probe compares the control bytes of 16 buckets at once and only calls
+// the key equality callback where the fragment matches. The array has
+// __CFBasicHashGroupWidth bytes past the last bucket which mirror the
+// first buckets (repeatedly, for tables smaller than a group), so a group
+// can be loaded at any bucket index without wrapping.
+#define __CFBasicHashGroupWidth 16
+#define __CFBasicHashControlEmpty 0x80
+#define __CFBasicHashControlDeleted 0xFE
+
+CF_INLINE uint8_t *__CFBasicHashGetControls(CFConstBasicHashRef ht) {
+    return (uint8_t *)ht->pointers[ht->bits.control_offset];
+}
+
+CF_INLINE void __CFBasicHashSetControls(CFBasicHashRef ht, uint8_t *ptr) {
+    __AssignWithWriteBarrier(&ht->pointers[ht->bits.control_offset], ptr);
+}
+
+CF_INLINE uint8_t __CFBasicHashControlFragment(CFHashCode hash_code) {
+#if __LP64__
+    return (uint8_t)((hash_code * 0x9E3779B97F4A7C15UL) >> 57);
+#else
+    return (uint8_t)((hash_code * 0x9E3779B9UL) >> 25);
+#endif
+}
+
+CF_INLINE void __CFBasicHashSetControlByte(CFBasicHashRef ht, CFIndex idx, uint8_t byte) {
+    uint8_t *controls = __CFBasicHashGetControls(ht);
+    CFIndex num_buckets = __CFBasicHashTableSizes[ht->bits.num_buckets_idx];
+    controls[idx] = byte;
+    for (CFIndex mirror = idx + num_buckets; mirror < num_buckets + __CFBasicHashGroupWidth; mirror += num_buckets) {
+        controls[mirror] = byte;
+    }
+}
+
+// Bit i of the result is set if controls[i] is byte
+CF_INLINE uint32_t __CFBasicHashGroupMatch(const uint8_t *controls, uint8_t byte) {
+#if __CF_BASICHASH_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)controls), _mm_set1_epi8((char)byte)));
+#elif __CF_BASICHASH_NEON
+    static const uint8_t lanes[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(vceqq_u8(vld1q_u8(controls), vdupq_n_u8(byte)), vld1q_u8(lanes));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __CFBasicHashGroupWidth; idx++) {
+        if (controls[idx] == byte) mask |= (1U << idx);
+    }
+    return mask;
+#endif
+}
+
+// Bit i of the result is set if controls[i] is empty or deleted; both marks have the top bit set and fragments never do
+CF_INLINE uint32_t __CFBasicHashGroupMatchFree(const uint8_t *controls) {
+#if __CF_BASICHASH_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)controls));
+#elif __CF_BASICHASH_NEON
+    static const uint8_t lanes[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(vcltzq_s8(vreinterpretq_s8_u8(vld1q_u8(controls))), vld1q_u8(lanes));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (CFIndex idx = 0; idx < __CFBasicHashGroupWidth; idx++) {
+        if (controls[idx] & 0x80) mask |= (1U << idx);
+    }
+    return mask;
+#endif
+}
+
 
 // to expose the load factor, expose this function to customization
 CF_INLINE CFIndex __CFBasicHashGetCapacityForNumBuckets(CFConstBasicHashRef ht, CFIndex num_buckets_idx) {
@@ -872,23 +950,49 @@ static uintptr_t __CFBasicHashFold(uintptr_t dividend, uint8_t idx) {
 #define FIND_BUCKET_FOR_INDIRECT_KEY	1
 #include "CFBasicHashFindBucket.m"
 
+#define FIND_BUCKET_NAME		___CFBasicHashFindBucket_Group
+#define FIND_BUCKET_HASH_STYLE		4
+#define FIND_BUCKET_FOR_REHASH		0
+#define FIND_BUCKET_FOR_INDIRECT_KEY	0
+#include "CFBasicHashFindBucket.m"
 
-CF_INLINE CFBasicHashBucket __CFBasicHashFindBucket(CFConstBasicHashRef ht, uintptr_t stack_key) {
+#define FIND_BUCKET_NAME		___CFBasicHashFindBucket_Group_NoCollision
+#define FIND_BUCKET_HASH_STYLE		4
+#define FIND_BUCKET_FOR_REHASH		1
+#define FIND_BUCKET_FOR_INDIRECT_KEY	0
+#include "CFBasicHashFindBucket.m"
+
+#define FIND_BUCKET_NAME		___CFBasicHashFindBucket_Group_Indirect
+#define FIND_BUCKET_HASH_STYLE		4
+#define FIND_BUCKET_FOR_REHASH		0
+#define FIND_BUCKET_FOR_INDIRECT_KEY	1
+#include "CFBasicHashFindBucket.m"
+
+#define FIND_BUCKET_NAME		___CFBasicHashFindBucket_Group_Indirect_NoCollision
+#define FIND_BUCKET_HASH_STYLE		4
+#define FIND_BUCKET_FOR_REHASH		1
+#define FIND_BUCKET_FOR_INDIRECT_KEY	1
+#include "CFBasicHashFindBucket.m"
+
+
+CF_INLINE CFBasicHashBucket __CFBasicHashFindBucketWithHash(CFConstBasicHashRef ht, uintptr_t stack_key, uintptr_t key_hash) {
     if (0 == ht->bits.num_buckets_idx) {
         CFBasicHashBucket result = {kCFNotFound, 0UL, 0UL, 0};
         return result;
     }
     if (ht->bits.indirect_keys) {
         switch (ht->bits.hash_style) {
-        case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear_Indirect(ht, stack_key);
-        case __kCFBasicHashDoubleHashingValue: return ___CFBasicHashFindBucket_Double_Indirect(ht, stack_key);
-        case __kCFBasicHashExponentialHashingValue: return ___CFBasicHashFindBucket_Exponential_Indirect(ht, stack_key);
+        case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear_Indirect(ht, stack_key, key_hash);
+        case __kCFBasicHashDoubleHashingValue: return ___CFBasicHashFindBucket_Double_Indirect(ht, stack_key, key_hash);
+        case __kCFBasicHashExponentialHashingValue: return ___CFBasicHashFindBucket_Exponential_Indirect(ht, stack_key, key_hash);
+        case __kCFBasicHashGroupHashingValue: return ___CFBasicHashFindBucket_Group_Indirect(ht, stack_key, key_hash);
         }
     } else {
         switch (ht->bits.hash_style) {
-        case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear(ht, stack_key);
-        case __kCFBasicHashDoubleHashingValue: return ___CFBasicHashFindBucket_Double(ht, stack_key);
-        case __kCFBasicHashExponentialHashingValue: return ___CFBasicHashFindBucket_Exponential(ht, stack_key);
+        case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear(ht, stack_key, key_hash);
+        case __kCFBasicHashDoubleHashingValue: return ___CFBasicHashFindBucket_Double(ht, stack_key, key_hash);
+        case __kCFBasicHashExponentialHashingValue: return ___CFBasicHashFindBucket_Exponential(ht, stack_key, key_hash);
+        case __kCFBasicHashGroupHashingValue: return ___CFBasicHashFindBucket_Group(ht, stack_key, key_hash);
         }
     }
     HALT;
@@ -896,6 +1000,17 @@ CF_INLINE CFBasicHashBucket __CFBasicHashFindBucket(CFConstBasicHashRef ht, uint
     return result;
 }
 
+CF_INLINE CFBasicHashBucket __CFBasicHashFindBucket(CFConstBasicHashRef ht, uintptr_t stack_key) {
+    return __CFBasicHashFindBucketWithHash(ht, stack_key, 0);
+}
+
+// For the add paths: also hands back the key's hash, so that filling the
+// bucket afterwards does not call the hash callback a second time
+CF_INLINE CFBasicHashBucket __CFBasicHashFindBucketReturningHash(CFConstBasicHashRef ht, uintptr_t stack_key, uintptr_t *key_hash) {
+    *key_hash = __CFBasicHashHashKey(ht, stack_key);
+    return __CFBasicHashFindBucketWithHash(ht, stack_key, *key_hash);
+}
+
 CF_INLINE CFIndex __CFBasicHashFindBucket_NoCollision(CFConstBasicHashRef ht, uintptr_t stack_key, uintptr_t key_hash) {
     if (0 == ht->bits.num_buckets_idx) {
         return kCFNotFound;
@@ -905,12 +1020,14 @@ CF_INLINE CFIndex __CFBasicHashFindBucket_NoCollision(CFConstBasicHashRef ht, ui
         case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear_Indirect_NoCollision(ht, stack_key, key_hash);
         case __kCFBasicHashDoubleHashingValue: return ___CFBasicHashFindBucket_Double_Indirect_NoCollision(ht, stack_key, key_hash);
         case __kCFBasicHashExponentialHashingValue: return ___CFBasicHashFindBucket_Exponential_Indirect_NoCollision(ht, stack_key, key_hash);
+        case __kCFBasicHashGroupHashingValue: return ___CFBasicHashFindBucket_Group_Indirect_NoCollision(ht, stack_key, key_hash);
         }
     } else {
         switch (ht->bits.hash_style) {
         case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear_NoCollision(ht, stack_key, key_hash);
         case __kCFBasicHashDoubleHashingValue: return ___CFBasicHashFindBucket_Double_NoCollision(ht, stack_key, key_hash);
         case __kCFBasicHashExponentialHashingValue: return ___CFBasicHashFindBucket_Exponential_NoCollision(ht, stack_key, key_hash);
+        case __kCFBasicHashGroupHashingValue: return ___CFBasicHashFindBucket_Group_NoCollision(ht, stack_key, key_hash);
         }
     }
     HALT;
@@ -934,7 +1051,7 @@ CF_PRIVATE void CFBasicHashUnsuppressRC(CFBasicHashRef ht) {
 }
 
 CF_PRIVATE CFOptionFlags CFBasicHashGetFlags(CFConstBasicHashRef ht) {
-    CFOptionFlags flags = (ht->bits.hash_style << 13);
+    CFOptionFlags flags = (__kCFBasicHashGroupHashingValue == ht->bits.hash_style) ? kCFBasicHashGroupHashing : (ht->bits.hash_style << 13);
     if (CFBasicHashHasStrongValues(ht)) flags |= kCFBasicHashStrongValues;
     if (CFBasicHashHasStrongKeys(ht)) flags |= kCFBasicHashStrongKeys;
     if (ht->bits.fast_grow) flags |= kCFBasicHashAggressiveGrowth;
@@ -1088,6 +1205,7 @@ static void __CFBasicHashDrain(CFBasicHashRef ht, Boolean forFinalization) {
     CFBasicHashValue *old_values = NULL, *old_keys = NULL;
     void *old_counts = NULL;
     uintptr_t *old_hashes = NULL;
+    uint8_t *old_controls = NULL;
 
     old_values = __CFBasicHashGetValues(ht);
     if (nullify) __CFBasicHashSetValues(ht, NULL);
@@ -1103,6 +1221,10 @@ static void __CFBasicHashDrain(CFBasicHashRef ht, Boolean forFinalization) {
         old_hashes = __CFBasicHashGetHashes(ht);
         if (nullify) __CFBasicHashSetHashes(ht, NULL);
     }
+    if (ht->bits.control_offset) {
+        old_controls = __CFBasicHashGetControls(ht);
+        if (nullify) __CFBasicHashSetControls(ht, NULL);
+    }
 
     if (nullify) {
         ht->bits.mutations++;
@@ -1132,6 +1254,7 @@ static void __CFBasicHashDrain(CFBasicHashRef ht, Boolean forFinalization) {
         CFAllocatorDeallocate(allocator, old_keys);
         CFAllocatorDeallocate(allocator, old_counts);
         CFAllocatorDeallocate(allocator, old_hashes);
+        CFAllocatorDeallocate(allocator, old_controls);
     }
 
 #if ENABLE_MEMORY_COUNTERS
@@ -1164,6 +1287,7 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
     CFBasicHashValue *new_values = NULL, *new_keys = NULL;
     void *new_counts = NULL;
     uintptr_t *new_hashes = NULL;
+    uint8_t *new_controls = NULL;
 
     if (0 < new_num_buckets) {
         new_values = (CFBasicHashValue *)__CFBasicHashAllocateMemory(ht, new_num_buckets, sizeof(CFBasicHashValue), CFBasicHashHasStrongValues(ht), 0);
@@ -1188,6 +1312,12 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
             __SetLastAllocationEventName(new_hashes, "CFBasicHash (hash-store)");
             memset(new_hashes, 0, new_num_buckets * sizeof(uintptr_t));
         }
+        if (ht->bits.control_offset) {
+            new_controls = (uint8_t *)__CFBasicHashAllocateMemory(ht, new_num_buckets + __CFBasicHashGroupWidth, 1, false, false);
+            if (!new_controls) HALT;
+            __SetLastAllocationEventName(new_controls, "CFBasicHash (control-store)");
+            memset(new_controls, __CFBasicHashControlEmpty, new_num_buckets + __CFBasicHashGroupWidth);
+        }
     }
 
     ht->bits.num_buckets_idx = new_num_buckets_idx;
@@ -1196,6 +1326,7 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
     CFBasicHashValue *old_values = NULL, *old_keys = NULL;
     void *old_counts = NULL;
     uintptr_t *old_hashes = NULL;
+    uint8_t *old_controls = NULL;
 
     old_values = __CFBasicHashGetValues(ht);
     __CFBasicHashSetValues(ht, new_values);
@@ -1211,6 +1342,10 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
         old_hashes = __CFBasicHashGetHashes(ht);
         __CFBasicHashSetHashes(ht, new_hashes);
     }
+    if (ht->bits.control_offset) {
+        old_controls = __CFBasicHashGetControls(ht);
+        __CFBasicHashSetControls(ht, new_controls);
+    }
 
     if (0 < old_num_buckets) {
         for (CFIndex idx = 0; idx < old_num_buckets; idx++) {
@@ -1227,7 +1362,11 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
                 if (ht->bits.indirect_keys) {
                     stack_key = __CFBasicHashGetIndirectKey(ht, stack_value);
                 }
-                CFIndex bkt_idx = __CFBasicHashFindBucket_NoCollision(ht, stack_key, old_hashes ? old_hashes[idx] : 0UL);
+                uintptr_t key_hash = old_hashes ? old_hashes[idx] : 0UL;
+                if (new_controls && !key_hash) {
+                    key_hash = __CFBasicHashHashKey(ht, stack_key);
+                }
+                CFIndex bkt_idx = __CFBasicHashFindBucket_NoCollision(ht, stack_key, key_hash);
                 __CFBasicHashSetValue(ht, bkt_idx, stack_value, false, false);
                 if (old_keys) {
                     __CFBasicHashSetKey(ht, bkt_idx, stack_key, false, false);
@@ -1243,6 +1382,9 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
                 if (old_hashes) {
                     new_hashes[bkt_idx] = old_hashes[idx];
                 }
+                if (new_controls) {
+                    __CFBasicHashSetControlByte(ht, bkt_idx, __CFBasicHashControlFragment(key_hash));
+                }
             }
         }
     }
@@ -1253,6 +1395,7 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
         CFAllocatorDeallocate(allocator, old_keys);
         CFAllocatorDeallocate(allocator, old_counts);
         CFAllocatorDeallocate(allocator, old_hashes);
+        CFAllocatorDeallocate(allocator, old_controls);
     }
 
     if (COCOA_HASHTABLE_REHASH_END_ENABLED()) COCOA_HASHTABLE_REHASH_END(ht, CFBasicHashGetNumBuckets(ht), CFBasicHashGetSize(ht, true));
@@ -1272,18 +1415,11 @@ CF_PRIVATE void CFBasicHashSetCapacity(CFBasicHashRef ht, CFIndex capacity) {
     }
 }
 
-static void __CFBasicHashAddValue(CFBasicHashRef ht, CFIndex bkt_idx, uintptr_t stack_key, uintptr_t stack_value) {
-    ht->bits.mutations++;
-    if (CFBasicHashGetCapacity(ht) < ht->bits.used_buckets + 1) {
-        __CFBasicHashRehash(ht, 1);
-        bkt_idx = __CFBasicHashFindBucket_NoCollision(ht, stack_key, 0);
-    } else if (__CFBasicHashIsDeleted(ht, bkt_idx)) {
+// Fills bucket bkt_idx, which must be empty or deleted, without any growing
+CF_INLINE void __CFBasicHashInsertValue(CFBasicHashRef ht, CFIndex bkt_idx, uintptr_t stack_key, uintptr_t stack_value, uintptr_t key_hash) {
+    if (__CFBasicHashIsDeleted(ht, bkt_idx)) {
         ht->bits.deleted--;
     }
-    uintptr_t key_hash = 0;
-    if (__CFBasicHashHasHashCache(ht)) {
-        key_hash = __CFBasicHashHashKey(ht, stack_key);
-    }
     stack_value = __CFBasicHashImportValue(ht, stack_value);
     if (ht->bits.keys_offset) {
         stack_key = __CFBasicHashImportKey(ht, stack_key);
@@ -1298,9 +1434,21 @@ static void __CFBasicHashAddValue(CFBasicHashRef ht, CFIndex bkt_idx, uintptr_t
     if (__CFBasicHashHasHashCache(ht)) {
         __CFBasicHashGetHashes(ht)[bkt_idx] = key_hash;
     }
+    if (ht->bits.control_offset) {
+        __CFBasicHashSetControlByte(ht, bkt_idx, __CFBasicHashControlFragment(key_hash));
+    }
     ht->bits.used_buckets++;
 }
 
+static void __CFBasicHashAddValue(CFBasicHashRef ht, CFIndex bkt_idx, uintptr_t stack_key, uintptr_t stack_value, uintptr_t key_hash) {
+    ht->bits.mutations++;
+    if (CFBasicHashGetCapacity(ht) < ht->bits.used_buckets + 1) {
+        __CFBasicHashRehash(ht, 1);
+        bkt_idx = __CFBasicHashFindBucket_NoCollision(ht, stack_key, key_hash);
+    }
+    __CFBasicHashInsertValue(ht, bkt_idx, stack_key, stack_value, key_hash);
+}
+
 static void __CFBasicHashReplaceValue(CFBasicHashRef ht, CFIndex bkt_idx, uintptr_t stack_key, uintptr_t stack_value) {
     ht->bits.mutations++;
     stack_value = __CFBasicHashImportValue(ht, stack_value);
@@ -1325,6 +1473,9 @@ static void __CFBasicHashRemoveValue(CFBasicHashRef ht, CFIndex bkt_idx) {
     if (__CFBasicHashHasHashCache(ht)) {
         __CFBasicHashGetHashes(ht)[bkt_idx] = 0;
     }
+    if (ht->bits.control_offset) {
+        __CFBasicHashSetControlByte(ht, bkt_idx, __CFBasicHashControlDeleted);
+    }
     ht->bits.used_buckets--;
     ht->bits.deleted++;
     Boolean do_shrink = false;
@@ -1351,7 +1502,8 @@ CF_PRIVATE Boolean CFBasicHashAddValue(CFBasicHashRef ht, uintptr_t stack_key, u
     if (__CFBasicHashSubABOne == stack_key) HALT;
     if (__CFBasicHashSubABZero == stack_value) HALT;
     if (__CFBasicHashSubABOne == stack_value) HALT;
-    CFBasicHashBucket bkt = __CFBasicHashFindBucket(ht, stack_key);
+    uintptr_t key_hash;
+    CFBasicHashBucket bkt = __CFBasicHashFindBucketReturningHash(ht, stack_key, &key_hash);
     if (0 < bkt.count) {
         ht->bits.mutations++;
         if (ht->bits.counts_offset && bkt.count < LONG_MAX) { // if not yet as large as a CFIndex can be... otherwise clamp and do nothing
@@ -1359,12 +1511,49 @@ CF_PRIVATE Boolean CFBasicHashAddValue(CFBasicHashRef ht, uintptr_t stack_key, u
             return true;
         }
     } else {
-        __CFBasicHashAddValue(ht, bkt.idx, stack_key, stack_value);
+        __CFBasicHashAddValue(ht, bkt.idx, stack_key, stack_value, key_hash);
         return true;
     }
     return false;
 }
 
+#define __kCFBasicHashAddValuesBatch 64
+
+// Adds count keys and values, growing the table at most once. The keys of each
+// batch are hashed together ahead of the probing, and the hash is then reused for
+// the probe, the hash cache and the control bytes instead of being recomputed.
+// Each key is looked for first, as by CFBasicHashAddValue, so repeated keys are fine.
+CF_PRIVATE void CFBasicHashAddValues(CFBasicHashRef ht, CFIndex count, const uintptr_t *stack_keys, const uintptr_t *stack_values) {
+    if (!CFBasicHashIsMutable(ht)) HALT;
+    if (count <= 0) return;
+    ht->bits.mutations++;
+    if (CFBasicHashGetCapacity(ht) < ht->bits.used_buckets + count) {
+        __CFBasicHashRehash(ht, count);
+    }
+    uintptr_t key_hashes[__kCFBasicHashAddValuesBatch];
+    for (CFIndex start = 0; start < count; start += __kCFBasicHashAddValuesBatch) {
+        CFIndex batch = __CFMin(count - start, __kCFBasicHashAddValuesBatch);
+        for (CFIndex idx = 0; idx < batch; idx++) {
+            uintptr_t stack_key = stack_keys[start + idx];
+            uintptr_t stack_value = stack_values[start + idx];
+            if (__CFBasicHashSubABZero == stack_key) HALT;
+            if (__CFBasicHashSubABOne == stack_key) HALT;
+            if (__CFBasicHashSubABZero == stack_value) HALT;
+            if (__CFBasicHashSubABOne == stack_value) HALT;
+            key_hashes[idx] = __CFBasicHashHashKey(ht, stack_key);
+        }
+        for (CFIndex idx = 0; idx < batch; idx++) {
+            uintptr_t stack_key = stack_keys[start + idx];
+            CFBasicHashBucket bkt = __CFBasicHashFindBucketWithHash(ht, stack_key, key_hashes[idx]);
+            if (0 == bkt.count) {
+                __CFBasicHashInsertValue(ht, bkt.idx, stack_key, stack_values[start + idx], key_hashes[idx]);
+            } else if (ht->bits.counts_offset && bkt.count < LONG_MAX) { // if not yet as large as a CFIndex can be... otherwise clamp and do nothing
+                __CFBasicHashIncSlotCount(ht, bkt.idx);
+            }
+        }
+    }
+}
+
 CF_PRIVATE void CFBasicHashReplaceValue(CFBasicHashRef ht, uintptr_t stack_key, uintptr_t stack_value) {
     if (!CFBasicHashIsMutable(ht)) HALT;
     if (__CFBasicHashSubABZero == stack_key) HALT;
@@ -1383,11 +1572,12 @@ CF_PRIVATE void CFBasicHashSetValue(CFBasicHashRef ht, uintptr_t stack_key, uint
     if (__CFBasicHashSubABOne == stack_key) HALT;
     if (__CFBasicHashSubABZero == stack_value) HALT;
     if (__CFBasicHashSubABOne == stack_value) HALT;
-    CFBasicHashBucket bkt = __CFBasicHashFindBucket(ht, stack_key);
+    uintptr_t key_hash;
+    CFBasicHashBucket bkt = __CFBasicHashFindBucketReturningHash(ht, stack_key, &key_hash);
     if (0 < bkt.count) {
         __CFBasicHashReplaceValue(ht, bkt.idx, stack_key, stack_value);
     } else {
-        __CFBasicHashAddValue(ht, bkt.idx, stack_key, stack_value);
+        __CFBasicHashAddValue(ht, bkt.idx, stack_key, stack_value, key_hash);
     }
 }
 
@@ -1432,14 +1622,15 @@ CF_PRIVATE Boolean CFBasicHashAddIntValueAndInc(CFBasicHashRef ht, uintptr_t sta
     if (__CFBasicHashSubABOne == stack_key) HALT;
     if (__CFBasicHashSubABZero == int_value) HALT;
     if (__CFBasicHashSubABOne == int_value) HALT;
-    CFBasicHashBucket bkt = __CFBasicHashFindBucket(ht, stack_key);
+    uintptr_t key_hash;
+    CFBasicHashBucket bkt = __CFBasicHashFindBucketReturningHash(ht, stack_key, &key_hash);
     if (0 < bkt.count) {
         ht->bits.mutations++;
     } else {
         // must rehash before renumbering
         if (CFBasicHashGetCapacity(ht) < ht->bits.used_buckets + 1) {
             __CFBasicHashRehash(ht, 1);
-            bkt.idx = __CFBasicHashFindBucket_NoCollision(ht, stack_key, 0);
+            bkt.idx = __CFBasicHashFindBucket_NoCollision(ht, stack_key, key_hash);
         }
         CFIndex cnt = (CFIndex)__CFBasicHashTableSizes[ht->bits.num_buckets_idx];
         for (CFIndex idx = 0; idx < cnt; idx++) {
@@ -1452,7 +1643,7 @@ CF_PRIVATE Boolean CFBasicHashAddIntValueAndInc(CFBasicHashRef ht, uintptr_t sta
                 }
             }
         }
-        __CFBasicHashAddValue(ht, bkt.idx, stack_key, int_value);
+        __CFBasicHashAddValue(ht, bkt.idx, stack_key, int_value, key_hash);
         return true;
     }
     return false;
@@ -1485,6 +1676,7 @@ CF_PRIVATE size_t CFBasicHashGetSize(CFConstBasicHashRef ht, Boolean total) {
     if (ht->bits.keys_offset) size += sizeof(CFBasicHashValue *);
     if (ht->bits.counts_offset) size += sizeof(void *);
     if (__CFBasicHashHasHashCache(ht)) size += sizeof(uintptr_t *);
+    if (ht->bits.control_offset) size += sizeof(uint8_t *);
     if (total) {
         CFIndex num_buckets = __CFBasicHashTableSizes[ht->bits.num_buckets_idx];
         if (0 < num_buckets) {
@@ -1492,6 +1684,7 @@ CF_PRIVATE size_t CFBasicHashGetSize(CFConstBasicHashRef ht, Boolean total) {
             if (ht->bits.keys_offset) size += malloc_size(__CFBasicHashGetKeys(ht));
             if (ht->bits.counts_offset) size += malloc_size(__CFBasicHashGetCounts(ht));
             if (__CFBasicHashHasHashCache(ht)) size += malloc_size(__CFBasicHashGetHashes(ht));
+            if (ht->bits.control_offset) size += malloc_size(__CFBasicHashGetControls(ht));
         }
     }
     return size;
@@ -1600,11 +1793,12 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreate(CFAllocatorRef allocator, CFOptionFl
     if (flags & kCFBasicHashHasKeys) size += sizeof(CFBasicHashValue *); // keys
     if (flags & kCFBasicHashHasCounts) size += sizeof(void *); // counts
     if (flags & kCFBasicHashHasHashCache) size += sizeof(uintptr_t *); // hashes
+    if (flags & kCFBasicHashGroupHashing) size += sizeof(uint8_t *); // controls
     CFBasicHashRef ht = (CFBasicHashRef)_CFRuntimeCreateInstance(allocator, CFBasicHashGetTypeID(), size, NULL);
     if (NULL == ht) return NULL;
 
     ht->bits.finalized = 0;
-    ht->bits.hash_style = (flags >> 13) & 0x3;
+    ht->bits.hash_style = (flags & kCFBasicHashGroupHashing) ? __kCFBasicHashGroupHashingValue : ((flags >> 13) & 0x3);
     ht->bits.fast_grow = (flags & kCFBasicHashAggressiveGrowth) ? 1 : 0;
     ht->bits.counts_width = 0;
     ht->bits.strong_values = (flags & kCFBasicHashStrongValues) ? 1 : 0;
@@ -1633,6 +1827,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreate(CFAllocatorRef allocator, CFOptionFl
     ht->bits.keys_offset = (flags & kCFBasicHashHasKeys) ? offset++ : 0;
     ht->bits.counts_offset = (flags & kCFBasicHashHasCounts) ? offset++ : 0;
     ht->bits.hashes_offset = (flags & kCFBasicHashHasHashCache) ? offset++ : 0;
+    ht->bits.control_offset = (flags & kCFBasicHashGroupHashing) ? offset++ : 0;
 
 #if DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI
     ht->bits.hashes_offset = 0;
@@ -1674,6 +1869,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     CFBasicHashValue *new_values = NULL, *new_keys = NULL;
     void *new_counts = NULL;
     uintptr_t *new_hashes = NULL;
+    uint8_t *new_controls = NULL;
 
     if (0 < new_num_buckets) {
         Boolean strongValues = CFBasicHashHasStrongValues(src_ht) && !(kCFUseCollectableAllocator && !CF_IS_COLLECTABLE_ALLOCATOR(allocator));
@@ -1696,6 +1892,11 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
             if (!new_hashes) return NULL; // in this unusual circumstance, leak previously allocated blocks for now
             __SetLastAllocationEventName(new_hashes, "CFBasicHash (hash-store)");
         }
+        if (src_ht->bits.control_offset) {
+            new_controls = (uint8_t *)__CFBasicHashAllocateMemory2(allocator, new_num_buckets + __CFBasicHashGroupWidth, 1, false, false);
+            if (!new_controls) return NULL; // in this unusual circumstance, leak previously allocated blocks for now
+            __SetLastAllocationEventName(new_controls, "CFBasicHash (control-store)");
+        }
     }
 
     CFBasicHashRef ht = (CFBasicHashRef)_CFRuntimeCreateInstance(allocator, CFBasicHashGetTypeID(), size, NULL);
@@ -1725,6 +1926,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     CFBasicHashValue *old_values = NULL, *old_keys = NULL;
     void *old_counts = NULL;
     uintptr_t *old_hashes = NULL;
+    uint8_t *old_controls = NULL;
 
     old_values = __CFBasicHashGetValues(src_ht);
     if (src_ht->bits.keys_offset) {
@@ -1736,6 +1938,9 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     if (__CFBasicHashHasHashCache(src_ht)) {
         old_hashes = __CFBasicHashGetHashes(src_ht);
     }
+    if (src_ht->bits.control_offset) {
+        old_controls = __CFBasicHashGetControls(src_ht);
+    }
 
     __CFBasicHashSetValues(ht, new_values);
     if (new_keys) {
@@ -1747,6 +1952,9 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     if (new_hashes) {
         __CFBasicHashSetHashes(ht, new_hashes);
     }
+    if (new_controls) {
+        __CFBasicHashSetControls(ht, new_controls);
+    }
 
     for (CFIndex idx = 0; idx < new_num_buckets; idx++) {
         uintptr_t stack_value = old_values[idx].neutral;
@@ -1770,6 +1978,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     }
     if (new_counts) memmove(new_counts, old_counts, new_num_buckets * (1 << ht->bits.counts_width));
     if (new_hashes) memmove(new_hashes, old_hashes, new_num_buckets * sizeof(uintptr_t));
+    if (new_controls) memmove(new_controls, old_controls, new_num_buckets + __CFBasicHashGroupWidth);
 
 #if ENABLE_MEMORY_COUNTERS
     int64_t size_now = OSAtomicAdd64Barrier((int64_t) CFBasicHashGetSize(ht, true), & __CFBasicHashTotalSize);
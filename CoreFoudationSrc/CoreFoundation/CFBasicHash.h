@@ -42,6 +42,7 @@ enum {
     __kCFBasicHashLinearHashingValue = 1,
     __kCFBasicHashDoubleHashingValue = 2,
     __kCFBasicHashExponentialHashingValue = 3,
+    __kCFBasicHashGroupHashingValue = 4,
 };
 
 enum {
@@ -65,6 +66,8 @@ enum {
     kCFBasicHashExponentialHashing = (__kCFBasicHashExponentialHashingValue << 13),
 
     kCFBasicHashAggressiveGrowth = (1UL << 15),
+
+    kCFBasicHashGroupHashing = (1UL << 16), // overrides bits 13-14; probes 16 buckets at a time using a control byte per bucket
 };
 
 // Note that for a hash table without keys, the value is treated as the key,
@@ -124,6 +127,7 @@ void CFBasicHashApplyIndexed(CFConstBasicHashRef ht, CFRange range, Boolean (^bl
 void CFBasicHashGetElements(CFConstBasicHashRef ht, CFIndex bufferslen, uintptr_t *weak_values, uintptr_t *weak_keys);
 
 Boolean CFBasicHashAddValue(CFBasicHashRef ht, uintptr_t stack_key, uintptr_t stack_value);
+void CFBasicHashAddValues(CFBasicHashRef ht, CFIndex count, const uintptr_t *stack_keys, const uintptr_t *stack_values);
 void CFBasicHashReplaceValue(CFBasicHashRef ht, uintptr_t stack_key, uintptr_t stack_value);
 void CFBasicHashSetValue(CFBasicHashRef ht, uintptr_t stack_key, uintptr_t stack_value);
 CFIndex CFBasicHashRemoveValue(CFBasicHashRef ht, uintptr_t stack_key);
@@ -33,26 +33,18 @@
 
 
 // During rehashing of a mutable CFBasicHash, we know that there are no
-// deleted slots and the keys have already been uniqued. When rehashing,
-// if key_hash is non-0, we use it as the hash code.
+// deleted slots and the keys have already been uniqued. If key_hash is
+// non-0, we use it as the hash code.
 static
 #if FIND_BUCKET_FOR_REHASH
 CFIndex
 #else
 CFBasicHashBucket
 #endif
-FIND_BUCKET_NAME (CFConstBasicHashRef ht, uintptr_t stack_key
-#if FIND_BUCKET_FOR_REHASH
-, uintptr_t key_hash
-#endif
-) {
+FIND_BUCKET_NAME (CFConstBasicHashRef ht, uintptr_t stack_key, uintptr_t key_hash) {
     uint8_t num_buckets_idx = ht->bits.num_buckets_idx;
     uintptr_t num_buckets = __CFBasicHashTableSizes[num_buckets_idx];
-#if FIND_BUCKET_FOR_REHASH
     CFHashCode hash_code = key_hash ? key_hash : __CFBasicHashHashKey(ht, stack_key);
-#else
-    CFHashCode hash_code = __CFBasicHashHashKey(ht, stack_key);
-#endif
 
 #if FIND_BUCKET_HASH_STYLE == 1	// __kCFBasicHashLinearHashingValue
     // Linear probing, with c = 1
@@ -95,8 +87,100 @@ FIND_BUCKET_NAME (CFConstBasicHashRef ht, uintptr_t stack_key
 #endif
     if (0 == h2) h2 = num_buckets - 1;
     uintptr_t pr = __CFBasicHashPrimitiveRoots[num_buckets_idx];
+#elif FIND_BUCKET_HASH_STYLE == 4	// __kCFBasicHashGroupHashingValue
+    // Group probing: linear probing over groups of 16 buckets
+    // group[0] = the 16 buckets from h1(k)
+    // group[i] = the 16 buckets from (h1(k) + i * 16) mod num_buckets, i = 1 .. ceil(num_buckets / 16) - 1
+    // h1(k) = k mod num_buckets
+    // h2(k) = top 7 bits of k scrambled, kept in the control byte of the bucket holding k
+    // note: a group with an empty bucket ends the probe sequence, so deleted buckets stay marked
+#if defined(__arm__)
+    uintptr_t h1 = __CFBasicHashFold(hash_code, num_buckets_idx);
+#else
+    uintptr_t h1 = hash_code % num_buckets;
+#endif
+#if !FIND_BUCKET_FOR_REHASH
+    uint8_t h2 = __CFBasicHashControlFragment(hash_code);
+#endif
 #endif
 
+#if FIND_BUCKET_HASH_STYLE == 4	// __kCFBasicHashGroupHashingValue
+    COCOA_HASHTABLE_PROBING_START(ht, num_buckets);
+    CFBasicHashValue *keys = (ht->bits.keys_offset) ? __CFBasicHashGetKeys(ht) : __CFBasicHashGetValues(ht);
+#if !FIND_BUCKET_FOR_REHASH
+    uintptr_t *hashes = (__CFBasicHashHasHashCache(ht)) ? __CFBasicHashGetHashes(ht) : NULL;
+#endif
+    const uint8_t *controls = __CFBasicHashGetControls(ht);
+    CFIndex num_groups = (num_buckets + __CFBasicHashGroupWidth - 1) / __CFBasicHashGroupWidth;
+    CFIndex free_idx = kCFNotFound;
+    uintptr_t group = h1;
+    for (CFIndex idx = 0; idx < num_groups; idx++) {
+#if !FIND_BUCKET_FOR_REHASH
+        for (uint32_t match = __CFBasicHashGroupMatch(controls + group, h2); match; match &= match - 1) {
+            uintptr_t probe = group + __builtin_ctz(match);
+            if (num_buckets <= probe) {
+                probe = probe % num_buckets;
+            }
+            COCOA_HASHTABLE_PROBE_VALID(ht, probe);
+            uintptr_t curr_key = keys[probe].neutral;
+            if (__CFBasicHashSubABZero == curr_key) curr_key = 0UL;
+            if (__CFBasicHashSubABOne == curr_key) curr_key = ~0UL;
+#if FIND_BUCKET_FOR_INDIRECT_KEY
+            // curr_key holds the value coming in here
+            curr_key = __CFBasicHashGetIndirectKey(ht, curr_key);
+#endif
+            if (curr_key == stack_key || ((!hashes || hashes[probe] == hash_code) && __CFBasicHashTestEqualKey(ht, curr_key, stack_key))) {
+                COCOA_HASHTABLE_PROBING_END(ht, idx + 1);
+                CFBasicHashBucket result;
+                result.idx = probe;
+                result.weak_value = __CFBasicHashGetValue(ht, probe);
+                result.weak_key = curr_key;
+                result.count = (ht->bits.counts_offset) ? __CFBasicHashGetSlotCount(ht, probe) : 1;
+                return result;
+            }
+        }
+#endif
+        // the first empty or deleted bucket along the way is where an add goes
+        if (kCFNotFound == free_idx) {
+            uint32_t free_mask = __CFBasicHashGroupMatchFree(controls + group);
+            if (free_mask) {
+                free_idx = group + __builtin_ctz(free_mask);
+                if (num_buckets <= free_idx) {
+                    free_idx = free_idx % num_buckets;
+                }
+#if FIND_BUCKET_FOR_REHASH
+                // no deleted buckets during a rehash, so this is empty
+                COCOA_HASHTABLE_PROBE_EMPTY(ht, free_idx);
+                COCOA_HASHTABLE_PROBING_END(ht, idx + 1);
+                return free_idx;
+#endif
+            }
+        }
+#if !FIND_BUCKET_FOR_REHASH
+        if (__CFBasicHashGroupMatch(controls + group, __CFBasicHashControlEmpty)) {
+            COCOA_HASHTABLE_PROBE_EMPTY(ht, free_idx);
+            COCOA_HASHTABLE_PROBING_END(ht, idx + 1);
+            CFBasicHashBucket result;
+            result.idx = free_idx;
+            result.count = 0;
+            return result;
+        }
+#endif
+        group += __CFBasicHashGroupWidth;
+        if (num_buckets <= group) {
+            group = group % num_buckets;
+        }
+    }
+    COCOA_HASHTABLE_PROBING_END(ht, num_groups);
+#if FIND_BUCKET_FOR_REHASH
+    CFIndex result = free_idx;
+#else
+    CFBasicHashBucket result;
+    result.idx = free_idx;
+    result.count = 0;
+#endif
+    return result; // all buckets full or deleted, return first deleted element which was found
+#else
     COCOA_HASHTABLE_PROBING_START(ht, num_buckets);
     CFBasicHashValue *keys = (ht->bits.keys_offset) ? __CFBasicHashGetKeys(ht) : __CFBasicHashGetValues(ht);
 #if !FIND_BUCKET_FOR_REHASH
@@ -189,6 +273,7 @@ FIND_BUCKET_NAME (CFConstBasicHashRef ht, uintptr_t stack_key
     result.count = 0;
 #endif
     return result; // all buckets full or deleted, return first deleted element which was found
+#endif
 }
 
 #undef FIND_BUCKET_NAME
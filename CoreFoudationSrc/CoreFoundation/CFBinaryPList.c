@@ -39,12 +39,17 @@
 #include <CoreFoundation/CFByteOrder.h>
 #include <CoreFoundation/CFRuntime.h>
 #include <CoreFoundation/CFUUID.h>
+#include <CoreFoundation/CFPriv.h>
 #include <stdio.h>
 #include <limits.h>
 #include <string.h>
 #include "CFInternal.h"
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
 #include <CoreFoundation/CFStream.h>
+#include <dispatch/dispatch.h>
+#endif
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI || DEPLOYMENT_TARGET_LINUX
+#include <sys/mman.h>
 #endif
 
 typedef struct {
@@ -404,15 +409,31 @@ static void _appendString(__CFBinaryPlistWriteBuffer *buf, CFStringRef str) {
 
 CF_EXPORT CFNumberType _CFNumberGetType2(CFNumberRef number);
 
+// Which of the encodings below _appendNumber uses for num
+enum {
+    __kCFBinaryPlistNumberInt64,
+    __kCFBinaryPlistNumberInt128,
+    __kCFBinaryPlistNumberFloat32,
+    __kCFBinaryPlistNumberFloat64
+};
+
+CF_INLINE uint8_t _numberEncoding(CFNumberRef num) {
+    if (CFNumberIsFloatType(num)) {
+        return (CFNumberGetByteSize(num) <= (CFIndex)sizeof(float)) ? __kCFBinaryPlistNumberFloat32 : __kCFBinaryPlistNumberFloat64;
+    }
+    return (kCFNumberSInt128Type == _CFNumberGetType2(num)) ? __kCFBinaryPlistNumberInt128 : __kCFBinaryPlistNumberInt64;
+}
+
 static void _appendNumber(__CFBinaryPlistWriteBuffer *buf, CFNumberRef num) {
     uint8_t marker;
     uint64_t bigint;
     uint8_t *bytes;
     CFIndex nbytes;
-    if (CFNumberIsFloatType(num)) {
+    uint8_t encoding = _numberEncoding(num);
+    if (__kCFBinaryPlistNumberFloat32 == encoding || __kCFBinaryPlistNumberFloat64 == encoding) {
         CFSwappedFloat64 swapped64;
         CFSwappedFloat32 swapped32;
-        if (CFNumberGetByteSize(num) <= (CFIndex)sizeof(float)) {
+        if (__kCFBinaryPlistNumberFloat32 == encoding) {
 	    float v;
 	    CFNumberGetValue(num, kCFNumberFloat32Type, &v);
 	    swapped32 = CFConvertFloat32HostToSwapped(v);
@@ -430,8 +451,7 @@ static void _appendNumber(__CFBinaryPlistWriteBuffer *buf, CFNumberRef num) {
         bufferWrite(buf, &marker, 1);
         bufferWrite(buf, bytes, nbytes);
     } else {
-        CFNumberType type = _CFNumberGetType2(num);
-        if (kCFNumberSInt128Type == type) {
+        if (__kCFBinaryPlistNumberInt128 == encoding) {
 	    CFSInt128Struct s;
 	    CFNumberGetValue(num, kCFNumberSInt128Type, &s);
 	    struct {
@@ -452,9 +472,8 @@ static void _appendNumber(__CFBinaryPlistWriteBuffer *buf, CFNumberRef num) {
     }
 }
 
-static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFDictionaryRef objtable, uint32_t objRefSize) {
-    uint64_t refnum;
-    CFIndex idx2;
+// Writes the scalar types; dictionaries and arrays are written by _writeObject, after their contents
+static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj) {
     CFTypeID type = CFGetTypeID(obj);
 	if (stringtype == type) {
 	    _appendString(buf, (CFStringRef)obj);
@@ -477,60 +496,6 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
 	    bufferWrite(buf, &marker, 1);
 	    swapped = CFConvertFloat64HostToSwapped(CFDateGetAbsoluteTime((CFDateRef)obj));
 	    bufferWrite(buf, (uint8_t *)&swapped, sizeof(swapped));
-	} else if (dicttype == type) {
-            CFIndex count = CFDictionaryGetCount((CFDictionaryRef)obj);
-            uint8_t marker = (uint8_t)(kCFBinaryPlistMarkerDict | (count < 15 ? count : 0xf));
-            bufferWrite(buf, &marker, 1);
-            if (15 <= count) {
-                _appendInt(buf, (uint64_t)count);
-            }
-            CFPropertyListRef *list, buffer[512];
-            list = (count <= 256) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
-            CFDictionaryGetKeysAndValues((CFDictionaryRef)obj, list, list + count);
-            for (idx2 = 0; idx2 < 2 * count; idx2++) {
-		CFPropertyListRef value = list[idx2];
-		if (objtable) {
-		    uint32_t swapped = 0;
-		    uint8_t *source = (uint8_t *)&swapped;
-		    refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, value);
-		    swapped = CFSwapInt32HostToBig((uint32_t)refnum);
-		    bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize);
-		} else {
-		    Boolean ret = _appendObject(buf, value, objtable, objRefSize);
-		    if (!ret) {
-			if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
-			return false;
-		    }
-		}
-            }
-            if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
-	} else if (arraytype == type) {
-	    CFIndex count = CFArrayGetCount((CFArrayRef)obj);
-	    CFPropertyListRef *list, buffer[256];
-	    uint8_t marker = (uint8_t)(kCFBinaryPlistMarkerArray | (count < 15 ? count : 0xf));
-	    bufferWrite(buf, &marker, 1);
-	    if (15 <= count) {
-		_appendInt(buf, (uint64_t)count);
-	    }
-	    list = (count <= 256) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
-	    CFArrayGetValues((CFArrayRef)obj, CFRangeMake(0, count), list);
-	    for (idx2 = 0; idx2 < count; idx2++) {
-		CFPropertyListRef value = list[idx2];
-		if (objtable) {
-		    uint32_t swapped = 0;
-		    uint8_t *source = (uint8_t *)&swapped;
-		    refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, value);
-		    swapped = CFSwapInt32HostToBig((uint32_t)refnum);
-		    bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize);
-		} else {
-		    Boolean ret = _appendObject(buf, value, objtable, objRefSize);
-		    if (!ret) {
-			if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
-			return false;
-		    }
-		}
-	    }
-	    if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
 	} else if (_CFKeyedArchiverUIDGetTypeID() == type) {
 	    _appendUID(buf, (CFKeyedArchiverUIDRef)obj);
 	} else {
@@ -539,49 +504,179 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
     return true;
 }
 
-static void _flattenPlist(CFPropertyListRef plist, CFMutableArrayRef objlist, CFMutableDictionaryRef objtable, CFMutableSetRef uniquingset) {
-    CFPropertyListRef unique;
+// count is the number of entries for a dictionary, which has twice as many refs
+static void _appendCollection(__CFBinaryPlistWriteBuffer *buf, uint8_t marker, CFIndex count, const uint32_t *refs, CFIndex refCount, uint32_t objRefSize) {
+    marker = (uint8_t)(marker | (count < 15 ? count : 0xf));
+    bufferWrite(buf, &marker, 1);
+    if (15 <= count) {
+	_appendInt(buf, (uint64_t)count);
+    }
+    for (CFIndex idx = 0; idx < refCount; idx++) {
+	uint32_t swapped = CFSwapInt32HostToBig(refs[idx]);
+	uint8_t *source = (uint8_t *)&swapped;
+	bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize);
+    }
+}
+
+// Returns the keys then the values of a dictionary, or the values of an array, in buffer
+// if they fit, else in an allocated list
+static CFIndex _getContents(CFPropertyListRef plist, CFTypeID type, CFPropertyListRef *buffer, CFIndex bufferCount, CFPropertyListRef **list) {
+    if (dicttype == type) {
+	CFIndex count = CFDictionaryGetCount((CFDictionaryRef)plist);
+	*list = (2 * count <= bufferCount) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
+	CFDictionaryGetKeysAndValues((CFDictionaryRef)plist, *list, *list + count);
+	return 2 * count;
+    }
+    CFIndex count = CFArrayGetCount((CFArrayRef)plist);
+    *list = (count <= bufferCount) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
+    CFArrayGetValues((CFArrayRef)plist, CFRangeMake(0, count), *list);
+    return count;
+}
+
+#define __kCFBinaryPlistRefUnassigned	UINT32_MAX
+
+typedef struct {
+    CFTypeRef obj;
+    uint32_t hash;
     uint32_t refnum;
+} __CFBinaryPlistObjTableEntry;
+
+// Open addressed table from the objects of the plist being written to their refs; this
+// replaces the CFArray, CFDictionary and CFSet the writer used to build. Strings, numbers,
+// dates and data are uniqued by value, everything else by identity.
+typedef struct {
+    __CFBinaryPlistObjTableEntry *entries;
+    CFIndex mask;
+    CFIndex count;
+} __CFBinaryPlistObjTable;
+
+CF_INLINE Boolean _isUniquedByValue(CFTypeID type) {
+    return (stringtype == type || numbertype == type || datetype == type || datatype == type);
+}
+
+static uint32_t _objTableHash(CFTypeRef obj, CFTypeID type) {
+    uint64_t h = _isUniquedByValue(type) ? (uint64_t)CFHash(obj) + type : (uint64_t)(uintptr_t)obj;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32);
+}
+
+CF_INLINE Boolean _objTableEqual(CFTypeRef obj1, CFTypeRef obj2, CFTypeID type) {
+    if (obj1 == obj2) return true;
+    if (!_isUniquedByValue(type) || CFGetTypeID(obj2) != type) return false;
+    // CFEqual finds 1 and 1.0, or a float and a double of the same value, equal, but they are written differently
+    if (numbertype == type && _numberEncoding((CFNumberRef)obj1) != _numberEncoding((CFNumberRef)obj2)) return false;
+    return CFEqual(obj1, obj2);
+}
+
+static void _objTableInit(__CFBinaryPlistObjTable *table, uint64_t estimate) {
+    CFIndex capacity = 64;
+    while ((uint64_t)capacity < 2 * estimate && capacity < (1L << 28)) capacity *= 2;
+    table->entries = (__CFBinaryPlistObjTableEntry *)CFAllocatorAllocate(kCFAllocatorSystemDefault, capacity * sizeof(__CFBinaryPlistObjTableEntry), 0);
+    memset(table->entries, 0, capacity * sizeof(__CFBinaryPlistObjTableEntry));
+    table->mask = capacity - 1;
+    table->count = 0;
+}
+
+static __CFBinaryPlistObjTableEntry *_objTableFind(__CFBinaryPlistObjTable *table, CFTypeRef obj, CFTypeID type, uint32_t hash) {
+    CFIndex idx = hash & table->mask;
+    for (;;) {
+	__CFBinaryPlistObjTableEntry *entry = table->entries + idx;
+	if (!entry->obj || (entry->hash == hash && _objTableEqual(obj, entry->obj, type))) return entry;
+	idx = (idx + 1) & table->mask;
+    }
+}
+
+static void _objTableGrow(__CFBinaryPlistObjTable *table) {
+    __CFBinaryPlistObjTableEntry *old = table->entries;
+    CFIndex oldCapacity = table->mask + 1, capacity = 2 * oldCapacity;
+    table->entries = (__CFBinaryPlistObjTableEntry *)CFAllocatorAllocate(kCFAllocatorSystemDefault, capacity * sizeof(__CFBinaryPlistObjTableEntry), 0);
+    memset(table->entries, 0, capacity * sizeof(__CFBinaryPlistObjTableEntry));
+    table->mask = capacity - 1;
+    for (CFIndex idx = 0; idx < oldCapacity; idx++) {
+	if (!old[idx].obj) continue;
+	CFIndex newIdx = old[idx].hash & table->mask;
+	while (table->entries[newIdx].obj) newIdx = (newIdx + 1) & table->mask;
+	table->entries[newIdx] = old[idx];
+    }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, old);
+}
+
+// Returns false if obj, or an object equal to it, was already in the table
+static Boolean _objTableAdd(__CFBinaryPlistObjTable *table, CFTypeRef obj, CFTypeID type) {
+    uint32_t hash = _objTableHash(obj, type);
+    __CFBinaryPlistObjTableEntry *entry = _objTableFind(table, obj, type, hash);
+    if (entry->obj) return false;
+    entry->obj = obj;
+    entry->hash = hash;
+    entry->refnum = __kCFBinaryPlistRefUnassigned;
+    table->count++;
+    if (table->mask + 1 < 2 * table->count) _objTableGrow(table);
+    return true;
+}
+
+// First pass: counts the objects to be written, which fixes the size of object refs
+static void _countObjects(CFPropertyListRef plist, __CFBinaryPlistObjTable *table, uint64_t *count) {
     CFTypeID type = CFGetTypeID(plist);
-    CFIndex idx;
-    CFPropertyListRef *list, buffer[256];
+    if (table && !_objTableAdd(table, plist, type)) return;
+    (*count)++;
+    if (dicttype == type || arraytype == type) {
+	CFPropertyListRef *list, buffer[256];
+	CFIndex cnt = _getContents(plist, type, buffer, 256, &list);
+	for (CFIndex idx = 0; idx < cnt; idx++) {
+	    _countObjects(list[idx], table, count);
+	}
+	if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
+    }
+}
 
-    // Do not unique dictionaries or arrays, because: they
-    // are slow to compare, and have poor hash codes.
-    // Uniquing bools is unnecessary.
-    if (stringtype == type || numbertype == type || datetype == type || datatype == type) {
-	CFIndex before = CFSetGetCount(uniquingset);
-	CFSetAddValue(uniquingset, plist);
-	CFIndex after = CFSetGetCount(uniquingset);
-	if (after == before) {	// already in set
-	    unique = CFSetGetValue(uniquingset, plist);
-	    if (unique != plist) {
-		refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, unique);
-		CFDictionaryAddValue(objtable, plist, (const void *)(uintptr_t)refnum);
-	    }
-	    return;
+typedef struct {
+    __CFBinaryPlistWriteBuffer *buf;
+    __CFBinaryPlistObjTable *table;	// NULL when not uniquing
+    uint64_t *offsets;
+    uint32_t nextRef;
+    uint32_t objRefSize;
+} __CFBinaryPlistWriter;
+
+// Second pass: writes each object once, after its contents, so that the refs of the
+// contents are known and the objects can go straight to the stream
+static Boolean _writeObject(__CFBinaryPlistWriter *writer, CFPropertyListRef plist, uint32_t *refnum) {
+    CFTypeID type = CFGetTypeID(plist);
+    __CFBinaryPlistObjTableEntry *entry = NULL;
+    if (writer->table) {
+	entry = _objTableFind(writer->table, plist, type, _objTableHash(plist, type));
+	if (__kCFBinaryPlistRefUnassigned != entry->refnum) {
+	    *refnum = entry->refnum;
+	    return true;
 	}
     }
-    refnum = CFArrayGetCount(objlist);
-    CFArrayAppendValue(objlist, plist);
-    CFDictionaryAddValue(objtable, plist, (const void *)(uintptr_t)refnum);
-    if (dicttype == type) {
-	CFIndex count = CFDictionaryGetCount((CFDictionaryRef)plist);
-	list = (count <= 128) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
-        CFDictionaryGetKeysAndValues((CFDictionaryRef)plist, list, list + count);
-        for (idx = 0; idx < 2 * count; idx++) {
-            _flattenPlist(list[idx], objlist, objtable, uniquingset);
-        }
-        if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
-    } else if (arraytype == type) {
-	CFIndex count = CFArrayGetCount((CFArrayRef)plist);
-	list = (count <= 256) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
-        CFArrayGetValues((CFArrayRef)plist, CFRangeMake(0, count), list);
-        for (idx = 0; idx < count; idx++) {
-            _flattenPlist(list[idx], objlist, objtable, uniquingset);
-        }
-        if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
+    if (dicttype == type || arraytype == type) {
+	CFPropertyListRef *list, buffer[128];
+	uint32_t *refs, refbuffer[128];
+	CFIndex cnt = _getContents(plist, type, buffer, 128, &list);
+	refs = (cnt <= 128) ? refbuffer : (uint32_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, cnt * sizeof(uint32_t), 0);
+	Boolean success = true;
+	for (CFIndex idx = 0; success && idx < cnt; idx++) {
+	    success = _writeObject(writer, list[idx], refs + idx);
+	}
+	if (success) {
+	    *refnum = writer->nextRef++;
+	    writer->offsets[*refnum] = writer->buf->written + writer->buf->used;
+	    if (dicttype == type) {
+		_appendCollection(writer->buf, kCFBinaryPlistMarkerDict, cnt / 2, refs, cnt, writer->objRefSize);
+	    } else {
+		_appendCollection(writer->buf, kCFBinaryPlistMarkerArray, cnt, refs, cnt, writer->objRefSize);
+	    }
+	}
+	if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
+	if (refs != refbuffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, refs);
+	if (!success) return false;
+    } else {
+	*refnum = writer->nextRef++;
+	writer->offsets[*refnum] = writer->buf->written + writer->buf->used;
+	if (!_appendObject(writer->buf, plist)) return false;
     }
+    if (entry) entry->refnum = *refnum;
+    return true;
 }
 
 /* Get the number of bytes required to hold the value in 'count'. Will return a power of 2 value big enough to hold 'count'.
@@ -606,39 +701,25 @@ CF_INLINE uint8_t _byteCount(uint64_t count) {
 }
 
 // stream can be a CFWriteStreamRef (on supported platforms) or a CFMutableDataRef
-/* Write a property list to a stream, in binary format. plist is the property list to write (one of the basic property list types), stream is the destination of the property list, and estimate is a best-guess at the total number of objects in the property list. The estimate parameter is for efficiency in pre-allocating memory for the uniquing step. Pass in a 0 if no estimate is available. The options flag specifies sort options. If the error parameter is non-NULL and an error occurs, it will be used to return a CFError explaining the problem. It is the callers responsibility to release the error. */
+/* Write a property list to a stream, in binary format. plist is the property list to write (one of the basic property list types), stream is the destination of the property list, and estimate is a best-guess at the total number of objects in the property list. The estimate parameter is for efficiency in pre-allocating memory for the uniquing step. Pass in a 0 if no estimate is available. The options flag may include kCFBinaryPlistWriteSkipUniquing. If the error parameter is non-NULL and an error occurs, it will be used to return a CFError explaining the problem. It is the callers responsibility to release the error. */
 CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options, CFErrorRef *error) {
-    CFMutableDictionaryRef objtable = NULL;
-    CFMutableArrayRef objlist = NULL;
-    CFMutableSetRef uniquingset = NULL;
+    __CFBinaryPlistObjTable table;
+    __CFBinaryPlistWriter writer;
     CFBinaryPlistTrailer trailer;
     uint64_t *offsets, length_so_far;
-    int64_t idx, cnt;
+    uint64_t idx, cnt = 0;
+    uint32_t topRef;
     __CFBinaryPlistWriteBuffer *buf;
     
     initStatics();
 
-    const CFDictionaryKeyCallBacks dictKeyCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0, 0};
-    objtable = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &dictKeyCallbacks, NULL);
-    
-    const CFArrayCallBacks arrayCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0};
-    objlist = CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &arrayCallbacks);
-    
-    
-    const CFSetCallBacks setCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0, 0};
-    uniquingset = CFSetCreateMutable(kCFAllocatorSystemDefault, 0, &setCallbacks);
-
-#if DEPLOYMENT_TARGET_MACOSX
-    _CFDictionarySetCapacity(objtable, estimate ? estimate : 650);
-    _CFArraySetCapacity(objlist, estimate ? estimate : 650);
-    _CFSetSetCapacity(uniquingset, estimate ? estimate : 1000);
-#endif
-
-    _flattenPlist(plist, objlist, objtable, uniquingset);
+    writer.table = NULL;
+    if (!(options & kCFBinaryPlistWriteSkipUniquing)) {
+	_objTableInit(&table, estimate ? estimate : 650);
+	writer.table = &table;
+    }
+    _countObjects(plist, writer.table, &cnt);
 
-    CFRelease(uniquingset);
-    
-    cnt = CFArrayGetCount(objlist);
     offsets = (uint64_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, (CFIndex)(cnt * sizeof(*offsets)), 0);
 
     buf = (__CFBinaryPlistWriteBuffer *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFBinaryPlistWriteBuffer), 0);
@@ -653,29 +734,27 @@ CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t
 
     memset(&trailer, 0, sizeof(trailer));
     trailer._numObjects = CFSwapInt64HostToBig(cnt);
-    trailer._topObject = 0;	// true for this implementation
-    trailer._objectRefSize = _byteCount(cnt);    
-    for (idx = 0; idx < cnt; idx++) {
-	offsets[idx] = buf->written + buf->used;
-	CFPropertyListRef obj = CFArrayGetValueAtIndex(objlist, (CFIndex)idx);
-	Boolean success = _appendObject(buf, obj, objtable, trailer._objectRefSize);
-	if (!success) {
-	    CFRelease(objtable);
-	    CFRelease(objlist);
-	    if (error && buf->error) {
-		// caller will release error
-		*error = buf->error;
-	    } else if (buf->error) {
-		// caller is not interested in error, release it here
-		CFRelease(buf->error);
-	    }
-	    CFAllocatorDeallocate(kCFAllocatorSystemDefault, buf);
-            CFAllocatorDeallocate(kCFAllocatorSystemDefault, offsets);
-	    return 0;
+    trailer._objectRefSize = _byteCount(cnt);
+    writer.buf = buf;
+    writer.offsets = offsets;
+    writer.nextRef = 0;
+    writer.objRefSize = trailer._objectRefSize;
+    Boolean success = _writeObject(&writer, plist, &topRef);
+    if (writer.table) CFAllocatorDeallocate(kCFAllocatorSystemDefault, table.entries);
+    if (!success) {
+	if (error && buf->error) {
+	    // caller will release error
+	    *error = buf->error;
+	} else if (buf->error) {
+	    // caller is not interested in error, release it here
+	    CFRelease(buf->error);
 	}
+	CFAllocatorDeallocate(kCFAllocatorSystemDefault, buf);
+	CFAllocatorDeallocate(kCFAllocatorSystemDefault, offsets);
+	return 0;
     }
-    CFRelease(objtable);
-    CFRelease(objlist);
+    // the top object is written last
+    trailer._topObject = CFSwapInt64HostToBig(topRef);
     
     length_so_far = buf->written + buf->used;
     trailer._offsetTableOffset = CFSwapInt64HostToBig(length_so_far);
@@ -756,11 +835,10 @@ CF_INLINE uint64_t _getSizedInt(const uint8_t *data, uint8_t valSize) {
     return res;
 }
 
-bool __CFBinaryPlistGetTopLevelInfo(const uint8_t *databytes, uint64_t datalen, uint8_t *marker, uint64_t *offset, CFBinaryPlistTrailer *trailer) {
+// Reads and checks the trailer, and that the offset table lies inside the data; the offsets in the table are not checked
+static bool _readTrailer(const uint8_t *databytes, uint64_t datalen, CFBinaryPlistTrailer *trailer) {
     CFBinaryPlistTrailer trail;
 
-    initStatics();
-
     if (!databytes || datalen < sizeof(trail) + 8 + 1) FAIL_FALSE;
     // Tiger and earlier will parse "bplist00"
     // Leopard will parse "bplist00" or "bplist01"
@@ -828,6 +906,16 @@ bool __CFBinaryPlistGetTopLevelInfo(const uint8_t *databytes, uint64_t datalen,
     if (CF_NO_ERROR != err) FAIL_FALSE;
     (void)check_ptr_add(offsetsFirstByte, offsetTableSize - 1, &err);
     if (CF_NO_ERROR != err) FAIL_FALSE;
+    *trailer = trail;
+    return true;
+}
+
+bool __CFBinaryPlistGetTopLevelInfo(const uint8_t *databytes, uint64_t datalen, uint8_t *marker, uint64_t *offset, CFBinaryPlistTrailer *trailer) {
+    CFBinaryPlistTrailer trail;
+
+    initStatics();
+
+    if (!_readTrailer(databytes, datalen, &trail)) FAIL_FALSE;
 
     const uint8_t *bytesptr = databytes + trail._offsetTableOffset;
     uint64_t maxOffset = trail._offsetTableOffset - 1;
@@ -997,6 +1085,8 @@ bool __CFBinaryPlistGetOffsetForValueFromDictionary3(const uint8_t *databytes, u
     // Perform linear search of the keys
     for (CFIndex idx = 0; idx < cnt; idx++) {
 	off = _getOffsetOfRefAt(databytes, ptr, trailer);
+	// the lazy reader does not check the whole offset table up front
+	if (off < objectsRangeStart || objectsRangeEnd < off) FAIL_FALSE;
 	marker = *(databytes + off);
 	// if it is an ASCII string in the data, then we do a memcmp. If the key isn't ASCII, then it won't pass the compare, unless it hits some odd edge case of the ASCII string actually containing the unicode escape sequence.
 	if (keyBufferPtr && (marker & 0xf0) == kCFBinaryPlistMarkerASCIIString) {
@@ -1055,6 +1145,8 @@ bool __CFBinaryPlistGetOffsetForValueFromDictionary3(const uint8_t *databytes, u
 
 extern CFDictionaryRef __CFDictionaryCreateTransfer(CFAllocatorRef allocator, const void * *klist, const void * *vlist, CFIndex numValues);
 extern CFSetRef __CFSetCreateTransfer(CFAllocatorRef allocator, const void * *klist, CFIndex numValues);
+extern void __CFDictionaryAddValues(CFMutableDictionaryRef dict, const void * *klist, const void * *vlist, CFIndex numValues);
+extern void __CFSetAddValues(CFMutableSetRef set, const void * *klist, CFIndex numValues);
 extern CFArrayRef __CFArrayCreateTransfer(CFAllocatorRef allocator, const void * *klist, CFIndex numValues);
 CF_PRIVATE void __CFPropertyListCreateSplitKeypaths(CFAllocatorRef allocator, CFSetRef currentKeys, CFSetRef *theseKeys, CFSetRef *nextKeys);
 
@@ -1406,9 +1498,7 @@ CF_PRIVATE bool __CFBinaryPlistCreateObjectFiltered(const uint8_t *databytes, ui
             } else {
                 if (mutabilityOption != kCFPropertyListImmutable) {
                     *plist = CFSetCreateMutable(allocator, 0, &kCFTypeSetCallBacks);
-                    for (CFIndex idx = 0; idx < arrayCount; idx++) {
-                        CFSetAddValue((CFMutableSetRef)*plist, list[idx]);
-                    }
+                    __CFSetAddValues((CFMutableSetRef)*plist, list, arrayCount);
                     for (CFIndex idx = 0; idx < arrayCount; idx++) {
                         CFRelease(list[idx]);
                     }
@@ -1524,9 +1614,7 @@ CF_PRIVATE bool __CFBinaryPlistCreateObjectFiltered(const uint8_t *databytes, ui
             }            
             if (mutabilityOption != kCFPropertyListImmutable) {
                 *plist = CFDictionaryCreateMutable(allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
-                for (CFIndex idx = 0; idx < dictionaryCount / 2; idx++) {
-                    CFDictionaryAddValue((CFMutableDictionaryRef)*plist, list[idx], list[idx + dictionaryCount / 2]);
-                }
+                __CFDictionaryAddValues((CFMutableDictionaryRef)*plist, list, list + dictionaryCount / 2, dictionaryCount / 2);
                 for (CFIndex idx = 0; idx < dictionaryCount; idx++) {
                     CFRelease(list[idx]);
                 }
@@ -1561,12 +1649,66 @@ bool __CFBinaryPlistCreateObject(const uint8_t *databytes, uint64_t datalen, uin
     return __CFBinaryPlistCreateObjectFiltered(databytes, datalen, startOffset, trailer, allocator, mutabilityOption, objects, NULL, 0, NULL, plist);
 }
 
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
+#define __kCFBinaryPlistConcurrentMinObjects	8192
+#define __kCFBinaryPlistConcurrentChunk		2048
+
+// The objects which __CFBinaryPlistCreateObjectFiltered puts in its objects cache and which hold no refs
+CF_INLINE Boolean _isCachedLeaf(uint8_t marker, CFOptionFlags mutabilityOption) {
+    switch (marker & 0xf0) {
+    case kCFBinaryPlistMarkerInt:
+    case kCFBinaryPlistMarkerReal:
+    case kCFBinaryPlistMarkerDate & 0xf0:
+    case kCFBinaryPlistMarkerUID:
+	return true;
+    case kCFBinaryPlistMarkerData:
+    case kCFBinaryPlistMarkerASCIIString:
+    case kCFBinaryPlistMarkerUnicode16String:
+	return (mutabilityOption != kCFPropertyListMutableContainersAndLeaves);
+    }
+    return false;
+}
+
+// Decodes the leaves in the offset table on several threads and seeds objects with them, so that
+// the serial decode after it only has to put the containers together. Leaves which that decode would
+// not cache, or which fail, are left to it, so the result and any failure are the same either way.
+static void __CFBinaryPlistDecodeLeavesConcurrently(const uint8_t *databytes, uint64_t datalen, const CFBinaryPlistTrailer *trailer, CFAllocatorRef allocator, CFOptionFlags mutabilityOption, CFMutableDictionaryRef objects) {
+    uint64_t numObjects = trailer->_numObjects;
+    const uint8_t *offsetTable = databytes + trailer->_offsetTableOffset;
+    uint8_t offsetIntSize = trailer->_offsetIntSize;
+    CFPropertyListRef *leaves = (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, numObjects * sizeof(CFPropertyListRef), 0);
+    if (!leaves) return;
+    size_t chunks = (numObjects + __kCFBinaryPlistConcurrentChunk - 1) / __kCFBinaryPlistConcurrentChunk;
+    dispatch_apply(chunks, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t chunk) {
+        // offsets were all checked by __CFBinaryPlistGetTopLevelInfo
+        uint64_t idx = chunk * __kCFBinaryPlistConcurrentChunk, lim = __CFMin(idx + __kCFBinaryPlistConcurrentChunk, numObjects);
+        for (; idx < lim; idx++) {
+            uint64_t off = _getSizedInt(offsetTable + idx * offsetIntSize, offsetIntSize);
+            CFPropertyListRef pl = NULL;
+            if (!_isCachedLeaf(databytes[off], mutabilityOption) || !__CFBinaryPlistCreateObjectFiltered(databytes, datalen, off, trailer, allocator, mutabilityOption, NULL, NULL, 0, NULL, &pl)) {
+                pl = NULL;
+            }
+            leaves[idx] = pl;
+        }
+    });
+    for (uint64_t idx = 0; idx < numObjects; idx++) {
+        if (!leaves[idx]) continue;
+        uint64_t off = _getSizedInt(offsetTable + idx * offsetIntSize, offsetIntSize);
+        CFDictionarySetValue(objects, (const void *)(uintptr_t)off, leaves[idx]);
+        CFRelease(leaves[idx]);
+    }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, leaves);
+}
+#endif
+
 CF_PRIVATE bool __CFTryParseBinaryPlist(CFAllocatorRef allocator, CFDataRef data, CFOptionFlags option, CFPropertyListRef *plist, CFStringRef *errorString) {
     uint8_t marker;    
     CFBinaryPlistTrailer trailer;
     uint64_t offset;
     const uint8_t *databytes = CFDataGetBytePtr(data);
     uint64_t datalen = CFDataGetLength(data);
+    Boolean concurrently = (option & _kCFPropertyListDecodeConcurrently) ? true : false;
+    option &= ~_kCFPropertyListDecodeConcurrently;
 
     if (8 <= datalen && __CFBinaryPlistGetTopLevelInfo(databytes, datalen, &marker, &offset, &trailer)) {
 	// FALSE: We know for binary plist parsing that the result objects will be retained
@@ -1577,6 +1719,11 @@ CF_PRIVATE bool __CFTryParseBinaryPlist(CFAllocatorRef allocator, CFDataRef data
 	// in the dictionary.
 	CFMutableDictionaryRef objects = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
 	_CFDictionarySetCapacity(objects, trailer._numObjects);
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
+	if (concurrently && __kCFBinaryPlistConcurrentMinObjects <= trailer._numObjects) {
+	    __CFBinaryPlistDecodeLeavesConcurrently(databytes, datalen, &trailer, allocator, option, objects);
+	}
+#endif
 	CFPropertyListRef pl = NULL;
         bool result = true;
         if (__CFBinaryPlistCreateObjectFiltered(databytes, datalen, offset, &trailer, allocator, option, objects, NULL, 0, NULL, &pl)) {
@@ -1605,3 +1752,327 @@ if (!CFEqual(pl, pl2)) CFLog(3, CFSTR("*** error: plists before and after are no
     FAIL_FALSE;
 }
 
+
+#pragma mark -
+#pragma mark Lazy reader
+
+// from CFUtilities.c
+CF_PRIVATE Boolean _CFReadMappedFromFile(CFStringRef path, Boolean map, Boolean uncached, void **outBytes, CFIndex *outLength, CFErrorRef *errorPtr);
+
+struct __CFBinaryPlistMap {
+    int32_t _rc;
+    CFAllocatorRef _allocator;
+    const uint8_t *_bytes;
+    uint64_t _length;
+    CFDataRef _data;		// when reading a CFData, which owns the bytes
+    Boolean _mapped;		// otherwise the bytes are munmap()'d, or else free()'d
+    uint64_t _topOffset;
+    CFBinaryPlistTrailer _trailer;
+};
+
+static void _releaseFileBytes(void *bytes, CFIndex length, Boolean mapped) {
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI || DEPLOYMENT_TARGET_LINUX
+    // an empty file is malloc()'d even when mapping is asked for
+    if (mapped && 0 < length) {
+        munmap(bytes, length);
+        return;
+    }
+#endif
+    free(bytes);
+}
+
+// Unlike __CFBinaryPlistGetTopLevelInfo, this doesn't read through the offset table; the
+// lazy reader checks each offset as it comes to it instead.
+static CFBinaryPlistMapRef __CFBinaryPlistMapCreate(CFAllocatorRef allocator, const uint8_t *databytes, uint64_t datalen) {
+    CFBinaryPlistTrailer trailer;
+    initStatics();
+    if (!_readTrailer(databytes, datalen, &trailer)) return NULL;
+    uint64_t off = _getSizedInt(databytes + trailer._offsetTableOffset + trailer._topObject * trailer._offsetIntSize, trailer._offsetIntSize);
+    if (off < 8 || trailer._offsetTableOffset <= off) return NULL;
+
+    allocator = allocator ? allocator : __CFGetDefaultAllocator();
+    CFBinaryPlistMapRef map = (CFBinaryPlistMapRef)CFAllocatorAllocate(allocator, sizeof(struct __CFBinaryPlistMap), 0);
+    if (!map) return NULL;
+    map->_rc = 1;
+    map->_allocator = (CFAllocatorRef)CFRetain(allocator);
+    map->_bytes = databytes;
+    map->_length = datalen;
+    map->_data = NULL;
+    map->_mapped = false;
+    map->_topOffset = off;
+    map->_trailer = trailer;
+    return map;
+}
+
+CFBinaryPlistMapRef __CFBinaryPlistMapCreateWithURL(CFAllocatorRef allocator, CFURLRef url, CFErrorRef *error) {
+    CFURLRef absoluteURL = CFURLCopyAbsoluteURL(url);
+#if DEPLOYMENT_TARGET_WINDOWS
+    CFStringRef path = CFURLCopyFileSystemPath(absoluteURL, kCFURLWindowsPathStyle);
+    Boolean mapped = false;
+#else
+    CFStringRef path = CFURLCopyFileSystemPath(absoluteURL, kCFURLPOSIXPathStyle);
+    Boolean mapped = true;
+#endif
+    CFRelease(absoluteURL);
+    if (!path) {
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("URL of binary property list has no file system path"));
+        return NULL;
+    }
+    void *bytes = NULL;
+    CFIndex length = 0;
+    Boolean success = _CFReadMappedFromFile(path, mapped, false, &bytes, &length, error);
+    CFRelease(path);
+    if (!success) return NULL;
+
+    CFBinaryPlistMapRef map = __CFBinaryPlistMapCreate(allocator, (const uint8_t *)bytes, length);
+    if (!map) {
+        _releaseFileBytes(bytes, length, mapped);
+        if (error) *error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Binary property list is corrupt"));
+        return NULL;
+    }
+    map->_mapped = mapped;
+    return map;
+}
+
+CFBinaryPlistMapRef __CFBinaryPlistMapCreateWithData(CFAllocatorRef allocator, CFDataRef data) {
+    CFBinaryPlistMapRef map = __CFBinaryPlistMapCreate(allocator, CFDataGetBytePtr(data), CFDataGetLength(data));
+    if (map) map->_data = (CFDataRef)CFRetain(data);
+    return map;
+}
+
+CFBinaryPlistMapRef __CFBinaryPlistMapRetain(CFBinaryPlistMapRef map) {
+    OSAtomicIncrement32Barrier(&map->_rc);
+    return map;
+}
+
+void __CFBinaryPlistMapRelease(CFBinaryPlistMapRef map) {
+    if (0 != OSAtomicDecrement32Barrier(&map->_rc)) return;
+    if (map->_data) {
+        CFRelease(map->_data);
+    } else {
+        _releaseFileBytes((void *)map->_bytes, (CFIndex)map->_length, map->_mapped);
+    }
+    CFAllocatorRef allocator = map->_allocator;
+    CFAllocatorDeallocate(allocator, map);
+    CFRelease(allocator);
+}
+
+CFBinaryPlistValue __CFBinaryPlistMapGetTopValue(CFBinaryPlistMapRef map) {
+    CFBinaryPlistValue value = {map, map->_topOffset};
+    return value;
+}
+
+// Checks that value is inside the object table and returns its marker byte; for data,
+// strings and collections, also their count and a pointer to their contents, which are
+// checked to be inside the object table too.
+static bool _readValueHeader(CFBinaryPlistValue value, uint8_t *outMarker, CFIndex *outCount, const uint8_t **outContents) {
+    CFBinaryPlistMapRef map = value._map;
+    if (!map) FAIL_FALSE;
+    const uint8_t *databytes = map->_bytes;
+    uint64_t objectsRangeStart = 8, objectsRangeEnd = map->_trailer._offsetTableOffset - 1;
+    if (value._offset < objectsRangeStart || objectsRangeEnd < value._offset) FAIL_FALSE;
+    const uint8_t *ptr = databytes + value._offset;
+    uint8_t marker = *ptr++;
+    *outMarker = marker;
+    uint64_t width;
+    switch (marker & 0xf0) {
+    case kCFBinaryPlistMarkerData:
+    case kCFBinaryPlistMarkerASCIIString:
+	width = 1;
+	break;
+    case kCFBinaryPlistMarkerUnicode16String:
+	width = 2;
+	break;
+    case kCFBinaryPlistMarkerArray:
+    case kCFBinaryPlistMarkerSet:
+	width = map->_trailer._objectRefSize;
+	break;
+    case kCFBinaryPlistMarkerDict:
+	width = 2 * map->_trailer._objectRefSize;
+	break;
+    default:
+	if (outCount) *outCount = -1;
+	if (outContents) *outContents = ptr;
+	return true;
+    }
+    uint64_t cnt = marker & 0x0f;
+    if (0xf == cnt) {
+	if (!_readInt(ptr, databytes + objectsRangeEnd, &cnt, &ptr)) FAIL_FALSE;
+	if (LONG_MAX < cnt) FAIL_FALSE;
+    }
+    int32_t err = CF_NO_ERROR;
+    size_t byte_cnt = check_size_t_mul(cnt, width, &err);
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    const uint8_t *extent = check_ptr_add(ptr, byte_cnt, &err) - 1;
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    if (0 < byte_cnt && databytes + objectsRangeEnd < extent) FAIL_FALSE;
+    if (outCount) *outCount = (CFIndex)cnt;
+    if (outContents) *outContents = ptr;
+    return true;
+}
+
+// Fixed-size scalars: checks that size bytes after the marker are inside the object table
+static const uint8_t *_getScalarBytes(CFBinaryPlistValue value, uint64_t size) {
+    const uint8_t *ptr;
+    uint8_t marker;
+    if (!_readValueHeader(value, &marker, NULL, &ptr)) return NULL;
+    int32_t err = CF_NO_ERROR;
+    const uint8_t *extent = check_ptr_add(ptr, size, &err) - 1;
+    if (CF_NO_ERROR != err) return NULL;
+    if (value._map->_bytes + value._map->_trailer._offsetTableOffset - 1 < extent) return NULL;
+    return ptr;
+}
+
+uint8_t __CFBinaryPlistValueGetMarker(CFBinaryPlistValue value) {
+    uint8_t marker;
+    if (!_readValueHeader(value, &marker, NULL, NULL)) return kCFBinaryPlistMarkerFill;
+    if (kCFBinaryPlistMarkerNull == (marker & 0xf0) || kCFBinaryPlistMarkerDate == marker) return marker;
+    return marker & 0xf0;
+}
+
+CFIndex __CFBinaryPlistValueGetCount(CFBinaryPlistValue value) {
+    uint8_t marker;
+    CFIndex cnt;
+    if (!_readValueHeader(value, &marker, &cnt, NULL)) return -1;
+    return cnt;
+}
+
+static bool _getValueForRefAt(CFBinaryPlistValue value, const uint8_t *refptr, CFBinaryPlistValue *result) {
+    uint64_t off = _getOffsetOfRefAt(value._map->_bytes, refptr, &value._map->_trailer);
+    // checked here rather than once for the whole offset table
+    if (off < 8 || value._map->_trailer._offsetTableOffset <= off) FAIL_FALSE;
+    if (result) {
+	result->_map = value._map;
+	result->_offset = off;
+    }
+    return true;
+}
+
+bool __CFBinaryPlistValueGetValueAtIndex(CFBinaryPlistValue value, CFIndex idx, CFBinaryPlistValue *element) {
+    uint8_t marker;
+    CFIndex cnt;
+    const uint8_t *ptr;
+    if (!_readValueHeader(value, &marker, &cnt, &ptr)) FAIL_FALSE;
+    if ((marker & 0xf0) != kCFBinaryPlistMarkerArray && (marker & 0xf0) != kCFBinaryPlistMarkerSet) FAIL_FALSE;
+    if (idx < 0 || cnt <= idx) FAIL_FALSE;
+    return _getValueForRefAt(value, ptr + idx * value._map->_trailer._objectRefSize, element);
+}
+
+bool __CFBinaryPlistValueGetKeyAndValueAtIndex(CFBinaryPlistValue value, CFIndex idx, CFBinaryPlistValue *key, CFBinaryPlistValue *element) {
+    uint8_t marker;
+    CFIndex cnt;
+    const uint8_t *ptr;
+    if (!_readValueHeader(value, &marker, &cnt, &ptr)) FAIL_FALSE;
+    if ((marker & 0xf0) != kCFBinaryPlistMarkerDict) FAIL_FALSE;
+    if (idx < 0 || cnt <= idx) FAIL_FALSE;
+    uint64_t refSize = value._map->_trailer._objectRefSize;
+    if (!_getValueForRefAt(value, ptr + idx * refSize, key)) FAIL_FALSE;
+    return _getValueForRefAt(value, ptr + (cnt + idx) * refSize, element);
+}
+
+bool __CFBinaryPlistValueGetValueForKey(CFBinaryPlistValue value, CFStringRef key, CFBinaryPlistValue *element) {
+    CFBinaryPlistMapRef map = value._map;
+    if (!map) FAIL_FALSE;
+    uint64_t voffset;
+    if (!__CFBinaryPlistGetOffsetForValueFromDictionary3(map->_bytes, map->_length, value._offset, &map->_trailer, (CFTypeRef)key, NULL, &voffset, false, NULL)) FAIL_FALSE;
+    if (voffset < 8 || map->_trailer._offsetTableOffset <= voffset) FAIL_FALSE;
+    if (element) {
+	element->_map = map;
+	element->_offset = voffset;
+    }
+    return true;
+}
+
+bool __CFBinaryPlistMapGetValueForKeyPath(CFBinaryPlistMapRef map, CFStringRef keyPath, CFBinaryPlistValue *value) {
+    if (!keyPath || CFStringGetLength(keyPath) == 0) FAIL_FALSE;
+    CFBinaryPlistValue current = __CFBinaryPlistMapGetTopValue(map);
+    bool success = true;
+    CFArrayRef keyPathArray = CFStringCreateArrayBySeparatingStrings(kCFAllocatorSystemDefault, keyPath, CFSTR(":"));
+    for (CFIndex i = 0; success && i < CFArrayGetCount(keyPathArray); i++) {
+	CFStringRef oneKey = (CFStringRef)CFArrayGetValueAtIndex(keyPathArray, i);
+	SInt32 intValue = CFStringGetIntValue(oneKey);
+	if ((intValue == 0 && CFStringCompare(CFSTR("0"), oneKey, 0) != kCFCompareEqualTo) || intValue == INT_MAX || intValue == INT_MIN || intValue < 0) {
+	    // Treat as a string key into a dictionary
+	    success = __CFBinaryPlistValueGetValueForKey(current, oneKey, &current);
+	} else {
+	    // Treat as integer index into an array
+	    success = __CFBinaryPlistValueGetValueAtIndex(current, intValue, &current);
+	}
+    }
+    CFRelease(keyPathArray);
+    if (success && value) *value = current;
+    return success;
+}
+
+bool __CFBinaryPlistValueGetBoolean(CFBinaryPlistValue value, Boolean *result) {
+    uint8_t marker;
+    if (!_readValueHeader(value, &marker, NULL, NULL)) FAIL_FALSE;
+    if (kCFBinaryPlistMarkerFalse != marker && kCFBinaryPlistMarkerTrue != marker) FAIL_FALSE;
+    if (result) *result = (kCFBinaryPlistMarkerTrue == marker);
+    return true;
+}
+
+bool __CFBinaryPlistValueGetInt64(CFBinaryPlistValue value, int64_t *result) {
+    uint8_t marker;
+    if (!_readValueHeader(value, &marker, NULL, NULL)) FAIL_FALSE;
+    if ((marker & 0xf0) != kCFBinaryPlistMarkerInt) FAIL_FALSE;
+    uint64_t cnt = 1 << (marker & 0x0f);
+    if (16 < cnt) FAIL_FALSE;
+    const uint8_t *ptr = _getScalarBytes(value, cnt);
+    if (!ptr) FAIL_FALSE;
+    // as in __CFBinaryPlistCreateObjectFiltered: 1, 2 and 4-byte integers are unsigned, 8-byte ones signed
+    if (result) *result = (int64_t)_getSizedInt(ptr, cnt);
+    return true;
+}
+
+bool __CFBinaryPlistValueGetFloat64(CFBinaryPlistValue value, double *result) {
+    uint8_t marker;
+    if (!_readValueHeader(value, &marker, NULL, NULL)) FAIL_FALSE;
+    if ((kCFBinaryPlistMarkerReal | 2) == marker) {
+	const uint8_t *ptr = _getScalarBytes(value, 4);
+	if (!ptr) FAIL_FALSE;
+	CFSwappedFloat32 swapped32;
+	memmove(&swapped32, ptr, 4);
+	if (result) *result = CFConvertFloat32SwappedToHost(swapped32);
+	return true;
+    }
+    if ((kCFBinaryPlistMarkerReal | 3) == marker || kCFBinaryPlistMarkerDate == marker) {
+	const uint8_t *ptr = _getScalarBytes(value, 8);
+	if (!ptr) FAIL_FALSE;
+	CFSwappedFloat64 swapped64;
+	memmove(&swapped64, ptr, 8);
+	if (result) *result = CFConvertFloat64SwappedToHost(swapped64);
+	return true;
+    }
+    FAIL_FALSE;
+}
+
+const uint8_t *__CFBinaryPlistValueGetBytePtr(CFBinaryPlistValue value, CFIndex *length) {
+    uint8_t marker;
+    CFIndex cnt;
+    const uint8_t *ptr;
+    if (!_readValueHeader(value, &marker, &cnt, &ptr)) return NULL;
+    switch (marker & 0xf0) {
+    case kCFBinaryPlistMarkerData:
+    case kCFBinaryPlistMarkerASCIIString:
+	if (length) *length = cnt;
+	return ptr;
+    case kCFBinaryPlistMarkerUnicode16String:
+	if (length) *length = cnt * 2;
+	return ptr;
+    }
+    return NULL;
+}
+
+CFPropertyListRef __CFBinaryPlistValueCreateObject(CFAllocatorRef allocator, CFBinaryPlistValue value, CFOptionFlags mutabilityOption) {
+    CFBinaryPlistMapRef map = value._map;
+    if (!map) return NULL;
+    // not presized to the number of objects, as __CFTryParseBinaryPlist does: usually only a small part of the file is wanted
+    CFMutableDictionaryRef objects = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+    CFPropertyListRef pl = NULL;
+    if (!__CFBinaryPlistCreateObjectFiltered(map->_bytes, map->_length, value._offset, &map->_trailer, allocator, mutabilityOption, objects, NULL, 0, NULL, &pl)) {
+	pl = NULL;
+    }
+    CFRelease(objects);
+    return pl;
+}
@@ -33,6 +33,15 @@
 #include "CFStringEncodingConverterPriv.h"
 #include "CFInternal.h"
 
+/* SSE2 is part of the x86_64 baseline and NEON of arm64, so the vector paths below need no runtime dispatch */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define __CF_CONVERTERS_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define __CF_CONVERTERS_NEON 1
+#endif
+
 #define ParagraphSeparator 0x2029
 #define ASCIINewLine 0x0a
 static int8_t __CFMapsParagraphSeparator = -1;
@@ -84,6 +93,67 @@ UniChar CFStringEncodingPrecomposeLatinCharacter(const UniChar *character, CFInd
     return 0xFFFD;
 }
 
+/* Widening and narrowing of runs of characters that are the same in Unicode and the 8-bit encoding: ASCII for all of the built-in ones, and all of 0-0xFF for ISO Latin 1.  These go 16 at a time while they can, and return how long the run was; characters or bytes may be NULL to only measure it.
+*/
+CF_INLINE CFIndex __CFWidenBytes(const uint8_t *bytes, CFIndex numBytes, UniChar *characters, bool asciiOnly) {
+    CFIndex idx = 0;
+#if __CF_CONVERTERS_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; idx + 16 <= numBytes; idx += 16) {
+        __m128i vb = _mm_loadu_si128((const __m128i *)(bytes + idx));
+        if (asciiOnly && _mm_movemask_epi8(vb)) break;
+        if (characters) {
+            _mm_storeu_si128((__m128i *)(characters + idx), _mm_unpacklo_epi8(vb, zero));
+            _mm_storeu_si128((__m128i *)(characters + idx + 8), _mm_unpackhi_epi8(vb, zero));
+        }
+    }
+#elif __CF_CONVERTERS_NEON
+    for (; idx + 16 <= numBytes; idx += 16) {
+        uint8x16_t vb = vld1q_u8(bytes + idx);
+        if (asciiOnly && (vmaxvq_u8(vb) & 0x80)) break;
+        if (characters) {
+            vst1q_u16(characters + idx, vmovl_u8(vget_low_u8(vb)));
+            vst1q_u16(characters + idx + 8, vmovl_u8(vget_high_u8(vb)));
+        }
+    }
+#endif
+    for (; idx < numBytes && (!asciiOnly || bytes[idx] < 0x80); idx++) {
+        if (characters) characters[idx] = bytes[idx];
+    }
+    return idx;
+}
+
+// maxCharacter is 0x7F or 0xFF
+CF_INLINE CFIndex __CFNarrowCharacters(const UniChar *characters, CFIndex numChars, uint8_t *bytes, UniChar maxCharacter) {
+    CFIndex idx = 0;
+#if __CF_CONVERTERS_SSE2
+    const __m128i zero = _mm_setzero_si128(), highBits = _mm_set1_epi16((short)(uint16_t)~maxCharacter);
+    for (; idx + 16 <= numChars; idx += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(characters + idx)), hi = _mm_loadu_si128((const __m128i *)(characters + idx + 8));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(lo, hi), highBits), zero)) != 0xFFFF) break;
+        if (bytes) _mm_storeu_si128((__m128i *)(bytes + idx), _mm_packus_epi16(lo, hi));
+    }
+#elif __CF_CONVERTERS_NEON
+    for (; idx + 16 <= numChars; idx += 16) {
+        uint16x8_t lo = vld1q_u16(characters + idx), hi = vld1q_u16(characters + idx + 8);
+        if (vmaxvq_u16(vorrq_u16(lo, hi)) > maxCharacter) break;
+        if (bytes) vst1q_u8(bytes + idx, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+#endif
+    for (; idx < numChars && characters[idx] <= maxCharacter; idx++) {
+        if (bytes) bytes[idx] = (uint8_t)characters[idx];
+    }
+    return idx;
+}
+
+CF_PRIVATE CFIndex __CFStringEncodingWidenBytes(const uint8_t *bytes, CFIndex numBytes, UniChar *characters, bool asciiOnly) {
+    return __CFWidenBytes(bytes, numBytes, characters, asciiOnly);
+}
+
+CF_PRIVATE CFIndex __CFStringEncodingNarrowCharacters(const UniChar *characters, CFIndex numChars, uint8_t *bytes, UniChar maxCharacter) {
+    return __CFNarrowCharacters(characters, numChars, bytes, maxCharacter);
+}
+
 /* ASCII */
 static bool __CFToASCII(uint32_t flags, UniChar character, uint8_t *byte) {
     if (character < 0x80) {
@@ -955,9 +1025,11 @@ static CFIndex __CFToUTF8(uint32_t flags, const UniChar *characters, CFIndex num
     while ((characters < endCharacter) && (!maxByteLen || (bytes < endBytes))) {
         ch = *(characters++);
 
-        if (ch < 0x80) { // ASCII
-            if (maxByteLen) *bytes = ch;
-            ++bytes;
+        if (ch < 0x80) { // ASCII; take the whole run
+            CFIndex remaining = endCharacter - characters + 1;
+            CFIndex run = __CFNarrowCharacters(characters - 1, (maxByteLen && (endBytes - bytes < remaining)) ? endBytes - bytes : remaining, maxByteLen ? bytes : NULL, 0x7F);
+            characters += run - 1;
+            bytes += run;
         } else {
             if (ch >= kSurrogateHighStart) {
                 if (ch <= kSurrogateHighEnd) {
@@ -1023,6 +1095,15 @@ static CFIndex __CFFromUTF8(uint32_t flags, const uint8_t *bytes, CFIndex numByt
     bool isStrict = !isHFSPlus;
 
     while (numBytes && (!maxCharLen || (theUsedCharLen < maxCharLen))) {
+        if (*source < 0x80) { // ASCII; take the whole run
+            CFIndex run = __CFWidenBytes(source, (maxCharLen && (maxCharLen - theUsedCharLen < numBytes)) ? maxCharLen - theUsedCharLen : numBytes, maxCharLen ? characters : NULL, true);
+            source += run;
+            numBytes -= run;
+            theUsedCharLen += run;
+            if (maxCharLen) characters += run;
+            continue;
+        }
+
         extraBytesToRead = trailingBytesForUTF8[*source];
 
         if (extraBytesToRead > --numBytes) break;
@@ -1110,6 +1191,13 @@ static CFIndex __CFToUTF8Len(uint32_t flags, const UniChar *characters, CFIndex
     uint32_t ch;
 
     while (numChars) {
+        if (*characters < 0x80) {
+            CFIndex run = __CFNarrowCharacters(characters, numChars, NULL, 0x7F);
+            characters += run;
+            numChars -= run;
+            bytesToWrite += run;
+            continue;
+        }
         ch = *characters++;
         numChars--;
         if ((ch >= kSurrogateHighStart && ch <= kSurrogateHighEnd) && numChars && (*characters >= kSurrogateLowStart && *characters <= kSurrogateLowEnd)) {
@@ -1134,6 +1222,14 @@ static CFIndex __CFFromUTF8Len(uint32_t flags, const uint8_t *source, CFIndex nu
     bool isStrict = !isHFSPlus;
 
     while (numBytes) {
+        if (*source < 0x80) {
+            CFIndex run = __CFWidenBytes(source, numBytes, NULL, true);
+            source += run;
+            numBytes -= run;
+            theUsedCharLen += run;
+            continue;
+        }
+
         extraBytesToRead = trailingBytesForUTF8[*source];
 
         if (extraBytesToRead > --numBytes) break;
@@ -0,0 +1,337 @@
+/*
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*	CFConcurrentDictionary.c
+	Not part of Apple's CoreFoundation sources; added in this tree and
+	distributed under the same license.
+*/
+
+#include "CFConcurrentDictionary.h"
+#include "CFBasicHash.h"
+#include "CFInternal.h"
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI || DEPLOYMENT_TARGET_LINUX
+#include <sched.h>
+#endif
+
+/* Writers hold a mutex only while they copy, change and publish. Waiting for the readers of the replaced snapshot, and releasing it, happen after the mutex is dropped, so the next writer can start its copy meanwhile, and release callbacks run with no lock held.
+
+Readers announce themselves in one of a few counters, picked by thread so that readers on different cores mostly touch different cache lines, and in one of two phases. A writer publishes its new snapshot first and then, for each phase in turn, points new readers at the other phase and waits for the count of the first to drain. Any reader which could have loaded the old snapshot had already counted itself by then (it counts itself before it loads), and waiting out both phases covers readers which picked their phase before an earlier writer's flip. New readers never join the phase being waited for, so a steady stream of them can't hold a writer up. One writer at a time waits, and a wait which starts after several snapshots were published retires all of them, so writers which publish in quick succession mostly share one wait.
+*/
+
+#define __kCFConcurrentDictionaryReaderSlots 16
+
+struct __CFConcurrentDictionaryReaders {
+    volatile int32_t _count[2];			/* readers inside, by phase */
+    uint8_t _pad[64 - 2 * sizeof(int32_t)];	/* a cache line each */
+};
+
+struct __CFConcurrentDictionary {
+    CFRuntimeBase _base;
+    CFDictionaryRef volatile _snapshot;		/* immutable; replaced whole, never mutated */
+    volatile int32_t _phase;			/* which count new readers use */
+    volatile uint32_t _published;		/* snapshots published; written under _writeLock */
+    uint32_t _drained;				/* of which readers are known gone; under _drainLock */
+    pthread_mutex_t _writeLock;			/* serializes writers' copy and publish */
+    pthread_mutex_t _drainLock;			/* serializes waiting for readers */
+    struct __CFConcurrentDictionaryReaders _readers[__kCFConcurrentDictionaryReaderSlots];
+};
+
+CF_INLINE volatile int32_t *__CFConcurrentDictionaryBeginRead(CFConcurrentDictionaryRef cd) {
+    uintptr_t thread = (uintptr_t)pthread_self();
+    struct __CFConcurrentDictionaryReaders *readers = &cd->_readers[((thread >> 12) ^ (thread >> 20)) % __kCFConcurrentDictionaryReaderSlots];
+    volatile int32_t *count = &readers->_count[cd->_phase & 1];
+    OSAtomicIncrement32Barrier(count);
+    return count;
+}
+
+CF_INLINE void __CFConcurrentDictionaryEndRead(volatile int32_t *count) {
+    OSAtomicDecrement32Barrier(count);
+}
+
+static void __CFConcurrentDictionaryWaitForReaders(CFConcurrentDictionaryRef cd) {
+    for (CFIndex flip = 0; flip < 2; flip++) {
+        int32_t phase = cd->_phase & 1;
+        cd->_phase = phase ^ 1;
+        OSMemoryBarrier();
+        for (CFIndex idx = 0; idx < __kCFConcurrentDictionaryReaderSlots; idx++) {
+            while (0 != cd->_readers[idx]._count[phase]) {
+#if DEPLOYMENT_TARGET_WINDOWS
+                Sleep(0);
+#else
+                sched_yield();
+#endif
+            }
+        }
+    }
+    OSMemoryBarrier();
+}
+
+// Called with the write lock held; takes over dict. Returns the snapshot it
+// replaced, which readers may still be using, and sets *generation for
+// __CFConcurrentDictionaryRetire.
+static CFDictionaryRef __CFConcurrentDictionaryPublish(CFConcurrentDictionaryRef cd, CFMutableDictionaryRef dict, uint32_t *generation) {
+    CFDictionaryRef old = cd->_snapshot;
+    CFBasicHashMakeImmutable((CFBasicHashRef)dict);
+    if (__CFOASafe) __CFSetLastAllocationEventName(dict, "CFConcurrentDictionary (snapshot)");
+    OSMemoryBarrier();
+    cd->_snapshot = dict;
+    OSMemoryBarrier();
+    *generation = ++cd->_published;
+    return old;
+}
+
+// Called without the write lock; waits until no reader can still be using old, then releases it
+static void __CFConcurrentDictionaryRetire(CFConcurrentDictionaryRef cd, CFDictionaryRef old, uint32_t generation) {
+    pthread_mutex_lock(&cd->_drainLock);
+    if ((int32_t)(generation - cd->_drained) > 0) {
+        // everything published by now is covered by this wait, not just old
+        uint32_t published = cd->_published;
+        OSMemoryBarrier();
+        __CFConcurrentDictionaryWaitForReaders(cd);
+        cd->_drained = published;
+    }
+    pthread_mutex_unlock(&cd->_drainLock);
+    CFRelease(old);
+}
+
+static CFStringRef __CFConcurrentDictionaryCopyDescription(CFTypeRef cf) {
+    CFConcurrentDictionaryRef cd = (CFConcurrentDictionaryRef)cf;
+    CFDictionaryRef snapshot = CFConcurrentDictionaryCopySnapshot(cd);
+    CFStringRef result = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("<CFConcurrentDictionary %p [%p]>%@"), cf, CFGetAllocator(cf), snapshot);
+    CFRelease(snapshot);
+    return result;
+}
+
+static void __CFConcurrentDictionaryDeallocate(CFTypeRef cf) {
+    CFConcurrentDictionaryRef cd = (CFConcurrentDictionaryRef)cf;
+    // the last reference is gone, so there are no readers left
+    if (cd->_snapshot) CFRelease(cd->_snapshot);
+    pthread_mutex_destroy(&cd->_writeLock);
+    pthread_mutex_destroy(&cd->_drainLock);
+}
+
+static CFTypeID __kCFConcurrentDictionaryTypeID = _kCFRuntimeNotATypeID;
+
+static const CFRuntimeClass __CFConcurrentDictionaryClass = {
+    0,
+    "CFConcurrentDictionary",
+    NULL,	// init
+    NULL,	// copy
+    __CFConcurrentDictionaryDeallocate,
+    NULL,	// equal
+    NULL,	// hash
+    NULL,	//
+    __CFConcurrentDictionaryCopyDescription
+};
+
+CFTypeID CFConcurrentDictionaryGetTypeID(void) {
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        __kCFConcurrentDictionaryTypeID = _CFRuntimeRegisterClass(&__CFConcurrentDictionaryClass);
+    });
+    return __kCFConcurrentDictionaryTypeID;
+}
+
+static CFConcurrentDictionaryRef __CFConcurrentDictionaryInit(CFAllocatorRef allocator, CFDictionaryRef snapshot) {
+    if (NULL == snapshot) return NULL;
+    CFIndex size = sizeof(struct __CFConcurrentDictionary) - sizeof(CFRuntimeBase);
+    CFConcurrentDictionaryRef memory = (CFConcurrentDictionaryRef)_CFRuntimeCreateInstance(allocator, CFConcurrentDictionaryGetTypeID(), size, NULL);
+    if (NULL == memory) {
+        CFRelease(snapshot);
+        return NULL;
+    }
+    memset((uint8_t *)memory + sizeof(CFRuntimeBase), 0, size);
+    pthread_mutex_init(&memory->_writeLock, NULL);
+    pthread_mutex_init(&memory->_drainLock, NULL);
+    memory->_snapshot = snapshot;
+    return memory;
+}
+
+CFConcurrentDictionaryRef CFConcurrentDictionaryCreate(CFAllocatorRef allocator, const CFDictionaryKeyCallBacks *keyCallBacks, const CFDictionaryValueCallBacks *valueCallBacks) {
+    // created mutable, and made immutable, so that writers' copies keep the callbacks
+    CFMutableDictionaryRef dict = CFDictionaryCreateMutable(allocator, 0, keyCallBacks, valueCallBacks);
+    if (dict) CFBasicHashMakeImmutable((CFBasicHashRef)dict);
+    return __CFConcurrentDictionaryInit(allocator, dict);
+}
+
+CFConcurrentDictionaryRef CFConcurrentDictionaryCreateWithDictionary(CFAllocatorRef allocator, CFDictionaryRef dict) {
+    CFAssert1(dict, __kCFLogAssertion, "%s(): dict cannot be NULL", __PRETTY_FUNCTION__);
+    return __CFConcurrentDictionaryInit(allocator, CFDictionaryCreateCopy(allocator, dict));
+}
+
+CFDictionaryRef CFConcurrentDictionaryCopySnapshot(CFConcurrentDictionaryRef cd) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    CFDictionaryRef snapshot = (CFDictionaryRef)CFRetain(cd->_snapshot);
+    __CFConcurrentDictionaryEndRead(count);
+    return snapshot;
+}
+
+CFIndex CFConcurrentDictionaryGetCount(CFConcurrentDictionaryRef cd) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    CFIndex result = CFDictionaryGetCount(cd->_snapshot);
+    __CFConcurrentDictionaryEndRead(count);
+    return result;
+}
+
+CFIndex CFConcurrentDictionaryGetCountOfKey(CFConcurrentDictionaryRef cd, const void *key) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    CFIndex result = CFDictionaryGetCountOfKey(cd->_snapshot, key);
+    __CFConcurrentDictionaryEndRead(count);
+    return result;
+}
+
+CFIndex CFConcurrentDictionaryGetCountOfValue(CFConcurrentDictionaryRef cd, const void *value) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    CFIndex result = CFDictionaryGetCountOfValue(cd->_snapshot, value);
+    __CFConcurrentDictionaryEndRead(count);
+    return result;
+}
+
+Boolean CFConcurrentDictionaryContainsKey(CFConcurrentDictionaryRef cd, const void *key) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    Boolean result = CFDictionaryContainsKey(cd->_snapshot, key);
+    __CFConcurrentDictionaryEndRead(count);
+    return result;
+}
+
+Boolean CFConcurrentDictionaryContainsValue(CFConcurrentDictionaryRef cd, const void *value) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    Boolean result = CFDictionaryContainsValue(cd->_snapshot, value);
+    __CFConcurrentDictionaryEndRead(count);
+    return result;
+}
+
+const void *CFConcurrentDictionaryGetValue(CFConcurrentDictionaryRef cd, const void *key) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    const void *result = CFDictionaryGetValue(cd->_snapshot, key);
+    __CFConcurrentDictionaryEndRead(count);
+    return result;
+}
+
+Boolean CFConcurrentDictionaryGetValueIfPresent(CFConcurrentDictionaryRef cd, const void *key, const void **value) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    Boolean result = CFDictionaryGetValueIfPresent(cd->_snapshot, key, value);
+    __CFConcurrentDictionaryEndRead(count);
+    return result;
+}
+
+void CFConcurrentDictionaryGetKeysAndValues(CFConcurrentDictionaryRef cd, const void **keys, const void **values) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    volatile int32_t *count = __CFConcurrentDictionaryBeginRead(cd);
+    CFDictionaryGetKeysAndValues(cd->_snapshot, keys, values);
+    __CFConcurrentDictionaryEndRead(count);
+}
+
+void CFConcurrentDictionaryApplyFunction(CFConcurrentDictionaryRef cd, CFDictionaryApplierFunction applier, void *context) {
+    FAULT_CALLBACK((void **)&(applier));
+    // on a retained snapshot rather than inside the read, so that a slow applier doesn't hold up writers
+    CFDictionaryRef snapshot = CFConcurrentDictionaryCopySnapshot(cd);
+    CFDictionaryApplyFunction(snapshot, applier, context);
+    CFRelease(snapshot);
+}
+
+void CFConcurrentDictionaryAddValue(CFConcurrentDictionaryRef cd, const void *key, const void *value) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    CFDictionaryRef old = NULL;
+    uint32_t generation = 0;
+    pthread_mutex_lock(&cd->_writeLock);
+    if (!CFDictionaryContainsKey(cd->_snapshot, key)) {
+        CFMutableDictionaryRef dict = CFDictionaryCreateMutableCopy(CFGetAllocator(cd), 0, cd->_snapshot);
+        CFDictionaryAddValue(dict, key, value);
+        old = __CFConcurrentDictionaryPublish(cd, dict, &generation);
+    }
+    pthread_mutex_unlock(&cd->_writeLock);
+    if (old) __CFConcurrentDictionaryRetire(cd, old, generation);
+}
+
+void CFConcurrentDictionarySetValue(CFConcurrentDictionaryRef cd, const void *key, const void *value) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    uint32_t generation;
+    pthread_mutex_lock(&cd->_writeLock);
+    CFMutableDictionaryRef dict = CFDictionaryCreateMutableCopy(CFGetAllocator(cd), 0, cd->_snapshot);
+    CFDictionarySetValue(dict, key, value);
+    CFDictionaryRef old = __CFConcurrentDictionaryPublish(cd, dict, &generation);
+    pthread_mutex_unlock(&cd->_writeLock);
+    __CFConcurrentDictionaryRetire(cd, old, generation);
+}
+
+void CFConcurrentDictionaryReplaceValue(CFConcurrentDictionaryRef cd, const void *key, const void *value) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    CFDictionaryRef old = NULL;
+    uint32_t generation = 0;
+    pthread_mutex_lock(&cd->_writeLock);
+    if (CFDictionaryContainsKey(cd->_snapshot, key)) {
+        CFMutableDictionaryRef dict = CFDictionaryCreateMutableCopy(CFGetAllocator(cd), 0, cd->_snapshot);
+        CFDictionaryReplaceValue(dict, key, value);
+        old = __CFConcurrentDictionaryPublish(cd, dict, &generation);
+    }
+    pthread_mutex_unlock(&cd->_writeLock);
+    if (old) __CFConcurrentDictionaryRetire(cd, old, generation);
+}
+
+void CFConcurrentDictionaryRemoveValue(CFConcurrentDictionaryRef cd, const void *key) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    CFDictionaryRef old = NULL;
+    uint32_t generation = 0;
+    pthread_mutex_lock(&cd->_writeLock);
+    if (CFDictionaryContainsKey(cd->_snapshot, key)) {
+        CFMutableDictionaryRef dict = CFDictionaryCreateMutableCopy(CFGetAllocator(cd), 0, cd->_snapshot);
+        CFDictionaryRemoveValue(dict, key);
+        old = __CFConcurrentDictionaryPublish(cd, dict, &generation);
+    }
+    pthread_mutex_unlock(&cd->_writeLock);
+    if (old) __CFConcurrentDictionaryRetire(cd, old, generation);
+}
+
+void CFConcurrentDictionaryRemoveAllValues(CFConcurrentDictionaryRef cd) {
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    CFDictionaryRef old = NULL;
+    uint32_t generation = 0;
+    pthread_mutex_lock(&cd->_writeLock);
+    if (0 < CFDictionaryGetCount(cd->_snapshot)) {
+        CFMutableDictionaryRef dict = CFDictionaryCreateMutableCopy(CFGetAllocator(cd), 0, cd->_snapshot);
+        CFDictionaryRemoveAllValues(dict);
+        old = __CFConcurrentDictionaryPublish(cd, dict, &generation);
+    }
+    pthread_mutex_unlock(&cd->_writeLock);
+    if (old) __CFConcurrentDictionaryRetire(cd, old, generation);
+}
+
+void CFConcurrentDictionaryApplyUpdate(CFConcurrentDictionaryRef cd, void (*updater)(CFMutableDictionaryRef dict, void *context), void *context) {
+    FAULT_CALLBACK((void **)&(updater));
+    __CFGenericValidateType(cd, CFConcurrentDictionaryGetTypeID());
+    uint32_t generation;
+    pthread_mutex_lock(&cd->_writeLock);
+    CFMutableDictionaryRef dict = CFDictionaryCreateMutableCopy(CFGetAllocator(cd), 0, cd->_snapshot);
+    INVOKE_CALLBACK2(updater, dict, context);
+    CFDictionaryRef old = __CFConcurrentDictionaryPublish(cd, dict, &generation);
+    pthread_mutex_unlock(&cd->_writeLock);
+    __CFConcurrentDictionaryRetire(cd, old, generation);
+}
+
@@ -0,0 +1,160 @@
+/*
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*	CFConcurrentDictionary.h
+	Not part of Apple's CoreFoundation sources; added in this tree and
+	distributed under the same license.
+*/
+
+/*!
+	@header CFConcurrentDictionary
+	CFConcurrentDictionary is a dictionary which may be read and written
+	from any number of threads without external locking, for read-mostly
+	uses such as shared caches.
+
+	The contents are held in an immutable CFDictionary snapshot. Readers
+	look up in whichever snapshot is current without taking a lock;
+	writers serialize among themselves, apply their change to a private
+	copy of the snapshot and then publish the copy in its place, so every
+	write costs a copy of the whole dictionary. Use
+	CFConcurrentDictionaryApplyUpdate to make several changes with a
+	single copy.
+
+	The read functions behave as their CFDictionary counterparts applied
+	to the snapshot current at the time of the call. A key or value they
+	return is not retained: it stays valid only until another thread
+	removes or replaces it. Callers which need it beyond that should
+	retain it, or work on a snapshot from
+	CFConcurrentDictionaryCopySnapshot.
+*/
+
+#if !defined(__COREFOUNDATION_CFCONCURRENTDICTIONARY__)
+#define __COREFOUNDATION_CFCONCURRENTDICTIONARY__ 1
+
+#include <CoreFoundation/CFBase.h>
+#include <CoreFoundation/CFDictionary.h>
+
+CF_EXTERN_C_BEGIN
+
+typedef struct __CFConcurrentDictionary * CFConcurrentDictionaryRef;
+
+CF_EXPORT
+CFTypeID CFConcurrentDictionaryGetTypeID(void);
+
+/*!
+	@function CFConcurrentDictionaryCreate
+	Creates an empty concurrent dictionary. The callbacks are those of
+	CFDictionaryCreateMutable.
+*/
+CF_EXPORT
+CFConcurrentDictionaryRef CFConcurrentDictionaryCreate(CFAllocatorRef allocator, const CFDictionaryKeyCallBacks *keyCallBacks, const CFDictionaryValueCallBacks *valueCallBacks);
+
+/*!
+	@function CFConcurrentDictionaryCreateWithDictionary
+	Creates a concurrent dictionary holding the contents of dict, with
+	its callbacks.
+*/
+CF_EXPORT
+CFConcurrentDictionaryRef CFConcurrentDictionaryCreateWithDictionary(CFAllocatorRef allocator, CFDictionaryRef dict);
+
+/*!
+	@function CFConcurrentDictionaryCopySnapshot
+	Returns the current contents as an immutable CFDictionary, which
+	later writes do not change.
+*/
+CF_EXPORT
+CFDictionaryRef CFConcurrentDictionaryCopySnapshot(CFConcurrentDictionaryRef cd);
+
+CF_EXPORT
+CFIndex CFConcurrentDictionaryGetCount(CFConcurrentDictionaryRef cd);
+
+CF_EXPORT
+CFIndex CFConcurrentDictionaryGetCountOfKey(CFConcurrentDictionaryRef cd, const void *key);
+
+CF_EXPORT
+CFIndex CFConcurrentDictionaryGetCountOfValue(CFConcurrentDictionaryRef cd, const void *value);
+
+CF_EXPORT
+Boolean CFConcurrentDictionaryContainsKey(CFConcurrentDictionaryRef cd, const void *key);
+
+CF_EXPORT
+Boolean CFConcurrentDictionaryContainsValue(CFConcurrentDictionaryRef cd, const void *value);
+
+CF_EXPORT
+const void *CFConcurrentDictionaryGetValue(CFConcurrentDictionaryRef cd, const void *key);
+
+CF_EXPORT
+Boolean CFConcurrentDictionaryGetValueIfPresent(CFConcurrentDictionaryRef cd, const void *key, const void **value);
+
+/*!
+	@function CFConcurrentDictionaryGetKeysAndValues
+	As CFDictionaryGetKeysAndValues. The count may change between calls,
+	so size the buffers from the count of a snapshot, and fill them from
+	that snapshot, when the contents are being written at the same time.
+*/
+CF_EXPORT
+void CFConcurrentDictionaryGetKeysAndValues(CFConcurrentDictionaryRef cd, const void **keys, const void **values);
+
+/*!
+	@function CFConcurrentDictionaryApplyFunction
+	Calls applier for each key-value pair of the current snapshot. The
+	applier may write to the dictionary; it goes on seeing the snapshot
+	it started with.
+*/
+CF_EXPORT
+void CFConcurrentDictionaryApplyFunction(CFConcurrentDictionaryRef cd, CFDictionaryApplierFunction applier, void *context);
+
+/*!
+	@function CFConcurrentDictionaryAddValue
+	As CFDictionaryAddValue. This and the other single-change writers
+	below each copy the whole dictionary, O(count) per call, and wait
+	for the readers of the snapshot they replace; to make several
+	changes use CFConcurrentDictionaryApplyUpdate instead.
+*/
+CF_EXPORT
+void CFConcurrentDictionaryAddValue(CFConcurrentDictionaryRef cd, const void *key, const void *value);
+
+CF_EXPORT
+void CFConcurrentDictionarySetValue(CFConcurrentDictionaryRef cd, const void *key, const void *value);
+
+CF_EXPORT
+void CFConcurrentDictionaryReplaceValue(CFConcurrentDictionaryRef cd, const void *key, const void *value);
+
+CF_EXPORT
+void CFConcurrentDictionaryRemoveValue(CFConcurrentDictionaryRef cd, const void *key);
+
+CF_EXPORT
+void CFConcurrentDictionaryRemoveAllValues(CFConcurrentDictionaryRef cd);
+
+/*!
+	@function CFConcurrentDictionaryApplyUpdate
+	Calls updater with a private mutable copy of the contents and then
+	publishes the copy, so any number of changes cost one copy and become
+	visible to readers together. Other writers wait until it is done;
+	updater must not write to cd itself.
+*/
+CF_EXPORT
+void CFConcurrentDictionaryApplyUpdate(CFConcurrentDictionaryRef cd, void (*updater)(CFMutableDictionaryRef dict, void *context), void *context);
+
+CF_EXTERN_C_END
+
+#endif /* ! __COREFOUNDATION_CFCONCURRENTDICTIONARY__ */
+
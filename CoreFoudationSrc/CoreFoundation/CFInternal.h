@@ -127,6 +127,7 @@ CF_EXPORT void _CFMachPortInstallNotifyPort(CFRunLoopRef rl, CFStringRef mode);
 
 
 CF_PRIVATE CFIndex __CFActiveProcessorCount();
+CF_PRIVATE void __CFSortValues(const void **values, CFIndex count, CFComparatorFunction comparator, void *context);
 
 #ifndef CLANG_ANALYZER_NORETURN
 #if __has_feature(attribute_analyzer_noreturn)
@@ -49,6 +49,15 @@
 #include <math.h>
 #include <ctype.h>
 
+/* SSE2 is part of the x86_64 baseline and NEON of arm64, so the vector scans below need no runtime dispatch */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define __CF_PLIST_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define __CF_PLIST_NEON 1
+#endif
+
 
 CF_EXPORT CFNumberType _CFNumberGetType2(CFNumberRef number);
 
@@ -739,8 +748,82 @@ static UInt32 lineNumber(_CFXMLPlistParseInfo *pInfo) {
     return count;
 }
 
+/* Vector scans for the XML parser. Each handles whole 16-byte blocks and returns where it stopped, leaving the remainder to the scalar code after it.
+*/
+
+/* Returns the first byte at or after p which is not XML white space (' ', '\t', '\n', '\r'), or the start of the last partial block
+*/
+CF_INLINE const char *__CFPListSkipWhitespaceBlocks(const char *p, const char *end) {
+#if __CF_PLIST_SSE2
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    for (; 16 <= end - p; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)), _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(ws);
+        if (mask != 0xFFFF) return p + __builtin_ctz(~mask);
+    }
+#elif __CF_PLIST_NEON
+    const uint8x16_t space = vdupq_n_u8(' '), tab = vdupq_n_u8('\t'), lf = vdupq_n_u8('\n'), cr = vdupq_n_u8('\r');
+    for (; 16 <= end - p; p += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)p);
+        uint8x16_t ws = vorrq_u8(vorrq_u8(vceqq_u8(v, space), vceqq_u8(v, tab)), vorrq_u8(vceqq_u8(v, lf), vceqq_u8(v, cr)));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(ws), 4)), 0);	// 4 bits per byte
+        if (mask != ~0ULL) return p + (__builtin_ctzll(~mask) >> 2);
+    }
+#endif
+    return p;
+}
+
+/* Returns the first '<' or '&' at or after p, or the start of the last partial block
+*/
+CF_INLINE const char *__CFPListSkipCharDataBlocks(const char *p, const char *end) {
+#if __CF_PLIST_SSE2
+    const __m128i lt = _mm_set1_epi8('<'), amp = _mm_set1_epi8('&');
+    for (; 16 <= end - p; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, amp)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+#elif __CF_PLIST_NEON
+    const uint8x16_t lt = vdupq_n_u8('<'), amp = vdupq_n_u8('&');
+    for (; 16 <= end - p; p += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)p);
+        uint8x16_t found = vorrq_u8(vceqq_u8(v, lt), vceqq_u8(v, amp));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(found), 4)), 0);
+        if (mask) return p + (__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    return p;
+}
+
+#if __CF_PLIST_SSE2 || __CF_PLIST_NEON
+#define __CF_PLIST_BASE64_BLOCKS 1
+
+/* Returns whether the 16 bytes at p are all base64 digits, with no white space or padding among them
+*/
+CF_INLINE Boolean __CFPListIsBase64Block(const char *p) {
+#if __CF_PLIST_SSE2
+    // signed compares: bytes from 0x80 up are negative and fall outside every range
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i symbol = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('+')), _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, symbol))) == 0xFFFF;
+#else
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t upper = vcleq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(25));
+    uint8x16_t lower = vcleq_u8(vsubq_u8(v, vdupq_n_u8('a')), vdupq_n_u8(25));
+    uint8x16_t digit = vcleq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(9));
+    uint8x16_t symbol = vorrq_u8(vceqq_u8(v, vdupq_n_u8('+')), vceqq_u8(v, vdupq_n_u8('/')));
+    return vminvq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, symbol))) == 0xFF;
+#endif
+}
+#endif
+
 // warning: doesn't have a good idea of Unicode white space
 CF_INLINE void skipWhitespace(_CFXMLPlistParseInfo *pInfo) {
+    pInfo->curr = __CFPListSkipWhitespaceBlocks(pInfo->curr, pInfo->end);
     while (pInfo->curr < pInfo->end) {
         switch (*(pInfo->curr)) {
             case ' ':
@@ -942,7 +1025,42 @@ static Boolean getContentObject(_CFXMLPlistParseInfo *pInfo, Boolean *isKey, CFT
     return false;
 }
 
-static void parseCDSect_pl(_CFXMLPlistParseInfo *pInfo, CFMutableDataRef stringData) {
+// The contents of a string which has CDATA or references in it, put together on the stack until they outgrow it
+typedef struct {
+    uint8_t *bytes;
+    CFIndex length;
+    CFIndex capacity;
+    CFAllocatorRef allocator;
+    uint8_t buffer[512];
+} __CFPListStringBuffer;
+
+CF_INLINE void __CFPListStringBufferInit(__CFPListStringBuffer *stringData, CFAllocatorRef allocator) {
+    stringData->bytes = stringData->buffer;
+    stringData->length = 0;
+    stringData->capacity = sizeof(stringData->buffer);
+    stringData->allocator = allocator;
+}
+
+static void __CFPListStringBufferAppend(__CFPListStringBuffer *stringData, const uint8_t *bytes, CFIndex length) {
+    if (stringData->capacity < stringData->length + length) {
+        CFIndex capacity = 2 * stringData->capacity;
+        while (capacity < stringData->length + length) capacity *= 2;
+        uint8_t *newBytes = (uint8_t *)CFAllocatorAllocate(stringData->allocator, capacity, 0);
+        if (!newBytes) HALT; // out of memory
+        memmove(newBytes, stringData->bytes, stringData->length);
+        if (stringData->bytes != stringData->buffer) CFAllocatorDeallocate(stringData->allocator, stringData->bytes);
+        stringData->bytes = newBytes;
+        stringData->capacity = capacity;
+    }
+    memmove(stringData->bytes + stringData->length, bytes, length);
+    stringData->length += length;
+}
+
+CF_INLINE void __CFPListStringBufferDestroy(__CFPListStringBuffer *stringData) {
+    if (stringData->bytes != stringData->buffer) CFAllocatorDeallocate(stringData->allocator, stringData->bytes);
+}
+
+static void parseCDSect_pl(_CFXMLPlistParseInfo *pInfo, __CFPListStringBuffer *stringData) {
     const char *end, *begin;
     if (pInfo->end - pInfo->curr < CDSECT_TAG_LENGTH) {
         pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Encountered unexpected EOF"));
@@ -958,7 +1076,7 @@ static void parseCDSect_pl(_CFXMLPlistParseInfo *pInfo, CFMutableDataRef stringD
     while (pInfo->curr < end) {
         if (*(pInfo->curr) == ']' && *(pInfo->curr+1) == ']' && *(pInfo->curr+2) == '>') {
             // Found the end!
-            CFDataAppendBytes(stringData, (const UInt8 *)begin, pInfo->curr-begin);
+            __CFPListStringBufferAppend(stringData, (const UInt8 *)begin, pInfo->curr-begin);
             pInfo->curr += 3;
             return;
         }
@@ -970,7 +1088,7 @@ static void parseCDSect_pl(_CFXMLPlistParseInfo *pInfo, CFMutableDataRef stringD
 }
 
 // Only legal references are {lt, gt, amp, apos, quote, #ddd, #xAAA}
-static void parseEntityReference_pl(_CFXMLPlistParseInfo *pInfo, CFMutableDataRef stringData) {
+static void parseEntityReference_pl(_CFXMLPlistParseInfo *pInfo, __CFPListStringBuffer *stringData) {
     int len;
     pInfo->curr ++; // move past the '&';
     len = pInfo->end - pInfo->curr; // how many bytes we can safely scan
@@ -1045,12 +1163,20 @@ static void parseEntityReference_pl(_CFXMLPlistParseInfo *pInfo, CFMutableDataRe
                 pInfo->curr ++;
                 if (ch == ';') {
                     // The value in num always refers to the unicode code point. We'll have to convert since the calling function expects UTF8 data.
-                    CFStringRef oneChar = CFStringCreateWithBytes(pInfo->allocator, (const uint8_t *)&num, 2, kCFStringEncodingUnicode, NO);
-                    uint8_t tmpBuf[6]; // max of 6 bytes for UTF8
+                    // A lone surrogate has no UTF8 form, and is dropped.
+                    uint8_t tmpBuf[3];
                     CFIndex tmpBufLength = 0;
-                    CFStringGetBytes(oneChar, CFRangeMake(0, 1), kCFStringEncodingUTF8, 0, NO, tmpBuf, 6, &tmpBufLength);
-                    CFDataAppendBytes(stringData, tmpBuf, tmpBufLength);
-                    __CFPListRelease(oneChar, pInfo->allocator);
+                    if (num < 0x80) {
+                        tmpBuf[tmpBufLength++] = (uint8_t)num;
+                    } else if (num < 0x800) {
+                        tmpBuf[tmpBufLength++] = (uint8_t)(0xC0 | (num >> 6));
+                        tmpBuf[tmpBufLength++] = (uint8_t)(0x80 | (num & 0x3F));
+                    } else if (num < 0xD800 || 0xDFFF < num) {
+                        tmpBuf[tmpBufLength++] = (uint8_t)(0xE0 | (num >> 12));
+                        tmpBuf[tmpBufLength++] = (uint8_t)(0x80 | ((num >> 6) & 0x3F));
+                        tmpBuf[tmpBufLength++] = (uint8_t)(0x80 | (num & 0x3F));
+                    }
+                    __CFPListStringBufferAppend(stringData, tmpBuf, tmpBufLength);
                     return;
                 }
                 if (!isHex) num = num*10;
@@ -1076,7 +1202,7 @@ static void parseEntityReference_pl(_CFXMLPlistParseInfo *pInfo, CFMutableDataRe
             pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Encountered unknown ampersand-escape sequence at line %d"), lineNumber(pInfo));
             return;
     }
-    CFDataAppendBytes(stringData, (const UInt8 *)&ch, 1);
+    __CFPListStringBufferAppend(stringData, (const UInt8 *)&ch, 1);
 }
 
 static void _createStringMap(_CFXMLPlistParseInfo *pInfo) {
@@ -1118,79 +1244,65 @@ static CFStringRef _createUniqueStringWithUTF8Bytes(_CFXMLPlistParseInfo *pInfo,
 // String could be comprised of characters, CDSects, or references to one of the "well-known" entities ('<', '>', '&', ''', '"')
 static Boolean parseStringTag(_CFXMLPlistParseInfo *pInfo, CFStringRef *out) {
     const char *mark = pInfo->curr;
-    CFMutableDataRef stringData = NULL;
+    __CFPListStringBuffer stringData;
+    __CFPListStringBufferInit(&stringData, pInfo->allocator);
+    Boolean unescaped = true;
     while (!pInfo->error && pInfo->curr < pInfo->end) {
         char ch = *(pInfo->curr);
         if (ch == '<') {
 	    if (pInfo->curr + 1 >= pInfo->end) break;
             // Could be a CDSect; could be the end of the string
             if (*(pInfo->curr+1) != '!') break; // End of the string
-            if (!stringData) stringData = CFDataCreateMutable(pInfo->allocator, 0);
-            CFDataAppendBytes(stringData, (const UInt8 *)mark, pInfo->curr - mark);
-            parseCDSect_pl(pInfo, stringData); // TODO: move to return boolean
+            unescaped = false;
+            __CFPListStringBufferAppend(&stringData, (const UInt8 *)mark, pInfo->curr - mark);
+            parseCDSect_pl(pInfo, &stringData); // TODO: move to return boolean
             mark = pInfo->curr;
         } else if (ch == '&') {
-            if (!stringData) stringData = CFDataCreateMutable(pInfo->allocator, 0);
-            CFDataAppendBytes(stringData, (const UInt8 *)mark, pInfo->curr - mark);
-            parseEntityReference_pl(pInfo, stringData); // TODO: move to return boolean
+            unescaped = false;
+            __CFPListStringBufferAppend(&stringData, (const UInt8 *)mark, pInfo->curr - mark);
+            parseEntityReference_pl(pInfo, &stringData); // TODO: move to return boolean
             mark = pInfo->curr;
         } else {
-            pInfo->curr ++;
+            pInfo->curr = __CFPListSkipCharDataBlocks(pInfo->curr + 1, pInfo->end);
         }
     }
 
     if (pInfo->error) {
-        __CFPListRelease(stringData, pInfo->allocator);
+        __CFPListStringBufferDestroy(&stringData);
         return false;
     }
-        
-    if (!stringData) {
-        if (pInfo->skip) {
-            *out = NULL;
+
+    // Without CDATA or references, the string is made straight from the XML
+    const char *bytes = mark;
+    CFIndex length = pInfo->curr - mark;
+    if (!unescaped) {
+        __CFPListStringBufferAppend(&stringData, (const UInt8 *)mark, pInfo->curr - mark);
+        bytes = (const char *)stringData.bytes;
+        length = stringData.length;
+    }
+    Boolean success = true;
+    if (pInfo->skip) {
+        *out = NULL;
+    } else if (pInfo->mutabilityOption != kCFPropertyListMutableContainersAndLeaves) {
+        CFStringRef s = _createUniqueStringWithUTF8Bytes(pInfo, bytes, length);
+        if (!s) {
+            pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
+            success = false;
         } else {
-            if (pInfo->mutabilityOption != kCFPropertyListMutableContainersAndLeaves) {
-                CFStringRef s = _createUniqueStringWithUTF8Bytes(pInfo, mark, pInfo->curr - mark);
-                if (!s) {
-                    pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
-                    return false;
-                }                    
-                *out = s;
-            } else {
-                CFStringRef s = CFStringCreateWithBytes(pInfo->allocator, (const UInt8 *)mark, pInfo->curr - mark, kCFStringEncodingUTF8, NO);
-                if (!s) {
-                    pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
-                    return false;
-                }
-                *out = CFStringCreateMutableCopy(pInfo->allocator, 0, s);
-                __CFPListRelease(s, pInfo->allocator);
-            }
+            *out = s;
         }
-        return true;
     } else {
-        if (pInfo->skip) {
-            *out = NULL;
+        CFStringRef s = CFStringCreateWithBytes(pInfo->allocator, (const UInt8 *)bytes, length, kCFStringEncodingUTF8, NO);
+        if (!s) {
+            pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
+            success = false;
         } else {
-            CFDataAppendBytes(stringData, (const UInt8 *)mark, pInfo->curr - mark);
-            if (pInfo->mutabilityOption != kCFPropertyListMutableContainersAndLeaves) {
-                CFStringRef s = _createUniqueStringWithUTF8Bytes(pInfo, (const char *)CFDataGetBytePtr(stringData), CFDataGetLength(stringData));
-                if (!s) {
-                    pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
-                    return false;
-                }
-                *out = s;
-            } else {
-                CFStringRef s = CFStringCreateWithBytes(pInfo->allocator, (const UInt8 *)CFDataGetBytePtr(stringData), CFDataGetLength(stringData), kCFStringEncodingUTF8, NO);
-                if (!s) {
-                    pInfo->error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Unable to convert string to correct encoding"));
-                    return false;
-                }
-                *out = CFStringCreateMutableCopy(pInfo->allocator, 0, s);
-                __CFPListRelease(s, pInfo->allocator);
-            }
+            *out = CFStringCreateMutableCopy(pInfo->allocator, 0, s);
+            __CFPListRelease(s, pInfo->allocator);
         }
-        __CFPListRelease(stringData, pInfo->allocator);
-        return true;
     }
+    __CFPListStringBufferDestroy(&stringData);
+    return success;
 }
 
 static Boolean checkForCloseTag(_CFXMLPlistParseInfo *pInfo, const char *tag, CFIndex tagLen) {
@@ -1421,6 +1533,21 @@ static Boolean parseArrayTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
     return true;
 }
 
+CF_PRIVATE void __CFDictionaryAddValues(CFMutableDictionaryRef dict, const void **klist, const void **vlist, CFIndex numValues);
+
+#define PLIST_DICT_BUFFER_COUNT 32
+
+static void __CFPListReleaseKeysAndValues(const void **keys, const void **values, CFIndex count, const void **buffer, CFAllocatorRef allocator) {
+    for (CFIndex idx = 0; idx < count; idx++) {
+        __CFPListRelease(keys[idx], allocator);
+        __CFPListRelease(values[idx], allocator);
+    }
+    if (keys != buffer) {
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, keys);
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, values);
+    }
+}
+
 static Boolean parseDictTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
     Boolean gotKey;
     Boolean result;
@@ -1458,6 +1585,10 @@ static Boolean parseDictTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
     __CFPropertyListCreateSplitKeypaths(pInfo->allocator, pInfo->keyPaths, &theseKeyPaths, &nextKeyPaths);
     
     CFMutableDictionaryRef dict = NULL;
+    // the entries are collected first so that the dictionary is built with one sizing of its table
+    const void *keyBuffer[PLIST_DICT_BUFFER_COUNT], *valueBuffer[PLIST_DICT_BUFFER_COUNT];
+    const void **keys = keyBuffer, **values = valueBuffer;
+    CFIndex count = 0, capacity = PLIST_DICT_BUFFER_COUNT;
     
     result = getContentObject(pInfo, &gotKey, &key);
     while (result && key) {
@@ -1466,7 +1597,7 @@ static Boolean parseDictTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
             __CFPListRelease(key, pInfo->allocator);
             __CFPListRelease(nextKeyPaths, pInfo->allocator);
             __CFPListRelease(theseKeyPaths, pInfo->allocator);
-            __CFPListRelease(dict, pInfo->allocator);
+            __CFPListReleaseKeysAndValues(keys, values, count, keyBuffer, pInfo->allocator);
             return false;
         }
         
@@ -1485,16 +1616,30 @@ static Boolean parseDictTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
             __CFPListRelease(key, pInfo->allocator);
             __CFPListRelease(nextKeyPaths, pInfo->allocator);
             __CFPListRelease(theseKeyPaths, pInfo->allocator);
-            __CFPListRelease(dict, pInfo->allocator);
+            __CFPListReleaseKeysAndValues(keys, values, count, keyBuffer, pInfo->allocator);
             return false;
         }
         
         if (key && value) {
-            if (NULL == dict) {
-                dict = CFDictionaryCreateMutable(pInfo->allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
-                _CFDictionarySetCapacity(dict, 10);
+            if (count == capacity) {
+                capacity *= 2;
+                const void **newKeys = (const void **)CFAllocatorAllocate(kCFAllocatorSystemDefault, capacity * sizeof(const void *), 0);
+                const void **newValues = (const void **)CFAllocatorAllocate(kCFAllocatorSystemDefault, capacity * sizeof(const void *), 0);
+                memmove(newKeys, keys, count * sizeof(const void *));
+                memmove(newValues, values, count * sizeof(const void *));
+                if (keys != keyBuffer) {
+                    CFAllocatorDeallocate(kCFAllocatorSystemDefault, keys);
+                    CFAllocatorDeallocate(kCFAllocatorSystemDefault, values);
+                }
+                keys = newKeys;
+                values = newValues;
             }
-            CFDictionarySetValue(dict, key, value);
+            // the lists take over the references
+            keys[count] = key;
+            values[count] = value;
+            count++;
+            key = NULL;
+            value = NULL;
         }
         
         __CFPListRelease(key, pInfo->allocator);
@@ -1508,6 +1653,17 @@ static Boolean parseDictTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
     __CFPListRelease(nextKeyPaths, pInfo->allocator);
     __CFPListRelease(theseKeyPaths, pInfo->allocator);
 
+    if (0 < count) {
+        // added last to first, so that of repeated keys the last one wins, as with CFDictionarySetValue
+        for (CFIndex lo = 0, hi = count - 1; lo < hi; lo++, hi--) {
+            const void *tmp = keys[lo]; keys[lo] = keys[hi]; keys[hi] = tmp;
+            tmp = values[lo]; values[lo] = values[hi]; values[hi] = tmp;
+        }
+        dict = CFDictionaryCreateMutable(pInfo->allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        __CFDictionaryAddValues(dict, keys, values, count);
+    }
+    __CFPListReleaseKeysAndValues(keys, values, count, keyBuffer, pInfo->allocator);
+
     if (checkForCloseTag(pInfo, CFXMLPlistTags[DICT_IX], DICT_TAG_LENGTH)) {
 	if (NULL == dict) {
 	    if (pInfo->mutabilityOption == kCFPropertyListImmutable) {
@@ -1546,6 +1702,21 @@ static Boolean parseDictTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
     return false;
 }
 
+static uint8_t *__CFPListGrowDataBuffer(CFAllocatorRef allocator, uint8_t *tmpbuf, int *tmpbuflen) {
+    if (*tmpbuflen < 256 * 1024) {
+        *tmpbuflen *= 4;
+    } else if (*tmpbuflen < 16 * 1024 * 1024) {
+        *tmpbuflen *= 2;
+    } else {
+        // once in this stage, this will be really slow
+        // and really potentially fragment memory
+        *tmpbuflen += 256 * 1024;
+    }
+    tmpbuf = (uint8_t *)CFAllocatorReallocate(allocator, tmpbuf, *tmpbuflen, 0);
+    if (!tmpbuf) HALT; // out of memory
+    return tmpbuf;
+}
+
 static Boolean parseDataTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
     const char *base = pInfo->curr;
     static const signed char dataDecodeTable[128] = {
@@ -1575,6 +1746,25 @@ static Boolean parseDataTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
     int cntr = 0;
     
     for (; pInfo->curr < pInfo->end; pInfo->curr++) {
+#if __CF_PLIST_BASE64_BLOCKS
+        // Runs of 16 base64 digits starting on a quad boundary, which is most of a <data>, are checked a block at a time and decoded without the checks per character
+        while (0 == (cntr & 0x3) && 16 <= pInfo->end - pInfo->curr && __CFPListIsBase64Block(pInfo->curr)) {
+            if (!pInfo->skip) {
+                if (tmpbuflen < tmpbufpos + 12) tmpbuf = __CFPListGrowDataBuffer(pInfo->allocator, tmpbuf, &tmpbuflen);
+                const uint8_t *in = (const uint8_t *)pInfo->curr;
+                for (int quad = 0; quad < 16; quad += 4) {
+                    int bits = (dataDecodeTable[in[quad]] << 18) | (dataDecodeTable[in[quad + 1]] << 12) | (dataDecodeTable[in[quad + 2]] << 6) | dataDecodeTable[in[quad + 3]];
+                    tmpbuf[tmpbufpos++] = (bits >> 16) & 0xff;
+                    tmpbuf[tmpbufpos++] = (bits >> 8) & 0xff;
+                    tmpbuf[tmpbufpos++] = bits & 0xff;
+                }
+            }
+            pInfo->curr += 16;
+            cntr += 16;
+            numeq = 0;
+        }
+        if (pInfo->curr >= pInfo->end) break;
+#endif
         signed char c = *(pInfo->curr);
         if (c == '<') {
             break;
@@ -1584,25 +1774,13 @@ static Boolean parseDataTag(_CFXMLPlistParseInfo *pInfo, CFTypeRef *out) {
         } else if (!isspace(c)) {
             numeq = 0;
         }
-        if (dataDecodeTable[c] < 0)
+        if (c < 0 || dataDecodeTable[c] < 0)
             continue;
         cntr++;
         acc <<= 6;
         acc += dataDecodeTable[c];
         if (!pInfo->skip && 0 == (cntr & 0x3)) {
-            if (tmpbuflen <= tmpbufpos + 2) {
-                if (tmpbuflen < 256 * 1024) {
-                    tmpbuflen *= 4;
-                } else if (tmpbuflen < 16 * 1024 * 1024) {
-                    tmpbuflen *= 2;
-                } else {
-                    // once in this stage, this will be really slow
-                    // and really potentially fragment memory
-                    tmpbuflen += 256 * 1024;
-                }
-                tmpbuf = (uint8_t *)CFAllocatorReallocate(pInfo->allocator, tmpbuf, tmpbuflen, 0);
-                if (!tmpbuf) HALT; // out of memory
-            }
+            if (tmpbuflen <= tmpbufpos + 2) tmpbuf = __CFPListGrowDataBuffer(pInfo->allocator, tmpbuf, &tmpbuflen);
             tmpbuf[tmpbufpos++] = (acc >> 16) & 0xff;
             if (numeq < 2) tmpbuf[tmpbufpos++] = (acc >> 8) & 0xff;
             if (numeq < 1) tmpbuf[tmpbufpos++] = acc & 0xff;
@@ -2444,6 +2622,7 @@ static Boolean _CFPropertyListCreateWithData(CFAllocatorRef allocator, CFDataRef
 	if (format) *format = kCFPropertyListBinaryFormat_v1_0;
         return true;
     }
+    option &= ~_kCFPropertyListDecodeConcurrently;	// binary only
     
     // Use our own error variable here so we can check it against NULL later
     CFErrorRef subError = NULL;
@@ -959,6 +959,13 @@ Boolean __CFSocketGetBytesAvailable(CFSocketRef s, CFIndex* ctBytesAvailable) {
 #include <sys/un.h>
 #include <libc.h>
 #include <dlfcn.h>
+#elif DEPLOYMENT_TARGET_LINUX
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <fcntl.h>
 #endif
 #include <CoreFoundation/CFArray.h>
 #include <CoreFoundation/CFData.h>
@@ -1002,10 +1009,28 @@ CF_PRIVATE int _NS_gettimeofday(struct timeval *tv, struct timezone *tz);
 
 // On Mach we use a v0 RunLoopSource to make client callbacks.  That source is signalled by a
 // separate SocketManager thread who uses select() to watch the sockets' fds.
+// On Linux the SocketManager thread waits in epoll_wait() instead, so that a wakeup costs time
+// in proportion to the sockets which are ready rather than to the highest fd being watched.
 
 //#define LOG_CFSOCKET
 
-#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI
+#if DEPLOYMENT_TARGET_LINUX
+#define __CFSOCKET_EPOLL 1
+
+#ifndef NBBY
+#define NBBY 8
+#endif
+
+// glibc checks fds against FD_SETSIZE in these; the fd sets here are grown as needed instead
+#undef FD_SET
+#undef FD_CLR
+#undef FD_ISSET
+#define FD_SET(n, p) (((fd_mask *)(p))[(n) / NFDBITS] |= ((fd_mask)1 << ((n) % NFDBITS)))
+#define FD_CLR(n, p) (((fd_mask *)(p))[(n) / NFDBITS] &= ~((fd_mask)1 << ((n) % NFDBITS)))
+#define FD_ISSET(n, p) ((((const fd_mask *)(p))[(n) / NFDBITS] & ((fd_mask)1 << ((n) % NFDBITS))) != 0)
+#endif
+
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI || DEPLOYMENT_TARGET_LINUX
 #define INVALID_SOCKET (CFSocketNativeHandle)(-1)
 #define closesocket(a) close((a))
 #define ioctlsocket(a,b,c) ioctl((a),(b),(c))
@@ -1057,7 +1082,7 @@ CF_INLINE Boolean __CFSocketFdSet(CFSocketNativeHandle sock, CFMutableDataRef fd
 */
 static CFSpinLock_t __CFAllSocketsLock = CFSpinLockInit; /* controls __CFAllSockets */
 static CFMutableDictionaryRef __CFAllSockets = NULL;
-static CFSpinLock_t __CFActiveSocketsLock = CFSpinLockInit; /* controls __CFRead/WriteSockets, __CFRead/WriteSocketsFds, __CFSocketManagerThread, and __CFSocketManagerIteration */
+static CFSpinLock_t __CFActiveSocketsLock = CFSpinLockInit; /* controls __CFRead/WriteSockets, __CFRead/WriteSocketsFds, __CFActiveSocketsByFd, __CFSocketManagerThread, and __CFSocketManagerIteration */
 static volatile UInt32 __CFSocketManagerIteration = 0;
 static CFMutableArrayRef __CFWriteSockets = NULL;
 static CFMutableArrayRef __CFReadSockets = NULL;
@@ -1069,6 +1094,13 @@ static Boolean __CFReadSocketsTimeoutInvalid = true;  /* rebuild the timeout val
 static CFSocketNativeHandle __CFWakeupSocketPair[2] = {INVALID_SOCKET, INVALID_SOCKET};
 static void *__CFSocketManagerThread = NULL;
 
+#if __CFSOCKET_EPOLL
+#define __kCFSocketEpollBatchSize 256
+static int __CFSocketEpollFd = -1;
+static CFMutableDictionaryRef __CFActiveSocketsByFd = NULL;    /* the sockets in __CFRead/WriteSockets by native handle, for the manager to look up ready fds */
+static Boolean __CFSocketManagerHasTimeout = false;     /* whether the manager is waiting with a read buffer timeout */
+#endif
+
 static void __CFSocketDoCallback(CFSocketRef s, CFDataRef data, CFDataRef address, CFSocketNativeHandle sock);
 
 struct __CFSocket {
@@ -1223,8 +1255,12 @@ CF_INLINE Boolean __CFSocketFdClr(CFSocketNativeHandle sock, CFMutableDataRef fd
     return retval;
 }
 
+CF_INLINE Boolean __CFSocketFdIsSet(CFSocketNativeHandle sock, CFDataRef fdSet) {
+    return (INVALID_SOCKET != sock && 0 <= sock && sock < __CFSocketFdGetSize(fdSet) && FD_ISSET(sock, (const fd_set *)CFDataGetBytePtr(fdSet)));
+}
+
 static SInt32 __CFSocketCreateWakeupSocketPair(void) {
-#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI || DEPLOYMENT_TARGET_LINUX
     SInt32 error;
 
     error = socketpair(PF_LOCAL, SOCK_DGRAM, 0, __CFWakeupSocketPair);
@@ -1266,48 +1302,93 @@ static SInt32 __CFSocketCreateWakeupSocketPair(void) {
 }
 
 
+#if __CFSOCKET_EPOLL
+/* Brings the epoll registration of sock in line with the read and write fd sets.  Registration is
+ * edge-triggered.  When the manager takes a ready socket out of the fd sets it leaves the registration
+ * alone, and drops the events which arrive for it meanwhile; putting the socket back re-registers it
+ * with EPOLL_CTL_MOD, which reports it straight away if it became ready in between.
+ */
+static void __CFSocketEpollUpdate(CFSocketNativeHandle sock) {
+    struct epoll_event event;
+    if (0 > __CFSocketEpollFd || INVALID_SOCKET == sock || 0 > sock) return;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLET;
+    if (__CFSocketFdIsSet(sock, __CFReadSocketsFds)) event.events |= EPOLLIN | EPOLLRDHUP;
+    if (__CFSocketFdIsSet(sock, __CFWriteSocketsFds)) event.events |= EPOLLOUT;
+    event.data.fd = sock;
+    if (EPOLLET == event.events) {
+        epoll_ctl(__CFSocketEpollFd, EPOLL_CTL_DEL, sock, &event);
+    } else if (0 != epoll_ctl(__CFSocketEpollFd, EPOLL_CTL_MOD, sock, &event) && ENOENT == errno) {
+        epoll_ctl(__CFSocketEpollFd, EPOLL_CTL_ADD, sock, &event);
+    }
+}
+#endif
+
+// Tells the manager thread that the fd sets changed.  epoll picks up the change by itself; there the
+// manager only needs waking when it may have to recompute its read buffer timeout.
+CF_INLINE void __CFSocketWakeUpManager(CFSocketRef s, uint8_t c) {
+#if __CFSOCKET_EPOLL
+    __CFSocketEpollUpdate(s->_socket);
+    if ('r' != c || (!__CFSocketManagerHasTimeout && !timerisset(&s->_readBufferTimeout) && NULL == s->_leftoverBytes)) return;
+#endif
+    if (INVALID_SOCKET != __CFWakeupSocketPair[0]) {
+        send(__CFWakeupSocketPair[0], (const char *)&c, sizeof(c), 0);
+    }
+}
+
 // Version 0 RunLoopSources set a mask in an FD set to control what socket activity we hear about.
 // Changes to the master fs_sets occur via these 4 functions.
 CF_INLINE Boolean __CFSocketSetFDForRead(CFSocketRef s) {
     __CFReadSocketsTimeoutInvalid = true;
     Boolean b = __CFSocketFdSet(s->_socket, __CFReadSocketsFds);
-    if (b && INVALID_SOCKET != __CFWakeupSocketPair[0]) {
-        uint8_t c = 'r';
-        send(__CFWakeupSocketPair[0], (const char *)&c, sizeof(c), 0);
-    }
+    if (b) __CFSocketWakeUpManager(s, 'r');
     return b;
 }
 
 CF_INLINE Boolean __CFSocketClearFDForRead(CFSocketRef s) {
     __CFReadSocketsTimeoutInvalid = true;
     Boolean b = __CFSocketFdClr(s->_socket, __CFReadSocketsFds);
-    if (b && INVALID_SOCKET != __CFWakeupSocketPair[0]) {
-        uint8_t c = 's';
-        send(__CFWakeupSocketPair[0], (const char *)&c, sizeof(c), 0);
-    }
+    if (b) __CFSocketWakeUpManager(s, 's');
     return b;
 }
 
 CF_INLINE Boolean __CFSocketSetFDForWrite(CFSocketRef s) {
 // CFLog(5, CFSTR("__CFSocketSetFDForWrite(%p)"), s);
     Boolean b = __CFSocketFdSet(s->_socket, __CFWriteSocketsFds);
-    if (b && INVALID_SOCKET != __CFWakeupSocketPair[0]) {
-        uint8_t c = 'w';
-        send(__CFWakeupSocketPair[0], (const char *)&c, sizeof(c), 0);
-    }
+    if (b) __CFSocketWakeUpManager(s, 'w');
     return b;
 }
 
 CF_INLINE Boolean __CFSocketClearFDForWrite(CFSocketRef s) {
 // CFLog(5, CFSTR("__CFSocketClearFDForWrite(%p)"), s);
     Boolean b = __CFSocketFdClr(s->_socket, __CFWriteSocketsFds);
-    if (b && INVALID_SOCKET != __CFWakeupSocketPair[0]) {
-        uint8_t c = 'x';
-        send(__CFWakeupSocketPair[0], (const char *)&c, sizeof(c), 0);
-    }
+    if (b) __CFSocketWakeUpManager(s, 'x');
     return b;
 }
 
+// Keep __CFActiveSocketsByFd in step with __CFRead/WriteSockets; called with __CFActiveSocketsLock held
+CF_INLINE void __CFSocketAddActiveSocket(CFSocketRef s) {
+#if __CFSOCKET_EPOLL
+    if (INVALID_SOCKET != s->_socket) CFDictionarySetValue(__CFActiveSocketsByFd, (void *)(uintptr_t)s->_socket, s);
+#endif
+}
+
+CF_INLINE void __CFSocketRemoveActiveSocket(CFSocketRef s) {
+#if __CFSOCKET_EPOLL
+    if (INVALID_SOCKET == s->_socket || 0 > s->_socket) return;
+    CFSocketRef owner = (CFSocketRef)CFDictionaryGetValue(__CFActiveSocketsByFd, (void *)(uintptr_t)s->_socket);
+    if (owner == s) CFDictionaryRemoveValue(__CFActiveSocketsByFd, (void *)(uintptr_t)s->_socket);
+    // Clearing the fd sets only updates the registration if the socket was in them, and the manager takes
+    // ready sockets out of them until they are rescheduled, so deregister here whatever the fd sets say;
+    // unless the fd has been reused by a socket added since, which now owns the registration
+    if ((owner == s || NULL == owner) && 0 <= __CFSocketEpollFd) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        epoll_ctl(__CFSocketEpollFd, EPOLL_CTL_DEL, s->_socket, &event);
+    }
+#endif
+}
+
 #if DEPLOYMENT_TARGET_WINDOWS
 static Boolean WinSockUsed = FALSE;
 
@@ -1356,6 +1437,14 @@ static void __CFSocketInitializeSockets(void) {
     zeroLengthData = CFDataCreateMutable(kCFAllocatorSystemDefault, 0);
 #if DEPLOYMENT_TARGET_WINDOWS
     __CFSocketInitializeWinSock_Guts();
+#endif
+#if __CFSOCKET_EPOLL
+    __CFActiveSocketsByFd = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, NULL, NULL);
+    __CFSocketEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (0 > __CFSocketEpollFd) {
+        CFLog(kCFLogLevelError, CFSTR("*** Could not create epoll instance for CFSocket!!!"));
+        HALT;
+    }
 #endif
     if (0 > __CFSocketCreateWakeupSocketPair()) {
         CFLog(kCFLogLevelWarning, CFSTR("*** Could not create wakeup socket pair for CFSocket!!!"));
@@ -1365,6 +1454,14 @@ static void __CFSocketInitializeSockets(void) {
         ioctlsocket(__CFWakeupSocketPair[0], FIONBIO, (u_long *)&yes);
         ioctlsocket(__CFWakeupSocketPair[1], FIONBIO, (u_long *)&yes);
         __CFSocketFdSet(__CFWakeupSocketPair[1], __CFReadSocketsFds);
+#if __CFSOCKET_EPOLL
+        // level-triggered, and drained by the manager whenever it fires
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = __CFWakeupSocketPair[1];
+        epoll_ctl(__CFSocketEpollFd, EPOLL_CTL_ADD, __CFWakeupSocketPair[1], &event);
+#endif
     }
 }
 
@@ -1414,9 +1511,19 @@ static CFRunLoopRef __CFSocketCopyRunLoopToWakeUp(CFRunLoopSourceRef src, CFMuta
     return rl;
 }
 
+// Wakes rl at once, or when the manager is collecting the run loops to wake for a whole batch of
+// ready sockets, adds it to runLoopsToWakeUp so that it is woken once after the batch is signalled.
+static void __CFSocketWakeUpRunLoop(CFRunLoopRef rl, CFMutableArrayRef runLoopsToWakeUp) {
+    if (NULL == runLoopsToWakeUp) {
+        CFRunLoopWakeUp(rl);
+    } else if (!CFArrayContainsValue(runLoopsToWakeUp, CFRangeMake(0, CFArrayGetCount(runLoopsToWakeUp)), rl)) {
+        CFArrayAppendValue(runLoopsToWakeUp, rl);
+    }
+}
+
 // If callBackNow, we immediately do client callbacks, else we have to signal a v0 RunLoopSource so the
 // callbacks can happen in another thread.
-static void __CFSocketHandleWrite(CFSocketRef s, Boolean callBackNow) {
+static void __CFSocketHandleWrite(CFSocketRef s, Boolean callBackNow, CFMutableArrayRef runLoopsToWakeUp) {
     SInt32 errorCode = 0;
     int errorSize = sizeof(errorCode);
     CFOptionFlags writeCallBacksAvailable;
@@ -1455,7 +1562,7 @@ static void __CFSocketHandleWrite(CFSocketRef s, Boolean callBackNow) {
         CFRunLoopRef rl = __CFSocketCopyRunLoopToWakeUp(source0, runLoopsCopy);
         if (source0) CFRelease(source0);
         if (NULL != rl) {
-            CFRunLoopWakeUp(rl);
+            __CFSocketWakeUpRunLoop(rl, runLoopsToWakeUp);
             CFRelease(rl);
         }
         __CFSocketLock(s);
@@ -1470,7 +1577,7 @@ static void __CFSocketHandleWrite(CFSocketRef s, Boolean callBackNow) {
     }
 }
 
-static void __CFSocketHandleRead(CFSocketRef s, Boolean causedByTimeout)
+static void __CFSocketHandleRead(CFSocketRef s, Boolean causedByTimeout, CFMutableArrayRef runLoopsToWakeUp)
 {
     CFDataRef data = NULL, address = NULL;
     CFSocketNativeHandle sock = INVALID_SOCKET;
@@ -1664,7 +1771,7 @@ static void __CFSocketHandleRead(CFSocketRef s, Boolean causedByTimeout)
     CFRunLoopRef rl = __CFSocketCopyRunLoopToWakeUp(source0, runLoopsCopy);
     if (source0) CFRelease(source0);
     if (NULL != rl) {
-        CFRunLoopWakeUp(rl);
+        __CFSocketWakeUpRunLoop(rl, runLoopsToWakeUp);
         CFRelease(rl);
     }
         __CFSocketLock(s);
@@ -1913,6 +2020,118 @@ static void __CFSocketWriteSocketList(CFArrayRef sockets, CFDataRef fdSet, Boole
 }
 #endif
 
+#if __CFSOCKET_EPOLL
+
+#ifdef __GNUC__
+__attribute__ ((noreturn))	// mostly interesting for shutting up a warning
+#endif /* __GNUC__ */
+static void __CFSocketManager(void * arg)
+{
+    pthread_setname_np(pthread_self(), "CFSocketManager");
+    struct epoll_event events[__kCFSocketEpollBatchSize];
+    SInt32 nrfds, idx, cnt;
+    int timeout = -1;
+    uint8_t buffer[256];
+    CFMutableArrayRef selectedWriteSockets = CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeArrayCallBacks);
+    CFMutableArrayRef selectedReadSockets = CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeArrayCallBacks);
+    CFMutableArrayRef runLoopsToWakeUp = CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeArrayCallBacks);
+    CFIndex selectedWriteSocketsIndex = 0, selectedReadSocketsIndex = 0;
+
+    for (;;) {
+        __CFSpinLock(&__CFActiveSocketsLock);
+        __CFSocketManagerIteration++;
+        if (__CFReadSocketsTimeoutInvalid) {
+            struct timeval* minTimeout = NULL;
+            __CFReadSocketsTimeoutInvalid = false;
+            CFArrayApplyFunction(__CFReadSockets, CFRangeMake(0, CFArrayGetCount(__CFReadSockets)), _calcMinTimeout_locked, (void*) &minTimeout);
+            // round up to whole milliseconds, so that the timeout never expires early
+            timeout = (NULL == minTimeout) ? -1 : (int)__CFMin((CFIndex)minTimeout->tv_sec * 1000 + (minTimeout->tv_usec + 999) / 1000, (CFIndex)INT_MAX);
+            __CFSocketManagerHasTimeout = (NULL != minTimeout);
+#if defined(LOG_CFSOCKET)
+            fprintf(stdout, "epoll_wait will have a %d ms timeout\n", timeout);
+#endif
+        }
+        __CFSpinUnlock(&__CFActiveSocketsLock);
+
+        nrfds = epoll_wait(__CFSocketEpollFd, events, __kCFSocketEpollBatchSize, timeout);
+
+#if defined(LOG_CFSOCKET)
+        fprintf(stdout, "socket manager woke from epoll_wait, ret=%ld\n", (long)nrfds);
+#endif
+        if (0 > nrfds) continue;    // EINTR; the registrations themselves cannot go bad the way select()'s fds can
+
+        __CFSpinLock(&__CFActiveSocketsLock);
+        if (0 == nrfds) {
+            /* timeout: kick off the expired reads through the normal read dispatch below */
+            cnt = CFArrayGetCount(__CFReadSockets);
+            for (idx = 0; idx < cnt; idx++) {
+                CFSocketRef s = (CFSocketRef)CFArrayGetValueAtIndex(__CFReadSockets, idx);
+                if ((timerisset(&s->_readBufferTimeout) || s->_leftoverBytes) && INVALID_SOCKET != s->_socket) {
+                    CFArraySetValueAtIndex(selectedReadSockets, selectedReadSocketsIndex, s);
+                    selectedReadSocketsIndex++;
+                    /* socket is removed from fds here, will be restored in read handling or in perform function */
+                    __CFSocketFdClr(s->_socket, __CFReadSocketsFds);
+                }
+            }
+        }
+        for (idx = 0; idx < nrfds; idx++) {
+            int sock = events[idx].data.fd;
+            uint32_t ready = events[idx].events;
+            if (sock == __CFWakeupSocketPair[1]) {
+                while (0 < recv(sock, (char *)buffer, sizeof(buffer), 0));
+                continue;
+            }
+            CFSocketRef s = (CFSocketRef)CFDictionaryGetValue(__CFActiveSocketsByFd, (void *)(uintptr_t)sock);
+            if (NULL == s) continue;
+            // as with select(), errors and hangups show up as readiness for whatever is being watched;
+            // sockets no longer in the fd sets are waiting to be rescheduled and their events are dropped
+            if ((ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && __CFSocketFdIsSet(sock, __CFWriteSocketsFds)) {
+                CFArraySetValueAtIndex(selectedWriteSockets, selectedWriteSocketsIndex, s);
+                selectedWriteSocketsIndex++;
+                /* socket is removed from fds here, restored by CFSocketReschedule */
+                __CFSocketFdClr(sock, __CFWriteSocketsFds);
+            }
+            if ((ready & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) && __CFSocketFdIsSet(sock, __CFReadSocketsFds)) {
+                CFArraySetValueAtIndex(selectedReadSockets, selectedReadSocketsIndex, s);
+                selectedReadSocketsIndex++;
+                /* socket is removed from fds here, will be restored in read handling or in perform function */
+                __CFSocketFdClr(sock, __CFReadSocketsFds);
+            }
+        }
+        __CFSpinUnlock(&__CFActiveSocketsLock);
+
+        // signal the whole batch, then wake each run loop involved once
+        for (idx = 0; idx < selectedWriteSocketsIndex; idx++) {
+            CFSocketRef s = (CFSocketRef)CFArrayGetValueAtIndex(selectedWriteSockets, idx);
+            if (kCFNull == (CFNullRef)s) continue;
+#if defined(LOG_CFSOCKET)
+            fprintf(stdout, "socket manager signaling socket %d for write\n", s->_socket);
+#endif
+            __CFSocketHandleWrite(s, FALSE, runLoopsToWakeUp);
+            CFArraySetValueAtIndex(selectedWriteSockets, idx, kCFNull);
+        }
+        selectedWriteSocketsIndex = 0;
+
+        for (idx = 0; idx < selectedReadSocketsIndex; idx++) {
+            CFSocketRef s = (CFSocketRef)CFArrayGetValueAtIndex(selectedReadSockets, idx);
+            if (kCFNull == (CFNullRef)s) continue;
+#if defined(LOG_CFSOCKET)
+            fprintf(stdout, "socket manager signaling socket %d for read\n", s->_socket);
+#endif
+            __CFSocketHandleRead(s, nrfds == 0, runLoopsToWakeUp);
+            CFArraySetValueAtIndex(selectedReadSockets, idx, kCFNull);
+        }
+        selectedReadSocketsIndex = 0;
+
+        for (idx = 0, cnt = CFArrayGetCount(runLoopsToWakeUp); idx < cnt; idx++) {
+            CFRunLoopWakeUp((CFRunLoopRef)CFArrayGetValueAtIndex(runLoopsToWakeUp, idx));
+        }
+        CFArrayRemoveAllValues(runLoopsToWakeUp);
+    }
+}
+
+#else /* !__CFSOCKET_EPOLL */
+
 static void
 clearInvalidFileDescriptors(CFMutableDataRef d)
 {
@@ -2178,7 +2397,7 @@ static void __CFSocketManager(void * arg)
 #if defined(LOG_CFSOCKET)
             fprintf(stdout, "socket manager signaling socket %d for write\n", s->_socket);
 #endif
-            __CFSocketHandleWrite(s, FALSE);
+            __CFSocketHandleWrite(s, FALSE, NULL);
             CFArraySetValueAtIndex(selectedWriteSockets, idx, kCFNull);
         }
         selectedWriteSocketsIndex = 0;
@@ -2189,13 +2408,15 @@ static void __CFSocketManager(void * arg)
 #if defined(LOG_CFSOCKET)
             fprintf(stdout, "socket manager signaling socket %d for read\n", s->_socket);
 #endif
-            __CFSocketHandleRead(s, nrfds == 0);
+            __CFSocketHandleRead(s, nrfds == 0, NULL);
             CFArraySetValueAtIndex(selectedReadSockets, idx, kCFNull);
         }
         selectedReadSocketsIndex = 0;
     }
 }
 
+#endif /* __CFSOCKET_EPOLL */
+
 static CFStringRef __CFSocketCopyDescription(CFTypeRef cf) {
     CFSocketRef s = (CFSocketRef)cf;
     CFMutableStringRef result;
@@ -2410,6 +2631,7 @@ void CFSocketInvalidate(CFSocketRef s) {
             CFArrayRemoveValueAtIndex(__CFReadSockets, idx);
             __CFSocketClearFDForRead(s);
         }
+        __CFSocketRemoveActiveSocket(s);
         previousSocketManagerIteration = __CFSocketManagerIteration;
         __CFSpinUnlock(&__CFActiveSocketsLock);
         CFDictionaryRemoveValue(__CFAllSockets, (void *)(uintptr_t)(s->_socket));
@@ -2612,6 +2834,7 @@ void __CFSocketEnableCallBacks(CFSocketRef s, CFOptionFlags callBackTypes, Boole
                 if (force) {
                     SInt32 idx = CFArrayGetFirstIndexOfValue(__CFWriteSockets, CFRangeMake(0, CFArrayGetCount(__CFWriteSockets)), s);
                     if (kCFNotFound == idx) CFArrayAppendValue(__CFWriteSockets, s);
+                    __CFSocketAddActiveSocket(s);
 //                     if (kCFNotFound == idx) CFLog(5, CFSTR("__CFSocketEnableCallBacks: put %p in __CFWriteSockets list due to force and non-presence"), s);
                 }
                 if (__CFSocketSetFDForWrite(s)) wakeup = true;
@@ -2620,6 +2843,7 @@ void __CFSocketEnableCallBacks(CFSocketRef s, CFOptionFlags callBackTypes, Boole
                 if (force) {
                     SInt32 idx = CFArrayGetFirstIndexOfValue(__CFReadSockets, CFRangeMake(0, CFArrayGetCount(__CFReadSockets)), s);
                     if (kCFNotFound == idx) CFArrayAppendValue(__CFReadSockets, s);
+                    __CFSocketAddActiveSocket(s);
                 }
                 if (__CFSocketSetFDForRead(s)) wakeup = true;
             }
@@ -2681,6 +2905,7 @@ static void __CFSocketCancel(void *info, CFRunLoopRef rl, CFStringRef mode) {
             CFArrayRemoveValueAtIndex(__CFReadSockets, idx);
             __CFSocketClearFDForRead(s);
         }
+        __CFSocketRemoveActiveSocket(s);
         __CFSpinUnlock(&__CFActiveSocketsLock);
     }
     if (NULL != s->_runLoops) {
@@ -27,7 +27,11 @@
 */
 
 #include <CoreFoundation/CFBase.h>
+#include <CoreFoundation/CFNumber.h>
+#include <CoreFoundation/CFString.h>
+#include <CoreFoundation/CFDate.h>
 #include "CFInternal.h"
+#include <math.h>
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
 #include <dispatch/dispatch.h>
 #endif
@@ -344,3 +348,229 @@ void CFMergeSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparat
 }
 
 
+#pragma mark Sorting arrays of values
+
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
+// dispatch keeps its own threads, so a sort needs no pool of its own
+struct __CFSortPool;
+
+static struct __CFSortPool *__CFSortPoolCreate(CFIndex width) {
+    return NULL;
+}
+
+static void __CFSortPoolDestroy(struct __CFSortPool *pool) {
+}
+
+static void __CFSortApply(struct __CFSortPool *pool, size_t count, void (^block)(size_t)) {
+    dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, DISPATCH_QUEUE_OVERCOMMIT), block);
+}
+#else
+// No dispatch here, so a sort starts a few threads of its own, which run the iterations of each of its __CFSortApply calls together with the calling thread
+
+struct __CFSortPool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;	// the workers wait here for the next job
+    pthread_cond_t done;	// the caller waits here for the workers to finish a job
+    void (^block)(size_t);
+    size_t count;
+    size_t next;		// the next iteration to run
+    uint32_t generation;	// counts the jobs
+    CFIndex busy;		// workers not yet finished with the current job
+    Boolean exiting;
+    CFIndex nthreads;
+    pthread_t threads[63];
+};
+
+static void __CFSortPoolRun(struct __CFSortPool *pool) {
+    for (;;) {
+        size_t idx = __sync_fetch_and_add(&pool->next, 1);
+        if (pool->count <= idx) break;
+        pool->block(idx);
+    }
+}
+
+static void *__CFSortPoolWorker(void *arg) {
+    struct __CFSortPool *pool = (struct __CFSortPool *)arg;
+    uint32_t generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == generation && !pool->exiting) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->exiting) break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        __CFSortPoolRun(pool);
+        pthread_mutex_lock(&pool->lock);
+        if (0 == --pool->busy) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// width is the most iterations any one job will have; NULL, or a pool without threads, runs the jobs on the calling thread
+static struct __CFSortPool *__CFSortPoolCreate(CFIndex width) {
+    CFIndex nthreads = __CFMin(__CFMin(__CFActiveProcessorCount(), width) - 1, 63);
+    if (nthreads <= 0) return NULL;
+    struct __CFSortPool *pool = (struct __CFSortPool *)calloc(1, sizeof(struct __CFSortPool));
+    if (!pool) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (CFIndex idx = 0; idx < nthreads; idx++) {
+        if (pthread_create(&pool->threads[idx], NULL, __CFSortPoolWorker, pool) != 0) break;
+        pool->nthreads = idx + 1;
+    }
+    return pool;
+}
+
+static void __CFSortPoolDestroy(struct __CFSortPool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->exiting = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (CFIndex idx = 0; idx < pool->nthreads; idx++) {
+        pthread_join(pool->threads[idx], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static void __CFSortApply(struct __CFSortPool *pool, size_t count, void (^block)(size_t)) {
+    if (!pool || 0 == pool->nthreads) {
+        for (size_t idx = 0; idx < count; idx++) block(idx);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->block = block;
+    pool->count = count;
+    pool->next = 0;
+    pool->busy = pool->nthreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    __CFSortPoolRun(pool);
+    pthread_mutex_lock(&pool->lock);
+    while (0 != pool->busy) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+#endif
+
+typedef const void *__CFSortValue;
+
+struct __CFSortComparatorContext {
+    CFComparatorFunction func;
+    void *context;
+};
+
+#define SORT_NAME		__CFSortValuesWithComparator
+#define SORT_ELEMENT_TYPE	__CFSortValue
+#define SORT_CONTEXT_TYPE	struct __CFSortComparatorContext *
+#define SORT_LESS_OR_EQUAL(A, B, C)	((CFComparisonResult)INVOKE_CALLBACK3((C)->func, (A), (B), (C)->context) <= 0)
+#include "CFSortFunctionsMerge.m"
+
+/* A value together with a key which orders it.  Values with the same key are equal, unless bytes is set, in which case the key is the first 8 bytes (big-endian, zero padded) and the whole byte strings decide. */
+typedef struct {
+    uint64_t key;
+    const void *value;
+    const uint8_t *bytes;
+    CFIndex length;
+} __CFSortKeyedValue;
+
+CF_INLINE bool __CFSortKeyedValueLessOrEqual(const __CFSortKeyedValue *v1, const __CFSortKeyedValue *v2) {
+    if (v1->key != v2->key) return v1->key < v2->key;
+    if (!v1->bytes) return true;
+    int res = memcmp(v1->bytes, v2->bytes, __CFMin(v1->length, v2->length));
+    return (res != 0) ? (res < 0) : (v1->length <= v2->length);
+}
+
+#define SORT_NAME		__CFSortKeyedValues
+#define SORT_ELEMENT_TYPE	__CFSortKeyedValue
+#define SORT_CONTEXT_TYPE	void *
+#define SORT_LESS_OR_EQUAL(A, B, C)	__CFSortKeyedValueLessOrEqual(&(A), &(B))
+#include "CFSortFunctionsMerge.m"
+
+// number of sections to sort concurrently; a power of 2
+static CFIndex __CFSortSectionCount(CFIndex count) {
+    if (count < 65536) return 1;
+    CFIndex ncores = __CFActiveProcessorCount();
+    CFIndex nsect = 1;
+    while (nsect < ncores && nsect < 64 && nsect * 2 * 16384 <= count) nsect *= 2;
+    return nsect;
+}
+
+/* CFNumberCompare orders integers by value and floats by value with -0.0 before 0.0; both map to unsigned 64-bit keys if the array is all integers that fit in 64 bits, or all floats without NaNs. */
+static Boolean __CFSortGetNumberKeys(const void **values, CFIndex count, __CFSortKeyedValue *keyed) {
+    CFTypeID numberTypeID = CFNumberGetTypeID();
+    Boolean isFloat = false;
+    for (CFIndex idx = 0; idx < count; idx++) {
+        CFNumberRef num = (CFNumberRef)values[idx];
+        if (!num || CF_IS_OBJC(numberTypeID, num) || CFGetTypeID(num) != numberTypeID) return false;
+        Boolean numIsFloat = CFNumberIsFloatType(num);
+        if (0 == idx) isFloat = numIsFloat;
+        if (numIsFloat != isFloat) return false;
+        uint64_t key;
+        if (isFloat) {
+            Float64 d;
+            CFNumberGetValue(num, kCFNumberFloat64Type, &d);
+            if (isnan(d)) return false;
+            memmove(&key, &d, sizeof(key));
+            key = (key & 0x8000000000000000ULL) ? ~key : (key | 0x8000000000000000ULL);
+        } else {
+            SInt64 i;
+            if (!CFNumberGetValue(num, kCFNumberSInt64Type, &i)) return false;
+            key = (uint64_t)i ^ 0x8000000000000000ULL;
+        }
+        keyed[idx].key = key;
+        keyed[idx].value = num;
+        keyed[idx].bytes = NULL;
+        keyed[idx].length = 0;
+    }
+    return true;
+}
+
+/* A literal CFStringCompare orders by UTF-16 code unit, which for ASCII strings is the order of their bytes. */
+static Boolean __CFSortGetStringKeys(const void **values, CFIndex count, __CFSortKeyedValue *keyed) {
+    CFTypeID stringTypeID = CFStringGetTypeID();
+    for (CFIndex idx = 0; idx < count; idx++) {
+        CFStringRef str = (CFStringRef)values[idx];
+        if (!str || CF_IS_OBJC(stringTypeID, str) || CFGetTypeID(str) != stringTypeID) return false;
+        const uint8_t *bytes = (const uint8_t *)CFStringGetCStringPtr(str, kCFStringEncodingASCII);
+        if (!bytes) return false;
+        CFIndex length = CFStringGetLength(str);
+        uint64_t key = 0;
+        for (CFIndex cnt = 0; cnt < 8; cnt++) {
+            key = (key << 8) | ((cnt < length) ? bytes[cnt] : 0);
+        }
+        keyed[idx].key = key;
+        keyed[idx].value = str;
+        keyed[idx].bytes = bytes;
+        keyed[idx].length = length;
+    }
+    return true;
+}
+
+/* Stable sort of an array of values, as done by CFArraySortValues.  Arrays of CF numbers or ASCII strings under CFNumberCompare or a literal CFStringCompare are sorted on extracted keys without calling the comparator.  Large arrays are sorted concurrently when the comparator is one of CF's own, which are safe to call from several threads; other comparators are always called from this thread only. */
+CF_PRIVATE void __CFSortValues(const void **values, CFIndex count, CFComparatorFunction comparator, void *context) {
+    if (count < 2) return;
+    CFIndex nsect = __CFSortSectionCount(count);
+    if (64 <= count && (comparator == (CFComparatorFunction)CFNumberCompare || (comparator == (CFComparatorFunction)CFStringCompare && !context))) {
+        __CFSortKeyedValue *keyed = (__CFSortKeyedValue *)malloc(count * sizeof(__CFSortKeyedValue));
+        if (!keyed) HALT;
+        Boolean haveKeys = (comparator == (CFComparatorFunction)CFNumberCompare) ? __CFSortGetNumberKeys(values, count, keyed) : __CFSortGetStringKeys(values, count, keyed);
+        if (haveKeys) {
+            __CFSortKeyedValues(keyed, count, nsect, NULL);
+            for (CFIndex idx = 0; idx < count; idx++) values[idx] = keyed[idx].value;
+            free(keyed);
+            return;
+        }
+        free(keyed);
+    }
+    if (comparator != (CFComparatorFunction)CFNumberCompare && comparator != (CFComparatorFunction)CFStringCompare && comparator != (CFComparatorFunction)CFDateCompare) {
+        nsect = 1;
+    }
+    struct __CFSortComparatorContext ctx = {comparator, context};
+    __CFSortValuesWithComparator(values, count, nsect, &ctx);
+}
+
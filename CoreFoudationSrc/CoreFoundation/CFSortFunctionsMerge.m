@@ -0,0 +1,159 @@
+/*
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*	CFSortFunctionsMerge.m
+	Not part of Apple's CoreFoundation sources; added in this tree and
+	distributed under the same license.
+*/
+
+/* A stable merge sort, #included by CFSortFunctions.c once for each element type so that the comparison is inlined.  Large lists are cut into sections which are sorted concurrently; the sections are then merged pairwise, and each pairwise merge is itself split at evenly spaced output positions (found by binary search) so that every round of merging keeps all sections busy, rather than running fewer and larger merges each round.
+*/
+
+/* SORT_ELEMENT_TYPE must be a single identifier (a typedef name for pointer types), as it is used in declarations with several declarators. */
+
+#if !defined(SORT_NAME) || !defined(SORT_ELEMENT_TYPE) || !defined(SORT_CONTEXT_TYPE) || !defined(SORT_LESS_OR_EQUAL)
+#error All of SORT_NAME, SORT_ELEMENT_TYPE, SORT_CONTEXT_TYPE, and SORT_LESS_OR_EQUAL must be defined before #including this file.
+#endif
+
+#define SORT_FN_(N, X) N##X
+#define SORT_FN(N, X) SORT_FN_(N, X)
+
+static void SORT_FN(SORT_NAME, _InsertionSort)(SORT_ELEMENT_TYPE *list, CFIndex cnt, SORT_CONTEXT_TYPE ctx) {
+    for (CFIndex idx = 1; idx < cnt; idx++) {
+        SORT_ELEMENT_TYPE v = list[idx];
+        CFIndex pos = idx;
+        while (0 < pos && !SORT_LESS_OR_EQUAL(list[pos - 1], v, ctx)) {
+            list[pos] = list[pos - 1];
+            pos--;
+        }
+        list[pos] = v;
+    }
+}
+
+// merges listp1 and listp2 into dst, taking from listp1 first on ties
+static void SORT_FN(SORT_NAME, _Merge)(const SORT_ELEMENT_TYPE *listp1, CFIndex cnt1, const SORT_ELEMENT_TYPE *listp2, CFIndex cnt2, SORT_ELEMENT_TYPE *dst, SORT_CONTEXT_TYPE ctx) {
+    const SORT_ELEMENT_TYPE *listp1_end = listp1 + cnt1, *listp2_end = listp2 + cnt2;
+    // if the last element of listp1 <= the first of listp2, lists are already ordered
+    if (0 < cnt1 && 0 < cnt2 && !SORT_LESS_OR_EQUAL(listp1_end[-1], listp2[0], ctx)) {
+        for (;;) {
+            if (SORT_LESS_OR_EQUAL(*listp1, *listp2, ctx)) {
+                *dst++ = *listp1++;
+                if (listp1 == listp1_end) break;
+            } else {
+                *dst++ = *listp2++;
+                if (listp2 == listp2_end) break;
+            }
+        }
+    }
+    memmove(dst, listp1, (listp1_end - listp1) * sizeof(SORT_ELEMENT_TYPE));
+    dst += listp1_end - listp1;
+    memmove(dst, listp2, (listp2_end - listp2) * sizeof(SORT_ELEMENT_TYPE));
+}
+
+// bottom-up: insertion sorted runs of 16, then merge passes alternating between listp and tmp
+static void SORT_FN(SORT_NAME, _SerialSort)(SORT_ELEMENT_TYPE *listp, CFIndex cnt, SORT_ELEMENT_TYPE *tmp, SORT_CONTEXT_TYPE ctx) {
+    for (CFIndex idx = 0; idx < cnt; idx += 16) {
+        SORT_FN(SORT_NAME, _InsertionSort)(listp + idx, __CFMin(16, cnt - idx), ctx);
+    }
+    SORT_ELEMENT_TYPE *src = listp, *dst = tmp;
+    for (CFIndex width = 16; width < cnt; width *= 2) {
+        for (CFIndex lo = 0; lo < cnt; lo += 2 * width) {
+            CFIndex mid = __CFMin(lo + width, cnt), hi = __CFMin(lo + 2 * width, cnt);
+            SORT_FN(SORT_NAME, _Merge)(src + lo, mid - lo, src + mid, hi - mid, dst + lo, ctx);
+        }
+        SORT_ELEMENT_TYPE *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != listp) memmove(listp, src, cnt * sizeof(SORT_ELEMENT_TYPE));
+}
+
+// returns how many of the first outIdx elements of the merge of listp1 and listp2 come from listp1
+static CFIndex SORT_FN(SORT_NAME, _SplitPoint)(CFIndex outIdx, const SORT_ELEMENT_TYPE *listp1, CFIndex cnt1, const SORT_ELEMENT_TYPE *listp2, CFIndex cnt2, SORT_CONTEXT_TYPE ctx) {
+    CFIndex lo = (cnt2 < outIdx) ? outIdx - cnt2 : 0;
+    CFIndex hi = (outIdx < cnt1) ? outIdx : cnt1;
+    while (lo < hi) {
+        CFIndex idx1 = lo + (hi - lo) / 2, idx2 = outIdx - idx1;
+        // listp1[idx1] comes after listp2[idx2 - 1] only if it is strictly greater
+        if (!SORT_LESS_OR_EQUAL(listp1[idx1], listp2[idx2 - 1], ctx)) {
+            hi = idx1;
+        } else {
+            lo = idx1 + 1;
+        }
+    }
+    return lo;
+}
+
+// nsect must be a power of 2
+static void SORT_FN(SORT_NAME, _ConcurrentSort)(SORT_ELEMENT_TYPE *listp, CFIndex cnt, SORT_ELEMENT_TYPE *tmp, CFIndex nsect, SORT_CONTEXT_TYPE ctx) {
+    const CFIndex sz = (cnt + nsect - 1) / nsect;
+    struct __CFSortPool *pool = __CFSortPoolCreate(nsect);
+    __CFSortApply(pool, nsect, ^(size_t sect) {
+            CFIndex lo = __CFMin((CFIndex)sect * sz, cnt), hi = __CFMin(lo + sz, cnt);
+            SORT_FN(SORT_NAME, _SerialSort)(listp + lo, hi - lo, tmp + lo, ctx);
+        });
+
+    SORT_ELEMENT_TYPE *src = listp, *dst = tmp;
+    for (CFIndex group = 2; group <= nsect; group *= 2) {
+        // each merge covers group sections and is split into group slices of its output, so there are always nsect slices
+        SORT_ELEMENT_TYPE *const from = src, *const to = dst;
+        __CFSortApply(pool, nsect, ^(size_t slice) {
+                CFIndex lo = __CFMin(((CFIndex)slice / group) * group * sz, cnt);
+                CFIndex mid = __CFMin(lo + (group / 2) * sz, cnt), hi = __CFMin(lo + group * sz, cnt);
+                CFIndex part = (CFIndex)slice % group, len = hi - lo;
+                CFIndex out1 = (len * part) / group, out2 = (len * (part + 1)) / group;
+                CFIndex in1 = SORT_FN(SORT_NAME, _SplitPoint)(out1, from + lo, mid - lo, from + mid, hi - mid, ctx);
+                CFIndex in2 = SORT_FN(SORT_NAME, _SplitPoint)(out2, from + lo, mid - lo, from + mid, hi - mid, ctx);
+                SORT_FN(SORT_NAME, _Merge)(from + lo + in1, in2 - in1, from + mid + (out1 - in1), (out2 - in2) - (out1 - in1), to + lo + out1, ctx);
+            });
+        src = to;
+        dst = from;
+    }
+    if (src != listp) {
+        SORT_ELEMENT_TYPE *const from = src;
+        __CFSortApply(pool, nsect, ^(size_t sect) {
+                CFIndex lo = __CFMin((CFIndex)sect * sz, cnt), hi = __CFMin(lo + sz, cnt);
+                memmove(listp + lo, from + lo, (hi - lo) * sizeof(SORT_ELEMENT_TYPE));
+            });
+    }
+    __CFSortPoolDestroy(pool);
+}
+
+static void SORT_NAME(SORT_ELEMENT_TYPE *listp, CFIndex cnt, CFIndex nsect, SORT_CONTEXT_TYPE ctx) {
+    if (cnt < 2) return;
+    STACK_BUFFER_DECL(SORT_ELEMENT_TYPE, local, cnt <= 1024 ? cnt : 1);
+    SORT_ELEMENT_TYPE *tmp = (cnt <= 1024) ? local : (SORT_ELEMENT_TYPE *)malloc(cnt * sizeof(SORT_ELEMENT_TYPE));
+    if (!tmp) HALT;
+    if (1 < nsect) {
+        SORT_FN(SORT_NAME, _ConcurrentSort)(listp, cnt, tmp, nsect, ctx);
+    } else {
+        SORT_FN(SORT_NAME, _SerialSort)(listp, cnt, tmp, ctx);
+    }
+    if (local != tmp) free(tmp);
+}
+
+#undef SORT_FN
+#undef SORT_FN_
+#undef SORT_NAME
+#undef SORT_ELEMENT_TYPE
+#undef SORT_CONTEXT_TYPE
+#undef SORT_LESS_OR_EQUAL
+
@@ -1109,6 +1109,69 @@ CF_PRIVATE void __CFStorageInitialize(void) {
     __kCFStorageTypeID = _CFRuntimeRegisterClass(&__CFStorageClass);
 }
 
+#pragma mark Bulk loading
+
+/* Builds the tree for numBytes of values into an empty storage from the bottom up, rather than inserting them one leaf at a time.  Every leaf but the last is filled to maxLeafCapacity, and each level of branches is made with three children apiece, save the last one or two which get two, so that all of the leaves end up at the same depth.  The nodes array is reused for every level, since a parent is always written at or before the index of its first child.
+ */
+static void __CFStorageBulkLoad(CFStorageRef storage, const uint8_t *values, CFIndex numBytes) {
+    const CFAllocatorRef allocator = CFGetAllocator(storage);
+    const CFIndex leafCapacity = storage->maxLeafCapacity;
+    ASSERT(storage->rootNode.numBytes == 0);
+    ASSERT(numBytes > 0);
+    
+    /* The cache may point at the root leaf, which is about to become a branch */
+    __CFStorageSetCache(storage, NULL, 0);
+    __CFStorageClearRootNode(storage);
+    
+    if (numBytes <= leafCapacity) {
+	/* Everything fits in the root */
+	__CFStorageAllocLeafNodeMemory(allocator, storage, &storage->rootNode, numBytes, false);
+	COPYMEM(values, storage->rootNode.info.leaf.memory, numBytes);
+	storage->rootNode.numBytes = numBytes;
+	return;
+    }
+    
+    CFIndex numNodes = (numBytes + leafCapacity - 1) / leafCapacity;
+    CFStorageNode **nodes = (CFStorageNode **)_CFAllocatorAllocateGC(allocator, numNodes * sizeof(CFStorageNode *), __kCFAllocatorGCScannedMemory);
+    if (!nodes) HALT;
+    for (CFIndex i = 0; i < numNodes; i++) {
+	CFIndex leafBytes = __CFMin(leafCapacity, numBytes - i * leafCapacity);
+	CFStorageNode *leaf = __CFStorageCreateNode(allocator, storage, true, leafBytes);
+	__CFStorageAllocLeafNodeMemory(allocator, storage, leaf, leafBytes, false);
+	COPYMEM(values + i * leafCapacity, leaf->info.leaf.memory, leafBytes);
+	__CFAssignWithWriteBarrier((void **)&nodes[i], leaf);
+    }
+    
+    while (numNodes > 3) {
+	CFIndex numParents = 0, i = 0;
+	while (i < numNodes) {
+	    /* Take three children unless that would leave a single one behind */
+	    CFIndex remaining = numNodes - i;
+	    CFIndex numChildren = (remaining == 2 || remaining == 4) ? 2 : 3;
+	    CFStorageNode *parent = __CFStorageCreateNode(allocator, storage, false, 0);
+	    for (CFIndex j = 0; j < numChildren; j++) {
+		__CFStorageSetChild(parent, j, nodes[i + j]); // transfers the reference count
+		parent->numBytes += nodes[i + j]->numBytes;
+	    }
+	    CHECK_NODE_INTEGRITY(parent);
+	    __CFAssignWithWriteBarrier((void **)&nodes[numParents++], parent);
+	    i += numChildren;
+	}
+	numNodes = numParents;
+    }
+    
+    /* The remaining two or three nodes become the children of the root */
+    storage->rootNode.isLeaf = false;
+    storage->rootNode.info.notLeaf.child[0] = storage->rootNode.info.notLeaf.child[1] = storage->rootNode.info.notLeaf.child[2] = NULL;
+    for (CFIndex i = 0; i < numNodes; i++) {
+	__CFStorageSetChild(&storage->rootNode, i, nodes[i]);
+	storage->rootNode.numBytes += nodes[i]->numBytes;
+    }
+    _CFAllocatorDeallocateGC(allocator, nodes);
+    ASSERT(storage->rootNode.numBytes == numBytes);
+    CHECK_INTEGRITY();
+}
+
 /*** Public API ***/
 
 CFStorageRef CFStorageCreate(CFAllocatorRef allocator, CFIndex valueSize) {
@@ -1389,6 +1452,95 @@ void CFStorageReplaceValues(CFStorageRef storage, CFRange range, const void *val
     }
 }
 
+/* Inserts range.length values at range.location and fills them from values.  An empty storage is built directly from the buffer; otherwise each chunk is copied in right after it is inserted, while the cache still points at the leaf that received it.
+ */
+void CFStorageInsertValuesFromBuffer(CFStorageRef storage, CFRange range, const void *values) {
+    CHECK_INTEGRITY();
+    if (range.length <= 0) return;
+    if (storage->rootNode.numBytes == 0) {
+	ASSERT(range.location == 0);
+	__CFStorageBulkLoad(storage, (const uint8_t *)values, __CFStorageConvertValueToByte(storage, range.length));
+	return;
+    }
+    const CFIndex insertionChunkSize = __CFStorageConvertByteToValue(storage, storage->maxLeafCapacity);
+    while (range.length > 0) {
+	CFIndex cntThisTime = __CFMin(range.length, insertionChunkSize);
+	CFStorageInsertValues(storage, CFRangeMake(range.location, cntThisTime));
+	CFStorageReplaceValues(storage, CFRangeMake(range.location, cntThisTime), values);
+	values = (const uint8_t *)values + __CFStorageConvertValueToByte(storage, cntThisTime);
+	range.location += cntThisTime;
+	range.length -= cntThisTime;
+    }
+    CHECK_INTEGRITY();
+}
+
+/* Replaces the range.length values at range.location with newCount values.  The values common to both are overwritten in place; only the difference is inserted or deleted, so the nodes around the range are left as they are.
+ */
+void CFStorageSpliceValues(CFStorageRef storage, CFRange range, const void *values, CFIndex newCount) {
+    CHECK_INTEGRITY();
+    CFIndex overwriteCount = __CFMin(range.length, newCount);
+    if (overwriteCount > 0) {
+	CFStorageReplaceValues(storage, CFRangeMake(range.location, overwriteCount), values);
+	values = (const uint8_t *)values + __CFStorageConvertValueToByte(storage, overwriteCount);
+    }
+    if (range.length > newCount) {
+	CFStorageDeleteValues(storage, CFRangeMake(range.location + overwriteCount, range.length - newCount));
+    } else if (newCount > range.length) {
+	CFStorageInsertValuesFromBuffer(storage, CFRangeMake(range.location + overwriteCount, newCount - range.length), values);
+    }
+    CHECK_INTEGRITY();
+}
+
+#pragma mark Cursors
+
+/* Cursors keep their own leaf, rather than going through storage->cacheNode, so that several of them (or a cursor and random lookups) do not evict each other.  Moving within the leaf is pointer arithmetic; leaving it costs one descent from the root.
+ */
+static const void *__CFStorageCursorFindIndex(CFStorageCursor *cursor, CFIndex idx) {
+    CFStorageRef storage = cursor->storage;
+    cursor->index = idx;
+    if (idx < 0 || idx >= __CFStorageGetCount(storage)) {
+	cursor->validConsecutiveValueRange = CFRangeMake(idx, 0);
+	cursor->_rangeValues = NULL;
+	return NULL;
+    }
+    CFStorageNode *resultNode;
+    CFRange rangeInBytes;
+    CFIndex byteNum = __CFStorageConvertValueToByte(storage, idx);
+    uint8_t *result = (uint8_t *)__CFStorageFindByte(storage, &storage->rootNode, byteNum, 0, &resultNode, &rangeInBytes, false/*requireUnfreezing*/);
+    cursor->validConsecutiveValueRange = __CFStorageConvertBytesToValueRange(storage, rangeInBytes.location, rangeInBytes.length);
+    cursor->_rangeValues = result - (byteNum - rangeInBytes.location);
+    return result;
+}
+
+const void *CFStorageCursorInit(CFStorageCursor *cursor, CFStorageRef storage, CFIndex idx) {
+    cursor->storage = storage;
+    return __CFStorageCursorFindIndex(cursor, idx);
+}
+
+const void *CFStorageCursorSetIndex(CFStorageCursor *cursor, CFIndex idx) {
+    CFRange range = cursor->validConsecutiveValueRange;
+    if (cursor->_rangeValues == NULL || idx < range.location || idx >= range.location + range.length) {
+	return __CFStorageCursorFindIndex(cursor, idx);
+    }
+    cursor->index = idx;
+    return (const uint8_t *)cursor->_rangeValues + __CFStorageConvertValueToByte(cursor->storage, idx - range.location);
+}
+
+const void *CFStorageCursorGetValue(const CFStorageCursor *cursor) {
+    if (cursor->_rangeValues == NULL) return NULL;
+    return (const uint8_t *)cursor->_rangeValues + __CFStorageConvertValueToByte(cursor->storage, cursor->index - cursor->validConsecutiveValueRange.location);
+}
+
+const void *CFStorageCursorNext(CFStorageCursor *cursor) {
+    if (cursor->index >= __CFStorageGetCount(cursor->storage)) return NULL;
+    return CFStorageCursorSetIndex(cursor, cursor->index + 1);
+}
+
+const void *CFStorageCursorPrevious(CFStorageCursor *cursor) {
+    if (cursor->index < 0) return NULL;
+    return CFStorageCursorSetIndex(cursor, cursor->index - 1);
+}
+
 static void __CFStorageApplyNodeBlockInterior(CFStorageRef storage, CFStorageNode *node, void (^block)(CFStorageRef storage, CFStorageNode *node)) {
     block(storage, node);
     if (! node->isLeaf) {
@@ -301,6 +301,98 @@ CF_EXPORT CFStorageRef CFStorageCreateWithSubrange(CFStorageRef storage, CFRange
 */
 CF_EXPORT void CFStorageReplaceValues(CFStorageRef storage, CFRange range, const void *values);
 
+/*!
+	@function CFStorageInsertValuesFromBuffer
+	Inserts range.length values at location range.location and copies them
+		from a buffer, as CFStorageInsertValues() followed by
+		CFStorageReplaceValues().  If the storage is empty, the tree is built
+		directly from the buffer with full leaves, which is much cheaper than
+		growing it one insertion at a time.
+	@param storage The storage to which the values are to be inserted.
+		If this parameter is not a valid CFStorage, the behavior is undefined.
+	@param range The range of values within the storage to insert, as for
+		CFStorageInsertValues().
+	@param values A C array of range.length values to be copied into the storage.
+*/
+CF_EXPORT void CFStorageInsertValuesFromBuffer(CFStorageRef storage, CFRange range, const void *values);
+
+/*!
+	@function CFStorageSpliceValues
+	Replaces a range of values in the storage with a possibly different
+		number of values.  The values common to the old and new ranges are
+		overwritten in place, and only the difference in length is inserted
+		or deleted.
+	@param storage The storage to be modified. If this parameter is not a
+		valid CFStorage, the behavior is undefined.
+	@param range The range of values within the storage to replace. If the
+		range location or end point are outside the index space of the
+		storage (0 to N inclusive, where N is the count of the storage),
+		the behavior is undefined.
+	@param values A C array of newCount values to be copied into the storage.
+		This parameter may be NULL if newCount is 0.
+	@param newCount The number of values that take the place of the range.
+*/
+CF_EXPORT void CFStorageSpliceValues(CFStorageRef storage, CFRange range, const void *values, CFIndex newCount);
+
+/*!
+	@typedef CFStorageCursor
+	A position in a CFStorage for walking it in either direction.  The cursor
+		remembers the consecutive range of values around its position, so
+		moving within that range costs no tree lookup, and it does not use
+		or disturb the lookup cache of the storage.  Any mutation of the
+		storage invalidates its cursors; set them again with
+		CFStorageCursorInit().  The fields other than index and
+		validConsecutiveValueRange are private.
+*/
+typedef struct {
+    CFStorageRef storage;
+    CFIndex index;
+    CFRange validConsecutiveValueRange;
+    const void *_rangeValues;
+} CFStorageCursor;
+
+/*!
+	@function CFStorageCursorInit
+	Positions a cursor at the given index of a storage.  This is not a
+		mutating function.
+	@param cursor The cursor to set up.
+	@param storage The storage to walk. If this parameter is not a valid
+		CFStorage, the behavior is undefined.
+	@param idx The index to start at.  This may be -1 or the count of the
+		storage, for walking backwards or forwards into the storage.
+	@result A pointer to the value at idx, or NULL if idx is outside the
+		index space of the storage.
+*/
+CF_EXPORT const void *CFStorageCursorInit(CFStorageCursor *cursor, CFStorageRef storage, CFIndex idx);
+
+/*!
+	@function CFStorageCursorSetIndex
+	Moves a cursor to the given index, and returns a pointer to the value
+		there, or NULL if idx is outside the index space of the storage.
+*/
+CF_EXPORT const void *CFStorageCursorSetIndex(CFStorageCursor *cursor, CFIndex idx);
+
+/*!
+	@function CFStorageCursorGetValue
+	Returns a pointer to the value at the position of the cursor, or NULL
+		if the cursor is outside the index space of the storage.
+*/
+CF_EXPORT const void *CFStorageCursorGetValue(const CFStorageCursor *cursor);
+
+/*!
+	@function CFStorageCursorNext
+	Moves a cursor forward by one value, and returns a pointer to the value
+		there, or NULL once the cursor has moved past the last value.
+*/
+CF_EXPORT const void *CFStorageCursorNext(CFStorageCursor *cursor);
+
+/*!
+	@function CFStorageCursorPrevious
+	Moves a cursor back by one value, and returns a pointer to the value
+		there, or NULL once the cursor has moved before the first value.
+*/
+CF_EXPORT const void *CFStorageCursorPrevious(CFStorageCursor *cursor);
+
 /* Private stuff...
 */
 CF_EXPORT CFIndex __CFStorageGetCapacity(CFStorageRef storage);
@@ -49,6 +49,15 @@
 #include <unistd.h>
 #endif
 
+/* SSE2 is part of the x86_64 baseline and NEON of arm64, so the vector paths below need no runtime dispatch */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define __CF_STRING_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define __CF_STRING_NEON 1
+#endif
+
 #if defined(__GNUC__)
 #define LONG_DOUBLE_SUPPORT 1
 #else
@@ -540,6 +549,21 @@ CFStringEncoding __CFStringComputeEightBitStringEncoding(void) {
 /* Returns whether the provided bytes can be stored in ASCII
 */
 CF_INLINE Boolean __CFBytesInASCII(const uint8_t *bytes, CFIndex len) {
+#if __CF_STRING_SSE2
+    while (len >= 32) {
+        __m128i hiBits = _mm_or_si128(_mm_loadu_si128((const __m128i *)bytes), _mm_loadu_si128((const __m128i *)(bytes + 16)));
+        if (_mm_movemask_epi8(hiBits)) return false;
+        bytes += 32;
+        len -= 32;
+    }
+#elif __CF_STRING_NEON
+    while (len >= 32) {
+        uint8x16_t hiBits = vorrq_u8(vld1q_u8(bytes), vld1q_u8(bytes + 16));
+        if (vmaxvq_u8(hiBits) & 0x80) return false;
+        bytes += 32;
+        len -= 32;
+    }
+#endif
 #if __LP64__
     /* A bit of unrolling; go by 32s, 16s, and 8s first */
     while (len >= 32) {
@@ -590,6 +614,162 @@ CF_INLINE Boolean __CFBytesInASCII(const uint8_t *bytes, CFIndex len) {
     return true;
 }
 
+/* Vector fast paths for comparing and searching string contents. Each handles whole 16-byte blocks and returns how far it got, leaving the remainder (and anything unusual, such as non-ASCII bytes) to the scalar code after it.
+*/
+
+/* Returns the index of the first differing UniChar in a and b, or len if there is none
+*/
+CF_INLINE CFIndex __CFStrUniCharsMismatch(const UniChar *a, const UniChar *b, CFIndex len) {
+    CFIndex idx = 0;
+#if __CF_STRING_SSE2
+    for (; idx + 8 <= len; idx += 8) {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(a + idx)), _mm_loadu_si128((const __m128i *)(b + idx)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        if (mask != 0xFFFF) return idx + (__builtin_ctz(~mask) >> 1);
+    }
+#elif __CF_STRING_NEON
+    for (; idx + 8 <= len; idx += 8) {
+        uint16x8_t eq = vceqq_u16(vld1q_u16(a + idx), vld1q_u16(b + idx));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(eq, 4)), 0);	// 8 bits per character
+        if (mask != ~0ULL) return idx + (__builtin_ctzll(~mask) >> 3);
+    }
+#endif
+    for (; idx < len; idx++) if (a[idx] != b[idx]) break;
+    return idx;
+}
+
+/* Returns the length of the prefix of a and b that is equal, or equal but for the case of ASCII letters if foldCase; only whole 16-byte blocks are compared
+*/
+CF_INLINE CFIndex __CFStrBytesEqualBlocks(const uint8_t *a, const uint8_t *b, CFIndex len, Boolean foldCase) {
+    CFIndex idx = 0;
+#if __CF_STRING_SSE2
+    const __m128i bias = _mm_set1_epi8((char)(0x80 - 'A')), limit = _mm_set1_epi8((char)(-0x80 + 26)), caseBit = _mm_set1_epi8(0x20);
+    for (; idx + 16 <= len; idx += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + idx)), vb = _mm_loadu_si128((const __m128i *)(b + idx));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xFFFF) continue;
+        if (!foldCase) break;
+        // 'A'...'Z' land on the 26 smallest signed bytes once biased; add 0x20 to just those
+        va = _mm_add_epi8(va, _mm_and_si128(_mm_cmplt_epi8(_mm_add_epi8(va, bias), limit), caseBit));
+        vb = _mm_add_epi8(vb, _mm_and_si128(_mm_cmplt_epi8(_mm_add_epi8(vb, bias), limit), caseBit));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF) break;
+    }
+#elif __CF_STRING_NEON
+    const uint8x16_t upperA = vdupq_n_u8('A'), span = vdupq_n_u8(25), caseBit = vdupq_n_u8(0x20);
+    for (; idx + 16 <= len; idx += 16) {
+        uint8x16_t va = vld1q_u8(a + idx), vb = vld1q_u8(b + idx);
+        if (vminvq_u8(vceqq_u8(va, vb)) == 0xFF) continue;
+        if (!foldCase) break;
+        va = vaddq_u8(va, vandq_u8(vcleq_u8(vsubq_u8(va, upperA), span), caseBit));
+        vb = vaddq_u8(vb, vandq_u8(vcleq_u8(vsubq_u8(vb, upperA), span), caseBit));
+        if (vminvq_u8(vceqq_u8(va, vb)) != 0xFF) break;
+    }
+#endif
+    return idx;
+}
+
+/* Returns whether the 8-bit contents (in the 8-bit CFString encoding) equal the UniChars; blocks of ASCII are compared by widening them
+*/
+CF_INLINE Boolean __CFStrEightBitEqualsUniChars(const uint8_t *bytes, const UniChar *chars, CFIndex len) {
+    CFIndex idx = 0;
+#if __CF_STRING_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; idx + 16 <= len; idx += 16) {
+        __m128i vb = _mm_loadu_si128((const __m128i *)(bytes + idx));
+        if (_mm_movemask_epi8(vb)) {
+            CFIndex cnt;
+            for (cnt = idx; cnt < idx + 16; cnt++) if (__CFCharToUniCharTable[bytes[cnt]] != chars[cnt]) return false;
+            continue;
+        }
+        __m128i lo = _mm_cmpeq_epi16(_mm_unpacklo_epi8(vb, zero), _mm_loadu_si128((const __m128i *)(chars + idx)));
+        __m128i hi = _mm_cmpeq_epi16(_mm_unpackhi_epi8(vb, zero), _mm_loadu_si128((const __m128i *)(chars + idx + 8)));
+        if (_mm_movemask_epi8(_mm_and_si128(lo, hi)) != 0xFFFF) return false;
+    }
+#elif __CF_STRING_NEON
+    for (; idx + 16 <= len; idx += 16) {
+        uint8x16_t vb = vld1q_u8(bytes + idx);
+        if (vmaxvq_u8(vb) & 0x80) {
+            CFIndex cnt;
+            for (cnt = idx; cnt < idx + 16; cnt++) if (__CFCharToUniCharTable[bytes[cnt]] != chars[cnt]) return false;
+            continue;
+        }
+        uint16x8_t lo = vceqq_u16(vmovl_u8(vget_low_u8(vb)), vld1q_u16(chars + idx));
+        uint16x8_t hi = vceqq_u16(vmovl_u8(vget_high_u8(vb)), vld1q_u16(chars + idx + 8));
+        if (vminvq_u16(vandq_u16(lo, hi)) != 0xFFFF) return false;
+    }
+#endif
+    for (; idx < len; idx++) if (__CFCharToUniCharTable[bytes[idx]] != chars[idx]) return false;
+    return true;
+}
+
+/* Returns the offset of the first occurrence of needle in haystack, or kCFNotFound. Blocks of candidate positions are filtered on the needle's first and last element before memcmp confirms them.
+*/
+static CFIndex __CFStrFindBytes(const uint8_t *haystack, CFIndex haystackLen, const uint8_t *needle, CFIndex needleLen) {
+    CFIndex last = haystackLen - needleLen, idx = 0;
+    if (last < 0) return kCFNotFound;
+#if __CF_STRING_SSE2
+    const __m128i first = _mm_set1_epi8((char)needle[0]), final = _mm_set1_epi8((char)needle[needleLen - 1]);
+    for (; idx + 16 <= last + 1; idx += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(haystack + idx))),
+                                                                  _mm_cmpeq_epi8(final, _mm_loadu_si128((const __m128i *)(haystack + idx + needleLen - 1)))));
+        while (mask) {
+            CFIndex candidate = idx + __builtin_ctz(mask);
+            if (memcmp(haystack + candidate + 1, needle + 1, needleLen - 1) == 0) return candidate;
+            mask &= mask - 1;
+        }
+    }
+#elif __CF_STRING_NEON
+    const uint8x16_t first = vdupq_n_u8(needle[0]), final = vdupq_n_u8(needle[needleLen - 1]);
+    for (; idx + 16 <= last + 1; idx += 16) {
+        uint8x16_t eq = vandq_u8(vceqq_u8(first, vld1q_u8(haystack + idx)), vceqq_u8(final, vld1q_u8(haystack + idx + needleLen - 1)));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);	// 4 bits per byte
+        while (mask) {
+            CFIndex candidate = idx + (__builtin_ctzll(mask) >> 2);
+            if (memcmp(haystack + candidate + 1, needle + 1, needleLen - 1) == 0) return candidate;
+            mask &= ~(0xFULL << (__builtin_ctzll(mask) & ~3));
+        }
+    }
+#endif
+    for (; idx <= last; idx++) {
+        if (haystack[idx] == needle[0] && memcmp(haystack + idx + 1, needle + 1, needleLen - 1) == 0) return idx;
+    }
+    return kCFNotFound;
+}
+
+/* UniChar version of __CFStrFindBytes
+*/
+static CFIndex __CFStrFindUniChars(const UniChar *haystack, CFIndex haystackLen, const UniChar *needle, CFIndex needleLen) {
+    CFIndex last = haystackLen - needleLen, idx = 0;
+    if (last < 0) return kCFNotFound;
+#if __CF_STRING_SSE2
+    const __m128i first = _mm_set1_epi16((short)needle[0]), final = _mm_set1_epi16((short)needle[needleLen - 1]);
+    for (; idx + 8 <= last + 1; idx += 8) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(first, _mm_loadu_si128((const __m128i *)(haystack + idx))),
+                                                                  _mm_cmpeq_epi16(final, _mm_loadu_si128((const __m128i *)(haystack + idx + needleLen - 1)))));
+        mask &= 0x5555;	// one bit per character
+        while (mask) {
+            CFIndex candidate = idx + (__builtin_ctz(mask) >> 1);
+            if (memcmp(haystack + candidate + 1, needle + 1, (needleLen - 1) * sizeof(UniChar)) == 0) return candidate;
+            mask &= mask - 1;
+        }
+    }
+#elif __CF_STRING_NEON
+    const uint16x8_t first = vdupq_n_u16(needle[0]), final = vdupq_n_u16(needle[needleLen - 1]);
+    for (; idx + 8 <= last + 1; idx += 8) {
+        uint16x8_t eq = vandq_u16(vceqq_u16(first, vld1q_u16(haystack + idx)), vceqq_u16(final, vld1q_u16(haystack + idx + needleLen - 1)));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(eq, 4)), 0) & 0x0101010101010101ULL;	// one bit per character
+        while (mask) {
+            CFIndex candidate = idx + (__builtin_ctzll(mask) >> 3);
+            if (memcmp(haystack + candidate + 1, needle + 1, (needleLen - 1) * sizeof(UniChar)) == 0) return candidate;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; idx <= last; idx++) {
+        if (haystack[idx] == needle[0] && memcmp(haystack + idx + 1, needle + 1, (needleLen - 1) * sizeof(UniChar)) == 0) return idx;
+    }
+    return kCFNotFound;
+}
+
 /* Returns whether the provided 8-bit string in the specified encoding can be stored in an 8-bit CFString. 
 */
 CF_INLINE Boolean __CFCanUseEightBitCFStringForBytes(const uint8_t *bytes, CFIndex len, CFStringEncoding encoding) {
@@ -994,28 +1174,12 @@ static Boolean __CFStringEqual(CFTypeRef cf1, CFTypeRef cf2) {
     if (__CFStrIsEightBit(str1) && __CFStrIsEightBit(str2)) {
         return memcmp((const char *)contents1, (const char *)contents2, len1) ? false : true;
     } else if (__CFStrIsEightBit(str1)) {	/* One string has Unicode contents */
-        CFStringInlineBuffer buf;
-	CFIndex buf_idx = 0;
-
-        CFStringInitInlineBuffer(str1, &buf, CFRangeMake(0, len1));
-	for (buf_idx = 0; buf_idx < len1; buf_idx++) {
-	    if (__CFStringGetCharacterFromInlineBufferQuick(&buf, buf_idx) != ((UniChar *)contents2)[buf_idx]) return false;
-  	}
+        return __CFStrEightBitEqualsUniChars(contents1, (const UniChar *)contents2, len1);
     } else if (__CFStrIsEightBit(str2)) {	/* One string has Unicode contents */
-        CFStringInlineBuffer buf;
-	CFIndex buf_idx = 0;
-
-        CFStringInitInlineBuffer(str2, &buf, CFRangeMake(0, len1));
-        for (buf_idx = 0; buf_idx < len1; buf_idx++) {
-            if (__CFStringGetCharacterFromInlineBufferQuick(&buf, buf_idx) != ((UniChar *)contents1)[buf_idx]) return false;
-        }
+        return __CFStrEightBitEqualsUniChars(contents2, (const UniChar *)contents1, len1);
     } else {					/* Both strings have Unicode contents */
-	CFIndex idx;
-        for (idx = 0; idx < len1; idx++) {
-            if (((UniChar *)contents1)[idx] != ((UniChar *)contents2)[idx]) return false;
-        }
+        return memcmp((const char *)contents1, (const char *)contents2, len1 * sizeof(UniChar)) ? false : true;
     }
-    return true;
 }
 
 
@@ -1047,27 +1211,44 @@ Hash function was changed between Panther and Tiger, and Tiger and Leopard.
 #define HashNextUniChar(accessStart, accessEnd, pointer) \
     {result = result * 257 + (accessStart 0 accessEnd); pointer++;}
 
+/* HashNextSixteenUniChars gives the same result as four HashNextFourUniChars in a row, but multiplies out the recurrence so that the four groups do not wait on each other: with M = 67503105 and g(i) the sum that HashNextFourUniChars adds for group i,
+   result = result * M^4 + g(0) * M^3 + g(1) * M^2 + g(2) * M + g(3)
+which is exact as all of this is arithmetic modulo the width of CFHashCode. g(i) is written in the same form as in HashNextFourUniChars, so that each product is converted to CFHashCode in the same way.
+*/
+#define HashMultiplier2 ((CFHashCode)67503105 * (CFHashCode)67503105)
+#define HashMultiplier3 (HashMultiplier2 * (CFHashCode)67503105)
+#define HashMultiplier4 (HashMultiplier2 * HashMultiplier2)
+
+#define HashFourUniChars(accessStart, accessEnd, i0, i1, i2, i3) \
+    ((CFHashCode)0 + (accessStart i0 accessEnd) * 16974593  + (accessStart i1 accessEnd) * 66049  + (accessStart i2 accessEnd) * 257 + (accessStart i3 accessEnd))
+
+#define HashNextSixteenUniChars(accessStart, accessEnd, pointer) \
+    {result = result * HashMultiplier4 + HashFourUniChars(accessStart, accessEnd, 0, 1, 2, 3) * HashMultiplier3 + HashFourUniChars(accessStart, accessEnd, 4, 5, 6, 7) * HashMultiplier2 + \
+              HashFourUniChars(accessStart, accessEnd, 8, 9, 10, 11) * 67503105 + HashFourUniChars(accessStart, accessEnd, 12, 13, 14, 15); pointer += 16;}
+
 
 /* In this function, actualLen is the length of the original string; but len is the number of characters in buffer. The buffer is expected to contain the parts of the string relevant to hashing.
 */
 CF_INLINE CFHashCode __CFStrHashCharacters(const UniChar *uContents, CFIndex len, CFIndex actualLen) {
     CFHashCode result = actualLen;
     if (len <= HashEverythingLimit) {
+        const UniChar *end16 = uContents + (len & ~15);
         const UniChar *end4 = uContents + (len & ~3);
         const UniChar *end = uContents + len;
-        while (uContents < end4) HashNextFourUniChars(uContents[, ], uContents); 	// First count in fours
+        while (uContents < end16) HashNextSixteenUniChars(uContents[, ], uContents);	// First count in sixteens
+        while (uContents < end4) HashNextFourUniChars(uContents[, ], uContents); 	// Then in fours
         while (uContents < end) HashNextUniChar(uContents[, ], uContents);		// Then for the last <4 chars, count in ones...
     } else {
         const UniChar *contents, *end;
 	contents = uContents;
         end = contents + 32;
-        while (contents < end) HashNextFourUniChars(contents[, ], contents);
+        while (contents < end) HashNextSixteenUniChars(contents[, ], contents);
 	contents = uContents + (len >> 1) - 16;
         end = contents + 32;
-        while (contents < end) HashNextFourUniChars(contents[, ], contents);
+        while (contents < end) HashNextSixteenUniChars(contents[, ], contents);
 	end = uContents + len;
         contents = end - 32;
-        while (contents < end) HashNextFourUniChars(contents[, ], contents);
+        while (contents < end) HashNextSixteenUniChars(contents[, ], contents);
     }
     return result + (result << (actualLen & 31));
 }
@@ -1092,23 +1273,29 @@ CF_INLINE CFHashCode __CFStrHashEightBit(const uint8_t *cContents, CFIndex len)
         }
     }
 #endif
+    // __CFCharToUniCharTable maps ASCII to itself, so ASCII contents can skip the table; this is the common case
+    if (len <= HashEverythingLimit ? __CFBytesInASCII(cContents, len) : (__CFBytesInASCII(cContents, 32) && __CFBytesInASCII(cContents + (len >> 1) - 16, 32) && __CFBytesInASCII(cContents + len - 32, 32))) {
+        return CFStringHashISOLatin1CString(cContents, len);
+    }
     CFHashCode result = len;
     if (len <= HashEverythingLimit) {
+        const uint8_t *end16 = cContents + (len & ~15);
         const uint8_t *end4 = cContents + (len & ~3);
         const uint8_t *end = cContents + len;
-        while (cContents < end4) HashNextFourUniChars(__CFCharToUniCharTable[cContents[, ]], cContents); 	// First count in fours
+        while (cContents < end16) HashNextSixteenUniChars(__CFCharToUniCharTable[cContents[, ]], cContents);	// First count in sixteens
+        while (cContents < end4) HashNextFourUniChars(__CFCharToUniCharTable[cContents[, ]], cContents); 	// Then in fours
         while (cContents < end) HashNextUniChar(__CFCharToUniCharTable[cContents[, ]], cContents);		// Then for the last <4 chars, count in ones...
     } else {
 	const uint8_t *contents, *end;
 	contents = cContents;
         end = contents + 32;
-        while (contents < end) HashNextFourUniChars(__CFCharToUniCharTable[contents[, ]], contents);
+        while (contents < end) HashNextSixteenUniChars(__CFCharToUniCharTable[contents[, ]], contents);
 	contents = cContents + (len >> 1) - 16;
         end = contents + 32;
-        while (contents < end) HashNextFourUniChars(__CFCharToUniCharTable[contents[, ]], contents);
+        while (contents < end) HashNextSixteenUniChars(__CFCharToUniCharTable[contents[, ]], contents);
 	end = cContents + len;
         contents = end - 32;
-        while (contents < end) HashNextFourUniChars(__CFCharToUniCharTable[contents[, ]], contents);
+        while (contents < end) HashNextSixteenUniChars(__CFCharToUniCharTable[contents[, ]], contents);
     }
     return result + (result << (len & 31));
 }
@@ -1116,21 +1303,23 @@ CF_INLINE CFHashCode __CFStrHashEightBit(const uint8_t *cContents, CFIndex len)
 CFHashCode CFStringHashISOLatin1CString(const uint8_t *bytes, CFIndex len) {
     CFHashCode result = len;
     if (len <= HashEverythingLimit) {
+        const uint8_t *end16 = bytes + (len & ~15);
         const uint8_t *end4 = bytes + (len & ~3);
         const uint8_t *end = bytes + len;
-        while (bytes < end4) HashNextFourUniChars(bytes[, ], bytes); 	// First count in fours
+        while (bytes < end16) HashNextSixteenUniChars(bytes[, ], bytes);	// First count in sixteens
+        while (bytes < end4) HashNextFourUniChars(bytes[, ], bytes); 	// Then in fours
         while (bytes < end) HashNextUniChar(bytes[, ], bytes);		// Then for the last <4 chars, count in ones...
     } else {
         const uint8_t *contents, *end;
 	contents = bytes;
         end = contents + 32;
-        while (contents < end) HashNextFourUniChars(contents[, ], contents);
+        while (contents < end) HashNextSixteenUniChars(contents[, ], contents);
 	contents = bytes + (len >> 1) - 16;
         end = contents + 32;
-        while (contents < end) HashNextFourUniChars(contents[, ], contents);
+        while (contents < end) HashNextSixteenUniChars(contents[, ], contents);
 	end = bytes + len;
         contents = end - 32;
-        while (contents < end) HashNextFourUniChars(contents[, ], contents);
+        while (contents < end) HashNextSixteenUniChars(contents[, ], contents);
     }
     return result + (result << (len & 31));
 }
@@ -2551,6 +2740,9 @@ CFComparisonResult CFStringCompareWithOptionsAndLocale(CFStringRef string, CFStr
 
                 str1Bytes += rangeToCompare.location;
 
+                // Skip whole blocks that are equal as they are, or equal but for ASCII case when that cannot decide a forced ordering
+                str1Index = __CFStrBytesEqualBlocks(str1Bytes, str2Bytes, limitLength, caseInsensitive && !forceOrdering);
+
                 while (str1Index < limitLength) {
                     str1Char = str1Bytes[str1Index];
                     str2Char = str2Bytes[str1Index];
@@ -2587,11 +2779,10 @@ CFComparisonResult CFStringCompareWithOptionsAndLocale(CFStringRef string, CFStr
 #if __LITTLE_ENDIAN__
             if ((NULL != str1Bytes) && (NULL != str2Bytes)) { // we cannot use memcmp
                 const UTF16Char *str1 = ((const UTF16Char *)str1Bytes) + rangeToCompare.location;
-                const UTF16Char *str1Limit = str1 + __CFMin(rangeToCompare.length, str2Len);
                 const UTF16Char *str2 = (const UTF16Char *)str2Bytes;
-                CFIndex cmpResult = 0;
-
-                while ((0 == cmpResult) && (str1 < str1Limit)) cmpResult = (CFIndex)*(str1++) - (CFIndex)*(str2++);
+                CFIndex cmpLength = __CFMin(rangeToCompare.length, str2Len);
+                CFIndex mismatch = __CFStrUniCharsMismatch(str1, str2, cmpLength);
+                CFIndex cmpResult = ((mismatch < cmpLength) ? (CFIndex)str1[mismatch] - (CFIndex)str2[mismatch] : 0);
 
                 if (0 == cmpResult) cmpResult = rangeToCompare.length - str2Len;
                 
@@ -2903,6 +3094,27 @@ Boolean CFStringFindWithOptionsAndLocale(CFStringRef string, CFStringRef stringT
         
         delta = ((fromLoc <= toLoc) ? 1 : -1);
 
+        if (!equalityOptions && (fromLoc < toLoc)) { // literal forward search over directly accessible contents
+            const UniChar *str1Chars = NULL, *str2Chars = NULL;
+            CFIndex foundIndex = kCFNotFound;
+            bool searched = true;
+
+            if ((NULL != str1Bytes) && (NULL != str2Bytes)) {
+                foundIndex = __CFStrFindBytes(str1Bytes + fromLoc, toLoc - fromLoc + findStrLen, str2Bytes, findStrLen);
+            } else if ((NULL == str1Bytes) && (NULL == str2Bytes) && (NULL != (str1Chars = CFStringGetCharactersPtr(string))) && (NULL != (str2Chars = CFStringGetCharactersPtr(stringToFind)))) {
+                foundIndex = __CFStrFindUniChars(str1Chars + fromLoc, toLoc - fromLoc + findStrLen, str2Chars, findStrLen);
+            } else {
+                searched = false;
+            }
+            if (searched) {
+                if (kCFNotFound != foundIndex) {
+                    didFind = true;
+                    if (NULL != result) *result = CFRangeMake(fromLoc + foundIndex, findStrLen);
+                }
+                return didFind;
+            }
+        }
+
         if ((NULL != str1Bytes) && (NULL != str2Bytes)) {
             uint8_t str1Byte, str2Byte;
 
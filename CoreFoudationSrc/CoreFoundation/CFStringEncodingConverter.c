@@ -234,13 +234,24 @@ static CFIndex __CFDefaultToUnicodeFallbackProc(const uint8_t *bytes, CFIndex nu
 
 #define EXTRA_BASE (0x0F00)
 
+/* The built-in cheap 8-bit converters map ASCII, and ISO Latin 1 all of 0-0xFF, to the same value; runs of those are converted in bulk before falling back to the per-character procs.
+*/
+CF_INLINE UniChar __CFCheapEightBitIdentityLimit(const CFStringEncodingConverter *definition) {
+    if (definition == &__CFConverterISOLatin1) return 0xFF;
+    if ((definition == &__CFConverterASCII) || (definition == &__CFConverterMacRoman) || (definition == &__CFConverterWinLatin1) || (definition == &__CFConverterNextStepLatin)) return 0x7F;
+    return 0;
+}
+
 /* Wrapper funcs for non-standard converters
 */
 static CFIndex __CFToBytesCheapEightBitWrapper(const void *converter, uint32_t flags, const UniChar *characters, CFIndex numChars, uint8_t *bytes, CFIndex maxByteLen, CFIndex *usedByteLen) {
     CFIndex processedCharLen = 0;
     CFIndex length = (maxByteLen && (maxByteLen < numChars) ? maxByteLen : numChars);
+    UniChar identityLimit = __CFCheapEightBitIdentityLimit(((const _CFEncodingConverter*)converter)->definition);
     uint8_t byte;
 
+    if (identityLimit) processedCharLen = __CFStringEncodingNarrowCharacters(characters, length, (maxByteLen ? bytes : NULL), identityLimit);
+
     while (processedCharLen < length) {
         if (!((CFStringEncodingCheapEightBitToBytesProc)((const _CFEncodingConverter*)converter)->definition->toBytes)(flags, characters[processedCharLen], &byte)) break;
 
@@ -255,8 +266,11 @@ static CFIndex __CFToBytesCheapEightBitWrapper(const void *converter, uint32_t f
 static CFIndex __CFToUnicodeCheapEightBitWrapper(const void *converter, uint32_t flags, const uint8_t *bytes, CFIndex numBytes, UniChar *characters, CFIndex maxCharLen, CFIndex *usedCharLen) {
     CFIndex processedByteLen = 0;
     CFIndex length = (maxCharLen && (maxCharLen < numBytes) ? maxCharLen : numBytes);
+    UniChar identityLimit = __CFCheapEightBitIdentityLimit(((const _CFEncodingConverter*)converter)->definition);
     UniChar character;
 
+    if (identityLimit) processedByteLen = __CFStringEncodingWidenBytes(bytes, length, (maxCharLen ? characters : NULL), (identityLimit == 0x7F));
+
     while (processedByteLen < length) {
         if (!((CFStringEncodingCheapEightBitToUnicodeProc)((const _CFEncodingConverter*)converter)->definition->toUnicode)(flags, bytes[processedByteLen], &character)) break;
 
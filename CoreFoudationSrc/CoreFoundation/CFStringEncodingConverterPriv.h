@@ -45,5 +45,9 @@ extern  CFIndex __CFStringEncodingPlatformBytesToUnicode(uint32_t encoding, uint
 extern  CFIndex __CFStringEncodingPlatformCharLengthForBytes(uint32_t encoding, uint32_t flags, const uint8_t *bytes, CFIndex numBytes);
 extern  CFIndex __CFStringEncodingPlatformByteLengthForCharacters(uint32_t encoding, uint32_t flags, const UniChar *characters, CFIndex numChars);
 
+/* Bulk conversion of the leading run of characters below 0x80 (asciiOnly) or 0x100; characters/bytes may be NULL to only measure it */
+extern  CFIndex __CFStringEncodingWidenBytes(const uint8_t *bytes, CFIndex numBytes, UniChar *characters, bool asciiOnly);
+extern  CFIndex __CFStringEncodingNarrowCharacters(const UniChar *characters, CFIndex numChars, uint8_t *bytes, UniChar maxCharacter);
+
 #endif /* ! __COREFOUNDATION_CFSTRINGENCODINGCONVERTERPRIV__ */
 
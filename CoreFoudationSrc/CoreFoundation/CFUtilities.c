@@ -445,6 +445,11 @@ CF_PRIVATE CFIndex __CFActiveProcessorCount() {
     if (result != 0) {
         pcnt = 0;
     }
+#elif DEPLOYMENT_TARGET_LINUX
+    pcnt = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    if (pcnt < 1) {
+        pcnt = 1;
+    }
 #else
     // Assume the worst
     pcnt = 1;
@@ -419,6 +419,47 @@ CF_EXPORT CFIndex __CFBinaryPlistWriteToStreamWithEstimate(CFPropertyListRef pli
 CF_EXPORT CFIndex __CFBinaryPlistWriteToStreamWithOptions(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options); // will be removed soon
 CF_EXPORT CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options, CFErrorRef *error);
 
+// Options for __CFBinaryPlistWrite. By default equal strings, numbers, dates and data, and
+// repeated dictionaries and arrays, are written once; skipping that saves hashing every
+// object but can make the output larger.
+enum {
+    kCFBinaryPlistWriteSkipUniquing = (1UL << 0)
+};
+
+// Lazy access to a binary plist, for reading a few values out of a large file without
+// creating the whole object graph. The file is mapped, and only the pages on the way to
+// the values asked for are touched. A CFBinaryPlistValue is a position in the map; it
+// needs no allocation and stays valid as long as the map does. CF objects are created
+// only by __CFBinaryPlistValueCreateObject.
+typedef struct __CFBinaryPlistMap * CFBinaryPlistMapRef;
+
+typedef struct {
+    CFBinaryPlistMapRef _map;
+    uint64_t _offset;
+} CFBinaryPlistValue;
+
+CF_EXPORT CFBinaryPlistMapRef __CFBinaryPlistMapCreateWithURL(CFAllocatorRef allocator, CFURLRef url, CFErrorRef *error);
+CF_EXPORT CFBinaryPlistMapRef __CFBinaryPlistMapCreateWithData(CFAllocatorRef allocator, CFDataRef data); // retains data
+CF_EXPORT CFBinaryPlistMapRef __CFBinaryPlistMapRetain(CFBinaryPlistMapRef map);
+CF_EXPORT void __CFBinaryPlistMapRelease(CFBinaryPlistMapRef map);
+CF_EXPORT CFBinaryPlistValue __CFBinaryPlistMapGetTopValue(CFBinaryPlistMapRef map);
+// keyPath as for _CFPropertyListCreateSingleValue: ':'-separated dictionary keys and array indexes
+CF_EXPORT bool __CFBinaryPlistMapGetValueForKeyPath(CFBinaryPlistMapRef map, CFStringRef keyPath, CFBinaryPlistValue *value);
+
+// One of the kCFBinaryPlistMarker values; strings, data and collections give just the type, without their count
+CF_EXPORT uint8_t __CFBinaryPlistValueGetMarker(CFBinaryPlistValue value);
+// Elements of an array or set, pairs of a dictionary, bytes of data, characters of a string; -1 for other types or bad data
+CF_EXPORT CFIndex __CFBinaryPlistValueGetCount(CFBinaryPlistValue value);
+CF_EXPORT bool __CFBinaryPlistValueGetValueAtIndex(CFBinaryPlistValue value, CFIndex idx, CFBinaryPlistValue *element);
+CF_EXPORT bool __CFBinaryPlistValueGetKeyAndValueAtIndex(CFBinaryPlistValue value, CFIndex idx, CFBinaryPlistValue *key, CFBinaryPlistValue *element);
+CF_EXPORT bool __CFBinaryPlistValueGetValueForKey(CFBinaryPlistValue value, CFStringRef key, CFBinaryPlistValue *element);
+CF_EXPORT bool __CFBinaryPlistValueGetBoolean(CFBinaryPlistValue value, Boolean *result);
+CF_EXPORT bool __CFBinaryPlistValueGetInt64(CFBinaryPlistValue value, int64_t *result); // the low 64 bits of a 128-bit integer
+CF_EXPORT bool __CFBinaryPlistValueGetFloat64(CFBinaryPlistValue value, double *result); // reals, and dates as absolute times
+// The bytes of data, of an ASCII string, or of a big-endian UTF-16 string, in the map; NULL for other types or bad data
+CF_EXPORT const uint8_t *__CFBinaryPlistValueGetBytePtr(CFBinaryPlistValue value, CFIndex *length);
+CF_EXPORT CFPropertyListRef __CFBinaryPlistValueCreateObject(CFAllocatorRef allocator, CFBinaryPlistValue value, CFOptionFlags mutabilityOption);
+
 // ---- Used by property list parsing in Foundation
 
 CF_EXPORT CFTypeRef _CFPropertyListCreateFromXMLData(CFAllocatorRef allocator, CFDataRef xmlData, CFOptionFlags option, CFStringRef *errorString, Boolean allowNewTypes, CFPropertyListFormat *format);
@@ -0,0 +1,249 @@
+/*
+ * basic_hash_add_values_test:  Check the bulk insertion path of CFBasicHash,
+ *                              CFBasicHashAddValues, against adding the
+ *                              same entries one at a time.
+ *
+ * usage:  basic_hash_add_values_test [options...]
+ *
+ * Default:  For lists of several sizes around the batch size of 64, with
+ *           keys drawn from a small range (many repeated keys) and from a
+ *           large one (almost all distinct), builds
+ *             - CFDictionary, CFSet and CFBag with their Create functions,
+ *             - a CFBasicHash of each probing style, linear and group,
+ *               with CFBasicHashAddValues, and
+ *             - mutable dictionaries and sets that already hold entries,
+ *               some of them removed again so that the table has deleted
+ *               buckets, with __CFDictionaryAddValues and __CFSetAddValues.
+ *           Each must have the same count and, key for key, the same value
+ *           object and bag count as one built with the single-entry add
+ *           functions; of repeated keys the first added wins, as with
+ *           CFDictionaryAddValue.  Keys that are equal are distinct
+ *           objects, and a value that isn't kept must not stay retained.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/basic_hash_add_values_test.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFBasicHash.h"
+
+extern void __CFDictionaryAddValues(CFMutableDictionaryRef dict, const void **klist, const void **vlist, CFIndex numValues);
+extern void __CFSetAddValues(CFMutableSetRef set, const void **klist, CFIndex numValues);
+extern Boolean CFDictionaryGetKeyIfPresent(CFDictionaryRef dict, const void *key, const void **actualkey);
+
+int rseed;
+int failed;
+
+static const void **xmalloc_values(CFIndex n) {
+    const void **values = malloc((n ? n : 1) * sizeof(void *));
+    if (!values) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    return values;
+}
+
+/* a new object each time, so that equal keys are never the same object, and none is shared from a cache */
+static CFStringRef create_string(const char *prefix, long k) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s.%ld", prefix, k);
+    return CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+}
+
+static void fail(const char *what, CFIndex n, const char *why, CFIndex i) {
+    printf("FAIL: %s, %ld entries: %s at %ld\n", what, (long)n, why, (long)i);
+    failed = 1;
+}
+
+/* The dictionary must hold what expected holds, with the very same key and value objects */
+static void compare_dictionaries(CFDictionaryRef dict, CFDictionaryRef expected, const void **keys, CFIndex n, const char *what) {
+    if (CFDictionaryGetCount(dict) != CFDictionaryGetCount(expected)) {
+        fail(what, n, "wrong count", CFDictionaryGetCount(dict));
+        return;
+    }
+    for (CFIndex i = 0; i < n && !failed; i++) {
+        const void *key, *value, *expected_key, *expected_value;
+        if (!CFDictionaryGetKeyIfPresent(dict, keys[i], &key) || !CFDictionaryGetKeyIfPresent(expected, keys[i], &expected_key)) {
+            fail(what, n, "key missing", i);
+        } else if (key != expected_key) {
+            fail(what, n, "a later equal key replaced the first", i);
+        } else {
+            value = CFDictionaryGetValue(dict, key);
+            expected_value = CFDictionaryGetValue(expected, key);
+            if (value != expected_value) fail(what, n, "wrong value object", i);
+        }
+    }
+    if (!failed && !CFEqual(dict, expected)) fail(what, n, "not CFEqual", 0);
+}
+
+static void compare_sets(CFSetRef set, CFSetRef expected, const void **keys, CFIndex n, Boolean bags, const char *what) {
+    CFIndex count = bags ? CFBagGetCount((CFBagRef)set) : CFSetGetCount(set);
+    if (count != (bags ? CFBagGetCount((CFBagRef)expected) : CFSetGetCount(expected))) {
+        fail(what, n, "wrong count", count);
+        return;
+    }
+    for (CFIndex i = 0; i < n && !failed; i++) {
+        const void *key, *expected_key;
+        Boolean found = bags ? CFBagGetValueIfPresent((CFBagRef)set, keys[i], &key) : CFSetGetValueIfPresent(set, keys[i], &key);
+        Boolean expected_found = bags ? CFBagGetValueIfPresent((CFBagRef)expected, keys[i], &expected_key) : CFSetGetValueIfPresent(expected, keys[i], &expected_key);
+        if (!found || !expected_found) fail(what, n, "value missing", i);
+        else if (key != expected_key) fail(what, n, "a later equal value replaced the first", i);
+        else if (bags && CFBagGetCountOfValue((CFBagRef)set, key) != CFBagGetCountOfValue((CFBagRef)expected, key)) fail(what, n, "wrong count of value", i);
+    }
+}
+
+static void check_create(const void **keys, const void **values, CFIndex n) {
+    CFMutableDictionaryRef expected = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    for (CFIndex i = 0; i < n; i++) CFDictionaryAddValue(expected, keys[i], values[i]);
+    CFDictionaryRef dict = CFDictionaryCreate(kCFAllocatorDefault, keys, values, n, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    compare_dictionaries(dict, expected, keys, n, "CFDictionaryCreate");
+    CFRelease(dict);
+    CFRelease(expected);
+
+    CFMutableSetRef expected_set = CFSetCreateMutable(kCFAllocatorDefault, 0, &kCFTypeSetCallBacks);
+    for (CFIndex i = 0; i < n; i++) CFSetAddValue(expected_set, keys[i]);
+    CFSetRef set = CFSetCreate(kCFAllocatorDefault, keys, n, &kCFTypeSetCallBacks);
+    compare_sets(set, expected_set, keys, n, false, "CFSetCreate");
+    CFRelease(set);
+    CFRelease(expected_set);
+
+    CFMutableBagRef expected_bag = CFBagCreateMutable(kCFAllocatorDefault, 0, &kCFTypeBagCallBacks);
+    for (CFIndex i = 0; i < n; i++) CFBagAddValue(expected_bag, keys[i]);
+    CFBagRef bag = CFBagCreate(kCFAllocatorDefault, keys, n, &kCFTypeBagCallBacks);
+    compare_sets((CFSetRef)bag, (CFSetRef)expected_bag, keys, n, true, "CFBagCreate");
+    CFRelease(bag);
+    CFRelease(expected_bag);
+}
+
+static uintptr_t retain_value(CFAllocatorRef allocator, uintptr_t value) {
+    return (uintptr_t)CFRetain((CFTypeRef)value);
+}
+
+static void release_value(CFAllocatorRef allocator, uintptr_t value) {
+    CFRelease((CFTypeRef)value);
+}
+
+static Boolean equal_values(uintptr_t value1, uintptr_t value2) {
+    return CFEqual((CFTypeRef)value1, (CFTypeRef)value2);
+}
+
+static CFHashCode hash_value(uintptr_t value) {
+    return CFHash((CFTypeRef)value);
+}
+
+static void check_basic_hash(CFOptionFlags style, const char *name, const void **keys, const void **values, CFIndex n) {
+    CFBasicHashCallbacks callbacks = {retain_value, retain_value, release_value, release_value, equal_values, equal_values, hash_value, NULL, NULL, NULL};
+    CFBasicHashRef ht = CFBasicHashCreate(kCFAllocatorDefault, style | kCFBasicHashHasKeys, &callbacks);
+    CFBasicHashRef expected = CFBasicHashCreate(kCFAllocatorDefault, style | kCFBasicHashHasKeys, &callbacks);
+    if ((CFBasicHashGetFlags(ht) & kCFBasicHashGroupHashing) != (style & kCFBasicHashGroupHashing)) {
+        printf("internal error: the %s table doesn't have the probing style asked for\n", name);
+        exit(99);
+    }
+    for (CFIndex i = 0; i < n; i++) CFBasicHashAddValue(expected, (uintptr_t)keys[i], (uintptr_t)values[i]);
+    CFBasicHashAddValues(ht, n, (const uintptr_t *)keys, (const uintptr_t *)values);
+    if (CFBasicHashGetCount(ht) != CFBasicHashGetCount(expected)) fail(name, n, "wrong count", CFBasicHashGetCount(ht));
+    for (CFIndex i = 0; i < n && !failed; i++) {
+        CFBasicHashBucket bucket = CFBasicHashFindBucket(ht, (uintptr_t)keys[i]);
+        CFBasicHashBucket expected_bucket = CFBasicHashFindBucket(expected, (uintptr_t)keys[i]);
+        if (0 == bucket.count) fail(name, n, "key missing", i);
+        else if (bucket.weak_key != expected_bucket.weak_key) fail(name, n, "a later equal key replaced the first", i);
+        else if (bucket.weak_value != expected_bucket.weak_value) fail(name, n, "wrong value object", i);
+    }
+    CFRelease(ht);
+    CFRelease(expected);
+}
+
+/* adds into tables which already hold some of the keys, and which have deleted buckets */
+static void check_populated(const void **keys, const void **values, CFIndex n) {
+    CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    CFMutableSetRef set = CFSetCreateMutable(kCFAllocatorDefault, 0, &kCFTypeSetCallBacks);
+    for (CFIndex i = 0; i < n; i += 2) {
+        CFDictionaryAddValue(dict, keys[i], values[i]);
+        CFSetAddValue(set, keys[i]);
+    }
+    for (CFIndex i = 0; i < n; i += 6) {
+        CFDictionaryRemoveValue(dict, keys[i]);
+        CFSetRemoveValue(set, keys[i]);
+    }
+    CFMutableDictionaryRef expected = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, dict);
+    CFMutableSetRef expected_set = CFSetCreateMutableCopy(kCFAllocatorDefault, 0, set);
+    for (CFIndex i = 0; i < n; i++) {
+        CFDictionaryAddValue(expected, keys[i], values[i]);
+        CFSetAddValue(expected_set, keys[i]);
+    }
+    __CFDictionaryAddValues(dict, keys, values, n);
+    __CFSetAddValues(set, keys, n);
+    compare_dictionaries(dict, expected, keys, n, "__CFDictionaryAddValues into a populated dictionary");
+    compare_sets(set, expected_set, keys, n, false, "__CFSetAddValues into a populated set");
+    CFRelease(dict);
+    CFRelease(expected);
+    CFRelease(set);
+    CFRelease(expected_set);
+}
+
+static void check(CFIndex n, long range) {
+    const void **keys = xmalloc_values(n), **values = xmalloc_values(n);
+    for (CFIndex i = 0; i < n; i++) {
+        keys[i] = create_string("key", random() % range);
+        values[i] = create_string("value", i);
+    }
+    check_create(keys, values, n);
+    if (!failed) check_basic_hash(kCFBasicHashLinearHashing, "CFBasicHashAddValues, linear", keys, values, n);
+    if (!failed) check_basic_hash(kCFBasicHashLinearHashing | kCFBasicHashGroupHashing, "CFBasicHashAddValues, group", keys, values, n);
+    if (!failed) check_populated(keys, values, n);
+
+    /* every collection has been released, so anything still retained was leaked by an add that kept nothing */
+    for (CFIndex i = 0; i < n && !failed; i++) {
+        if (1 != CFGetRetainCount(keys[i]) || 1 != CFGetRetainCount(values[i])) fail("all collections released", n, "entry still retained", i);
+    }
+    for (CFIndex i = 0; i < n; i++) {
+        CFRelease(keys[i]);
+        CFRelease(values[i]);
+    }
+    free(keys);
+    free(values);
+}
+
+static long get_long(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atol(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    static const CFIndex sizes[] = {0, 1, 2, 63, 64, 65, 127, 128, 129, 1000, 100000};
+
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-seed")) rseed = (int)get_long(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    printf("seed %d\n", rseed);
+    srandom(rseed);
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && !failed; s++) {
+        CFIndex n = sizes[s];
+        check(n, n / 4 + 1);
+        if (!failed) check(n, 1000000000L);
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * basic_hash_bench:  Time CFBasicHash lookups with linear and with group
+ *                    probing at several load factors, and check every
+ *                    answer against a reference set.
+ *
+ * usage:  basic_hash_bench [options...]
+ *
+ * Default:  For each probing style, linear and kCFBasicHashGroupHashing,
+ *           and for load factors of about 50%, 75% and 90%, fills a table
+ *           of CFString keys sized so that it holds that fraction of its
+ *           buckets, then times
+ *             - lookups of keys that are present, through equal strings
+ *               that are not the same objects, so that each match costs a
+ *               CFEqual,
+ *             - lookups of keys that are not, and
+ *             - a mix of half hits, a quarter misses and a quarter removals
+ *               of a present key, each followed by adding it back.
+ *           Both styles get the same callbacks, which count the key
+ *           equality calls, and the calls per operation are printed with
+ *           the times.  Every lookup and removal must agree with the
+ *           reference, and afterwards every key is looked up once more.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/basic_hash_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -buckets #    Smallest table size used (the next prime size up).
+ *    -iters #      Operations timed for each figure.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the timings)
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFBasicHash.h"
+
+CFIndex buckets = 250000;
+long iters = 4000000;
+int rseed;
+int failed;
+unsigned long equal_calls;
+
+/* keys[0 .. nkeys) may be in the table, keys[nkeys .. 2 * nkeys) never are; probes are equal strings but other objects */
+CFStringRef *keys, *probes;
+char *present;
+CFIndex nkeys;
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static uintptr_t retain_value(CFAllocatorRef allocator, uintptr_t value) {
+    return (uintptr_t)CFRetain((CFTypeRef)value);
+}
+
+static void release_value(CFAllocatorRef allocator, uintptr_t value) {
+    CFRelease((CFTypeRef)value);
+}
+
+static Boolean equal_values(uintptr_t value1, uintptr_t value2) {
+    equal_calls++;
+    return CFEqual((CFTypeRef)value1, (CFTypeRef)value2);
+}
+
+static CFHashCode hash_value(uintptr_t value) {
+    return CFHash((CFTypeRef)value);
+}
+
+static CFStringRef create_key(long i, long salt) {
+    char name[48];
+    snprintf(name, sizeof(name), "com.example.key.%ld.%08lx", i, salt);
+    return CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+}
+
+static void create_keys(CFIndex n) {
+    keys = malloc(2 * n * sizeof(CFStringRef));
+    probes = malloc(2 * n * sizeof(CFStringRef));
+    present = calloc(2 * n, 1);
+    if (!keys || !probes || !present) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    for (CFIndex i = 0; i < 2 * n; i++) {
+        long salt = random();
+        keys[i] = create_key(i, salt);
+        probes[i] = create_key(i, salt);
+    }
+}
+
+static void release_keys(CFIndex n) {
+    for (CFIndex i = 0; i < 2 * n; i++) {
+        CFRelease(keys[i]);
+        CFRelease(probes[i]);
+    }
+    free(keys);
+    free(probes);
+    free(present);
+}
+
+static void check_found(CFBasicHashRef ht, CFIndex i, const char *what) {
+    CFBasicHashBucket bucket = CFBasicHashFindBucket(ht, (uintptr_t)probes[i]);
+    if ((0 < bucket.count) != present[i] || (present[i] && bucket.weak_value != (uintptr_t)keys[i])) {
+        printf("FAIL: %s: key %ld was %s, but it is %s the reference set\n", what, (long)i, (0 < bucket.count) ? "found" : "not found", present[i] ? "in" : "not in");
+        failed = 1;
+    }
+}
+
+static void report(const char *what, double elapsed, unsigned long calls) {
+    printf("    %-26s %7.1f ns/op %6.2f equal calls/op\n", what, elapsed * 1e9 / iters, (double)calls / iters);
+}
+
+static void run(CFOptionFlags style, const char *name, double load) {
+    CFBasicHashCallbacks callbacks = {retain_value, retain_value, release_value, release_value, equal_values, equal_values, hash_value, NULL, NULL, NULL};
+    CFBasicHashRef ht = CFBasicHashCreate(kCFAllocatorDefault, style, &callbacks);
+    if ((CFBasicHashGetFlags(ht) & kCFBasicHashGroupHashing) != (style & kCFBasicHashGroupHashing)) {
+        printf("internal error: the %s table doesn't have the probing style asked for\n", name);
+        exit(99);
+    }
+    CFBasicHashSetCapacity(ht, buckets);
+    CFIndex num_buckets = CFBasicHashGetNumBuckets(ht);
+    CFIndex count = (CFIndex)(load * num_buckets);
+    if (count > nkeys || count >= CFBasicHashGetCapacity(ht)) {
+        printf("internal error: %ld keys for %ld buckets\n", (long)count, (long)num_buckets);
+        exit(99);
+    }
+    memset(present, 0, 2 * nkeys);
+    for (CFIndex i = 0; i < count; i++) {
+        CFBasicHashAddValue(ht, (uintptr_t)keys[i], (uintptr_t)keys[i]);
+        present[i] = 1;
+    }
+    if (CFBasicHashGetNumBuckets(ht) != num_buckets || CFBasicHashGetCount(ht) != count) {
+        printf("FAIL: %s: %ld keys added to %ld buckets left %ld keys in %ld buckets\n", name, (long)count, (long)num_buckets, (long)CFBasicHashGetCount(ht), (long)CFBasicHashGetNumBuckets(ht));
+        failed = 1;
+    }
+    printf("%s probing, %ld of %ld buckets used (%.0f%%)\n", name, (long)count, (long)num_buckets, 100.0 * count / num_buckets);
+
+    unsigned long calls = equal_calls;
+    double start = now();
+    for (long n = 0; n < iters; n++) {
+        CFIndex i = random() % count;
+        if (0 == CFBasicHashFindBucket(ht, (uintptr_t)probes[i]).count) {
+            printf("FAIL: %s: present key %ld was not found\n", name, (long)i);
+            failed = 1;
+            break;
+        }
+    }
+    report("hits", now() - start, equal_calls - calls);
+
+    calls = equal_calls;
+    start = now();
+    for (long n = 0; n < iters; n++) {
+        CFIndex i = nkeys + random() % nkeys;
+        if (0 != CFBasicHashFindBucket(ht, (uintptr_t)probes[i]).count) {
+            printf("FAIL: %s: absent key %ld was found\n", name, (long)i);
+            failed = 1;
+            break;
+        }
+    }
+    report("misses", now() - start, equal_calls - calls);
+
+    calls = equal_calls;
+    start = now();
+    for (long n = 0; n < iters && !failed; n++) {
+        long r = random();
+        if (r % 4 < 2) {
+            check_found(ht, r / 4 % count, "mixed hit");
+        } else if (r % 4 == 2) {
+            check_found(ht, nkeys + r / 4 % nkeys, "mixed miss");
+        } else {
+            CFIndex i = r / 4 % count;
+            if (1 != CFBasicHashRemoveValue(ht, (uintptr_t)probes[i])) {
+                printf("FAIL: %s: removing present key %ld didn't remove one value\n", name, (long)i);
+                failed = 1;
+            }
+            CFBasicHashAddValue(ht, (uintptr_t)keys[i], (uintptr_t)keys[i]);
+        }
+    }
+    report("mixed, with removals", now() - start, equal_calls - calls);
+
+    /* removing and adding back left the count alone, but a rehash to clear deleted buckets may have moved the load */
+    for (CFIndex i = 0; i < 2 * nkeys && !failed; i++) check_found(ht, i, "final lookup");
+    if (CFBasicHashGetCount(ht) != count) {
+        printf("FAIL: %s: %ld keys at the end, expected %ld\n", name, (long)CFBasicHashGetCount(ht), (long)count);
+        failed = 1;
+    }
+    if (CFBasicHashGetNumBuckets(ht) != num_buckets) printf("    (rehashed to %ld buckets along the way)\n", (long)CFBasicHashGetNumBuckets(ht));
+    CFRelease(ht);
+}
+
+static long get_long(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atol(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    static const double loads[] = {0.5, 0.75, 0.9};
+
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-buckets")) buckets = get_long(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-iters")) iters = get_long(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = (int)get_long(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (buckets < 16 || iters < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %ld operations timed for each figure\n", rseed, iters);
+    srandom(rseed);
+
+    /* the table sizes are primes just above the capacities asked for, so twice the request is plenty of keys */
+    nkeys = 2 * buckets;
+    create_keys(nkeys);
+    for (unsigned l = 0; l < sizeof(loads) / sizeof(loads[0]) && !failed; l++) {
+        run(kCFBasicHashLinearHashing, "linear", loads[l]);
+        if (!failed) run(kCFBasicHashLinearHashing | kCFBasicHashGroupHashing, "group", loads[l]);
+    }
+    release_keys(nkeys);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
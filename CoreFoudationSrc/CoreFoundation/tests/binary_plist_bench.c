@@ -0,0 +1,222 @@
+/*
+ * binary_plist_bench:  Time the binary property list writer, and measure the
+ *                      memory it needs, with and without uniquing.
+ *
+ * usage:  binary_plist_bench [options...]
+ *
+ * Default:  Builds an array of dictionaries whose keys come from a small
+ *           set, so most strings repeat, and whose values are strings,
+ *           integers, reals of both sizes, dates and data, then writes it
+ *           with __CFBinaryPlistWrite, once uniquing equal objects and once
+ *           with kCFBinaryPlistWriteSkipUniquing.  Each run is done in a
+ *           child process forked before CoreFoundation is used, which reports
+ *           the write rate, the output size and how far the write raised the
+ *           process's high-water RSS.  The output is read back and must equal
+ *           the input, with every number keeping its integer or real type
+ *           and its size: 1, 1.0f and 1.0 are equal under CFEqual but
+ *           written differently.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/binary_plist_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -count #      Dictionaries in the array.
+ *    -keys #       Distinct keys, and entries per dictionary.
+ *    -iters #      Writes timed per run.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the rates)
+ *    1    FAIL (the output didn't read back as the input, or a child run
+ *         failed)
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../ForFoundationOnly.h"
+
+int count = 100000;
+int nkeys = 16;
+int iters = 5;
+int rseed;
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long max_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;     /* bytes on Darwin */
+}
+
+static CFTypeRef create_value(int kind, int i) {
+    switch (kind % 6) {
+    case 0: {
+        char name[32];
+        snprintf(name, sizeof(name), "value %d", i % 1000);
+        return CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+    }
+    case 1: {
+        /* small integers repeat, and must not merge with the equal reals below */
+        SInt64 v = i % 100;
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &v);
+    }
+    case 2: {
+        double v = i % 100;
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &v);
+    }
+    case 3: {
+        float v = i % 100;
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat32Type, &v);
+    }
+    case 4:
+        return CFDateCreate(kCFAllocatorDefault, (CFAbsoluteTime)(i % 500));
+    default: {
+        uint8_t bytes[24];
+        memset(bytes, i % 7, sizeof(bytes));
+        return CFDataCreate(kCFAllocatorDefault, bytes, 8 + i % 16);
+    }
+    }
+}
+
+static CFArrayRef create_plist(void) {
+    CFStringRef *keys = malloc(nkeys * sizeof(CFStringRef));
+    CFTypeRef *values = malloc(nkeys * sizeof(CFTypeRef));
+    CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+    if (!keys || !values || !array) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    for (int k = 0; k < nkeys; k++) {
+        char name[32];
+        snprintf(name, sizeof(name), "key%d", k);
+        keys[k] = CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+    }
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < nkeys; k++) values[k] = create_value(k + (int)(random() % 6), (int)random());
+        CFDictionaryRef dict = CFDictionaryCreate(kCFAllocatorDefault, (const void **)keys, values, nkeys, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFArrayAppendValue(array, dict);
+        CFRelease(dict);
+        for (int k = 0; k < nkeys; k++) CFRelease(values[k]);
+    }
+    for (int k = 0; k < nkeys; k++) CFRelease(keys[k]);
+    free(keys);
+    free(values);
+    return array;
+}
+
+/* CFEqual can't tell these apart, so the round trip is checked number by number */
+static int same_number_types(CFTypeRef written, CFTypeRef read) {
+    if (CFGetTypeID(written) != CFNumberGetTypeID()) return 1;
+    if (CFNumberIsFloatType((CFNumberRef)written) != CFNumberIsFloatType((CFNumberRef)read)) return 0;
+    return !CFNumberIsFloatType((CFNumberRef)written) || CFNumberGetByteSize((CFNumberRef)written) == CFNumberGetByteSize((CFNumberRef)read);
+}
+
+static int check(CFArrayRef plist, CFDataRef data) {
+    CFErrorRef error = NULL;
+    CFPropertyListRef read = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, &error);
+    if (!read || !CFEqual(plist, read)) {
+        printf("FAIL: the output doesn't read back as the input\n");
+        if (read) CFRelease(read);
+        if (error) CFRelease(error);
+        return 0;
+    }
+    int ok = 1;
+    CFIndex n = CFArrayGetCount(plist);
+    for (CFIndex i = 0; ok && i < n; i++) {
+        CFDictionaryRef w = CFArrayGetValueAtIndex(plist, i), r = CFArrayGetValueAtIndex(read, i);
+        CFIndex c = CFDictionaryGetCount(w);
+        const void **keys = malloc(c * sizeof(void *)), **values = malloc(c * sizeof(void *));
+        CFDictionaryGetKeysAndValues(w, keys, values);
+        for (CFIndex k = 0; ok && k < c; k++) {
+            if (!same_number_types(values[k], CFDictionaryGetValue(r, keys[k]))) {
+                printf("FAIL: a number in dictionary %ld was read back as another type\n", (long)i);
+                ok = 0;
+            }
+        }
+        free(keys);
+        free(values);
+    }
+    CFRelease(read);
+    return ok;
+}
+
+static int run(CFOptionFlags options, const char *name) {
+    srandom(rseed);
+    CFArrayRef plist = create_plist();
+    CFMutableDataRef data = NULL;
+    long rss = max_rss();
+    double start = now();
+    for (int i = 0; i < iters; i++) {
+        if (data) CFRelease(data);
+        data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+        if (__CFBinaryPlistWrite(plist, data, 0, options, NULL) <= 0) {
+            printf("FAIL: %s: the write failed\n", name);
+            return 1;
+        }
+    }
+    double elapsed = now() - start;
+    long grew = max_rss() - rss;
+    printf("%-12s %8.1f MB/s  %10ld bytes  peak RSS +%ld KB\n", name, CFDataGetLength(data) * (double)iters / elapsed / 1e6, (long)CFDataGetLength(data), grew / 1024);
+    int ok = check(plist, data);
+    CFRelease(data);
+    CFRelease(plist);
+    return ok ? 0 : 1;
+}
+
+/* CoreFoundation can't be used across fork(), so each run gets a fresh child */
+static int run_in_child(CFOptionFlags options, const char *name) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(99);
+    }
+    if (0 == pid) _exit(run(options, name));
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) return 1;
+    return WEXITSTATUS(status);
+}
+
+static int get_int(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-count")) count = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-keys")) nkeys = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-iters")) iters = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = get_int(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (count < 1 || nkeys < 1 || iters < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %d dictionaries of %d entries\n", rseed, count, nkeys);
+    int failed = run_in_child(0, "uniqued");
+    failed |= run_in_child(kCFBinaryPlistWriteSkipUniquing, "not uniqued");
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
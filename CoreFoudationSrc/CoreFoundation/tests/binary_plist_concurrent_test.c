@@ -0,0 +1,264 @@
+/*
+ * binary_plist_concurrent_test:  Check that decoding a binary property list
+ *                                with _kCFPropertyListDecodeConcurrently
+ *                                gives the same objects as decoding it on
+ *                                one thread.
+ *
+ * usage:  binary_plist_concurrent_test [options...]
+ *
+ * Default:  Writes an array of dictionaries holding ASCII and UTF-16
+ *           strings, integers, reals, dates, data and small arrays with
+ *           __CFBinaryPlistWrite, once uniquing equal objects, so that many
+ *           references lead to one leaf, and once with
+ *           kCFBinaryPlistWriteSkipUniquing, so that equal leaves are
+ *           written over and over.  Each file is decoded under every
+ *           mutability option, with and without the concurrent option, and
+ *           the two results must be CFEqual to each other and to what was
+ *           written.  They must also share objects in the same places: the
+ *           one-thread decode hands out one object for a leaf however many
+ *           references it has, except for strings and data made mutable,
+ *           and so must the concurrent decode.  Last, a string leaf is
+ *           corrupted, and both decodes must fail.  The time of each decode
+ *           is printed.
+ *
+ *           Without dispatch, as on Linux, the option is ignored, and the
+ *           two decodes are the same code.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/binary_plist_concurrent_test.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -count #      Dictionaries in the array (the concurrent decode is only
+ *                  used for files of 8192 objects or more).
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the timings)
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFPriv.h"
+#include "../ForFoundationOnly.h"
+
+extern Boolean CFDictionaryGetKeyIfPresent(CFDictionaryRef dict, const void *key, const void **actualkey);
+
+int count = 50000;
+int rseed;
+int failed;
+
+static const CFOptionFlags mutability_options[] = {kCFPropertyListImmutable, kCFPropertyListMutableContainers, kCFPropertyListMutableContainersAndLeaves};
+static const char *const mutability_names[] = {"immutable", "mutable containers", "mutable containers and leaves"};
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void set_value(CFMutableDictionaryRef dict, CFStringRef key, CFTypeRef value) {
+    CFDictionarySetValue(dict, key, value);
+    CFRelease(value);
+}
+
+static CFStringRef create_string(const char *format, long i) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), format, i);
+    return CFStringCreateWithCString(kCFAllocatorDefault, buf, kCFStringEncodingUTF8);
+}
+
+static CFArrayRef create_plist(void) {
+    CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+    for (int i = 0; i < count; i++) {
+        CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        /* some leaves are all different, others come from a small set and repeat */
+        SInt64 index = i, small = random() % 50;
+        double real = (random() % 1000) / 8.0;
+        uint8_t bytes[40];
+        memset(bytes, random() % 4, sizeof(bytes));
+        set_value(dict, CFSTR("name"), create_string("item %ld", i));
+        set_value(dict, CFSTR("kind"), create_string("kind %ld", random() % 20));
+        set_value(dict, CFSTR("title"), create_string("\xc3\xa9l\xc3\xa9ment %ld", random() % 100));
+        set_value(dict, CFSTR("index"), CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &index));
+        set_value(dict, CFSTR("small"), CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &small));
+        set_value(dict, CFSTR("real"), CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &real));
+        set_value(dict, CFSTR("date"), CFDateCreate(kCFAllocatorDefault, (CFAbsoluteTime)(random() % 500)));
+        set_value(dict, CFSTR("data"), CFDataCreate(kCFAllocatorDefault, bytes, 8 + random() % 32));
+        CFMutableArrayRef tags = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+        for (int t = random() % 4; 0 < t; t--) {
+            CFStringRef tag = create_string("tag %ld", random() % 7);
+            CFArrayAppendValue(tags, tag);
+            CFRelease(tag);
+        }
+        CFArrayAppendValue(tags, kCFBooleanTrue);
+        set_value(dict, CFSTR("tags"), tags);
+        CFArrayAppendValue(array, dict);
+        CFRelease(dict);
+    }
+    return array;
+}
+
+/* Pairs up the objects in the same places of two equal plists; each object must always pair with the same one */
+struct pairing {
+    CFMutableDictionaryRef forward, backward;
+    const char *what;
+};
+
+static void pair(struct pairing *p, CFTypeRef serial, CFTypeRef concurrent) {
+    const void *seen;
+    if (CFDictionaryGetValueIfPresent(p->forward, serial, &seen) && seen != concurrent) {
+        printf("FAIL: %s: an object shared by the one-thread decode isn't shared by the concurrent one\n", p->what);
+        failed = 1;
+    }
+    if (CFDictionaryGetValueIfPresent(p->backward, concurrent, &seen) && seen != serial) {
+        printf("FAIL: %s: an object shared by the concurrent decode isn't shared by the one-thread one\n", p->what);
+        failed = 1;
+    }
+    CFDictionarySetValue(p->forward, serial, concurrent);
+    CFDictionarySetValue(p->backward, concurrent, serial);
+}
+
+static void pair_all(struct pairing *p, CFTypeRef serial, CFTypeRef concurrent) {
+    if (failed) return;
+    pair(p, serial, concurrent);
+    if (CFGetTypeID(serial) == CFArrayGetTypeID()) {
+        for (CFIndex i = 0; i < CFArrayGetCount(serial); i++) pair_all(p, CFArrayGetValueAtIndex(serial, i), CFArrayGetValueAtIndex(concurrent, i));
+    } else if (CFGetTypeID(serial) == CFDictionaryGetTypeID()) {
+        CFIndex n = CFDictionaryGetCount(serial);
+        const void **keys = malloc(n * sizeof(void *)), **values = malloc(n * sizeof(void *));
+        CFDictionaryGetKeysAndValues(serial, keys, values);
+        for (CFIndex i = 0; i < n; i++) {
+            const void *key, *value;
+            if (!CFDictionaryGetKeyIfPresent(concurrent, keys[i], &key) || !CFDictionaryGetValueIfPresent(concurrent, key, &value)) {
+                printf("FAIL: %s: a key is missing from the concurrent decode\n", p->what);
+                failed = 1;
+                break;
+            }
+            pair_all(p, keys[i], key);
+            pair_all(p, values[i], value);
+        }
+        free(keys);
+        free(values);
+    }
+}
+
+static CFPropertyListRef decode(CFDataRef data, CFOptionFlags option, double *elapsed, CFErrorRef *error) {
+    double start = now();
+    CFPropertyListRef plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, option, NULL, error);
+    *elapsed = now() - start;
+    return plist;
+}
+
+static void check(CFArrayRef written, CFDataRef data, const char *name) {
+    for (unsigned o = 0; o < sizeof(mutability_options) / sizeof(mutability_options[0]) && !failed; o++) {
+        char what[128];
+        double serial_time, concurrent_time;
+        snprintf(what, sizeof(what), "%s, %s", name, mutability_names[o]);
+        CFPropertyListRef serial = decode(data, mutability_options[o], &serial_time, NULL);
+        CFPropertyListRef concurrent = decode(data, mutability_options[o] | _kCFPropertyListDecodeConcurrently, &concurrent_time, NULL);
+        printf("%-44s one thread %7.3fs  concurrently %7.3fs\n", what, serial_time, concurrent_time);
+        if (!serial || !concurrent) {
+            printf("FAIL: %s: the %s decode failed\n", what, serial ? "concurrent" : "one-thread");
+            failed = 1;
+        } else if (!CFEqual(serial, written) || !CFEqual(concurrent, serial)) {
+            printf("FAIL: %s: the %s decode isn't equal to what was written\n", what, CFEqual(serial, written) ? "concurrent" : "one-thread");
+            failed = 1;
+        } else {
+            struct pairing p = {CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, NULL), CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, NULL), what};
+            pair_all(&p, serial, concurrent);
+            CFRelease(p.forward);
+            CFRelease(p.backward);
+        }
+        if (serial) CFRelease(serial);
+        if (concurrent) CFRelease(concurrent);
+    }
+}
+
+/* Breaks the count of an ASCII string leaf: the marker says an integer count follows, and what follows isn't one */
+static void check_corrupt_leaf(CFDataRef good) {
+    CFMutableDataRef data = CFDataCreateMutableCopy(kCFAllocatorDefault, 0, good);
+    uint8_t *bytes = CFDataGetMutableBytePtr(data);
+    uint8_t marker;
+    uint64_t offset, leaf = 0;
+    CFBinaryPlistTrailer trailer;
+    if (!__CFBinaryPlistGetTopLevelInfo(bytes, CFDataGetLength(data), &marker, &offset, &trailer)) {
+        printf("internal error: the plist written can't be read\n");
+        exit(99);
+    }
+    for (uint64_t i = trailer._numObjects / 2; i < trailer._numObjects && !leaf; i++) {
+        const uint8_t *entry = bytes + trailer._offsetTableOffset + i * trailer._offsetIntSize;
+        uint64_t off = 0;
+        for (unsigned b = 0; b < trailer._offsetIntSize; b++) off = (off << 8) | entry[b];
+        if (kCFBinaryPlistMarkerASCIIString == (bytes[off] & 0xf0) && 1 <= (bytes[off] & 0x0f) && (bytes[off] & 0x0f) < 0x0f) leaf = off;
+    }
+    if (!leaf) {
+        printf("internal error: no short ASCII string to corrupt\n");
+        exit(99);
+    }
+    bytes[leaf] = kCFBinaryPlistMarkerASCIIString | 0x0f;
+    bytes[leaf + 1] = kCFBinaryPlistMarkerNull;
+    for (unsigned o = 0; o < sizeof(mutability_options) / sizeof(mutability_options[0]); o++) {
+        double elapsed;
+        for (int concurrently = 0; concurrently < 2; concurrently++) {
+            CFErrorRef error = NULL;
+            CFPropertyListRef plist = decode(data, mutability_options[o] | (concurrently ? _kCFPropertyListDecodeConcurrently : 0), &elapsed, &error);
+            if (plist || !error) {
+                printf("FAIL: a corrupt leaf, %s, %s: %s\n", mutability_names[o], concurrently ? "concurrently" : "one thread", plist ? "the decode succeeded" : "no error was returned");
+                failed = 1;
+            }
+            if (plist) CFRelease(plist);
+            if (error) CFRelease(error);
+        }
+    }
+    CFRelease(data);
+}
+
+static int get_int(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-count")) count = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = get_int(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (count < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %d dictionaries\n", rseed, count);
+    srandom(rseed);
+
+    CFArrayRef written = create_plist();
+    CFMutableDataRef uniqued = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    CFMutableDataRef repeated = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    if (__CFBinaryPlistWrite(written, uniqued, 0, 0, NULL) <= 0 || __CFBinaryPlistWrite(written, repeated, 0, kCFBinaryPlistWriteSkipUniquing, NULL) <= 0) {
+        printf("internal error: the write failed\n");
+        exit(99);
+    }
+    check(written, uniqued, "uniqued leaves");
+    if (!failed) check(written, repeated, "repeated leaves");
+    if (!failed) check_corrupt_leaf(uniqued);
+
+    CFRelease(uniqued);
+    CFRelease(repeated);
+    CFRelease(written);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,511 @@
+/*
+ * binary_plist_map_test:  Check the lazy binary property list reader, the
+ *                         __CFBinaryPlistMap functions, against a full parse
+ *                         of the same file.
+ *
+ * usage:  binary_plist_map_test [options...]
+ *
+ * Default:  Writes a dictionary with __CFBinaryPlistWrite which holds one
+ *           value of every type, nested collections, and an array of
+ *           generated dictionaries, then maps it both from a CFData and
+ *           from a file.  Through each map it checks
+ *             - the marker, count, bytes, and Boolean, integer and real
+ *               value of each scalar, and that every typed accessor refuses
+ *               a value of another type,
+ *             - every key and value pair of the top dictionary, indexes and
+ *               keys past the end or before the start, and keys asked of
+ *               arrays and indexes of dictionaries,
+ *             - key paths that lead somewhere, and ones with a missing key,
+ *               an index out of range, or a step into a scalar, and
+ *             - that objects created from values, under each mutability
+ *               option, are CFEqual to the same part of a full parse.
+ *           Then corrupts copies of the file: truncated ones, a trailer
+ *           whose offset table runs into it, an offset table entry for the
+ *           top object or for a nested value which points outside the
+ *           object table, and an object reference past the last object.
+ *           Each must be refused where it is met, and values not reached
+ *           through the corrupt part must still read.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/binary_plist_map_test.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -count #      Generated dictionaries.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../ForFoundationOnly.h"
+
+#define SMALL_ARRAY_COUNT 10
+
+int count = 20000;
+int rseed;
+int failed;
+
+static const CFOptionFlags mutability_options[] = {kCFPropertyListImmutable, kCFPropertyListMutableContainers, kCFPropertyListMutableContainersAndLeaves};
+
+static void fail(const char *what, const char *why) {
+    printf("FAIL: %s: %s\n", what, why);
+    failed = 1;
+}
+
+static void set_value(CFMutableDictionaryRef dict, const char *key, CFTypeRef value) {
+    CFStringRef k = CFStringCreateWithCString(kCFAllocatorDefault, key, kCFStringEncodingUTF8);
+    CFDictionarySetValue(dict, k, value);
+    CFRelease(k);
+    CFRelease(value);
+}
+
+static CFNumberRef create_int(SInt64 v) {
+    return CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &v);
+}
+
+static CFStringRef create_string(const char *format, long i) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), format, i);
+    return CFStringCreateWithCString(kCFAllocatorDefault, buf, kCFStringEncodingUTF8);
+}
+
+static CFDictionaryRef create_plist(void) {
+    CFMutableDictionaryRef top = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    float f = 1.25f;
+    double d = 3.5;
+    static const uint8_t bytes[] = {0, 1, 2, 0xfe, 0xff, 'b', 'p', 'l', 'i', 's', 't'};
+    set_value(top, "true", CFRetain(kCFBooleanTrue));
+    set_value(top, "false", CFRetain(kCFBooleanFalse));
+    set_value(top, "int", create_int(42));
+    set_value(top, "negative", create_int(-7));
+    set_value(top, "big", create_int(1LL << 40));
+    set_value(top, "real", CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &d));
+    set_value(top, "float", CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat32Type, &f));
+    set_value(top, "date", CFDateCreate(kCFAllocatorDefault, 1000000.0));
+    set_value(top, "data", CFDataCreate(kCFAllocatorDefault, bytes, sizeof(bytes)));
+    set_value(top, "ascii", CFStringCreateWithCString(kCFAllocatorDefault, "hello", kCFStringEncodingUTF8));
+    set_value(top, "unicode", CFStringCreateWithCString(kCFAllocatorDefault, "h\xc3\xa9llo \xe2\x82\xac", kCFStringEncodingUTF8));
+
+    CFMutableArrayRef small = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    for (int i = 0; i < SMALL_ARRAY_COUNT; i++) {
+        CFNumberRef n = create_int(1000 + i);
+        CFArrayAppendValue(small, n);
+        CFRelease(n);
+    }
+    set_value(top, "small", small);
+
+    /* nested: {a = {b = ("x", {c = 7})}} */
+    CFMutableDictionaryRef c = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    set_value(c, "c", create_int(7));
+    CFMutableArrayRef b = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    CFArrayAppendValue(b, CFSTR("x"));
+    CFArrayAppendValue(b, c);
+    CFRelease(c);
+    CFMutableDictionaryRef a = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    set_value(a, "b", b);
+    CFMutableDictionaryRef nested = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    set_value(nested, "a", a);
+    set_value(top, "nested", nested);
+
+    CFMutableArrayRef items = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+    for (int i = 0; i < count; i++) {
+        CFMutableDictionaryRef item = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        double score = (random() % 1000) / 4.0;
+        set_value(item, "name", create_string("item %ld", i));
+        set_value(item, "index", create_int(i));
+        set_value(item, "score", CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &score));
+        CFMutableArrayRef tags = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+        for (int t = random() % 4; 0 < t; t--) {
+            CFStringRef tag = create_string("tag %ld", random() % 7);
+            CFArrayAppendValue(tags, tag);
+            CFRelease(tag);
+        }
+        set_value(item, "tags", tags);
+        CFArrayAppendValue(items, item);
+        CFRelease(item);
+    }
+    set_value(top, "items", items);
+    return top;
+}
+
+static CFBinaryPlistValue value_at(CFBinaryPlistMapRef map, const char *keyPath, const char *what) {
+    CFBinaryPlistValue value = {NULL, 0};
+    CFStringRef path = CFStringCreateWithCString(kCFAllocatorDefault, keyPath, kCFStringEncodingUTF8);
+    if (!__CFBinaryPlistMapGetValueForKeyPath(map, path, &value)) fail(what, "a key path that is there wasn't found");
+    CFRelease(path);
+    return value;
+}
+
+static bool has_key_path(CFBinaryPlistMapRef map, const char *keyPath) {
+    CFStringRef path = CFStringCreateWithCString(kCFAllocatorDefault, keyPath, kCFStringEncodingUTF8);
+    bool found = __CFBinaryPlistMapGetValueForKeyPath(map, path, NULL);
+    CFRelease(path);
+    return found;
+}
+
+/* value must create objects equal to expected under every mutability option */
+static void check_object(CFBinaryPlistValue value, CFTypeRef expected, const char *what) {
+    for (unsigned o = 0; o < sizeof(mutability_options) / sizeof(mutability_options[0]); o++) {
+        CFPropertyListRef object = __CFBinaryPlistValueCreateObject(kCFAllocatorDefault, value, mutability_options[o]);
+        if (!object || !CFEqual(object, expected)) {
+            fail(what, "the object created from the map isn't equal to the full parse");
+            if (object) CFRelease(object);
+            return;
+        }
+        CFRelease(object);
+    }
+}
+
+static void check_scalars(CFBinaryPlistMapRef map, const char *what) {
+    Boolean boolean;
+    int64_t integer;
+    double real;
+    CFIndex length;
+    const uint8_t *ptr;
+
+    if (!__CFBinaryPlistValueGetBoolean(value_at(map, "true", what), &boolean) || !boolean) fail(what, "true");
+    if (!__CFBinaryPlistValueGetBoolean(value_at(map, "false", what), &boolean) || boolean) fail(what, "false");
+    if (!__CFBinaryPlistValueGetInt64(value_at(map, "int", what), &integer) || 42 != integer) fail(what, "int");
+    if (!__CFBinaryPlistValueGetInt64(value_at(map, "negative", what), &integer) || -7 != integer) fail(what, "negative int");
+    if (!__CFBinaryPlistValueGetInt64(value_at(map, "big", what), &integer) || (1LL << 40) != integer) fail(what, "big int");
+    if (!__CFBinaryPlistValueGetFloat64(value_at(map, "real", what), &real) || 3.5 != real) fail(what, "real");
+    if (!__CFBinaryPlistValueGetFloat64(value_at(map, "float", what), &real) || 1.25 != real) fail(what, "float");
+    if (kCFBinaryPlistMarkerDate != __CFBinaryPlistValueGetMarker(value_at(map, "date", what))) fail(what, "date marker");
+    if (!__CFBinaryPlistValueGetFloat64(value_at(map, "date", what), &real) || 1000000.0 != real) fail(what, "date");
+
+    CFBinaryPlistValue data = value_at(map, "data", what);
+    ptr = __CFBinaryPlistValueGetBytePtr(data, &length);
+    if (kCFBinaryPlistMarkerData != __CFBinaryPlistValueGetMarker(data) || 11 != __CFBinaryPlistValueGetCount(data) || !ptr || 11 != length || 0 != memcmp(ptr + 5, "bplist", 6)) fail(what, "data");
+
+    CFBinaryPlistValue ascii = value_at(map, "ascii", what);
+    ptr = __CFBinaryPlistValueGetBytePtr(ascii, &length);
+    if (kCFBinaryPlistMarkerASCIIString != __CFBinaryPlistValueGetMarker(ascii) || 5 != __CFBinaryPlistValueGetCount(ascii) || !ptr || 5 != length || 0 != memcmp(ptr, "hello", 5)) fail(what, "ASCII string");
+
+    /* UTF-16 strings are in the map big-endian */
+    CFBinaryPlistValue unicode = value_at(map, "unicode", what);
+    CFStringRef expected = CFStringCreateWithCString(kCFAllocatorDefault, "h\xc3\xa9llo \xe2\x82\xac", kCFStringEncodingUTF8);
+    CFIndex chars = CFStringGetLength(expected);
+    ptr = __CFBinaryPlistValueGetBytePtr(unicode, &length);
+    if (kCFBinaryPlistMarkerUnicode16String != __CFBinaryPlistValueGetMarker(unicode) || chars != __CFBinaryPlistValueGetCount(unicode) || !ptr || 2 * chars != length) {
+        fail(what, "UTF-16 string");
+    } else {
+        for (CFIndex i = 0; i < chars; i++) {
+            if (((ptr[2 * i] << 8) | ptr[2 * i + 1]) != CFStringGetCharacterAtIndex(expected, i)) fail(what, "UTF-16 string characters");
+        }
+    }
+    CFRelease(expected);
+
+    /* every accessor refuses the types it isn't for */
+    CFBinaryPlistValue integer_value = value_at(map, "int", what);
+    if (__CFBinaryPlistValueGetBoolean(integer_value, &boolean)) fail(what, "an int read as a Boolean");
+    if (__CFBinaryPlistValueGetFloat64(integer_value, &real)) fail(what, "an int read as a real");
+    if (__CFBinaryPlistValueGetBytePtr(integer_value, &length)) fail(what, "an int read as bytes");
+    if (-1 != __CFBinaryPlistValueGetCount(integer_value)) fail(what, "an int has a count");
+    if (__CFBinaryPlistValueGetInt64(ascii, &integer)) fail(what, "a string read as an int");
+    if (__CFBinaryPlistValueGetInt64(value_at(map, "real", what), &integer)) fail(what, "a real read as an int");
+    if (__CFBinaryPlistValueGetBoolean(value_at(map, "nested", what), &boolean)) fail(what, "a dictionary read as a Boolean");
+    if (__CFBinaryPlistValueGetBytePtr(value_at(map, "small", what), &length)) fail(what, "an array read as bytes");
+}
+
+static void check_collections(CFBinaryPlistMapRef map, CFDictionaryRef eager, const char *what) {
+    CFBinaryPlistValue top = __CFBinaryPlistMapGetTopValue(map), key, value;
+    CFIndex n = CFDictionaryGetCount(eager);
+    if (kCFBinaryPlistMarkerDict != __CFBinaryPlistValueGetMarker(top) || n != __CFBinaryPlistValueGetCount(top)) {
+        fail(what, "the top dictionary's marker or count");
+        return;
+    }
+    for (CFIndex i = 0; i < n && !failed; i++) {
+        if (!__CFBinaryPlistValueGetKeyAndValueAtIndex(top, i, &key, &value)) {
+            fail(what, "a pair of the top dictionary can't be read");
+            break;
+        }
+        CFPropertyListRef k = __CFBinaryPlistValueCreateObject(kCFAllocatorDefault, key, kCFPropertyListImmutable);
+        CFTypeRef expected = k ? CFDictionaryGetValue(eager, k) : NULL;
+        if (!expected) fail(what, "a key of the top dictionary isn't in the full parse");
+        else check_object(value, expected, what);
+        if (k) CFRelease(k);
+    }
+    check_object(top, eager, what);
+    if (__CFBinaryPlistValueGetKeyAndValueAtIndex(top, n, &key, &value)) fail(what, "a pair past the end");
+    if (__CFBinaryPlistValueGetKeyAndValueAtIndex(top, -1, &key, &value)) fail(what, "a pair before the start");
+    if (__CFBinaryPlistValueGetValueAtIndex(top, 0, &value)) fail(what, "an index into a dictionary");
+    if (__CFBinaryPlistValueGetValueForKey(top, CFSTR("missing"), &value)) fail(what, "a missing key");
+
+    CFBinaryPlistValue small = value_at(map, "small", what);
+    int64_t integer;
+    if (kCFBinaryPlistMarkerArray != __CFBinaryPlistValueGetMarker(small) || SMALL_ARRAY_COUNT != __CFBinaryPlistValueGetCount(small)) fail(what, "the small array's marker or count");
+    for (CFIndex i = 0; i < SMALL_ARRAY_COUNT; i++) {
+        if (!__CFBinaryPlistValueGetValueAtIndex(small, i, &value) || !__CFBinaryPlistValueGetInt64(value, &integer) || 1000 + i != integer) fail(what, "an element of the small array");
+    }
+    if (__CFBinaryPlistValueGetValueAtIndex(small, SMALL_ARRAY_COUNT, &value)) fail(what, "an index past the end");
+    if (__CFBinaryPlistValueGetValueAtIndex(small, -1, &value)) fail(what, "an index before the start");
+    if (__CFBinaryPlistValueGetValueForKey(small, CFSTR("0"), &value)) fail(what, "a key of an array");
+    if (__CFBinaryPlistValueGetKeyAndValueAtIndex(small, 0, &key, &value)) fail(what, "a pair of an array");
+
+    /* key paths */
+    if (!__CFBinaryPlistValueGetInt64(value_at(map, "nested:a:b:1:c", what), &integer) || 7 != integer) fail(what, "nested:a:b:1:c");
+    if (kCFBinaryPlistMarkerASCIIString != __CFBinaryPlistValueGetMarker(value_at(map, "nested:a:b:0", what))) fail(what, "nested:a:b:0");
+    static const char *const missing[] = {"missing", "nested:a:missing", "nested:a:b:2", "nested:a:b:-1", "nested:a:b:x", "nested:0", "int:0", "int:key", "ascii:0", "small:10", "nested:a:b:1:c:0"};
+    for (unsigned m = 0; m < sizeof(missing) / sizeof(missing[0]); m++) {
+        if (has_key_path(map, missing[m])) fail(what, missing[m]);
+    }
+    if (__CFBinaryPlistMapGetValueForKeyPath(map, CFSTR(""), &value)) fail(what, "an empty key path");
+
+    /* the generated dictionaries, reached by key path and created one by one */
+    CFArrayRef items = CFDictionaryGetValue(eager, CFSTR("items"));
+    char path[64];
+    snprintf(path, sizeof(path), "items:%d", count);
+    if (has_key_path(map, path)) fail(what, "an item past the end");
+    for (int t = 0; t < 200 && !failed; t++) {
+        long i = (0 == t) ? count - 1 : random() % count;
+        snprintf(path, sizeof(path), "items:%ld", i);
+        CFDictionaryRef item = CFArrayGetValueAtIndex(items, i);
+        check_object(value_at(map, path, what), item, what);
+        snprintf(path, sizeof(path), "items:%ld:name", i);
+        value = value_at(map, path, what);
+        CFStringRef name = __CFBinaryPlistValueCreateObject(kCFAllocatorDefault, value, kCFPropertyListImmutable);
+        if (!name || !CFEqual(name, CFDictionaryGetValue(item, CFSTR("name")))) fail(what, path);
+        if (name) CFRelease(name);
+    }
+}
+
+static void check_map(CFBinaryPlistMapRef map, CFDictionaryRef eager, const char *what) {
+    if (!map) {
+        fail(what, "the map wasn't created");
+        return;
+    }
+    check_scalars(map, what);
+    if (!failed) check_collections(map, eager, what);
+}
+
+/* big-endian integers of the trailer and the offset table */
+static uint64_t get_sized(const uint8_t *p, unsigned size) {
+    uint64_t v = 0;
+    while (size--) v = (v << 8) | *p++;
+    return v;
+}
+
+static void put_sized(uint8_t *p, unsigned size, uint64_t v) {
+    while (size--) {
+        p[size] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+/* Both readers must refuse the data; a map that is created anyway must not give a top object */
+static void check_refused(CFMutableDataRef data, const char *what) {
+    CFBinaryPlistMapRef map = __CFBinaryPlistMapCreateWithData(kCFAllocatorDefault, data);
+    if (map) {
+        fail(what, "the map was created");
+        __CFBinaryPlistMapRelease(map);
+    }
+    CFPropertyListRef read = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+    if (read) {
+        fail(what, "the full parse succeeded");
+        CFRelease(read);
+    }
+}
+
+/* Index in the offset table of the object at offset, which must be there just once */
+static uint64_t find_offset(const uint8_t *bytes, const CFBinaryPlistTrailer *trailer, uint64_t offset) {
+    uint64_t found = trailer->_numObjects;
+    for (uint64_t i = 0; i < trailer->_numObjects; i++) {
+        if (get_sized(bytes + trailer->_offsetTableOffset + i * trailer->_offsetIntSize, trailer->_offsetIntSize) == offset) {
+            if (found != trailer->_numObjects) {
+                printf("internal error: two objects at offset %llu\n", (unsigned long long)offset);
+                exit(99);
+            }
+            found = i;
+        }
+    }
+    if (found == trailer->_numObjects) {
+        printf("internal error: no object at offset %llu\n", (unsigned long long)offset);
+        exit(99);
+    }
+    return found;
+}
+
+static void check_corrupt(CFDataRef good) {
+    CFIndex length = CFDataGetLength(good);
+    uint8_t marker;
+    uint64_t top_offset;
+    CFBinaryPlistTrailer trailer;
+    if (!__CFBinaryPlistGetTopLevelInfo(CFDataGetBytePtr(good), length, &marker, &top_offset, &trailer)) {
+        printf("internal error: the plist written can't be read\n");
+        exit(99);
+    }
+    uint64_t table = trailer._offsetTableOffset, int_size = trailer._offsetIntSize;
+
+    /* too short for a header and a trailer, and short by one byte, which misaligns the trailer */
+    static const CFIndex short_lengths[] = {0, 8, 40};
+    for (unsigned s = 0; s < sizeof(short_lengths) / sizeof(short_lengths[0]); s++) {
+        CFMutableDataRef data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+        CFDataAppendBytes(data, CFDataGetBytePtr(good), short_lengths[s]);
+        check_refused(data, "a truncated file");
+        CFRelease(data);
+    }
+    CFMutableDataRef data = CFDataCreateMutableCopy(kCFAllocatorDefault, 0, good);
+    CFDataSetLength(data, length - 1);
+    check_refused(data, "a file short by one byte");
+    CFRelease(data);
+
+    /* half the offset table cut out, the trailer kept */
+    data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    CFDataAppendBytes(data, CFDataGetBytePtr(good), table + trailer._numObjects * int_size / 2);
+    CFDataAppendBytes(data, CFDataGetBytePtr(good) + length - sizeof(CFBinaryPlistTrailer), sizeof(CFBinaryPlistTrailer));
+    check_refused(data, "a truncated offset table");
+    CFRelease(data);
+
+    /* a trailer that claims one more object than the table holds */
+    data = CFDataCreateMutableCopy(kCFAllocatorDefault, 0, good);
+    uint8_t *bytes = CFDataGetMutableBytePtr(data);
+    put_sized(bytes + length - 24, 8, trailer._numObjects + 1);
+    check_refused(data, "an offset table running into the trailer");
+    CFRelease(data);
+
+    /* the top object's entry pointing into the offset table, and before the object table */
+    const uint64_t bad_top_offsets[] = {0, 7, table};
+    for (unsigned b = 0; b < sizeof(bad_top_offsets) / sizeof(bad_top_offsets[0]); b++) {
+        data = CFDataCreateMutableCopy(kCFAllocatorDefault, 0, good);
+        bytes = CFDataGetMutableBytePtr(data);
+        put_sized(bytes + table + trailer._topObject * int_size, int_size, bad_top_offsets[b]);
+        CFBinaryPlistMapRef map = __CFBinaryPlistMapCreateWithData(kCFAllocatorDefault, data);
+        if (map) {
+            fail("a corrupt offset of the top object", "the map was created");
+            __CFBinaryPlistMapRelease(map);
+        }
+        CFRelease(data);
+    }
+
+    /* a nested dictionary's entry pointing into the offset table: the map reads until it gets there */
+    data = CFDataCreateMutableCopy(kCFAllocatorDefault, 0, good);
+    CFBinaryPlistMapRef map = __CFBinaryPlistMapCreateWithData(kCFAllocatorDefault, data);
+    CFBinaryPlistValue nested = value_at(map, "nested:a", "finding nested:a");
+    bytes = CFDataGetMutableBytePtr(data);
+    put_sized(bytes + table + find_offset(bytes, &trailer, nested._offset) * int_size, int_size, table);
+    const char *what = "a corrupt offset of a nested value";
+    if (has_key_path(map, "nested:a") || has_key_path(map, "nested:a:b")) fail(what, "the value was found");
+    if (!has_key_path(map, "nested") || !has_key_path(map, "int")) fail(what, "a value not under it wasn't found");
+    CFPropertyListRef object = __CFBinaryPlistValueCreateObject(kCFAllocatorDefault, __CFBinaryPlistMapGetTopValue(map), kCFPropertyListImmutable);
+    if (object) {
+        fail(what, "the top object was created");
+        CFRelease(object);
+    }
+    object = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+    if (object) {
+        fail(what, "the full parse succeeded");
+        CFRelease(object);
+    }
+    __CFBinaryPlistMapRelease(map);
+    CFRelease(data);
+
+    /* an element of the small array referring to an object past the last one */
+    data = CFDataCreateMutableCopy(kCFAllocatorDefault, 0, good);
+    map = __CFBinaryPlistMapCreateWithData(kCFAllocatorDefault, data);
+    CFBinaryPlistValue small = value_at(map, "small", "finding small"), element;
+    bytes = CFDataGetMutableBytePtr(data);
+    put_sized(bytes + small._offset + 1 + 3 * trailer._objectRefSize, trailer._objectRefSize, ~0ULL);
+    what = "a reference past the last object";
+    if (__CFBinaryPlistValueGetValueAtIndex(small, 3, &element)) fail(what, "the element was found");
+    if (!__CFBinaryPlistValueGetValueAtIndex(small, 2, &element) || !__CFBinaryPlistValueGetValueAtIndex(small, 4, &element)) fail(what, "its neighbours weren't found");
+    object = __CFBinaryPlistValueCreateObject(kCFAllocatorDefault, small, kCFPropertyListImmutable);
+    if (object) {
+        fail(what, "the array was created");
+        CFRelease(object);
+    }
+    __CFBinaryPlistMapRelease(map);
+    CFRelease(data);
+}
+
+static void check_url(CFDataRef data, CFDictionaryRef eager) {
+    char path[] = "/tmp/binary_plist_map_test.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, CFDataGetBytePtr(data), CFDataGetLength(data)) != CFDataGetLength(data)) {
+        perror("writing the plist");
+        exit(99);
+    }
+    close(fd);
+    CFURLRef url = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path, strlen(path), false);
+    CFErrorRef error = NULL;
+    CFBinaryPlistMapRef map = __CFBinaryPlistMapCreateWithURL(kCFAllocatorDefault, url, &error);
+    unlink(path);
+    CFRelease(url);
+    if (error) CFRelease(error);
+    /* the file is gone, but the map holds it */
+    check_map(map, eager, "a map of a file");
+    if (map) __CFBinaryPlistMapRelease(map);
+
+    error = NULL;
+    url = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path, strlen(path), false);
+    map = __CFBinaryPlistMapCreateWithURL(kCFAllocatorDefault, url, &error);
+    if (map || !error) fail("a map of a missing file", map ? "the map was created" : "no error was returned");
+    if (map) __CFBinaryPlistMapRelease(map);
+    if (error) CFRelease(error);
+    CFRelease(url);
+}
+
+static int get_int(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-count")) count = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = get_int(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (count < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %d generated dictionaries\n", rseed, count);
+    srandom(rseed);
+
+    CFDictionaryRef plist = create_plist();
+    CFMutableDataRef data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    if (__CFBinaryPlistWrite(plist, data, 0, 0, NULL) <= 0) {
+        printf("internal error: the write failed\n");
+        exit(99);
+    }
+    CFDictionaryRef eager = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+    if (!eager || !CFEqual(eager, plist)) {
+        printf("internal error: the plist written doesn't read back\n");
+        exit(99);
+    }
+
+    /* the data's owner lets go first; the map keeps it */
+    CFDataRef copy = CFDataCreateCopy(kCFAllocatorDefault, data);
+    CFBinaryPlistMapRef map = __CFBinaryPlistMapCreateWithData(kCFAllocatorDefault, copy);
+    CFRelease(copy);
+    if (map) {
+        __CFBinaryPlistMapRetain(map);
+        __CFBinaryPlistMapRelease(map);
+    }
+    check_map(map, eager, "a map of a CFData");
+    if (map) __CFBinaryPlistMapRelease(map);
+    if (!failed) check_url(data, eager);
+    if (!failed) check_corrupt(data);
+
+    CFRelease(eager);
+    CFRelease(data);
+    CFRelease(plist);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * concurrent_dictionary_test:  Read and write one CFConcurrentDictionary
+ *                              from many threads at once, and check that
+ *                              readers only ever see whole snapshots and
+ *                              that every replaced value is released.
+ *
+ * usage:  concurrent_dictionary_test [options...]
+ *
+ * Default:  Reader threads look keys up and take snapshots while writer
+ *           threads set and remove single keys, and an updater thread
+ *           rewrites a group of keys in one CFConcurrentDictionaryApplyUpdate
+ *           call.  A value records the key it was stored under, so a
+ *           reader which sees a value under the wrong key, or a group whose
+ *           members come from different updates, has seen a torn or freed
+ *           snapshot.  Values are counted by their retain and release
+ *           callbacks, and must all be released once the dictionary is;
+ *           released values are poisoned but not freed.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/concurrent_dictionary_test.c libCoreFoudationSrc.a
+ *           and run with MallocScribble=1, so that a snapshot freed while a
+ *           reader still uses it shows up as a torn snapshot.
+ *
+ * Options:
+ *    -readers #    Number of reader threads.
+ *    -writers #    Number of single-key writer threads.
+ *    -iters #      Writes per writer thread, and updates by the updater.
+ *    -keys #       Number of distinct single keys.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFConcurrentDictionary.h"
+
+#define GROUP_BASE	0x100000	/* keys of the ApplyUpdate group */
+#define GROUP_SIZE	16
+#define MAX_THREADS	64
+
+/* A value: the key it belongs under, and which write stored it */
+struct test_value {
+    uintptr_t key;
+    uintptr_t tag;
+    uintptr_t magic;
+    volatile int32_t refs;	/* references held by snapshots */
+};
+
+#define VALUE_MAGIC	0x5EEDF00DUL
+#define VALUE_FREED	0xDEADBEEFUL
+
+int nreaders = 4;
+int nwriters = 4;
+int iters = 20000;
+int nkeys = 256;
+int rseed;
+
+CFConcurrentDictionaryRef dict;
+volatile int32_t writers_done;
+volatile int32_t live_values;
+volatile int32_t failed;
+
+static const void *value_retain(CFAllocatorRef allocator, const void *ptr) {
+    struct test_value *value = (struct test_value *)ptr;
+    if (1 == OSAtomicIncrement32Barrier(&value->refs)) OSAtomicIncrement32Barrier(&live_values);
+    return ptr;
+}
+
+static void value_release(CFAllocatorRef allocator, const void *ptr) {
+    struct test_value *value = (struct test_value *)ptr;
+    /* poisoned before this release, or by another release now, are different things */
+    int32_t refs = (VALUE_MAGIC == value->magic) ? OSAtomicDecrement32Barrier(&value->refs) : -1;
+    if (refs < 0) {
+        printf("FAIL: value for key %#lx released once too often\n", (unsigned long)value->key);
+        failed = 1;
+    } else if (0 == refs) {
+        /* poison, and keep the memory, so that a late reader is caught rather than crashing */
+        value->magic = VALUE_FREED;
+        OSAtomicDecrement32Barrier(&live_values);
+    }
+}
+
+static const CFDictionaryValueCallBacks value_callbacks = {0, value_retain, value_release, NULL, NULL};
+
+static struct test_value *new_value(uintptr_t key, uintptr_t tag) {
+    struct test_value *value = malloc(sizeof(struct test_value));
+    if (!value) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    value->key = key;
+    value->tag = tag;
+    value->magic = VALUE_MAGIC;
+    value->refs = 0;
+    return value;
+}
+
+/* A value from GetValue isn't retained, and may be released as soon as the read is over; one in a retained snapshot must be live */
+static void check_value(const struct test_value *value, uintptr_t key, int retained, const char *where) {
+    if (value && ((retained && VALUE_MAGIC != value->magic) || value->key != key)) {
+        printf("FAIL: %s: key %#lx has %s value %p\n", where, (unsigned long)key, VALUE_MAGIC != value->magic ? "a released" : "another key's", value);
+        failed = 1;
+    }
+}
+
+static void *reader(void *arg) {
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    while (!writers_done && !failed) {
+        uintptr_t key = 1 + rand_r(&seed) % nkeys;
+        check_value(CFConcurrentDictionaryGetValue(dict, (const void *)key), key, 0, "GetValue");
+        if (0 == rand_r(&seed) % 64) {
+            /* the group must come from a single update */
+            CFDictionaryRef snapshot = CFConcurrentDictionaryCopySnapshot(dict);
+            const struct test_value *first = CFDictionaryGetValue(snapshot, (const void *)GROUP_BASE);
+            for (uintptr_t idx = 0; first && idx < GROUP_SIZE; idx++) {
+                const struct test_value *value = CFDictionaryGetValue(snapshot, (const void *)(GROUP_BASE + idx));
+                check_value(value, GROUP_BASE + idx, 1, "snapshot");
+                if (!value || value->tag != first->tag) {
+                    printf("FAIL: snapshot mixes the group of update %lu with another\n", (unsigned long)first->tag);
+                    failed = 1;
+                    break;
+                }
+            }
+            CFRelease(snapshot);
+        }
+    }
+    return NULL;
+}
+
+static void *writer(void *arg) {
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    for (int i = 0; i < iters && !failed; i++) {
+        uintptr_t key = 1 + rand_r(&seed) % nkeys;
+        if (0 == rand_r(&seed) % 4) {
+            CFConcurrentDictionaryRemoveValue(dict, (const void *)key);
+        } else {
+            struct test_value *value = new_value(key, i);
+            CFConcurrentDictionarySetValue(dict, (const void *)key, value);
+        }
+    }
+    return NULL;
+}
+
+static void update_group(CFMutableDictionaryRef copy, void *context) {
+    uintptr_t tag = (uintptr_t)context;
+    for (uintptr_t idx = 0; idx < GROUP_SIZE; idx++) {
+        CFDictionarySetValue(copy, (const void *)(GROUP_BASE + idx), new_value(GROUP_BASE + idx, tag));
+    }
+}
+
+static void *updater(void *arg) {
+    for (uintptr_t i = 1; i <= (uintptr_t)iters && !failed; i++) {
+        CFConcurrentDictionaryApplyUpdate(dict, update_group, (void *)i);
+    }
+    return NULL;
+}
+
+static int get_int(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    pthread_t readers[MAX_THREADS], writers[MAX_THREADS], update_thread;
+
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-readers")) nreaders = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-writers")) nwriters = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-iters")) iters = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-keys")) nkeys = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = get_int(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (nreaders < 1 || nreaders > MAX_THREADS || nwriters < 1 || nwriters > MAX_THREADS || iters < 1 || nkeys < 1 || nkeys >= GROUP_BASE) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %d readers, %d writers, %d iterations\n", rseed, nreaders, nwriters, iters);
+
+    dict = CFConcurrentDictionaryCreate(kCFAllocatorDefault, NULL, &value_callbacks);
+    for (int i = 0; i < nreaders; i++) pthread_create(&readers[i], NULL, reader, (void *)(uintptr_t)(rseed + i));
+    for (int i = 0; i < nwriters; i++) pthread_create(&writers[i], NULL, writer, (void *)(uintptr_t)(rseed + MAX_THREADS + i));
+    pthread_create(&update_thread, NULL, updater, NULL);
+    for (int i = 0; i < nwriters; i++) pthread_join(writers[i], NULL);
+    pthread_join(update_thread, NULL);
+    writers_done = 1;
+    for (int i = 0; i < nreaders; i++) pthread_join(readers[i], NULL);
+
+    /* the dictionary's own references are all that is left */
+    CFIndex count = CFConcurrentDictionaryGetCount(dict);
+    if (!failed && count != live_values) {
+        printf("FAIL: %ld values in the dictionary, but %d retained\n", (long)count, live_values);
+        failed = 1;
+    }
+    CFRelease(dict);
+    if (!failed && 0 != live_values) {
+        printf("FAIL: %d values still retained after the dictionary was released\n", live_values);
+        failed = 1;
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * converters_bench:  Check the built-in string encoding converters and their
+ *                    bulk ASCII / Latin 1 kernels, and time transcoding of
+ *                    text in several scripts.
+ *
+ * usage:  converters_bench [options...]
+ *
+ * Default:  First checks __CFStringEncodingWidenBytes and
+ *           __CFStringEncodingNarrowCharacters against a scalar loop, for
+ *           every length up to 80, every buffer alignment, and a character
+ *           outside the identity range at every position.  Then builds text
+ *           in several scripts (ASCII, Latin with accents, Cyrillic, CJK,
+ *           emoji, and a mix of all of them) and checks that
+ *             - UTF-8 made by a reference encoder reads back through
+ *               CFStringCreateWithBytes as the same characters, and
+ *               CFStringGetBytes writes the same UTF-8, also into output
+ *               buffers too small for all of it, where it must stop on a
+ *               character boundary, and
+ *             - ISO Latin 1, Mac Roman, Windows Latin 1 and ASCII convert
+ *               every character they can represent, and stop at the first
+ *               one they can't.
+ *           Then prints the decode and encode rates for each script and
+ *           encoding.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/converters_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -length #     Characters of text timed per script.
+ *    -iters #      Conversions timed per script and encoding.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the rates)
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFStringEncodingConverterPriv.h"
+
+#define CHECK_LENGTH    4096
+
+CFIndex length = 1024 * 1024;
+int iters = 20;
+int rseed;
+int failed;
+
+enum { ASCII, LATIN, CYRILLIC, CJK, EMOJI, MIXED, NSCRIPTS };
+
+static const char *const script_names[NSCRIPTS] = {"ASCII", "Latin", "Cyrillic", "CJK", "emoji", "mixed"};
+
+static const struct {
+    CFStringEncoding encoding;
+    const char *name;
+    UniChar identityLimit;      /* the characters each byte value up to this stands for itself */
+} eight_bit[] = {
+    {kCFStringEncodingISOLatin1, "ISO Latin 1", 0xFF},
+    {kCFStringEncodingMacRoman, "Mac Roman", 0x7F},
+    {kCFStringEncodingWindowsLatin1, "Windows Latin 1", 0x7F},
+    {kCFStringEncodingASCII, "ASCII", 0x7F},
+};
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *xmalloc(size_t size) {
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    return ptr;
+}
+
+static void check_kernels(void) {
+    uint8_t bytes[128 + 16], narrowed[128 + 16];
+    UniChar characters[128 + 16], widened[128 + 16];
+    for (CFIndex align = 0; align < 16; align++) {
+        for (CFIndex len = 0; len <= 80; len++) {
+            for (CFIndex stop = 0; stop <= len; stop++) {
+                /* bytes and characters before stop are ASCII; the byte at stop isn't, and the character at stop is above 0x7F or, every other stop, above 0xFF */
+                for (CFIndex i = 0; i < len; i++) {
+                    bytes[align + i] = (uint8_t)(random() % 0x80);
+                    characters[align + i] = (i < stop || 0 == random() % 2) ? (UniChar)(random() % 0x80) : (UniChar)(0x80 + random() % 0x80);
+                }
+                if (stop < len) {
+                    bytes[align + stop] = (uint8_t)(0x80 | random());
+                    characters[align + stop] = (stop % 2) ? (UniChar)(0x80 + random() % 0x80) : (UniChar)(0x100 + random() % 0xFF00);
+                }
+                CFIndex expected = stop;
+                CFIndex done = __CFStringEncodingWidenBytes(bytes + align, len, widened + align, true);
+                bool ok = (done == expected);
+                for (CFIndex i = 0; ok && i < done; i++) ok = (widened[align + i] == bytes[align + i]);
+                if (ok && __CFStringEncodingWidenBytes(bytes + align, len, widened + align, false) != len) ok = false;
+                for (CFIndex i = 0; ok && i < len; i++) ok = (widened[align + i] == bytes[align + i]);
+                if (ok && __CFStringEncodingWidenBytes(bytes + align, len, NULL, true) != expected) ok = false;
+                if (!ok) {
+                    printf("FAIL: __CFStringEncodingWidenBytes, length %ld, alignment %ld, stop %ld\n", (long)len, (long)align, (long)stop);
+                    failed = 1;
+                    return;
+                }
+                for (int limit = 0; limit < 2; limit++) {
+                    UniChar maxCharacter = limit ? 0xFF : 0x7F;
+                    expected = 0;
+                    while (expected < len && characters[align + expected] <= maxCharacter) expected++;
+                    done = __CFStringEncodingNarrowCharacters(characters + align, len, narrowed + align, maxCharacter);
+                    ok = (done == expected) && (__CFStringEncodingNarrowCharacters(characters + align, len, NULL, maxCharacter) == expected);
+                    for (CFIndex i = 0; ok && i < done; i++) ok = (narrowed[align + i] == characters[align + i]);
+                    if (!ok) {
+                        printf("FAIL: __CFStringEncodingNarrowCharacters up to %#x, length %ld, alignment %ld, stop %ld\n", maxCharacter, (long)len, (long)align, (long)stop);
+                        failed = 1;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static CFIndex append_character(UniChar *text, CFIndex idx, CFIndex len, UInt32 ch) {
+    if (ch < 0x10000) {
+        text[idx++] = (UniChar)ch;
+    } else if (idx + 1 < len) {
+        ch -= 0x10000;
+        text[idx++] = (UniChar)(0xD800 + (ch >> 10));
+        text[idx++] = (UniChar)(0xDC00 + (ch & 0x3FF));
+    } else {
+        text[idx++] = ' ';
+    }
+    return idx;
+}
+
+/* Text of len UTF-16 units: words in a script, separated by spaces and some punctuation, as real text runs */
+static UniChar *create_text(int script, CFIndex len) {
+    static const UniChar latin[] = {0xE9, 0xE8, 0xE0, 0xFC, 0xF6, 0xE7, 0xDF, 0xF1};
+    UniChar *text = xmalloc(len * sizeof(UniChar));
+    CFIndex idx = 0;
+    while (idx < len) {
+        int word = (MIXED == script) ? (int)(random() % MIXED) : script;
+        CFIndex wordLen = 1 + random() % 9;
+        for (CFIndex i = 0; i < wordLen && idx < len; i++) {
+            UInt32 ch;
+            switch (word) {
+            case ASCII: ch = 'a' + random() % 26; break;
+            case LATIN: ch = (0 == random() % 6) ? latin[random() % 8] : (UInt32)('a' + random() % 26); break;
+            case CYRILLIC: ch = 0x430 + random() % 32; break;
+            case CJK: ch = 0x4E00 + random() % 0x5000; break;
+            default: ch = (0 == random() % 2) ? 0x1F600 + random() % 0x50 : 0x2600 + random() % 0x100; break;
+            }
+            idx = append_character(text, idx, len, ch);
+        }
+        if (idx < len) text[idx++] = (0 == random() % 12) ? '.' : ' ';
+    }
+    return text;
+}
+
+/* Reference UTF-8 encoder; returns the length of the encoding of text[0..len) */
+static CFIndex encode_utf8(const UniChar *text, CFIndex len, uint8_t *bytes) {
+    CFIndex used = 0;
+    for (CFIndex i = 0; i < len; i++) {
+        UInt32 ch = text[i];
+        if (ch >= 0xD800 && ch < 0xDC00 && i + 1 < len) ch = 0x10000 + ((ch - 0xD800) << 10) + (text[++i] - 0xDC00);
+        if (ch < 0x80) {
+            bytes[used++] = (uint8_t)ch;
+        } else if (ch < 0x800) {
+            bytes[used++] = (uint8_t)(0xC0 | (ch >> 6));
+            bytes[used++] = (uint8_t)(0x80 | (ch & 0x3F));
+        } else if (ch < 0x10000) {
+            bytes[used++] = (uint8_t)(0xE0 | (ch >> 12));
+            bytes[used++] = (uint8_t)(0x80 | ((ch >> 6) & 0x3F));
+            bytes[used++] = (uint8_t)(0x80 | (ch & 0x3F));
+        } else {
+            bytes[used++] = (uint8_t)(0xF0 | (ch >> 18));
+            bytes[used++] = (uint8_t)(0x80 | ((ch >> 12) & 0x3F));
+            bytes[used++] = (uint8_t)(0x80 | ((ch >> 6) & 0x3F));
+            bytes[used++] = (uint8_t)(0x80 | (ch & 0x3F));
+        }
+    }
+    return used;
+}
+
+static bool same_characters(CFStringRef str, const UniChar *text, CFIndex len) {
+    if (!str || CFStringGetLength(str) != len) return false;
+    UniChar *characters = xmalloc(len * sizeof(UniChar));
+    CFStringGetCharacters(str, CFRangeMake(0, len), characters);
+    bool same = (0 == memcmp(characters, text, len * sizeof(UniChar)));
+    free(characters);
+    return same;
+}
+
+static void check_utf8(int script) {
+    UniChar *text = create_text(script, CHECK_LENGTH);
+    uint8_t *expected = xmalloc(CHECK_LENGTH * 3), *bytes = xmalloc(CHECK_LENGTH * 3), *scratch = xmalloc(CHECK_LENGTH * 3);
+    CFIndex expectedLen = encode_utf8(text, CHECK_LENGTH, expected);
+
+    CFStringRef str = CFStringCreateWithBytes(kCFAllocatorDefault, expected, expectedLen, kCFStringEncodingUTF8, false);
+    if (!same_characters(str, text, CHECK_LENGTH)) {
+        printf("FAIL: %s text doesn't read back from UTF-8\n", script_names[script]);
+        failed = 1;
+    }
+    if (str) CFRelease(str);
+
+    str = CFStringCreateWithCharacters(kCFAllocatorDefault, text, CHECK_LENGTH);
+    CFIndex usedLen = 0;
+    CFIndex converted = CFStringGetBytes(str, CFRangeMake(0, CHECK_LENGTH), kCFStringEncodingUTF8, 0, false, NULL, 0, &usedLen);
+    if (converted != CHECK_LENGTH || usedLen != expectedLen) {
+        printf("FAIL: %s text measures as %ld bytes of UTF-8, not %ld\n", script_names[script], (long)usedLen, (long)expectedLen);
+        failed = 1;
+    }
+    /* a short buffer takes the longest prefix of whole characters that fits */
+    for (CFIndex max = expectedLen; max > 0 && !failed; max = (max > 64) ? max / 2 + random() % 7 : max - 1) {
+        converted = CFStringGetBytes(str, CFRangeMake(0, CHECK_LENGTH), kCFStringEncodingUTF8, 0, false, bytes, max, &usedLen);
+        CFIndex prefixLen = encode_utf8(text, converted, scratch);
+        /* and the next character, whole surrogate pair and all, wouldn't have */
+        CFIndex next = converted + ((converted + 1 < CHECK_LENGTH && text[converted] >= 0xD800 && text[converted] < 0xDC00) ? 2 : 1);
+        CFIndex nextLen = (converted < CHECK_LENGTH) ? encode_utf8(text, next, scratch) : expectedLen + 1;
+        if (usedLen > max || usedLen != prefixLen || 0 != memcmp(bytes, expected, usedLen) || nextLen <= max) {
+            printf("FAIL: %s text into %ld bytes of UTF-8: %ld characters in %ld bytes\n", script_names[script], (long)max, (long)converted, (long)usedLen);
+            failed = 1;
+        }
+    }
+    CFRelease(str);
+    free(text);
+    free(expected);
+    free(bytes);
+    free(scratch);
+}
+
+static void check_eight_bit(int script) {
+    UniChar *text = create_text(script, CHECK_LENGTH);
+    uint8_t *bytes = xmalloc(CHECK_LENGTH);
+    CFStringRef str = CFStringCreateWithCharacters(kCFAllocatorDefault, text, CHECK_LENGTH);
+    for (unsigned e = 0; e < sizeof(eight_bit) / sizeof(eight_bit[0]); e++) {
+        CFIndex usedLen = 0;
+        CFIndex converted = CFStringGetBytes(str, CFRangeMake(0, CHECK_LENGTH), eight_bit[e].encoding, 0, false, bytes, CHECK_LENGTH, &usedLen);
+        /* everything up to the identity limit must convert, to itself; past it, only what the encoding has */
+        CFIndex identity = 0;
+        while (identity < CHECK_LENGTH && text[identity] <= eight_bit[e].identityLimit) identity++;
+        bool ok = (converted >= identity) && (usedLen == converted);
+        for (CFIndex i = 0; ok && i < identity; i++) ok = (bytes[i] == text[i]);
+        if (ok && 0xFF == eight_bit[e].identityLimit) ok = (converted == identity);
+        if (ok && converted < CHECK_LENGTH) {
+            /* the character it stopped at really can't be converted */
+            CFStringRef rest = CFStringCreateWithCharacters(kCFAllocatorDefault, text + converted, 1);
+            ok = (0 == CFStringGetBytes(rest, CFRangeMake(0, 1), eight_bit[e].encoding, 0, false, NULL, 0, NULL));
+            CFRelease(rest);
+        }
+        if (ok) {
+            CFStringRef back = CFStringCreateWithBytes(kCFAllocatorDefault, bytes, usedLen, eight_bit[e].encoding, false);
+            ok = same_characters(back, text, converted);
+            if (back) CFRelease(back);
+        }
+        if (!ok) {
+            printf("FAIL: %s text to %s: %ld characters converted\n", script_names[script], eight_bit[e].name, (long)converted);
+            failed = 1;
+        }
+    }
+    CFRelease(str);
+    free(text);
+    free(bytes);
+}
+
+static void bench_encoding(int script, CFStringRef str, CFStringEncoding encoding, const char *name) {
+    CFIndex usedLen = 0;
+    CFIndex converted = CFStringGetBytes(str, CFRangeMake(0, length), encoding, 0, false, NULL, 0, &usedLen);
+    if (converted != length) return;    /* the text can't be represented */
+    uint8_t *bytes = xmalloc(usedLen);
+    double start = now();
+    for (int i = 0; i < iters; i++) CFStringGetBytes(str, CFRangeMake(0, length), encoding, 0, false, bytes, usedLen, NULL);
+    double encode = now() - start;
+    start = now();
+    for (int i = 0; i < iters; i++) {
+        CFStringRef decoded = CFStringCreateWithBytes(kCFAllocatorDefault, bytes, usedLen, encoding, false);
+        if (!decoded) {
+            printf("FAIL: %s text doesn't decode from %s\n", script_names[script], name);
+            failed = 1;
+            break;
+        }
+        CFRelease(decoded);
+    }
+    double decode = now() - start;
+    printf("%-9s %-16s encode %8.1f MB/s  decode %8.1f MB/s\n", script_names[script], name, usedLen * (double)iters / encode / 1e6, usedLen * (double)iters / decode / 1e6);
+    free(bytes);
+}
+
+static void bench(int script) {
+    UniChar *text = create_text(script, length);
+    CFStringRef str = CFStringCreateWithCharacters(kCFAllocatorDefault, text, length);
+    bench_encoding(script, str, kCFStringEncodingUTF8, "UTF-8");
+    for (unsigned e = 0; e < sizeof(eight_bit) / sizeof(eight_bit[0]); e++) bench_encoding(script, str, eight_bit[e].encoding, eight_bit[e].name);
+    CFRelease(str);
+    free(text);
+}
+
+static long get_long(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atol(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-length")) length = get_long(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-iters")) iters = (int)get_long(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = (int)get_long(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (length < 1 || iters < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %ld characters, %d iterations\n", rseed, (long)length, iters);
+    srandom(rseed);
+
+    check_kernels();
+    for (int script = 0; script < NSCRIPTS && !failed; script++) {
+        check_utf8(script);
+        check_eight_bit(script);
+    }
+    for (int script = 0; script < NSCRIPTS && !failed; script++) bench(script);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * socket_bench:  Time CFSocket read callbacks with many idle sockets
+ *                scheduled, and check that the socket manager forgets
+ *                sockets once they are invalidated.
+ *
+ * usage:  socket_bench [options...]
+ *
+ * Default:  Schedules a read callback for one end of each of 10000 idle
+ *           socket pairs on the main run loop, plus one active pair.  Then
+ *             - times round trips on the active pair: a byte is sent, and
+ *               the run loop runs until its read callback has taken it,
+ *             - measures the CPU time the process uses while the run loop
+ *               waits with nothing to do, which should be none however
+ *               many sockets are scheduled, and
+ *             - times invalidating and recreating the idle sockets.
+ *           An idle socket must never get a callback.  The active socket
+ *           doesn't re-enable its read callback, so the manager still has
+ *           it out of its fd sets when it is invalidated.  The sockets are
+ *           invalidated without closing them, and on Linux the manager's
+ *           epoll instance (found through /proc) must then have no socket
+ *           left registered but its own wakeup socket.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/socket_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -sockets #    Idle socket pairs.
+ *    -iters #      Round trips timed.
+ *    -idle #       Seconds of idle waiting measured.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the timings)
+ *    1    FAIL
+ *    99   Illegal arguments or internal error (including too low a limit
+ *         on open files).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+int nsockets = 10000;
+int iters = 10000;
+int idle_seconds = 2;
+int failed;
+
+int (*idle_pairs)[2];
+CFSocketRef *idle_sockets;
+int active_pair[2];
+CFSocketRef active_socket;
+int active_reads;
+int active_reenable = 1;
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double cpu_time(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void idle_callback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void *data, void *info) {
+    printf("FAIL: idle socket %ld got a callback\n", (long)(intptr_t)info);
+    failed = 1;
+}
+
+static void active_callback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void *data, void *info) {
+    char byte;
+    while (0 < recv(CFSocketGetNative(s), &byte, 1, MSG_DONTWAIT)) active_reads++;
+    if (active_reenable) CFSocketEnableCallBacks(s, kCFSocketReadCallBack);
+}
+
+static CFSocketRef schedule(int fd, CFSocketCallBack callback, intptr_t idx) {
+    CFSocketContext context = {0, (void *)idx, NULL, NULL, NULL};
+    CFSocketRef s = CFSocketCreateWithNative(kCFAllocatorDefault, fd, kCFSocketReadCallBack, callback, &context);
+    if (!s) {
+        printf("internal error: CFSocketCreateWithNative failed for socket %ld\n", (long)idx);
+        exit(99);
+    }
+    /* the test closes the sockets itself, after checking what invalidating them left behind */
+    CFSocketSetSocketFlags(s, CFSocketGetSocketFlags(s) & ~kCFSocketCloseOnInvalidate);
+    CFRunLoopSourceRef source = CFSocketCreateRunLoopSource(kCFAllocatorDefault, s, 0);
+    CFRunLoopAddSource(CFRunLoopGetCurrent(), source, kCFRunLoopDefaultMode);
+    CFRelease(source);
+    return s;
+}
+
+static void round_trip(int i) {
+    int expected = active_reads + 1;
+    if (1 != send(active_pair[1], "x", 1, 0)) {
+        perror("send");
+        exit(99);
+    }
+    while (active_reads < expected && !failed) {
+        if (kCFRunLoopRunTimedOut == CFRunLoopRunInMode(kCFRunLoopDefaultMode, 5.0, true)) {
+            printf("FAIL: no read callback for round trip %d\n", i);
+            failed = 1;
+        }
+    }
+}
+
+static void schedule_idle(void) {
+    for (int i = 0; i < nsockets; i++) idle_sockets[i] = schedule(idle_pairs[i][0], idle_callback, i);
+}
+
+static void invalidate_idle(void) {
+    for (int i = 0; i < nsockets; i++) {
+        CFSocketInvalidate(idle_sockets[i]);
+        CFRelease(idle_sockets[i]);
+    }
+}
+
+#if defined(__linux__)
+/* Counts the file descriptors registered with the process's one epoll instance, or returns -1 */
+static int epoll_registrations(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    char path[64], link[64], line[256];
+    int count = -1;
+    while (dir && (entry = readdir(dir))) {
+        snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+        ssize_t len = readlink(path, link, sizeof(link) - 1);
+        if (len <= 0) continue;
+        link[len] = '\0';
+        if (0 != strcmp(link, "anon_inode:[eventpoll]")) continue;
+        snprintf(path, sizeof(path), "/proc/self/fdinfo/%s", entry->d_name);
+        FILE *info = fopen(path, "r");
+        if (!info) break;
+        count = 0;
+        while (fgets(line, sizeof(line), info)) {
+            if (0 == strncmp(line, "tfd:", 4)) count++;
+        }
+        fclose(info);
+        break;
+    }
+    if (dir) closedir(dir);
+    return count;
+}
+#endif
+
+static int get_int(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-sockets")) nsockets = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-iters")) iters = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-idle")) idle_seconds = get_int(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (nsockets < 0 || iters < 1 || idle_seconds < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    rlim_t needed = 2 * (rlim_t)nsockets + 64;
+    if (limit.rlim_cur < needed) {
+        limit.rlim_cur = (limit.rlim_max < needed) ? limit.rlim_max : needed;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < needed) {
+            printf("internal error: %d idle sockets need %lu open files, but the limit is %lu\n", nsockets, (unsigned long)needed, (unsigned long)limit.rlim_cur);
+            exit(99);
+        }
+    }
+    printf("%d idle sockets, %d round trips\n", nsockets, iters);
+
+    idle_pairs = malloc((nsockets + 1) * sizeof(idle_pairs[0]));
+    idle_sockets = malloc((nsockets + 1) * sizeof(CFSocketRef));
+    if (!idle_pairs || !idle_sockets) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    for (int i = 0; i < nsockets; i++) {
+        if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, idle_pairs[i])) {
+            perror("socketpair");
+            exit(99);
+        }
+    }
+    if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, active_pair)) {
+        perror("socketpair");
+        exit(99);
+    }
+
+    double start = now();
+    schedule_idle();
+    printf("schedule %d idle sockets        %8.2f us/socket\n", nsockets, (now() - start) * 1e6 / (nsockets ? nsockets : 1));
+
+    /* the callback re-enables itself by hand, so the manager keeps the socket out of its fd sets in between */
+    active_socket = schedule(active_pair[0], active_callback, -1);
+    CFSocketSetSocketFlags(active_socket, CFSocketGetSocketFlags(active_socket) & ~kCFSocketAutomaticallyReenableReadCallBack);
+
+    start = now();
+    for (int i = 0; i < iters && !failed; i++) round_trip(i);
+    printf("round trip                      %8.2f us\n", (now() - start) * 1e6 / iters);
+
+    double cpu = cpu_time();
+    start = now();
+    CFRunLoopRunInMode(kCFRunLoopDefaultMode, idle_seconds, false);
+    printf("idle                            %8.2f%% of a CPU\n", 100.0 * (cpu_time() - cpu) / (now() - start));
+
+    start = now();
+    invalidate_idle();
+    schedule_idle();
+    printf("invalidate and reschedule       %8.2f us/socket\n", (now() - start) * 1e6 / (nsockets ? nsockets : 1));
+
+    /* one more callback, which leaves the active socket out of the manager's fd sets */
+    active_reenable = 0;
+    round_trip(iters);
+    invalidate_idle();
+    CFSocketInvalidate(active_socket);
+    CFRelease(active_socket);
+
+#if defined(__linux__)
+    int registered = epoll_registrations();
+    if (registered > 1) {
+        printf("FAIL: %d sockets are still registered with epoll after being invalidated\n", registered - 1);
+        failed = 1;
+    }
+#endif
+    for (int i = 0; i < nsockets; i++) {
+        close(idle_pairs[i][0]);
+        close(idle_pairs[i][1]);
+    }
+    close(active_pair[0]);
+    close(active_pair[1]);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
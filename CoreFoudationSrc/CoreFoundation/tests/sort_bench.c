@@ -0,0 +1,228 @@
+/*
+ * sort_bench:  Check CFArraySortValues against a stable reference sort, and
+ *              time it against the sorts it replaced.
+ *
+ * usage:  sort_bench [options...]
+ *
+ * Default:  Sorts arrays of several sizes, from empty to past the point
+ *           where the sort goes concurrent, under
+ *             - CFNumberCompare over integers with many duplicates, and
+ *               over floats including -0.0, 0.0 and infinities (the keyed
+ *               path), and over a mix of the two (the comparator path),
+ *             - a literal CFStringCompare over ASCII strings (keyed) and
+ *               over strings which aren't all ASCII, and CFStringCompare
+ *               with options (the comparator path),
+ *             - CFDateCompare, which is called concurrently, and
+ *             - a comparator of the test's own, which must only ever be
+ *               called on the sorting thread.
+ *           Equal values are distinct objects, and each result must be the
+ *           same array, object for object, as CFMergeSortArray gives, so a
+ *           sort which isn't stable fails.  Then times CFArraySortValues,
+ *           CFMergeSortArray and CFQSortArray on large arrays of numbers,
+ *           strings and dates.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/sort_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -count #      Values sorted for the timings.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the timings)
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFPriv.h"
+
+CFIndex count = 4 * 1024 * 1024;
+int rseed;
+int failed;
+pthread_t sorting_thread;
+
+enum { INTEGERS, FLOATS, MIXED_NUMBERS, ASCII_STRINGS, STRINGS, DATES, NKINDS };
+
+static const char *const kind_names[NKINDS] = {"integers", "floats", "mixed numbers", "ASCII strings", "strings", "dates"};
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static const void **xmalloc_values(CFIndex n) {
+    const void **values = malloc((n ? n : 1) * sizeof(void *));
+    if (!values) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    return values;
+}
+
+static CFTypeRef create_value(int kind, CFIndex range) {
+    long r = random() % range;
+    switch (kind) {
+    case INTEGERS: {
+        SInt64 v = r - range / 2;
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &v);
+    }
+    case FLOATS: {
+        static const double specials[] = {0.0, -0.0, INFINITY, -INFINITY, 1e300, -1e-300};
+        double v = (0 == random() % 16) ? specials[random() % 6] : (r - range / 2) / 8.0;
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &v);
+    }
+    case MIXED_NUMBERS: {
+        if (random() % 2) {
+            double v = r / 2.0;
+            return CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &v);
+        }
+        SInt32 v = (SInt32)(r / 2);
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &v);
+    }
+    case ASCII_STRINGS:
+    case STRINGS: {
+        /* short strings over a small alphabet share long prefixes, past the 8 bytes of the sort key */
+        static const char *const alphabet[] = {"a", "b", "A", " ", "\xc3\xa9"};
+        char buf[64] = "";
+        int len = random() % 14;
+        for (int i = 0; i < len; i++) strcat(buf, alphabet[random() % (ASCII_STRINGS == kind ? 4 : 5)]);
+        if (0 == random() % 4) strcat(buf, "aaaaaaaaaaaa");
+        return CFStringCreateWithCString(kCFAllocatorDefault, buf, kCFStringEncodingUTF8);
+    }
+    default:
+        return CFDateCreate(kCFAllocatorDefault, (CFAbsoluteTime)r);
+    }
+}
+
+static CFComparisonResult own_compare(const void *v1, const void *v2, void *context) {
+    if (!pthread_equal(pthread_self(), sorting_thread)) {
+        printf("FAIL: an arbitrary comparator was called on another thread\n");
+        failed = 1;
+    }
+    return CFNumberCompare((CFNumberRef)v1, (CFNumberRef)v2, context);
+}
+
+struct reference_context {
+    CFComparatorFunction comparator;
+    void *context;
+};
+
+/* CFMergeSortArray passes pointers to the elements */
+static CFComparisonResult reference_compare(const void *p1, const void *p2, void *context) {
+    struct reference_context *ref = (struct reference_context *)context;
+    return ref->comparator(*(const void **)p1, *(const void **)p2, ref->context);
+}
+
+static void check(int kind, CFIndex n, CFComparatorFunction comparator, void *context, const char *what) {
+    const void **values = xmalloc_values(n), **expected = xmalloc_values(n);
+    CFIndex range = (0 == random() % 2) ? n / 8 + 1 : 4 * n + 1;
+    for (CFIndex i = 0; i < n; i++) values[i] = create_value(kind, range);
+    CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    CFArrayReplaceValues(array, CFRangeMake(0, 0), values, n);
+    memmove(expected, values, n * sizeof(void *));
+    struct reference_context ref = {comparator, context};
+    CFMergeSortArray(expected, n, sizeof(void *), reference_compare, &ref);
+
+    sorting_thread = pthread_self();
+    CFArraySortValues(array, CFRangeMake(0, n), comparator, context);
+    CFArrayGetValues(array, CFRangeMake(0, n), values);
+    for (CFIndex i = 0; i < n; i++) {
+        if (values[i] != expected[i]) {
+            printf("FAIL: %s of %s, %ld values: %s at %ld\n", what, kind_names[kind], (long)n, (0 == comparator(values[i], expected[i], context)) ? "equal values out of order" : "out of order", (long)i);
+            failed = 1;
+            break;
+        }
+    }
+    for (CFIndex i = 0; i < n; i++) CFRelease(values[i]);
+    CFRelease(array);
+    free(values);
+    free(expected);
+}
+
+static void bench(int kind, CFComparatorFunction comparator, const char *what) {
+    const void **values = xmalloc_values(count), **sorted = xmalloc_values(count);
+    for (CFIndex i = 0; i < count; i++) values[i] = create_value(kind, 4 * count);
+    CFArrayRef source = CFArrayCreate(kCFAllocatorDefault, values, count, &kCFTypeArrayCallBacks);
+    CFMutableArrayRef array = CFArrayCreateMutableCopy(kCFAllocatorDefault, 0, source);
+    struct reference_context ref = {comparator, NULL};
+
+    double start = now();
+    CFArraySortValues(array, CFRangeMake(0, count), comparator, NULL);
+    double sort = now() - start;
+
+    memmove(sorted, values, count * sizeof(void *));
+    start = now();
+    CFMergeSortArray(sorted, count, sizeof(void *), reference_compare, &ref);
+    double merge = now() - start;
+
+    memmove(sorted, values, count * sizeof(void *));
+    start = now();
+    CFQSortArray(sorted, count, sizeof(void *), reference_compare, &ref);
+    double quick = now() - start;
+
+    printf("%-28s CFArraySortValues %7.3fs  CFMergeSortArray %7.3fs  CFQSortArray %7.3fs\n", what, sort, merge, quick);
+    for (CFIndex i = 0; i < count; i++) CFRelease(values[i]);
+    CFRelease(array);
+    CFRelease(source);
+    free(values);
+    free(sorted);
+}
+
+static long get_long(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atol(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    static const CFIndex sizes[] = {0, 1, 2, 63, 64, 65, 1000, 65535, 65536, 200003, 1000000};
+
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-count")) count = get_long(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = (int)get_long(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (count < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %ld values timed\n", rseed, (long)count);
+    srandom(rseed);
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && !failed; s++) {
+        CFIndex n = sizes[s];
+        check(INTEGERS, n, (CFComparatorFunction)CFNumberCompare, NULL, "CFNumberCompare");
+        check(FLOATS, n, (CFComparatorFunction)CFNumberCompare, NULL, "CFNumberCompare");
+        check(MIXED_NUMBERS, n, (CFComparatorFunction)CFNumberCompare, NULL, "CFNumberCompare");
+        check(ASCII_STRINGS, n, (CFComparatorFunction)CFStringCompare, NULL, "CFStringCompare");
+        check(STRINGS, n, (CFComparatorFunction)CFStringCompare, NULL, "CFStringCompare");
+        check(ASCII_STRINGS, n, (CFComparatorFunction)CFStringCompare, (void *)kCFCompareCaseInsensitive, "CFStringCompare (case insensitive)");
+        check(DATES, n, (CFComparatorFunction)CFDateCompare, NULL, "CFDateCompare");
+        check(INTEGERS, n, own_compare, NULL, "own comparator");
+    }
+    if (!failed) {
+        bench(INTEGERS, (CFComparatorFunction)CFNumberCompare, "integers, CFNumberCompare");
+        bench(ASCII_STRINGS, (CFComparatorFunction)CFStringCompare, "ASCII, CFStringCompare");
+        bench(STRINGS, (CFComparatorFunction)CFStringCompare, "strings, CFStringCompare");
+        bench(DATES, (CFComparatorFunction)CFDateCompare, "dates, CFDateCompare");
+        bench(INTEGERS, own_compare, "integers, own comparator");
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
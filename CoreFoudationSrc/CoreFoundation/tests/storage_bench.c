@@ -0,0 +1,293 @@
+/*
+ * storage_bench:  Check CFStorage's bulk load, splice and cursors, and time
+ *                 sequential and random access through it against the deque
+ *                 storage CFArray uses and against a flat buffer.
+ *
+ * usage:  storage_bench [options...]
+ *
+ * Default:  First checks the storage against a flat buffer: random splices
+ *           of random lengths, bulk loads into empty and non-empty storages,
+ *           and cursor walks in both directions, for value sizes 1, 3, 8 and
+ *           12 bytes.  Then loads the same pointer-sized values into a
+ *           CFStorage, a mutable CFArray and a flat buffer, and prints the
+ *           time per value of
+ *             - a sequential read, through CFStorageGetConstValueAtIndex and
+ *               its valid range, through a CFStorageCursor, through
+ *               CFArrayGetValueAtIndex and through the buffer,
+ *             - a random read of the same number of values, and
+ *             - inserting and then deleting a value at random indexes.
+ *           Every read sums what it sees, and the sums must agree.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/storage_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -count #      Values loaded for the timings.
+ *    -edits #      Inserts and deletes timed, and splices checked.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the timings)
+ *    1    FAIL (the storage didn't match the buffer, or the sums disagree)
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFStorage.h"
+
+#define CHECK_MAX_COUNT 20000
+
+CFIndex count = 4 * 1024 * 1024;
+int edits = 20000;
+int rseed;
+int failed;
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *xmalloc(size_t size) {
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    return ptr;
+}
+
+static void fill(uint8_t *bytes, CFIndex size) {
+    for (CFIndex i = 0; i < size; i++) bytes[i] = (uint8_t)random();
+}
+
+/* The whole storage must equal the buffer, read both ways and through cursors */
+static void compare(CFStorageRef storage, const uint8_t *flat, CFIndex n, CFIndex size, const char *where) {
+    if (CFStorageGetCount(storage) != n) {
+        printf("FAIL: %s: count %ld, expected %ld\n", where, (long)CFStorageGetCount(storage), (long)n);
+        failed = 1;
+        return;
+    }
+    uint8_t *copy = xmalloc(n * size);
+    CFStorageGetValues(storage, CFRangeMake(0, n), copy);
+    if (0 != memcmp(copy, flat, n * size)) {
+        printf("FAIL: %s: CFStorageGetValues doesn't match (value size %ld)\n", where, (long)size);
+        failed = 1;
+    }
+    free(copy);
+
+    CFStorageCursor cursor;
+    const uint8_t *value = CFStorageCursorInit(&cursor, storage, -1);
+    CFIndex idx = 0;
+    while ((value = CFStorageCursorNext(&cursor))) {
+        if (cursor.index != idx || 0 != memcmp(value, flat + idx * size, size)) break;
+        idx++;
+    }
+    if (idx != n) {
+        printf("FAIL: %s: forward cursor went wrong at %ld of %ld (value size %ld)\n", where, (long)idx, (long)n, (long)size);
+        failed = 1;
+    }
+    value = CFStorageCursorInit(&cursor, storage, n);
+    idx = n;
+    while ((value = CFStorageCursorPrevious(&cursor))) {
+        idx--;
+        if (cursor.index != idx || 0 != memcmp(value, flat + idx * size, size)) break;
+    }
+    if (idx != 0 || cursor.index != -1) {
+        printf("FAIL: %s: backward cursor went wrong at %ld of %ld (value size %ld)\n", where, (long)idx, (long)n, (long)size);
+        failed = 1;
+    }
+    if (n > 0) {
+        CFIndex at = random() % n;
+        value = CFStorageCursorSetIndex(&cursor, at);
+        if (!value || 0 != memcmp(value, flat + at * size, size)) {
+            printf("FAIL: %s: CFStorageCursorSetIndex(%ld) got the wrong value\n", where, (long)at);
+            failed = 1;
+        }
+    }
+}
+
+static void check_size(CFIndex size) {
+    uint8_t *flat = xmalloc(CHECK_MAX_COUNT * size);
+    uint8_t *values = xmalloc(CHECK_MAX_COUNT * size);
+    CFIndex n = CHECK_MAX_COUNT / 2;
+
+    /* bulk load into an empty storage */
+    CFStorageRef storage = CFStorageCreate(kCFAllocatorDefault, size);
+    fill(flat, n * size);
+    CFStorageInsertValuesFromBuffer(storage, CFRangeMake(0, n), flat);
+    compare(storage, flat, n, size, "bulk load");
+
+    for (int i = 0; i < edits && !failed; i++) {
+        CFIndex loc = random() % (n + 1);
+        CFIndex len = random() % (n - loc + 1);
+        CFIndex newCount = random() % 64;
+        if (0 == random() % 16) len = random() % (n - loc + 1) / 4 * 4;
+        if (n - len + newCount > CHECK_MAX_COUNT) newCount = 0;
+        fill(values, newCount * size);
+        if (0 == random() % 8) {
+            /* bulk load into a storage that isn't empty */
+            CFStorageInsertValuesFromBuffer(storage, CFRangeMake(loc, newCount), values);
+            len = 0;
+        } else {
+            CFStorageSpliceValues(storage, CFRangeMake(loc, len), values, newCount);
+        }
+        memmove(flat + (loc + newCount) * size, flat + (loc + len) * size, (n - loc - len) * size);
+        memcpy(flat + loc * size, values, newCount * size);
+        n += newCount - len;
+        if (0 == i % 512) compare(storage, flat, n, size, "splice");
+    }
+    compare(storage, flat, n, size, "splice");
+    CFRelease(storage);
+    free(flat);
+    free(values);
+}
+
+static void report(const char *name, double elapsed, CFIndex n) {
+    printf("%-34s %8.2f ns/value\n", name, elapsed * 1e9 / n);
+}
+
+static void check_sum(const char *name, uintptr_t sum, uintptr_t expected) {
+    if (sum != expected) {
+        printf("FAIL: %s read values that don't sum as the buffer does\n", name);
+        failed = 1;
+    }
+}
+
+static void bench(void) {
+    uintptr_t *flat = xmalloc(count * sizeof(uintptr_t));
+    CFIndex *indexes = xmalloc(count * sizeof(CFIndex));
+    for (CFIndex i = 0; i < count; i++) {
+        flat[i] = (uintptr_t)random();
+        indexes[i] = random() % count;
+    }
+
+    double start = now();
+    CFStorageRef storage = CFStorageCreate(kCFAllocatorDefault, sizeof(uintptr_t));
+    CFStorageInsertValuesFromBuffer(storage, CFRangeMake(0, count), flat);
+    report("load: CFStorage bulk", now() - start, count);
+
+    start = now();
+    CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, 0, NULL);
+    CFArrayReplaceValues(array, CFRangeMake(0, 0), (const void **)flat, count);
+    report("load: CFArray (deque)", now() - start, count);
+
+    uintptr_t expected = 0, sum;
+    start = now();
+    for (CFIndex i = 0; i < count; i++) expected += flat[i];
+    report("sequential: buffer", now() - start, count);
+
+    start = now();
+    sum = 0;
+    for (CFIndex i = 0; i < count;) {
+        CFRange range;
+        const uintptr_t *values = CFStorageGetConstValueAtIndex(storage, i, &range);
+        for (CFIndex end = range.location + range.length; i < end; i++) sum += values[i - range.location];
+    }
+    report("sequential: CFStorage valid range", now() - start, count);
+    check_sum("the valid range walk", sum, expected);
+
+    start = now();
+    sum = 0;
+    CFStorageCursor cursor;
+    const uintptr_t *value = CFStorageCursorInit(&cursor, storage, -1);
+    while ((value = CFStorageCursorNext(&cursor))) sum += *value;
+    report("sequential: CFStorage cursor", now() - start, count);
+    check_sum("the cursor", sum, expected);
+
+    start = now();
+    sum = 0;
+    for (CFIndex i = 0; i < count; i++) sum += *(const uintptr_t *)CFStorageGetConstValueAtIndex(storage, i, NULL);
+    report("sequential: CFStorage by index", now() - start, count);
+    check_sum("CFStorageGetConstValueAtIndex", sum, expected);
+
+    start = now();
+    sum = 0;
+    for (CFIndex i = 0; i < count; i++) sum += (uintptr_t)CFArrayGetValueAtIndex(array, i);
+    report("sequential: CFArray (deque)", now() - start, count);
+    check_sum("CFArrayGetValueAtIndex", sum, expected);
+
+    start = now();
+    expected = 0;
+    for (CFIndex i = 0; i < count; i++) expected += flat[indexes[i]];
+    report("random: buffer", now() - start, count);
+
+    start = now();
+    sum = 0;
+    for (CFIndex i = 0; i < count; i++) sum += *(const uintptr_t *)CFStorageGetConstValueAtIndex(storage, indexes[i], NULL);
+    report("random: CFStorage", now() - start, count);
+    check_sum("random CFStorage reads", sum, expected);
+
+    start = now();
+    sum = 0;
+    for (CFIndex i = 0; i < count; i++) sum += *(const uintptr_t *)CFStorageCursorSetIndex(&cursor, indexes[i]);
+    report("random: CFStorage cursor", now() - start, count);
+    check_sum("random cursor reads", sum, expected);
+
+    start = now();
+    sum = 0;
+    for (CFIndex i = 0; i < count; i++) sum += (uintptr_t)CFArrayGetValueAtIndex(array, indexes[i]);
+    report("random: CFArray (deque)", now() - start, count);
+    check_sum("random CFArray reads", sum, expected);
+
+    start = now();
+    for (int i = 0; i < edits; i++) {
+        CFIndex at = indexes[i % count];
+        CFStorageSpliceValues(storage, CFRangeMake(at, 0), &flat[at], 1);
+        CFStorageSpliceValues(storage, CFRangeMake(at, 1), NULL, 0);
+    }
+    report("insert+delete: CFStorage", now() - start, edits);
+
+    start = now();
+    for (int i = 0; i < edits; i++) {
+        CFIndex at = indexes[i % count];
+        CFArrayInsertValueAtIndex(array, at, (const void *)flat[at]);
+        CFArrayRemoveValueAtIndex(array, at);
+    }
+    report("insert+delete: CFArray (deque)", now() - start, edits);
+
+    CFRelease(storage);
+    CFRelease(array);
+    free(flat);
+    free(indexes);
+}
+
+static long get_long(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atol(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    static const CFIndex sizes[] = {1, 3, 8, 12};
+
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-count")) count = get_long(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-edits")) edits = (int)get_long(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = (int)get_long(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (count < 1 || edits < 0) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %ld values, %d edits\n", rseed, (long)count, edits);
+    srandom(rseed);
+
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !failed; i++) check_size(sizes[i]);
+    if (!failed) bench();
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,391 @@
+/*
+ * string_bench:  Check CFString hashing, comparison and search against the
+ *                code they replaced, and time them.
+ *
+ * usage:  string_bench [options...]
+ *
+ * Default:  For every length from 0 to 200, hashes ASCII strings, strings
+ *           of bytes with a few non-ASCII ones in them and UTF-16 strings,
+ *           through CFHash on 8-bit and UTF-16 strings and through
+ *           CFStringHashCString, CFStringHashISOLatin1CString and
+ *           CFStringHashCharacters.  Every hash must equal what the old
+ *           HashNextFourUniChars recurrence gives, which is written out
+ *           here, over the whole string up to 96 characters and over its
+ *           first, middle and last 32 past that.
+ *           Then compares and searches strings which share long prefixes,
+ *           differ in case or in one character, and have needles crossing
+ *           16-byte blocks.  Each result must be the same whether both
+ *           strings are 8-bit or both UTF-16, which takes the block paths,
+ *           or one of each, which takes the character by character ones;
+ *           literal results must also match a plain loop over the
+ *           characters.  Comparisons are done with no options, case and
+ *           diacritic insensitively, with forced ordering, and over ranges
+ *           starting anywhere in the first string.
+ *           Finally times hashing, comparing, CFEqual and searching.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/string_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -trials #     Random comparisons and searches checked.
+ *    -iters #      Operations timed for each rate.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the rates)
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include "../CFPriv.h"
+#include "../ForFoundationOnly.h"
+
+#define MAX_LENGTH 200
+#define MAX_FIND_LENGTH 300
+
+enum { ASCII, HIGH_BYTES, UTF16, NKINDS };
+
+static const char *const kind_names[NKINDS] = {"ASCII", "bytes", "UTF-16"};
+
+int trials = 20000;
+int iters = 200000;
+int rseed;
+int failed;
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* The old HashNextFourUniChars and HashNextUniChar, as they evaluate: each product is an int, which wraps, converted to CFHashCode */
+static void reference_run(CFHashCode *result, const UniChar *chars, CFIndex len) {
+    CFIndex i = 0;
+    for (; i + 4 <= len; i += 4) {
+        *result = *result * 67503105 + (CFHashCode)(int)(chars[i] * 16974593U) + (CFHashCode)(int)(chars[i + 1] * 66049U) + (CFHashCode)(int)(chars[i + 2] * 257U) + chars[i + 3];
+    }
+    for (; i < len; i++) *result = *result * 257 + chars[i];
+}
+
+static CFHashCode reference_hash(const UniChar *chars, CFIndex len) {
+    CFHashCode result = len;
+    if (len <= 96) {
+        reference_run(&result, chars, len);
+    } else {
+        reference_run(&result, chars, 32);
+        reference_run(&result, chars + (len >> 1) - 16, 32);
+        reference_run(&result, chars + len - 32, 32);
+    }
+    return result + (result << (len & 31));
+}
+
+static void random_chars(UniChar *chars, CFIndex len, int kind, const char *alphabet) {
+    CFIndex alphabetLen = strlen(alphabet);
+    for (CFIndex i = 0; i < len; i++) chars[i] = alphabet[random() % alphabetLen];
+    if (HIGH_BYTES == kind && len > 0) {
+        /* a few, so that long strings are often ASCII in the hashed windows and not elsewhere */
+        for (int n = random() % 3; n >= 0; n--) chars[random() % len] = 0x80 + random() % 0x80;
+    } else if (UTF16 == kind) {
+        for (CFIndex i = 0; i < len; i++) {
+            if (0 == random() % 4) chars[i] = 0x100 + random() % 0xD700;   /* not a surrogate */
+        }
+    }
+}
+
+/* Holds ASCII as 8-bit contents */
+static CFStringRef create_eight_bit(const UniChar *chars, CFIndex len) {
+    CFStringRef str = CFStringCreateWithCharacters(kCFAllocatorDefault, chars, len);
+    if (len > 0 && !CFStringGetCStringPtr(str, kCFStringEncodingASCII)) {
+        printf("internal error: an ASCII string wasn't stored as 8-bit\n");
+        exit(99);
+    }
+    return str;
+}
+
+/* Holds anything as UTF-16 contents: a mutable string never goes back to 8-bit once it has held a character which needs 16 bits */
+static CFStringRef create_utf16(const UniChar *chars, CFIndex len) {
+    static const UniChar wide = 0x263A;
+    CFMutableStringRef str = CFStringCreateMutable(kCFAllocatorDefault, 0);
+    CFStringAppendCharacters(str, &wide, 1);
+    CFStringAppendCharacters(str, chars, len);
+    CFStringDelete(str, CFRangeMake(0, 1));
+    if (!CFStringGetCharactersPtr(str)) {
+        printf("internal error: a string wasn't stored as UTF-16\n");
+        exit(99);
+    }
+    return str;
+}
+
+static void check_hash(const char *what, int kind, CFIndex len, CFHashCode hash, CFHashCode expected) {
+    if (hash != expected) {
+        printf("FAIL: %s of %ld %s characters: 0x%lx, expected 0x%lx\n", what, (long)len, kind_names[kind], (unsigned long)hash, (unsigned long)expected);
+        failed = 1;
+    }
+}
+
+static void check_hashes(void) {
+    UniChar chars[MAX_LENGTH], mapped[MAX_LENGTH];
+    uint8_t bytes[MAX_LENGTH];
+    for (CFIndex len = 0; len <= MAX_LENGTH && !failed; len++) {
+        for (int trial = 0; trial < 3 * NKINDS; trial++) {
+            int kind = trial % NKINDS;
+            random_chars(chars, len, kind, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,-");
+            CFHashCode expected = reference_hash(chars, len);
+
+            CFStringRef str = create_utf16(chars, len);
+            check_hash("CFHash (UTF-16)", kind, len, CFHash(str), expected);
+            CFRelease(str);
+            check_hash("CFStringHashCharacters", kind, len, CFStringHashCharacters(chars, len), expected);
+            if (UTF16 == kind) continue;
+
+            for (CFIndex i = 0; i < len; i++) {
+                bytes[i] = (uint8_t)chars[i];
+                mapped[i] = __CFCharToUniCharTable[bytes[i]];
+            }
+            check_hash("CFStringHashISOLatin1CString", kind, len, CFStringHashISOLatin1CString(bytes, len), expected);
+            check_hash("CFStringHashCString", kind, len, CFStringHashCString(bytes, len), reference_hash(mapped, len));
+            if (ASCII == kind) {
+                str = create_eight_bit(chars, len);
+                check_hash("CFHash (8-bit)", kind, len, CFHash(str), expected);
+                CFRelease(str);
+            }
+        }
+    }
+}
+
+static CFComparisonResult reference_compare(const UniChar *a, CFIndex aLen, const UniChar *b, CFIndex bLen) {
+    for (CFIndex i = 0; i < aLen && i < bLen; i++) {
+        if (a[i] != b[i]) return (a[i] < b[i]) ? kCFCompareLessThan : kCFCompareGreaterThan;
+    }
+    return (aLen == bLen) ? kCFCompareEqualTo : ((aLen < bLen) ? kCFCompareLessThan : kCFCompareGreaterThan);
+}
+
+/* b is a, with its case changed here and there, one character changed, or its end moved */
+static CFIndex random_variant(const UniChar *a, CFIndex aLen, UniChar *b, int kind) {
+    CFIndex bLen = aLen;
+    memmove(b, a, aLen * sizeof(UniChar));
+    switch (random() % 4) {
+    case 0:
+        for (CFIndex i = 0; i < aLen; i++) {
+            if (0 == random() % 8 && b[i] < 0x80) b[i] ^= (((b[i] | 0x20) >= 'a' && (b[i] | 0x20) <= 'z') ? 0x20 : 0);
+        }
+        break;
+    case 1:
+        if (aLen > 0) random_chars(b + random() % aLen, 1, kind, "abAB");
+        break;
+    case 2:
+        bLen = random() % (aLen + 1);
+        break;
+    default:
+        bLen = aLen + random() % 20;
+        if (bLen > MAX_LENGTH) bLen = MAX_LENGTH;
+        random_chars(b + aLen, bLen - aLen, kind, "abAB");
+        break;
+    }
+    return bLen;
+}
+
+static void check_compares(void) {
+    static const CFStringCompareFlags options[] = {
+        0, kCFCompareCaseInsensitive, kCFCompareCaseInsensitive | kCFCompareForcedOrdering, kCFCompareDiacriticInsensitive,
+        kCFCompareCaseInsensitive | kCFCompareDiacriticInsensitive, kCFCompareForcedOrdering,
+    };
+    UniChar a[MAX_LENGTH], b[MAX_LENGTH];
+    for (int trial = 0; trial < trials && !failed; trial++) {
+        int kind = (0 == trial % 4) ? UTF16 : ASCII;
+        CFIndex aLen = random() % (MAX_LENGTH + 1);
+        random_chars(a, aLen, kind, (0 == trial % 2) ? "aAbB" : "abcdefghABCDEFGH0123");
+        CFIndex bLen = random_variant(a, aLen, b, kind);
+        CFIndex loc = (0 == random() % 4 && aLen > 0) ? random() % aLen : 0;
+        CFRange range = CFRangeMake(loc, aLen - loc);
+
+        CFStringRef a16 = create_utf16(a, aLen), b16 = create_utf16(b, bLen);
+        CFStringRef a8 = (ASCII == kind) ? create_eight_bit(a, aLen) : NULL, b8 = (ASCII == kind) ? create_eight_bit(b, bLen) : NULL;
+        for (unsigned o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+            /* other than literally, UTF-16 strings which can't be 8-bit have nothing to be checked against */
+            if (!a8 && 0 != options[o]) continue;
+            CFComparisonResult result = CFStringCompareWithOptions(a16, b16, range, options[o]);
+            CFComparisonResult expected = result;
+            if (0 == options[o]) {
+                expected = reference_compare(a + loc, aLen - loc, b, bLen);
+            } else if (a8) {
+                /* one 8-bit string and one UTF-16 string go character by character */
+                expected = CFStringCompareWithOptions(a8, b16, range, options[o]);
+                if (expected != CFStringCompareWithOptions(a16, b8, range, options[o])) {
+                    printf("FAIL: compare (options 0x%lx) of %ld and %ld characters from %ld depends on which string is 8-bit\n", (unsigned long)options[o], (long)aLen, (long)bLen, (long)loc);
+                    failed = 1;
+                }
+            }
+            if (result != expected || (a8 && CFStringCompareWithOptions(a8, b8, range, options[o]) != expected)) {
+                printf("FAIL: compare (options 0x%lx) of %ld and %ld %s characters from %ld: %ld as UTF-16, %ld as 8-bit, expected %ld\n", (unsigned long)options[o], (long)aLen, (long)bLen, kind_names[kind], (long)loc,
+                       (long)result, a8 ? (long)CFStringCompareWithOptions(a8, b8, range, options[o]) : (long)expected, (long)expected);
+                failed = 1;
+            }
+        }
+        if (a8 && CFEqual(a8, b16) != (0 == reference_compare(a, aLen, b, bLen))) {
+            printf("FAIL: CFEqual of %ld 8-bit and %ld UTF-16 characters\n", (long)aLen, (long)bLen);
+            failed = 1;
+        }
+        CFRelease(a16);
+        CFRelease(b16);
+        if (a8) CFRelease(a8);
+        if (b8) CFRelease(b8);
+    }
+}
+
+static CFIndex reference_find(const UniChar *haystack, CFRange range, const UniChar *needle, CFIndex needleLen) {
+    for (CFIndex i = range.location; i + needleLen <= range.location + range.length; i++) {
+        if (0 == memcmp(haystack + i, needle, needleLen * sizeof(UniChar))) return i;
+    }
+    return kCFNotFound;
+}
+
+static void check_finds(void) {
+    UniChar haystack[MAX_FIND_LENGTH], needle[MAX_FIND_LENGTH];
+    for (int trial = 0; trial < trials && !failed; trial++) {
+        int kind = (0 == trial % 4) ? UTF16 : ASCII;
+        CFIndex haystackLen = 1 + random() % MAX_FIND_LENGTH;
+        /* a small alphabet gives many candidates whose first and last characters match */
+        random_chars(haystack, haystackLen, kind, (0 == trial % 2) ? "ab" : "abcd");
+        CFIndex at = random() % haystackLen;
+        CFIndex needleLen = 1 + random() % ((haystackLen - at < 40) ? haystackLen - at : 40);
+        memmove(needle, haystack + at, needleLen * sizeof(UniChar));
+        if (0 == random() % 3) random_chars(needle + random() % needleLen, 1, kind, "abcd");
+        CFIndex loc = random() % (haystackLen + 1);
+        CFRange range = CFRangeMake(loc, random() % (haystackLen - loc + 1));
+        if (0 == random() % 2) range = CFRangeMake(0, haystackLen);
+
+        CFIndex expected = reference_find(haystack, range, needle, needleLen);
+        CFStringRef h16 = create_utf16(haystack, haystackLen), n16 = create_utf16(needle, needleLen);
+        CFStringRef h8 = (ASCII == kind) ? create_eight_bit(haystack, haystackLen) : NULL, n8 = (ASCII == kind) ? create_eight_bit(needle, needleLen) : NULL;
+        CFStringRef pairs[3][2] = {{h16, n16}, {h8, n8}, {h8, n16}};
+        for (int p = 0; p < (h8 ? 3 : 1); p++) {
+            CFRange found;
+            CFIndex result = CFStringFindWithOptions(pairs[p][0], pairs[p][1], range, 0, &found) ? found.location : kCFNotFound;
+            if (result != expected) {
+                printf("FAIL: find %ld of %ld %s characters in [%ld, %ld) (%s): %ld, expected %ld\n", (long)needleLen, (long)haystackLen, kind_names[kind], (long)range.location, (long)(range.location + range.length),
+                       (0 == p) ? "both UTF-16" : ((1 == p) ? "both 8-bit" : "8-bit in UTF-16"), (long)result, (long)expected);
+                failed = 1;
+            }
+        }
+        CFRelease(h16);
+        CFRelease(n16);
+        if (h8) CFRelease(h8);
+        if (n8) CFRelease(n8);
+    }
+}
+
+static void report(const char *name, double elapsed, double bytes) {
+    printf("%-40s %8.1f ns/op %9.1f MB/s\n", name, elapsed * 1e9 / iters, bytes * iters / elapsed / 1e6);
+}
+
+static void bench(void) {
+    static const CFIndex hashLengths[] = {8, 32, 96, 1000};
+    CFIndex len = 4096;
+    UniChar *chars = malloc(len * sizeof(UniChar)), *other = malloc(len * sizeof(UniChar));
+    if (!chars || !other) {
+        printf("internal error: out of memory\n");
+        exit(99);
+    }
+    random_chars(chars, len, ASCII, "abcdefghijklmnopqrstuvwxyz");
+    volatile CFHashCode sink = 0;
+    char name[64];
+
+    for (unsigned h = 0; h < sizeof(hashLengths) / sizeof(hashLengths[0]); h++) {
+        CFIndex hashed = (hashLengths[h] <= 96) ? hashLengths[h] : 96;
+        CFStringRef s8 = create_eight_bit(chars, hashLengths[h]), s16 = create_utf16(chars, hashLengths[h]);
+        double start = now();
+        for (int i = 0; i < iters; i++) sink += CFHash(s8);
+        snprintf(name, sizeof(name), "CFHash, %ld characters, 8-bit", (long)hashLengths[h]);
+        report(name, now() - start, hashed);
+        start = now();
+        for (int i = 0; i < iters; i++) sink += CFHash(s16);
+        snprintf(name, sizeof(name), "CFHash, %ld characters, UTF-16", (long)hashLengths[h]);
+        report(name, now() - start, hashed * sizeof(UniChar));
+        CFRelease(s8);
+        CFRelease(s16);
+    }
+
+    /* equal but for case in the last character, so every comparison reads all of both strings */
+    memmove(other, chars, len * sizeof(UniChar));
+    other[len - 1] -= 'a' - 'A';
+    CFStringRef a8 = create_eight_bit(chars, len), b8 = create_eight_bit(other, len);
+    CFStringRef a16 = create_utf16(chars, len), b16 = create_utf16(other, len), c16 = create_utf16(chars, len);
+    double start = now();
+    for (int i = 0; i < iters; i++) sink += CFStringCompare(a8, b8, kCFCompareCaseInsensitive | kCFCompareForcedOrdering);
+    report("compare 4096, forced ordering, 8-bit", now() - start, 2.0 * len);
+    start = now();
+    for (int i = 0; i < iters; i++) sink += CFStringCompare(a16, b16, 0);
+    report("compare 4096, literal, UTF-16", now() - start, 2.0 * len * sizeof(UniChar));
+    start = now();
+    for (int i = 0; i < iters; i++) sink += CFEqual(a16, c16);
+    report("CFEqual 4096, UTF-16", now() - start, 2.0 * len * sizeof(UniChar));
+    start = now();
+    for (int i = 0; i < iters; i++) sink += CFEqual(a8, c16);
+    report("CFEqual 4096, 8-bit and UTF-16", now() - start, 3.0 * len);
+
+    /* a needle found only at the end of the haystack */
+    CFStringRef n8 = create_eight_bit(chars + len - 16, 16), n16 = create_utf16(chars + len - 16, 16);
+    CFRange found = CFRangeMake(kCFNotFound, 0);
+    start = now();
+    for (int i = 0; i < iters; i++) sink += CFStringFindWithOptions(a8, n8, CFRangeMake(0, len), 0, &found);
+    report("find 16 in 4096, 8-bit", now() - start, len);
+    start = now();
+    for (int i = 0; i < iters; i++) sink += CFStringFindWithOptions(a16, n16, CFRangeMake(0, len), 0, &found);
+    report("find 16 in 4096, UTF-16", now() - start, len * sizeof(UniChar));
+    if (found.location != len - 16) {
+        printf("FAIL: the timed search found the needle at %ld\n", (long)found.location);
+        failed = 1;
+    }
+
+    CFRelease(a8);
+    CFRelease(b8);
+    CFRelease(a16);
+    CFRelease(b16);
+    CFRelease(c16);
+    CFRelease(n8);
+    CFRelease(n16);
+    free(chars);
+    free(other);
+}
+
+static int get_int(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-trials")) trials = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-iters")) iters = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = get_int(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (trials < 0 || iters < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %d trials\n", rseed, trials);
+    srandom(rseed);
+
+    check_hashes();
+    if (!failed) check_compares();
+    if (!failed) check_finds();
+    if (!failed) bench();
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
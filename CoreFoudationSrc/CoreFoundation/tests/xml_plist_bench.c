@@ -0,0 +1,456 @@
+/*
+ * xml_plist_bench:  Check the XML property list parser on generated files
+ *                   against the objects they were generated from, and time
+ *                   it against the binary encoding of the same objects.
+ *
+ * usage:  xml_plist_bench [options...]
+ *
+ * Default:  First parses a few fixed cases: each entity, CDATA with
+ *           brackets in it, decimal and hex character references, base64
+ *           with and without white space and padding, and a dictionary with
+ *           a repeated key.  Then generates an XML property list of an array
+ *           of dictionaries, writing the XML text and building the objects
+ *           it stands for side by side.  Its strings mix plain runs longer
+ *           and shorter than 16 bytes, UTF-8, entities, character references
+ *           and CDATA sections; its data is base64 of random bytes, padded
+ *           or not and with or without white space through it; its keys are
+ *           drawn from a small set, so dictionaries repeat them and the last
+ *           value must win; and the white space between elements runs from
+ *           none to several lines.  The parse must be CFEqual to the
+ *           objects, under each mutability option.  So must a parse of the
+ *           same objects as written by the XML writer and by the binary
+ *           writer.  The rate of each parse is printed.
+ *
+ *           Unpadded base64 whose length isn't a multiple of four loses its
+ *           last partial group, as it always has; the expected data is cut
+ *           to match.
+ *
+ *           Build against this tree's CoreFoundation, e.g.
+ *           cc -I.. tests/xml_plist_bench.c libCoreFoudationSrc.a
+ *
+ * Options:
+ *    -count #      Dictionaries in the generated array.
+ *    -iters #      Parses timed for each encoding.
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the rates)
+ *    1    FAIL
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#define NKEYS 12
+
+int count = 20000;
+int iters = 5;
+int rseed;
+int failed;
+
+static const char *const plist_header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n<plist version=\"1.0\">\n";
+static const char *const plist_footer = "\n</plist>\n";
+
+/* keys as written, and as they read back */
+static const char *const key_xml[NKEYS] = {"name", "index", "tags", "data", "a", "b", "key with spaces", "0123456789abcdef0123", "a&amp;b", "caf&#xe9;", "<![CDATA[<key>]]>", "\xc3\xa9t\xc3\xa9"};
+static const char *const key_expected[NKEYS] = {"name", "index", "tags", "data", "a", "b", "key with spaces", "0123456789abcdef0123", "a&b", "caf\xc3\xa9", "<key>", "\xc3\xa9t\xc3\xa9"};
+
+struct buffer {
+    char *bytes;
+    size_t length, capacity;
+};
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void append(struct buffer *b, const void *bytes, size_t length) {
+    if (b->capacity < b->length + length) {
+        b->capacity = 2 * (b->length + length) + 256;
+        b->bytes = realloc(b->bytes, b->capacity);
+        if (!b->bytes) {
+            printf("internal error: out of memory\n");
+            exit(99);
+        }
+    }
+    memmove(b->bytes + b->length, bytes, length);
+    b->length += length;
+}
+
+static void append_str(struct buffer *b, const char *s) {
+    append(b, s, strlen(s));
+}
+
+static void append_char(struct buffer *b, char c) {
+    append(b, &c, 1);
+}
+
+static void append_utf8(struct buffer *b, unsigned cp) {
+    if (cp < 0x80) {
+        append_char(b, cp);
+    } else if (cp < 0x800) {
+        append_char(b, 0xc0 | (cp >> 6));
+        append_char(b, 0x80 | (cp & 0x3f));
+    } else {
+        append_char(b, 0xe0 | (cp >> 12));
+        append_char(b, 0x80 | ((cp >> 6) & 0x3f));
+        append_char(b, 0x80 | (cp & 0x3f));
+    }
+}
+
+static CFStringRef create_string(const char *bytes, size_t length) {
+    return CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)bytes, length, kCFStringEncodingUTF8, false);
+}
+
+static CFPropertyListRef parse(const char *xml, size_t length, CFOptionFlags options) {
+    CFDataRef data = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)xml, length, kCFAllocatorNull);
+    CFPropertyListFormat format = 0;
+    CFPropertyListRef plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, options, &format, NULL);
+    CFRelease(data);
+    if (plist && kCFPropertyListXMLFormat_v1_0 != format) {
+        CFRelease(plist);
+        return NULL;
+    }
+    return plist;
+}
+
+/* Parses value, wrapped in a plist element, and compares it with expected */
+static void check_fixed(const char *value, CFTypeRef expected, const char *what) {
+    struct buffer xml = {NULL, 0, 0};
+    append_str(&xml, plist_header);
+    append_str(&xml, value);
+    append_str(&xml, plist_footer);
+    CFPropertyListRef plist = parse(xml.bytes, xml.length, kCFPropertyListImmutable);
+    if (!plist || !CFEqual(plist, expected)) {
+        printf("FAIL: %s: %s\n", what, plist ? "parsed to another value" : "didn't parse");
+        failed = 1;
+    }
+    if (plist) CFRelease(plist);
+    CFRelease(expected);
+    free(xml.bytes);
+}
+
+static void check_fixed_cases(void) {
+    static const struct {
+        const char *xml;
+        const char *expected;
+    } strings[] = {
+        {"<string>a &lt;b&gt; &amp; &apos;c&apos; &quot;d&quot;</string>", "a <b> & 'c' \"d\""},
+        {"<string><![CDATA[x < y & z]]></string>", "x < y & z"},
+        {"<string>pre<![CDATA[<mid>]]]>post <![CDATA[]]> ]]&gt;</string>", "pre<mid>]post  ]]>"},
+        {"<string>&#65;&#x42;&#x20AC;&#x20ac;&#233;&#0233;&#x4e2d;</string>", "AB\xe2\x82\xac\xe2\x82\xac\xc3\xa9\xc3\xa9\xe4\xb8\xad"},
+        {"<string>0123456789abcde&amp;0123456789abcdef&lt;0123456789abcdef0</string>", "0123456789abcde&0123456789abcdef<0123456789abcdef0"},
+        {"<string>  leading and trailing\n\tspace  </string>", "  leading and trailing\n\tspace  "},
+        {"<string>\xc3\xa9t\xc3\xa9 0123456789abcdef \xe2\x82\xac\xf0\x9f\x98\x80</string>", "\xc3\xa9t\xc3\xa9 0123456789abcdef \xe2\x82\xac\xf0\x9f\x98\x80"},
+    };
+    for (unsigned i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        check_fixed(strings[i].xml, create_string(strings[i].expected, strlen(strings[i].expected)), strings[i].xml);
+    }
+
+    static const struct {
+        const char *xml;
+        const char *expected;
+    } datas[] = {
+        {"<data>SGVsbG8sIHdvcmxkIQ==</data>", "Hello, world!"},
+        {"<data>\n\tSGVs\n\tbG8s IHdv\tcmxk\r\nIQ=\n=\n</data>", "Hello, world!"},
+        {"<data>SGVsbG8sIHdvcmxkIQ</data>", "Hello, world"},
+        {"<data>QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVo=</data>", "ABCDEFGHIJKLMNOPQRSTUVWXYZ"},
+        {"<data>QUJDREVGR0hJSktM TU5PUFFSU1RVVldYWVo=</data>", "ABCDEFGHIJKLMNOPQRSTUVWXYZ"},
+        {"<data>Q UJDREVGR0hJSktMTU5PUFFSU1RVVldYWVo=</data>", "ABCDEFGHIJKLMNOPQRSTUVWXYZ"},
+        {"<data></data>", ""},
+    };
+    for (unsigned i = 0; i < sizeof(datas) / sizeof(datas[0]); i++) {
+        check_fixed(datas[i].xml, CFDataCreate(kCFAllocatorDefault, (const UInt8 *)datas[i].expected, strlen(datas[i].expected)), datas[i].xml);
+    }
+
+    /* of repeated keys the last one wins */
+    CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    int three = 3, two = 2;
+    CFNumberRef n = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &three);
+    CFDictionarySetValue(dict, CFSTR("a"), n);
+    CFRelease(n);
+    n = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &two);
+    CFDictionarySetValue(dict, CFSTR("b"), n);
+    CFRelease(n);
+    check_fixed("<dict><key>a</key><integer>1</integer><key>b</key><integer>2</integer><key>a</key><integer>3</integer></dict>", dict, "a dictionary with a repeated key");
+
+    const void *booleans[] = {kCFBooleanTrue, kCFBooleanFalse};
+    check_fixed("<array>\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t<true/>                                          \r\n\n\n <false/>\t</array>", CFArrayCreate(kCFAllocatorDefault, booleans, 2, &kCFTypeArrayCallBacks), "long runs of white space");
+}
+
+/* Between elements: usually a newline and indentation, sometimes nothing or a long mixed run */
+static void append_space(struct buffer *xml, int depth) {
+    static const char space[] = " \t\n\r";
+    switch (random() % 4) {
+    case 0:
+        break;
+    case 1:
+        for (int n = 16 + random() % 48; 0 < n; n--) append_char(xml, space[random() % 4]);
+        break;
+    default:
+        append_char(xml, '\n');
+        for (int d = 0; d < depth; d++) append_char(xml, '\t');
+        break;
+    }
+}
+
+static void append_plain(struct buffer *xml, struct buffer *expected, int length) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,;:!?-_/()[]>\t\n";
+    for (int i = 0; i < length; i++) {
+        char c = chars[random() % (sizeof(chars) - 1)];
+        append_char(xml, c);
+        append_char(expected, c);
+    }
+}
+
+static void append_string_contents(struct buffer *xml, struct buffer *expected) {
+    static const char *const entities[][2] = {{"&lt;", "<"}, {"&gt;", ">"}, {"&amp;", "&"}, {"&apos;", "'"}, {"&quot;", "\""}};
+    static const char *const utf8[] = {"\xc3\xa9", "\xe2\x82\xac", "\xe4\xb8\xad", "\xf0\x9f\x98\x80"};
+    static const unsigned code_points[] = {'A', 'z', '<', '&', 0xa0, 0xe9, 0x3b1, 0x7ff, 0x800, 0x20ac, 0x4e2d, 0xfffd};
+    for (int segments = random() % 7; 0 < segments; segments--) {
+        switch (random() % 8) {
+        case 0:
+        case 1:
+            append_plain(xml, expected, random() % 16);
+            break;
+        case 2:
+            append_plain(xml, expected, 16 + random() % 64);
+            break;
+        case 3: {
+            int e = random() % 5;
+            append_str(xml, entities[e][0]);
+            append_str(expected, entities[e][1]);
+            break;
+        }
+        case 4: {
+            char ref[16];
+            unsigned cp = code_points[random() % (sizeof(code_points) / sizeof(code_points[0]))];
+            snprintf(ref, sizeof(ref), (random() % 2) ? "&#%u;" : (random() % 2) ? "&#x%x;" : "&#x%X;", cp);
+            append_str(xml, ref);
+            append_utf8(expected, cp);
+            break;
+        }
+        case 5: {
+            /* anything but the end marker, including markup and lone brackets */
+            static const char chars[] = "ab<&>] ";
+            append_str(xml, "<![CDATA[");
+            for (int n = random() % 24; 0 < n; n--) {
+                char c = chars[random() % (sizeof(chars) - 1)];
+                if ('>' == c && 2 <= expected->length && ']' == expected->bytes[expected->length - 1] && ']' == expected->bytes[expected->length - 2]) c = 'a';
+                append_char(xml, c);
+                append_char(expected, c);
+            }
+            append_str(xml, "]]>");
+            break;
+        }
+        default: {
+            const char *s = utf8[random() % 4];
+            append_str(xml, s);
+            append_str(expected, s);
+            break;
+        }
+        }
+    }
+}
+
+static CFStringRef append_string(struct buffer *xml, const char *tag) {
+    struct buffer expected = {NULL, 0, 0};
+    append_char(xml, '<');
+    append_str(xml, tag);
+    append_char(xml, '>');
+    append_string_contents(xml, &expected);
+    append_str(xml, "</");
+    append_str(xml, tag);
+    append_char(xml, '>');
+    CFStringRef s = create_string(expected.bytes, expected.length);
+    free(expected.bytes);
+    return s;
+}
+
+static CFDataRef append_data(struct buffer *xml, int depth) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char space[] = " \t\n\r";
+    int length = (0 == random() % 8) ? random() % 4000 : random() % 100;
+    int padded = random() % 2, spaced = random() % 2;
+    uint8_t *bytes = malloc(length + 3);
+    for (int i = 0; i < length; i++) bytes[i] = random();
+    memset(bytes + length, 0, 3);
+
+    struct buffer encoded = {NULL, 0, 0};
+    for (int i = 0; i < length; i += 3) {
+        unsigned bits = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+        char quad[4] = {digits[bits >> 18], digits[(bits >> 12) & 0x3f], digits[(bits >> 6) & 0x3f], digits[bits & 0x3f]};
+        int used = (length - i < 3) ? length - i + 1 : 4;
+        append(&encoded, quad, used);
+        if (padded) for (int p = used; p < 4; p++) append_char(&encoded, '=');
+    }
+    append_str(xml, "<data>");
+    if (spaced) append_space(xml, depth);
+    for (size_t i = 0; i < encoded.length; i++) {
+        append_char(xml, encoded.bytes[i]);
+        /* as the writer lays it out, or anywhere at all */
+        if (spaced && ((0 == (i + 1) % 68) || 0 == random() % 12)) append_char(xml, space[random() % 4]);
+    }
+    if (spaced) append_space(xml, depth);
+    append_str(xml, "</data>");
+    free(encoded.bytes);
+
+    /* without padding, a group of two or three digits at the end is dropped */
+    CFDataRef data = CFDataCreate(kCFAllocatorDefault, bytes, padded ? length : length - length % 3);
+    free(bytes);
+    return data;
+}
+
+static CFTypeRef append_value(struct buffer *xml, int depth);
+
+static CFDictionaryRef append_dict(struct buffer *xml, int depth) {
+    CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    append_str(xml, "<dict>");
+    for (int n = random() % 10; 0 < n; n--) {
+        int k = random() % NKEYS;
+        append_space(xml, depth + 1);
+        append_str(xml, "<key>");
+        append_str(xml, key_xml[k]);
+        append_str(xml, "</key>");
+        append_space(xml, depth + 1);
+        CFTypeRef value = append_value(xml, depth + 1);
+        CFStringRef key = create_string(key_expected[k], strlen(key_expected[k]));
+        CFDictionarySetValue(dict, key, value);
+        CFRelease(key);
+        CFRelease(value);
+    }
+    append_space(xml, depth);
+    append_str(xml, "</dict>");
+    return dict;
+}
+
+static CFArrayRef append_array(struct buffer *xml, int depth, int n) {
+    CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    append_str(xml, "<array>");
+    for (int i = 0; i < n; i++) {
+        append_space(xml, depth + 1);
+        CFTypeRef value = (0 == depth) ? append_dict(xml, depth + 1) : append_value(xml, depth + 1);
+        CFArrayAppendValue(array, value);
+        CFRelease(value);
+    }
+    append_space(xml, depth);
+    append_str(xml, "</array>");
+    return array;
+}
+
+static CFTypeRef append_value(struct buffer *xml, int depth) {
+    switch (random() % (depth < 4 ? 8 : 5)) {
+    case 0:
+    case 1:
+        return append_string(xml, "string");
+    case 2:
+        return append_data(xml, depth);
+    case 3: {
+        char text[48];
+        SInt64 v = (random() % 2) ? random() % 100 : ((SInt64)random() << 16) - ((SInt64)1 << 40);
+        snprintf(text, sizeof(text), "<integer>%lld</integer>", (long long)v);
+        append_str(xml, text);
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &v);
+    }
+    case 4: {
+        Boolean b = random() % 2;
+        append_str(xml, b ? "<true/>" : "<false/>");
+        return CFRetain(b ? kCFBooleanTrue : kCFBooleanFalse);
+    }
+    case 5:
+        return append_array(xml, depth, random() % 6);
+    default:
+        return append_dict(xml, depth);
+    }
+}
+
+/* Parses iters times, reports the rate, and compares the last parse with expected */
+static void time_parse(CFDataRef data, CFPropertyListRef expected, const char *what) {
+    CFPropertyListRef plist = NULL;
+    double start = now();
+    for (int i = 0; i < iters; i++) {
+        if (plist) CFRelease(plist);
+        plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+    }
+    double elapsed = now() - start;
+    printf("%-28s %10ld bytes %8.1f MB/s\n", what, (long)CFDataGetLength(data), CFDataGetLength(data) * (double)iters / elapsed / 1e6);
+    if (!plist || !CFEqual(plist, expected)) {
+        printf("FAIL: %s: %s\n", what, plist ? "parsed to other objects than were written" : "didn't parse");
+        failed = 1;
+    }
+    if (plist) CFRelease(plist);
+}
+
+static void check_generated(void) {
+    struct buffer xml = {NULL, 0, 0};
+    append_str(&xml, plist_header);
+    CFArrayRef expected = append_array(&xml, 0, count);
+    append_str(&xml, plist_footer);
+
+    /* the leaves are made on separate paths when they are to be mutable */
+    static const CFOptionFlags options[] = {kCFPropertyListMutableContainers, kCFPropertyListMutableContainersAndLeaves};
+    for (unsigned o = 0; o < sizeof(options) / sizeof(options[0]) && !failed; o++) {
+        CFPropertyListRef plist = parse(xml.bytes, xml.length, options[o]);
+        if (!plist || !CFEqual(plist, expected)) {
+            printf("FAIL: generated XML, mutability option %lu: %s\n", (unsigned long)options[o], plist ? "parsed to other objects than were generated" : "didn't parse");
+            failed = 1;
+        }
+        if (plist) CFRelease(plist);
+    }
+
+    CFDataRef generated = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)xml.bytes, xml.length, kCFAllocatorNull);
+    CFDataRef written = CFPropertyListCreateData(kCFAllocatorDefault, expected, kCFPropertyListXMLFormat_v1_0, 0, NULL);
+    CFDataRef binary = CFPropertyListCreateData(kCFAllocatorDefault, expected, kCFPropertyListBinaryFormat_v1_0, 0, NULL);
+    if (!written || !binary) {
+        printf("internal error: the generated objects couldn't be written\n");
+        exit(99);
+    }
+    time_parse(generated, expected, "XML, generated");
+    time_parse(written, expected, "XML, from the writer");
+    time_parse(binary, expected, "binary");
+    CFRelease(generated);
+    CFRelease(written);
+    CFRelease(binary);
+    CFRelease(expected);
+    free(xml.bytes);
+}
+
+static int get_int(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Missing value after %s\n", argv[*i]);
+        exit(99);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    rseed = (int)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-count")) count = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-iters")) iters = get_int(argc, argv, &i);
+        else if (0 == strcmp(argv[i], "-seed")) rseed = get_int(argc, argv, &i);
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(99);
+        }
+    }
+    if (count < 1 || iters < 1) {
+        printf("Illegal arguments\n");
+        exit(99);
+    }
+    printf("seed %d, %d dictionaries, %d parses timed\n", rseed, count, iters);
+    srandom(rseed);
+
+    check_fixed_cases();
+    if (!failed) check_generated();
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -54,9 +54,11 @@
 #include <mach/vm_statistics.h>
 #include <mach/mach_init.h>
 #include <os/tsd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/time.h>
 
 #if defined(__i386__) || defined(__x86_64__) || defined(__arm__) || defined(__arm64__)
 #define __APPLE_API_PRIVATE
@@ -311,6 +313,7 @@ typedef struct region_trailer
 	volatile int		pinned_to_depot;
 	unsigned			bytes_used;  //已使用的字节数
 	mag_index_t			mag_index;   //对应cpuid
+	boolean_t			scavenge_dirty; // Depot'd with free pages the scavenger has yet to madvise
 } region_trailer_t;
 
 typedef struct tiny_region
@@ -552,6 +555,38 @@ typedef struct {
 #define SZONE_FLOTSAM_THRESHOLD_LOW  (1024 * 512)
 #define SZONE_FLOTSAM_THRESHOLD_HIGH (1024 * 1024)
 
+/*
+ * The large_entries hash is split into LARGE_ENTRY_SHARDS independently locked shards, chosen by the
+ * low bits of a block's page number, so that threads churning large blocks rarely meet on one lock.
+ * SZONE_LOCK now guards only the death-row cache; when both are needed it is taken first.
+ */
+#define LARGE_ENTRY_SHARDS		8 /* MUST BE A POWER OF 2! */
+
+typedef struct large_shard {
+	_malloc_lock_s	large_shard_lock CACHE_ALIGN;
+	unsigned	num_large_objects; // in use blocks hashed into this shard
+	unsigned	num_large_entries;
+	size_t		num_large_allocs; // cumulative, for scalable_zone_class_statistics()
+	size_t		num_large_frees;
+	large_entry_t	*large_entries; // hashed by location; null entries don't count
+} large_shard_t;
+
+/*
+ * Per-CPU large caches sit in front of death-row. A free()'d block of at most LARGE_PERCPU_ENTRY_LIMIT
+ * bytes is parked, dirty and without any syscall, in the freeing CPU's cache provided that cache holds
+ * fewer than LARGE_PERCPU_CACHE_SIZE blocks and stays within large_percpu_cache_limit bytes (the CPU's
+ * share of large_entry_cache_reserve_limit). A later large_malloc() on that CPU takes it straight back.
+ */
+#define LARGE_PERCPU_CACHE_SIZE		4
+#define LARGE_PERCPU_ENTRY_LIMIT	(4 * 1024 * 1024)
+
+typedef struct large_percpu_cache {
+	_malloc_lock_s	lock CACHE_ALIGN;
+	unsigned	count;
+	size_t		bytes;
+	large_entry_t	entries[LARGE_PERCPU_CACHE_SIZE]; // entries[count - 1] is the most recent arrival
+} large_percpu_cache_t;
+
 /*******************************************************************************
  * Definitions for region hash
  ******************************************************************************/
@@ -606,7 +641,9 @@ typedef struct {			// vm_allocate()'d, so the array of magazines is page-aligned
 	region_trailer_t	*firstNode;  //region链表的header
 	region_trailer_t	*lastNode;   //region链表的tail
 
-	uintptr_t		pad[50-CACHE_LINE/sizeof(uintptr_t)];
+	unsigned		mag_free_list_verify; // free list pops since the last sampled link check (XOR free lists)
+
+	uintptr_t		pad[49-CACHE_LINE/sizeof(uintptr_t)];
 } magazine_t;
 
 #ifdef __has_extension
@@ -631,6 +668,74 @@ _Static_assert(sizeof(magazine_t) == 1280, "Incorrect padding in magazine_t");
 
 #define DEPOT_MAGAZINE_INDEX		-1
 
+/*
+ * Per-size-class statistics.
+ *
+ * Alongside its magazine_t, every magazine (and the Depot) has a row of class_stats_t, one per free list
+ * slot, updated under the magazine lock wherever mag_num_objects is. Readers sum the rows without taking
+ * any lock, as scalable_zone_statistics() does. Blocks move between magazines, so only the sums are
+ * meaningful. The row after the last possible magazine holds the totals last printed by
+ * scalable_zone_print_class_statistics(), from which it derives rates. Printing takes class_stats_lock,
+ * since it reads and rewrites those rows.
+ */
+typedef struct {
+	size_t		num_allocs;	// blocks of this slot's size handed out, cumulative
+	size_t		num_frees;	// blocks of this slot's size given back, cumulative
+	size_t		bytes_free;	// bytes on this slot's free list
+} class_stats_t;
+
+#define CLASS_STATS_SNAPSHOT_ROW(max_magazines)	((max_magazines) + 1)
+
+#define TINY_CLASS_STATS_PAGED_SIZE						\
+(((sizeof(class_stats_t) * NUM_TINY_SLOTS * (TINY_MAX_MAGAZINES + 2)) + vm_page_quanta_size - 1) &\
+~ (vm_page_quanta_size - 1)) /* + 1 for the Depot, + 1 for the snapshot */
+
+#define SMALL_CLASS_STATS_PAGED_SIZE						\
+(((sizeof(class_stats_t) * NUM_SMALL_SLOTS_LARGEMEM * (SMALL_MAX_MAGAZINES + 2)) + vm_page_quanta_size - 1) &\
+~ (vm_page_quanta_size - 1)) /* + 1 for the Depot, + 1 for the snapshot */
+
+/*
+ * Huge page mode (SCALABLE_MALLOC_HUGE_PAGES / MallocHugePages).
+ *
+ * Small regions (8MB, 8MB aligned) already cover whole huge pages. Tiny regions are 1MB, so in this
+ * mode they are carved in pairs out of a 2MB aligned "arena"; the unused buddy half of an arena is
+ * parked on tiny_arena_spares (linked through its first word) until a region is next needed, and the
+ * arena is only returned to the VM once both halves are spare. A parked half is replaced with fresh
+ * zero-fill memory rather than scrubbed, so parking never faults it in. madvise in this mode is clamped
+ * inward to whole huge pages; a range covering none is released only if it spans HUGE_PAGE_SPLIT_MIN,
+ * so freeing a few pages never splits a huge page mapping but a mostly free tiny region still shrinks.
+ */
+#define HUGE_PAGE_SHIFT			21
+#define HUGE_PAGE_SIZE			((size_t)1 << HUGE_PAGE_SHIFT)
+#define HUGE_PAGE_SPLIT_MIN		(HUGE_PAGE_SIZE / 4)
+#define trunc_huge_page(x)		((x) & ~((uintptr_t)HUGE_PAGE_SIZE - 1))
+#define round_huge_page(x)		trunc_huge_page((x) + HUGE_PAGE_SIZE - 1)
+
+#define TINY_ARENA_BUDDY(r)		((region_t)((uintptr_t)(r) ^ ((uintptr_t)1 << TINY_BLOCKS_ALIGN)))
+
+/*
+ * Background scavenging (SCALABLE_MALLOC_BACKGROUND_SCAVENGE / MallocBackgroundScavenge).
+ *
+ * Instead of madvise()'ing and vm_deallocate()'ing Depot'd regions on the free path, free() only marks
+ * the region's trailer scavenge_dirty. A per-zone thread sleeps on scavenger_cond while nothing is dirty
+ * and is woken by the free path. Once SCAVENGE_DIRTY_HIGH_WATER regions are dirty (or some have stayed dirty
+ * for SCAVENGE_IDLE_PASSES intervals of SCAVENGE_INTERVAL_USEC), it cleans at most SCAVENGE_REGIONS_PER_PASS
+ * regions per interval until the dirty count falls back to SCAVENGE_DIRTY_LOW_WATER.
+ *
+ * scavenger_started holds the scavenger_generation the thread was started in (negated while it is being
+ * started). The generation is bumped in the fork() child, where the thread no longer exists, so the next
+ * free() there starts a new one.
+ */
+#define SCAVENGE_INTERVAL_USEC		100000
+#define SCAVENGE_REGIONS_PER_PASS	8
+#define SCAVENGE_DIRTY_HIGH_WATER	4
+#define SCAVENGE_DIRTY_LOW_WATER	0
+#define SCAVENGE_IDLE_PASSES		50
+
+#define SCAVENGER_RUNNING		0	// scavenger_waiting: not waiting on scavenger_cond
+#define SCAVENGER_IDLE			1	// timed wait with a few dirty regions; wake at the high water mark
+#define SCAVENGER_ASLEEP		2	// untimed wait with nothing dirty; wake on the next dirty region
+
 /****************************** zone itself ***********************************/
 
 /*
@@ -659,6 +764,7 @@ typedef struct szone_s {				// vm_allocate()'d, so page-aligned to begin with.
 	unsigned			num_tiny_magazines_mask;
 	int				num_tiny_magazines_mask_shift;
 	magazine_t			*tiny_magazines; //对应不同cpuid -1为备用 array of per-processor magazines
+	class_stats_t			*tiny_class_stats; // NUM_TINY_SLOTS per magazine, Depot first
 	uintptr_t			last_tiny_advise;
 
 	/* Regions for small objects */
@@ -673,23 +779,25 @@ typedef struct szone_s {				// vm_allocate()'d, so page-aligned to begin with.
 	unsigned			num_small_magazines_mask;
 	int				num_small_magazines_mask_shift;
 	magazine_t			*small_magazines; // array of per-processor magazines
+	class_stats_t			*small_class_stats; // NUM_SMALL_SLOTS_LARGEMEM per magazine, Depot first
 	uintptr_t			last_small_advise;
 
 	/* large objects: all the rest */
-	_malloc_lock_s		large_szone_lock CACHE_ALIGN; // One customer at a time for large
-	unsigned			num_large_objects_in_use;
-	unsigned			num_large_entries;
-	large_entry_t		*large_entries; // hashed by location; null entries don't count
-	size_t			num_bytes_in_large_objects;
+	_malloc_lock_s		large_szone_lock CACHE_ALIGN; // One customer at a time for death-row
+	unsigned			num_large_objects_in_use; // updated atomically
+	large_shard_t		large_shards[LARGE_ENTRY_SHARDS];
+	size_t			num_bytes_in_large_objects; // updated atomically
 
 #if LARGE_CACHE
 	int				large_entry_cache_oldest;  //大块内存的最旧缓存  通过hash求模算法形成一个环
 	int				large_entry_cache_newest;  //大块内存的最新缓存
 	large_entry_t		large_entry_cache[LARGE_ENTRY_CACHE_SIZE]; // "death row" for large malloc/free
 	boolean_t			large_legacy_reset_mprotect;
-	size_t			large_entry_cache_reserve_bytes;
+	size_t			large_entry_cache_reserve_bytes; // updated atomically, includes the per-CPU caches
 	size_t			large_entry_cache_reserve_limit;  //16M
-	size_t			large_entry_cache_bytes; //缓存大块内存的总大小
+	size_t			large_entry_cache_bytes; //缓存大块内存的总大小 (updated atomically, includes the per-CPU caches)
+	size_t			large_percpu_cache_limit; // per-CPU share of large_entry_cache_reserve_limit
+	large_percpu_cache_t	large_percpu_caches[TINY_MAX_MAGAZINES];
 #endif
 
 	/* flag and limits pertaining to altered malloc behavior for systems with
@@ -710,10 +818,68 @@ typedef struct szone_s {				// vm_allocate()'d, so page-aligned to begin with.
 	struct szone_s		*helper_zone;
 
 	boolean_t			flotsam_enabled;
+
+	/* Huge page mode bookkeeping. The spare list is protected by tiny_regions_lock. */
+	region_t			tiny_arena_spares;		// unused halves of 2MB tiny arenas
+	unsigned			num_tiny_arena_spares;
+	size_t				huge_page_bytes_mapped;		// region bytes held in huge page advised mappings
+	size_t				huge_page_bytes_released;	// cumulative bytes actually given back in huge page mode
+
+	/* Background scavenger */
+	volatile boolean_t		scavenge_deferred;		// free() leaves Depot'd regions to the scavenger
+	volatile int32_t		scavenger_started;		// generation the thread runs in, 0 => none
+	volatile boolean_t		scavenger_stop;
+	volatile int32_t		scavenger_waiting;		// SCAVENGER_RUNNING, _IDLE or _ASLEEP
+	pthread_t			scavenger_thread;
+	pthread_mutex_t			scavenger_lock;			// protects scavenger_waiting transitions
+	pthread_cond_t			scavenger_cond;
+	volatile int32_t		scavenge_dirty_regions;		// tiny and small Depot'd regions marked scavenge_dirty
+	size_t				scavenge_passes;
+
+	/* Per-size-class statistics: large totals as of the last print, and when that was */
+	_malloc_lock_s			class_stats_lock;		// protects the snapshot rows and the time of the last print
+	class_stats_t			large_class_stats_snapshot;
+	uint64_t			class_stats_snapshot_usec;
 } szone_t;
 
 #define SZONE_PAGED_SIZE		round_page_quanta((sizeof(szone_t)))
 
+#define TINY_SLOT_FOR_MSIZE(_m)		((!(_m) || ((_m) >= NUM_TINY_SLOTS)) ? NUM_TINY_SLOTS - 1 : (_m) - 1)
+
+static INLINE class_stats_t *
+tiny_class_stats(szone_t *szone, magazine_t *tiny_mag_ptr, grain_t slot)
+{
+	// tiny_mag_ptr - szone->tiny_magazines is DEPOT_MAGAZINE_INDEX for the Depot, which gets row 0
+	return &szone->tiny_class_stats[(tiny_mag_ptr - szone->tiny_magazines + 1) * NUM_TINY_SLOTS + slot];
+}
+
+// A block of old_msize now counts as one of new_msize (realloc in place, or one side of a split)
+static INLINE void
+tiny_class_stats_resize(szone_t *szone, magazine_t *tiny_mag_ptr, msize_t old_msize, msize_t new_msize)
+{
+	tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(old_msize))->num_frees++;
+	tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(new_msize))->num_allocs++;
+}
+
+static INLINE grain_t
+small_slot_for_msize(szone_t *szone, msize_t msize)
+{
+	return (msize <= szone->num_small_slots) ? msize - 1 : szone->num_small_slots - 1;
+}
+
+static INLINE class_stats_t *
+small_class_stats(szone_t *szone, magazine_t *small_mag_ptr, grain_t slot)
+{
+	return &szone->small_class_stats[(small_mag_ptr - szone->small_magazines + 1) * NUM_SMALL_SLOTS_LARGEMEM + slot];
+}
+
+static INLINE void
+small_class_stats_resize(szone_t *szone, magazine_t *small_mag_ptr, msize_t old_msize, msize_t new_msize)
+{
+	small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, old_msize))->num_frees++;
+	small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, new_msize))->num_allocs++;
+}
+
 #if DEBUG_MALLOC || DEBUG_CLIENT
 static void		szone_sleep(void);
 #endif
@@ -730,6 +896,18 @@ static void		*allocate_pages_securely(szone_t *szone, size_t size, unsigned char
 										 int vm_page_label);
 static void		deallocate_pages(szone_t *szone, void *addr, size_t size, unsigned debug_flags);
 static int		madvise_free_range(szone_t *szone, region_t r, uintptr_t pgLo, uintptr_t pgHi, uintptr_t *last);
+static void		madvise_huge_pages(szone_t *szone, void *addr, size_t size);
+static region_t		tiny_region_allocate(szone_t *szone);
+static void		tiny_region_deallocate(szone_t *szone, region_t r);
+static region_t		small_region_allocate(szone_t *szone);
+static void		small_region_deallocate(szone_t *szone, region_t r);
+static INLINE void	scavenge_mark_dirty(szone_t *szone, region_trailer_t *node) ALWAYSINLINE;
+static INLINE void	scavenge_mark_clean(szone_t *szone, region_trailer_t *node) ALWAYSINLINE;
+static NOINLINE void	szone_scavenger_start(szone_t *szone);
+static NOINLINE void	szone_scavenger_wake(szone_t *szone);
+static INLINE void	szone_scavenger_kick(szone_t *szone) ALWAYSINLINE;
+static unsigned		tiny_scavenge_depot(szone_t *szone, unsigned limit);
+static unsigned		small_scavenge_depot(szone_t *szone, unsigned limit);
 static kern_return_t	_szone_default_reader(task_t task, vm_address_t address, vm_size_t size, void **ptr);
 
 static INLINE		mag_index_t mag_get_thread_index(szone_t *szone) ALWAYSINLINE;
@@ -746,6 +924,8 @@ static region_t		*hash_regions_grow_no_lock(szone_t *szone, region_t *regions, s
 static INLINE uintptr_t free_list_gen_checksum(uintptr_t ptr) ALWAYSINLINE;
 static INLINE uintptr_t free_list_checksum_ptr(szone_t *szone, void *p) ALWAYSINLINE;
 static INLINE void	*free_list_unchecksum_ptr(szone_t *szone, ptr_union *ptr) ALWAYSINLINE;
+static INLINE uintptr_t free_list_encode_ptr(szone_t *szone, ptr_union *slot, void *p) ALWAYSINLINE;
+static INLINE void	*free_list_decode_ptr(szone_t *szone, ptr_union *ptr) ALWAYSINLINE;
 static unsigned		free_list_count(szone_t *szone, free_list_t *ptr);
 
 static INLINE void	recirc_list_extract(szone_t *szone, magazine_t *mag_ptr, region_trailer_t *node) ALWAYSINLINE;
@@ -789,7 +969,10 @@ static kern_return_t	tiny_in_use_enumerator(task_t task, void *context, unsigned
 											   memory_reader_t reader, vm_range_recorder_t recorder);
 static void		*tiny_malloc_from_free_list(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t mag_index,
 											msize_t msize);
+static unsigned		tiny_malloc_run_from_end_no_lock(szone_t *szone, magazine_t *tiny_mag_ptr, msize_t msize,
+												 void **results, unsigned count);
 static INLINE void	*tiny_malloc_should_clear(szone_t *szone, msize_t msize, boolean_t cleared_requested) ALWAYSINLINE;
+static unsigned		tiny_batch_malloc(szone_t *szone, msize_t msize, void **results, unsigned count);
 static void	free_tiny(szone_t *szone, void *ptr, region_t tiny_region, size_t known_size);
 static void		print_tiny_free_list(szone_t *szone);
 static void		print_tiny_region(boolean_t verbose, region_t region, size_t bytes_at_start, size_t bytes_at_end);
@@ -820,7 +1003,10 @@ static kern_return_t	small_in_use_enumerator(task_t task, void *context, unsigne
 												memory_reader_t reader, vm_range_recorder_t recorder);
 static void		*small_malloc_from_free_list(szone_t *szone, magazine_t *small_mag_ptr, mag_index_t mag_index,
 											 msize_t msize);
+static unsigned		small_malloc_run_from_end_no_lock(szone_t *szone, magazine_t *small_mag_ptr, msize_t msize,
+												  void **results, unsigned count);
 static INLINE void	*small_malloc_should_clear(szone_t *szone, msize_t msize, boolean_t cleared_requested) ALWAYSINLINE;
+static unsigned		small_batch_malloc(szone_t *szone, msize_t msize, void **results, unsigned count);
 static INLINE void	free_small(szone_t *szone, void *ptr, region_t small_region, size_t known_size) ALWAYSINLINE;
 static void		print_small_free_list(szone_t *szone);
 static void		print_small_region(szone_t *szone, boolean_t verbose, region_t region, size_t bytes_at_start, size_t bytes_at_end);
@@ -829,14 +1015,15 @@ static boolean_t	small_free_list_check(szone_t *szone, grain_t grain);
 #if DEBUG_MALLOC
 static void		large_debug_print(szone_t *szone);
 #endif
-static large_entry_t	*large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr);
-static void		large_entry_insert_no_lock(szone_t *szone, large_entry_t range);
-static INLINE void	large_entries_rehash_after_entry_no_lock(szone_t *szone, large_entry_t *entry) ALWAYSINLINE;
+static large_entry_t	*large_entry_for_pointer_no_lock(large_shard_t *shard, const void *ptr);
+static void		large_entry_insert_no_lock(large_shard_t *shard, large_entry_t range);
+static INLINE void	large_entries_rehash_after_entry_no_lock(large_shard_t *shard, large_entry_t *entry) ALWAYSINLINE;
 static INLINE large_entry_t *large_entries_alloc_no_lock(szone_t *szone, unsigned num) ALWAYSINLINE;
 static void		large_entries_free_no_lock(szone_t *szone, large_entry_t *entries, unsigned num,
 										   vm_range_t *range_to_deallocate);
-static large_entry_t	*large_entries_grow_no_lock(szone_t *szone, vm_range_t *range_to_deallocate);
-static vm_range_t	large_entry_free_no_lock(szone_t *szone, large_entry_t *entry);
+static large_entry_t	*large_entries_grow_no_lock(szone_t *szone, large_shard_t *shard, vm_range_t *range_to_deallocate);
+static boolean_t	large_entry_add(szone_t *szone, vm_address_t addr, size_t size);
+static vm_range_t	large_entry_free_no_lock(szone_t *szone, large_shard_t *shard, large_entry_t *entry);
 static NOINLINE		kern_return_t	large_in_use_enumerator(task_t task, void *context,
 															unsigned type_mask, vm_address_t large_entries_address,
 															unsigned num_entries, memory_reader_t reader,
@@ -844,6 +1031,7 @@ static NOINLINE		kern_return_t	large_in_use_enumerator(task_t task, void *contex
 static void		*large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, boolean_t cleared_requested);
 static NOINLINE void	free_large(szone_t *szone, void *ptr);
 static INLINE int	large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new_size) ALWAYSINLINE;
+static NOINLINE void	*large_try_realloc_remap(szone_t *szone, void *ptr, size_t old_size, size_t new_size);
 
 /*
  * Mark these NOINLINE to avoid bloating the purgeable zone call backs
@@ -930,6 +1118,26 @@ SZONE_TRY_LOCK(szone_t *szone) {
 	return _malloc_lock_trylock(&szone->large_szone_lock);
 }
 
+static inline large_shard_t *
+LARGE_SHARD_FOR_PTR(szone_t *szone, const void *ptr) {
+	return &szone->large_shards[((uintptr_t)ptr >> vm_page_quanta_shift) & (LARGE_ENTRY_SHARDS - 1)];
+}
+
+static inline void
+LARGE_SHARD_LOCK(large_shard_t *shard) {
+	_malloc_lock_lock(&shard->large_shard_lock);
+}
+
+static inline void
+LARGE_SHARD_UNLOCK(large_shard_t *shard) {
+	_malloc_lock_unlock(&shard->large_shard_lock);
+}
+
+static inline bool
+LARGE_SHARD_TRY_LOCK(large_shard_t *shard) {
+	return _malloc_lock_trylock(&shard->large_shard_lock);
+}
+
 static inline void
 SZONE_MAGAZINE_PTR_LOCK(szone_t *szone, magazine_t *mag_ptr) {
 	_malloc_lock_lock(&mag_ptr->magazine_lock);
@@ -1210,6 +1418,19 @@ deallocate_pages(szone_t *szone, void *addr, size_t size, unsigned debug_flags)
 static int
 madvise_free_range(szone_t *szone, region_t r, uintptr_t pgLo, uintptr_t pgHi, uintptr_t *last)
 {
+	boolean_t huge_pages = (szone->debug_flags & SCALABLE_MALLOC_HUGE_PAGES) != 0;
+
+	if (huge_pages) {
+		// Prefer whole huge pages. A range that covers none (always the case inside a 1MB tiny region)
+		// is still worth splitting a mapping for once it is large; small runs are left alone.
+		if (trunc_huge_page(pgHi) > round_huge_page(pgLo)) {
+			pgLo = round_huge_page(pgLo);
+			pgHi = trunc_huge_page(pgHi);
+		} else if (pgHi < pgLo + HUGE_PAGE_SPLIT_MIN) {
+			return 0;
+		}
+	}
+
 	if (pgHi > pgLo) {
 		size_t len = pgHi - pgLo;
 
@@ -1233,6 +1454,8 @@ madvise_free_range(szone_t *szone, region_t r, uintptr_t pgLo, uintptr_t pgHi, u
 			szone_error(szone, 0, "madvise_free_range madvise(..., MADV_FREE_REUSABLE) failed",
 						(void *)pgLo, "length=%d\n", len);
 #endif
+		} else if (huge_pages) {
+			__sync_fetch_and_add(&szone->huge_page_bytes_released, len);
 		}
 	}
 	return 0;
@@ -1256,6 +1479,287 @@ madvise_reuse_range(szone_t *szone, region_t r, uintptr_t pgLo, uintptr_t phHi)
 	return 0;
 }
 
+/*********************	HUGE PAGE REGION ROUTINES	************************/
+
+static void
+madvise_huge_pages(szone_t *szone, void *addr, size_t size)
+{
+#if defined(MADV_HUGEPAGE)
+	if (-1 == madvise(addr, size, MADV_HUGEPAGE)) {
+#if DEBUG_MADVISE
+		szone_error(szone, 0, "madvise_huge_pages madvise(..., MADV_HUGEPAGE) failed",
+					addr, "length=%d\n", size);
+#endif
+	}
+#endif
+	// Where the VM has no huge page advice the 2MB alignment alone lets it promote the mapping.
+	__sync_fetch_and_add(&szone->huge_page_bytes_mapped, size);
+}
+
+static region_t
+tiny_region_allocate(szone_t *szone)
+{
+	region_t r;
+
+	if (!(szone->debug_flags & SCALABLE_MALLOC_HUGE_PAGES))
+		return allocate_pages_securely(szone, TINY_REGION_SIZE, TINY_BLOCKS_ALIGN, VM_MEMORY_MALLOC_TINY);
+
+	_malloc_lock_lock(&szone->tiny_regions_lock);
+	r = szone->tiny_arena_spares;
+	if (r) {
+		szone->tiny_arena_spares = *(region_t *)r;
+		szone->num_tiny_arena_spares--;
+		_malloc_lock_unlock(&szone->tiny_regions_lock);
+		*(region_t *)r = NULL; // region memory is expected to be zero-filled
+		return r;
+	}
+	_malloc_lock_unlock(&szone->tiny_regions_lock);
+
+	// No spare half; map a fresh 2MB arena, keep the low half and park the high half.
+	r = allocate_pages_securely(szone, HUGE_PAGE_SIZE, HUGE_PAGE_SHIFT, VM_MEMORY_MALLOC_TINY);
+	if (!r)
+		return NULL;
+	madvise_huge_pages(szone, r, HUGE_PAGE_SIZE);
+
+	_malloc_lock_lock(&szone->tiny_regions_lock);
+	*(region_t *)TINY_ARENA_BUDDY(r) = szone->tiny_arena_spares;
+	szone->tiny_arena_spares = TINY_ARENA_BUDDY(r);
+	szone->num_tiny_arena_spares++;
+	_malloc_lock_unlock(&szone->tiny_regions_lock);
+	return r;
+}
+
+// Spares must come back out pristine, as a freshly mapped region would be. Mapping fresh zero-fill memory
+// over the half drops its pages without touching them, and the VM zeroes them again only as they are reused.
+static void
+tiny_region_park(szone_t *szone, region_t r)
+{
+	mach_vm_address_t vm_addr = (mach_vm_address_t)(uintptr_t)r;
+	kern_return_t kr;
+
+	kr = mach_vm_map(mach_task_self(), &vm_addr, TINY_REGION_SIZE, 0,
+			VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE | VM_MAKE_TAG(VM_MEMORY_MALLOC_TINY), MEMORY_OBJECT_NULL, 0, FALSE,
+			VM_PROT_DEFAULT, VM_PROT_ALL, VM_INHERIT_DEFAULT);
+	if (kr) {
+		// Could not replace the mapping; fall back to scrubbing the half in place.
+		memset(r, 0, TINY_REGION_SIZE);
+		return;
+	}
+	__sync_fetch_and_add(&szone->huge_page_bytes_released, TINY_REGION_SIZE);
+}
+
+static void
+tiny_region_deallocate(szone_t *szone, region_t r)
+{
+	region_t buddy, *link;
+
+	if (!(szone->debug_flags & SCALABLE_MALLOC_HUGE_PAGES)) {
+		deallocate_pages(szone, r, TINY_REGION_SIZE, 0);
+		return;
+	}
+
+	tiny_region_park(szone, r);
+
+	buddy = TINY_ARENA_BUDDY(r);
+	_malloc_lock_lock(&szone->tiny_regions_lock);
+	for (link = &szone->tiny_arena_spares; *link; link = (region_t *)*link) {
+		if (*link == buddy) {
+			// Both halves are now unused, so the whole arena goes back to the VM.
+			*link = *(region_t *)buddy;
+			szone->num_tiny_arena_spares--;
+			_malloc_lock_unlock(&szone->tiny_regions_lock);
+			deallocate_pages(szone, (void *)trunc_huge_page((uintptr_t)r), HUGE_PAGE_SIZE, 0);
+			__sync_fetch_and_sub(&szone->huge_page_bytes_mapped, HUGE_PAGE_SIZE);
+			return;
+		}
+	}
+	// Buddy still in service; park this half so the arena stays intact for the next region.
+	*(region_t *)r = szone->tiny_arena_spares;
+	szone->tiny_arena_spares = r;
+	szone->num_tiny_arena_spares++;
+	_malloc_lock_unlock(&szone->tiny_regions_lock);
+}
+
+static region_t
+small_region_allocate(szone_t *szone)
+{
+	region_t r = allocate_pages_securely(szone, SMALL_REGION_SIZE, SMALL_BLOCKS_ALIGN, VM_MEMORY_MALLOC_SMALL);
+
+	// Small regions are 8MB aligned, hence already a whole number of huge pages.
+	if (r && (szone->debug_flags & SCALABLE_MALLOC_HUGE_PAGES))
+		madvise_huge_pages(szone, r, SMALL_REGION_SIZE);
+	return r;
+}
+
+static void
+small_region_deallocate(szone_t *szone, region_t r)
+{
+	deallocate_pages(szone, r, SMALL_REGION_SIZE, 0);
+	if (szone->debug_flags & SCALABLE_MALLOC_HUGE_PAGES)
+		__sync_fetch_and_sub(&szone->huge_page_bytes_mapped, SMALL_REGION_SIZE);
+}
+
+/*********************	BACKGROUND SCAVENGER ROUTINES	************************/
+
+// Both of these are called with the Depot lock held.
+static INLINE void
+scavenge_mark_dirty(szone_t *szone, region_trailer_t *node)
+{
+	if (!node->scavenge_dirty) {
+		node->scavenge_dirty = TRUE;
+		OSAtomicIncrement32(&szone->scavenge_dirty_regions);
+	}
+}
+
+static INLINE void
+scavenge_mark_clean(szone_t *szone, region_trailer_t *node)
+{
+	if (node->scavenge_dirty) {
+		node->scavenge_dirty = FALSE;
+		OSAtomicDecrement32(&szone->scavenge_dirty_regions);
+	}
+}
+
+// Bumped in the fork() child; a scavenger_started from an older generation names a thread that is gone.
+static volatile int32_t scavenger_generation = 1;
+
+void
+szone_forked_scavengers(void)
+{
+	scavenger_generation++;
+}
+
+// Waits on scavenger_cond in the given state. SCAVENGER_RUNNING and SCAVENGER_IDLE time out after
+// SCAVENGE_INTERVAL_USEC, SCAVENGER_ASLEEP only returns once woken.
+static void
+szone_scavenger_wait(szone_t *szone, int32_t state)
+{
+	struct timeval now;
+	struct timespec deadline;
+	boolean_t wait;
+
+	pthread_mutex_lock(&szone->scavenger_lock);
+	szone->scavenger_waiting = state;
+	OSMemoryBarrier(); // pairs with szone_scavenger_kick(): publish the state before re-reading the count
+	if (state == SCAVENGER_ASLEEP)
+		wait = szone->scavenge_dirty_regions <= 0;
+	else if (state == SCAVENGER_IDLE)
+		wait = szone->scavenge_dirty_regions < SCAVENGE_DIRTY_HIGH_WATER;
+	else
+		wait = TRUE;
+
+	if (wait && !szone->scavenger_stop) {
+		if (state == SCAVENGER_ASLEEP) {
+			pthread_cond_wait(&szone->scavenger_cond, &szone->scavenger_lock);
+		} else {
+			gettimeofday(&now, NULL);
+			deadline.tv_sec = now.tv_sec + (now.tv_usec + SCAVENGE_INTERVAL_USEC) / 1000000;
+			deadline.tv_nsec = ((now.tv_usec + SCAVENGE_INTERVAL_USEC) % 1000000) * 1000;
+			pthread_cond_timedwait(&szone->scavenger_cond, &szone->scavenger_lock, &deadline);
+		}
+	}
+	szone->scavenger_waiting = SCAVENGER_RUNNING;
+	pthread_mutex_unlock(&szone->scavenger_lock);
+}
+
+static void *
+szone_scavenger_thread(void *arg)
+{
+	szone_t *szone = (szone_t *)arg;
+	boolean_t active = FALSE;
+	unsigned idle = 0;
+
+	while (!szone->scavenger_stop) {
+		int32_t dirty = szone->scavenge_dirty_regions;
+		if (!active) {
+			if (dirty <= 0) {
+				idle = 0;
+				szone_scavenger_wait(szone, SCAVENGER_ASLEEP);
+				continue;
+			}
+			// Hysteresis: a few dirty regions are left alone unless they linger.
+			if (dirty < SCAVENGE_DIRTY_HIGH_WATER && ++idle < SCAVENGE_IDLE_PASSES) {
+				szone_scavenger_wait(szone, SCAVENGER_IDLE);
+				continue;
+			}
+			active = TRUE;
+			idle = 0;
+		}
+
+		// Rate limit: at most SCAVENGE_REGIONS_PER_PASS regions of each kind per interval.
+		(void)tiny_scavenge_depot(szone, SCAVENGE_REGIONS_PER_PASS);
+		(void)small_scavenge_depot(szone, SCAVENGE_REGIONS_PER_PASS);
+		szone->scavenge_passes++;
+
+		if (szone->scavenge_dirty_regions <= SCAVENGE_DIRTY_LOW_WATER)
+			active = FALSE;
+		else
+			szone_scavenger_wait(szone, SCAVENGER_RUNNING);
+	}
+	return NULL;
+}
+
+// Called with no locks held, when a free() leaves a region dirty and this generation has no thread yet.
+static NOINLINE void
+szone_scavenger_start(szone_t *szone)
+{
+	int32_t generation = scavenger_generation;
+	int32_t started = szone->scavenger_started;
+
+	if (started == generation || started == -generation ||
+		!OSAtomicCompareAndSwap32Barrier(started, -generation, &szone->scavenger_started))
+		return;
+
+	// Any earlier thread belonged to the parent of a fork(); its lock and condition are meaningless here.
+	pthread_mutex_init(&szone->scavenger_lock, NULL);
+	pthread_cond_init(&szone->scavenger_cond, NULL);
+	szone->scavenger_waiting = SCAVENGER_RUNNING;
+	szone->scavenger_stop = FALSE;
+
+	if (pthread_create(&szone->scavenger_thread, NULL, szone_scavenger_thread, szone)) {
+		malloc_printf("*** can't start background scavenger, returning memory on the free path\n");
+		szone->scavenge_deferred = FALSE;
+		OSMemoryBarrier();
+		szone->scavenger_started = 0;
+		while (tiny_scavenge_depot(szone, SCAVENGE_REGIONS_PER_PASS))
+			;
+		while (small_scavenge_depot(szone, SCAVENGE_REGIONS_PER_PASS))
+			;
+		return;
+	}
+	OSMemoryBarrier();
+	szone->scavenger_started = generation;
+}
+
+static NOINLINE void
+szone_scavenger_wake(szone_t *szone)
+{
+	pthread_mutex_lock(&szone->scavenger_lock);
+	if (szone->scavenger_waiting != SCAVENGER_RUNNING) {
+		szone->scavenger_waiting = SCAVENGER_RUNNING;
+		pthread_cond_signal(&szone->scavenger_cond);
+	}
+	pthread_mutex_unlock(&szone->scavenger_lock);
+}
+
+// Called with no locks held at the end of the free paths.
+static INLINE void
+szone_scavenger_kick(szone_t *szone)
+{
+	int32_t dirty = szone->scavenge_dirty_regions;
+	int32_t waiting;
+
+	if (dirty <= 0)
+		return;
+	if (szone->scavenger_started != scavenger_generation) {
+		szone_scavenger_start(szone);
+		return;
+	}
+	waiting = szone->scavenger_waiting;
+	if (waiting == SCAVENGER_ASLEEP || (waiting == SCAVENGER_IDLE && dirty >= SCAVENGE_DIRTY_HIGH_WATER))
+		szone_scavenger_wake(szone);
+}
+
 static kern_return_t
 _szone_default_reader(task_t task, vm_address_t address, vm_size_t size, void **ptr)
 {
@@ -1487,6 +1991,84 @@ free_list_unchecksum_ptr(szone_t *szone, ptr_union *ptr)
 #undef ANTI_NYBBLE
 #undef NYBBLE
 
+// With SCALABLE_MALLOC_XOR_FREE_LIST the links are instead stored XORed with the
+// zone cookie and with the page number of the link's own address, which costs
+// two instructions each way.  Mixing in the address means a NULL link doesn't
+// store the cookie itself, and a link copied elsewhere no longer decodes, so a
+// link that moves is decoded and encoded again (free_list_copy_ptr).  A
+// decoded link must still look like a block address: quantum aligned and, on
+// 64-bit, inside the user address space, so corrupting a link without knowing
+// the cookie is caught about as often as with the checksum, and more often on
+// 64-bit.  Every FREE_LIST_VERIFY_INTERVAL pops from a magazine, the links on
+// either side of the popped block are also checked against each other.
+
+#if __LP64__
+#if defined(MACH_VM_MAX_ADDRESS)
+#define FREE_LIST_XOR_MAX_ADDRESS	((uintptr_t)MACH_VM_MAX_ADDRESS - 1)
+#else
+#define FREE_LIST_XOR_MAX_ADDRESS	((uintptr_t)0x00FFFFFFFFFFFFFF) // 57-bit, the widest Linux user space
+#endif
+// every bit above the highest one a user address can have, plus the quantum bits
+#define FREE_LIST_XOR_INVALID_BITS	(~(~(uintptr_t)0 >> __builtin_clzl(FREE_LIST_XOR_MAX_ADDRESS)) | (uintptr_t)0xF)
+#else
+#define FREE_LIST_XOR_INVALID_BITS	((uintptr_t)0xF)
+#endif
+#define FREE_LIST_XOR_SLOT_SHIFT	12
+#define FREE_LIST_VERIFY_INTERVAL	64 // MUST BE A POWER OF 2!
+
+// Returns what to store in *slot to link to ptr
+static INLINE uintptr_t
+free_list_encode_ptr(szone_t *szone, ptr_union *slot, void *ptr)
+{
+	if (szone->debug_flags & SCALABLE_MALLOC_XOR_FREE_LIST)
+		return (uintptr_t)ptr ^ ((uintptr_t)slot >> FREE_LIST_XOR_SLOT_SHIFT) ^ szone->cookie;
+	return free_list_checksum_ptr(szone, ptr);
+}
+
+static INLINE void *
+free_list_decode_ptr(szone_t *szone, ptr_union *ptr)
+{
+	ptr_union p;
+
+	if (!(szone->debug_flags & SCALABLE_MALLOC_XOR_FREE_LIST))
+		return free_list_unchecksum_ptr(szone, ptr);
+	p.u = ptr->u ^ ((uintptr_t)ptr >> FREE_LIST_XOR_SLOT_SHIFT) ^ szone->cookie;
+	if (p.u & FREE_LIST_XOR_INVALID_BITS) {
+		free_list_checksum_botch(szone, (free_list_t *)ptr);
+		return NULL;
+	}
+	return p.p;
+}
+
+// Copies the link in *src to *dst.  A checksummed link doesn't depend on where it
+// is stored, but an XORed one does, so it has to be decoded and encoded again.
+static INLINE void
+free_list_copy_ptr(szone_t *szone, ptr_union *dst, ptr_union *src)
+{
+	if (szone->debug_flags & SCALABLE_MALLOC_XOR_FREE_LIST)
+		dst->u = free_list_encode_ptr(szone, dst, free_list_decode_ptr(szone, src));
+	else
+		*dst = *src;
+}
+
+static NOINLINE void
+free_list_verify_links(szone_t *szone, free_list_t *ptr, free_list_t *next)
+{
+	// ptr is the head of its free list, and next its successor
+	if (free_list_decode_ptr(szone, &ptr->previous) != NULL ||
+		(next && free_list_decode_ptr(szone, &next->previous) != ptr))
+		free_list_checksum_botch(szone, ptr);
+}
+
+static INLINE void
+free_list_sample_verify(szone_t *szone, magazine_t *mag_ptr, free_list_t *ptr, free_list_t *next)
+{
+	if (!(szone->debug_flags & SCALABLE_MALLOC_XOR_FREE_LIST) ||
+		(++mag_ptr->mag_free_list_verify & (FREE_LIST_VERIFY_INTERVAL - 1)))
+		return;
+	free_list_verify_links(szone, ptr, next);
+}
+
 static unsigned
 free_list_count(szone_t *szone, free_list_t *ptr)
 {
@@ -1494,7 +2076,7 @@ free_list_count(szone_t *szone, free_list_t *ptr)
 
 	while (ptr) {
 		count++;
-		ptr = free_list_unchecksum_ptr(szone, &ptr->next);
+		ptr = free_list_decode_ptr(szone, &ptr->next);
 	}
 	return count;
 }
@@ -1916,14 +2498,15 @@ tiny_free_list_add_ptr(szone_t *szone, magazine_t *tiny_mag_ptr, void *ptr, msiz
 
 	set_tiny_meta_header_free(ptr, msize);
 	if (free_head) {
-		free_head->previous.u = free_list_checksum_ptr(szone, free_ptr);
+		free_head->previous.u = free_list_encode_ptr(szone, &free_head->previous, free_ptr);
 	} else {
 		BITMAPV_SET(tiny_mag_ptr->mag_bitmap, slot);
 	}
-	free_ptr->previous.u = free_list_checksum_ptr(szone, NULL);
-	free_ptr->next.u = free_list_checksum_ptr(szone, free_head);
+	free_ptr->previous.u = free_list_encode_ptr(szone, &free_ptr->previous, NULL);
+	free_ptr->next.u = free_list_encode_ptr(szone, &free_ptr->next, free_head);
 
 	tiny_mag_ptr->mag_free_list[slot] = free_ptr;
+	tiny_class_stats(szone, tiny_mag_ptr, slot)->bytes_free += TINY_BYTES_FOR_MSIZE(msize);
 }
 
 /*
@@ -1936,23 +2519,22 @@ tiny_free_list_remove_ptr(szone_t *szone, magazine_t *tiny_mag_ptr, void *ptr, m
 	grain_t	slot = (!msize || (msize >= NUM_TINY_SLOTS)) ? NUM_TINY_SLOTS - 1 : msize - 1;
 	free_list_t	*free_ptr = ptr, *next, *previous;
 
-	next = free_list_unchecksum_ptr(szone, &free_ptr->next);
-	previous = free_list_unchecksum_ptr(szone, &free_ptr->previous);
+	next = free_list_decode_ptr(szone, &free_ptr->next);
+	previous = free_list_decode_ptr(szone, &free_ptr->previous);
 
 
+	tiny_class_stats(szone, tiny_mag_ptr, slot)->bytes_free -= TINY_BYTES_FOR_MSIZE(msize);
 	if (!previous) {
 		// The block to remove is the head of the free list
 		tiny_mag_ptr->mag_free_list[slot] = next;
 		if (!next) BITMAPV_CLR(tiny_mag_ptr->mag_bitmap, slot);
 	} else {
-		// We know free_ptr is already checksummed, so we don't need to do it
-		// again.
-		previous->next = free_ptr->next;
+		// Both links are decoded already, so they are encoded for their new
+		// slots rather than copied, which XORed links wouldn't survive.
+		previous->next.u = free_list_encode_ptr(szone, &previous->next, next);
 	}
 	if (next) {
-		// We know free_ptr is already checksummed, so we don't need to do it
-		// again.
-		next->previous = free_ptr->previous;
+		next->previous.u = free_list_encode_ptr(szone, &next->previous, previous);
 	}
 }
 
@@ -2287,6 +2869,13 @@ tiny_free_do_recirc_to_depot(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index
 	MAGMALLOC_RECIRCREGION((void *)szone, (int)mag_index, (void *)sparse_region, TINY_REGION_SIZE,
 						   (int)BYTES_USED_FOR_TINY_REGION(sparse_region));  // DTrace USDT Probe
 
+	if (szone->scavenge_deferred) {
+		// Leave the madvise and any vm_deallocate() to the scavenger thread
+		scavenge_mark_dirty(szone, node);
+		SZONE_MAGAZINE_PTR_UNLOCK(szone,depot_ptr);
+		return FALSE; // Caller need not unlock the originating magazine
+	}
+
 	// Mark free'd dirty pages with MADV_FREE to reduce memory pressure
 	tiny_free_scan_madvise_free(szone, depot_ptr, sparse_region);
 
@@ -2294,10 +2883,47 @@ tiny_free_do_recirc_to_depot(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index
 	region_t r_dealloc = tiny_free_try_depot_unmap_no_lock(szone, depot_ptr, node);
 	SZONE_MAGAZINE_PTR_UNLOCK(szone,depot_ptr);
 	if (r_dealloc)
-		deallocate_pages(szone, r_dealloc, TINY_REGION_SIZE, 0);
+		tiny_region_deallocate(szone, r_dealloc);
 	return FALSE; // Caller need not unlock the originating magazine
 }
 
+// Madvise, and where possible vm_deallocate(), up to limit Depot'd regions the free path left dirty.
+// Returns the number of regions cleaned.
+static unsigned
+tiny_scavenge_depot(szone_t *szone, unsigned limit)
+{
+	magazine_t *depot_ptr = &(szone->tiny_magazines[DEPOT_MAGAZINE_INDEX]);
+	region_t r_dealloc[SCAVENGE_REGIONS_PER_PASS];
+	unsigned cleaned = 0, n_dealloc = 0, i;
+	region_trailer_t *node, *next;
+
+	if (limit > SCAVENGE_REGIONS_PER_PASS)
+		limit = SCAVENGE_REGIONS_PER_PASS;
+
+	SZONE_MAGAZINE_PTR_LOCK(szone, depot_ptr);
+	for (node = depot_ptr->firstNode; node && cleaned < limit; node = next) {
+		if (!node->scavenge_dirty) {
+			next = node->next;
+			continue;
+		}
+		scavenge_mark_clean(szone, node);
+		cleaned++;
+
+		// Drops and retakes the Depot lock around the madvise's; node stays pinned to the Depot meanwhile
+		tiny_free_scan_madvise_free(szone, depot_ptr, TINY_REGION_FOR_PTR(node));
+
+		next = node->next;
+		region_t r = tiny_free_try_depot_unmap_no_lock(szone, depot_ptr, node);
+		if (r)
+			r_dealloc[n_dealloc++] = r;
+	}
+	SZONE_MAGAZINE_PTR_UNLOCK(szone, depot_ptr);
+
+	for (i = 0; i < n_dealloc; i++)
+		tiny_region_deallocate(szone, r_dealloc[i]);
+	return cleaned;
+}
+
 static region_t
 tiny_find_msize_region(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t mag_index, msize_t msize)
 {
@@ -2391,6 +3017,7 @@ tiny_get_region_from_depot(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t
 	int objects_in_use = tiny_free_detach_region(szone, depot_ptr, sparse_region);
 
 	// Transfer ownership of the region
+	scavenge_mark_clean(szone, node);
 	MAGAZINE_INDEX_FOR_TINY_REGION(sparse_region) = mag_index;
 	node->pinned_to_depot = 0;
 
@@ -2459,26 +3086,27 @@ tiny_free_no_lock(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t mag_inde
 			msize += next_msize;
 
 			big_free_block = (free_list_t *)next_block;
-			after_next_block = free_list_unchecksum_ptr(szone, &big_free_block->next);
-			before_next_block = free_list_unchecksum_ptr(szone, &big_free_block->previous);
+			after_next_block = free_list_decode_ptr(szone, &big_free_block->next);
+			before_next_block = free_list_decode_ptr(szone, &big_free_block->previous);
 
 			if (!before_next_block) {
 				tiny_mag_ptr->mag_free_list[NUM_TINY_SLOTS-1] = ptr;
 			} else {
-				before_next_block->next.u = free_list_checksum_ptr(szone, ptr);
+				before_next_block->next.u = free_list_encode_ptr(szone, &before_next_block->next, ptr);
 			}
 
 			if (after_next_block) {
-				after_next_block->previous.u = free_list_checksum_ptr(szone, ptr);
+				after_next_block->previous.u = free_list_encode_ptr(szone, &after_next_block->previous, ptr);
 			}
 
-			// we don't need to checksum these since they are already checksummed
-			((free_list_t *)ptr)->previous = big_free_block->previous;
-			((free_list_t *)ptr)->next = big_free_block->next;
+			// ptr takes big_free_block's place in the list, so it gets its links
+			((free_list_t *)ptr)->previous.u = free_list_encode_ptr(szone, &((free_list_t *)ptr)->previous, before_next_block);
+			((free_list_t *)ptr)->next.u = free_list_encode_ptr(szone, &((free_list_t *)ptr)->next, after_next_block);
 
 			// clear the meta_header to enable coalescing backwards
 			set_tiny_meta_header_middle(big_free_block);
 			set_tiny_meta_header_free(ptr, msize);
+			tiny_class_stats(szone, tiny_mag_ptr, NUM_TINY_SLOTS - 1)->bytes_free += TINY_BYTES_FOR_MSIZE(msize - next_msize);
 
 			goto tiny_free_ending;
 		}
@@ -2493,6 +3121,7 @@ tiny_free_ending:
 	//5.更新magazine中可用内存块信息
 	tiny_mag_ptr->mag_num_objects--;
 	tiny_mag_ptr->mag_num_bytes_in_objects -= original_size;
+	tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(TINY_MSIZE_FOR_BYTES(original_size)))->num_frees++;
 	region_trailer_t *node = REGION_TRAILER_FOR_TINY_REGION(region);
 	size_t bytes_used = node->bytes_used - original_size;
 	node->bytes_used = bytes_used;
@@ -2523,6 +3152,12 @@ tiny_free_ending:
 		}
 	} else {
 #endif
+		if (szone->scavenge_deferred && DEPOT_MAGAZINE_INDEX == mag_index) {
+			// Freed to Depot. The scavenger thread will madvise, or return the region to the OS, later.
+			scavenge_mark_dirty(szone, node);
+			return TRUE; // Caller must do SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr)
+		}
+
 		// Freed to Depot. N.B. Lock on tiny_magazines[DEPOT_MAGAZINE_INDEX] is already held
 		// Calcuate the first page in the coalesced block that would be safe to mark MADV_FREE
 		size_t free_header_size = sizeof(free_list_t) + sizeof(msize_t);
@@ -2572,7 +3207,7 @@ tiny_free_ending:
 			region_t r_dealloc = tiny_free_try_depot_unmap_no_lock(szone, tiny_mag_ptr, node);
 			SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
 			if (r_dealloc)
-				deallocate_pages(szone, r_dealloc, TINY_REGION_SIZE, 0);
+				tiny_region_deallocate(szone, r_dealloc);
 			return FALSE; // Caller need not unlock
 		}
 	}
@@ -2658,6 +3293,7 @@ tiny_malloc_from_region_no_lock(szone_t *szone, magazine_t *tiny_mag_ptr, mag_in
 	set_tiny_meta_header_in_use(ptr, msize);
 	tiny_mag_ptr->mag_num_objects++;
 	tiny_mag_ptr->mag_num_bytes_in_objects += TINY_BYTES_FOR_MSIZE(msize);
+	tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(msize))->num_allocs++;
 	tiny_mag_ptr->num_bytes_in_magazine += TINY_REGION_PAYLOAD_BYTES;
 
 	// We put a header on the last block so that it appears in use (for coalescing, etc...)
@@ -2695,6 +3331,8 @@ tiny_try_shrink_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new_
 		// Mark q as block header and in-use, thus creating two blocks.
 		set_tiny_meta_header_in_use(q, mshrinkage);
 		tiny_mag_ptr->mag_num_objects++;
+		tiny_class_stats_resize(szone, tiny_mag_ptr, TINY_MSIZE_FOR_BYTES(old_size), new_msize);
+		tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(mshrinkage))->num_allocs++;
 
 		SZONE_MAGAZINE_PTR_UNLOCK(szone,tiny_mag_ptr);
 		szone_free(szone, q); // avoid inlining free_tiny(szone, q, ...);
@@ -2763,6 +3401,7 @@ tiny_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new
 	}
 	set_tiny_meta_header_in_use(ptr, old_msize + coalesced_msize);
 	tiny_mag_ptr->mag_num_bytes_in_objects += TINY_BYTES_FOR_MSIZE(coalesced_msize);
+	tiny_class_stats_resize(szone, tiny_mag_ptr, old_msize, old_msize + coalesced_msize);
 
 	// Update this region's bytes in use count
 	region_trailer_t *node = REGION_TRAILER_FOR_TINY_REGION(TINY_REGION_FOR_PTR(ptr));
@@ -2876,8 +3515,8 @@ tiny_check_region(szone_t *szone, region_t region)
 			 * Check the integrity of this block's entry in its freelist.
 			 */
 			free_head = (free_list_t *)ptr;
-			previous = free_list_unchecksum_ptr(szone, &free_head->previous);
-			next = free_list_unchecksum_ptr(szone, &free_head->next);
+			previous = free_list_decode_ptr(szone, &free_head->previous);
+			next = free_list_decode_ptr(szone, &free_head->next);
 			if (previous && !tiny_meta_header_is_free(previous)) {
 				malloc_printf("*** invariant broken for %p (previous %p is not a free pointer)\n",
 							  ptr, previous);
@@ -3098,14 +3737,16 @@ tiny_malloc_from_free_list(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t
 	//1.找到对应大小slot的空闲链表，如果有内存资源，则返回链表头部节点，把ptr.next作为头部
 	ptr = *the_slot;
 	if (ptr) {
-		next = free_list_unchecksum_ptr(szone, &ptr->next);
+		next = free_list_decode_ptr(szone, &ptr->next);
+		free_list_sample_verify(szone, tiny_mag_ptr, ptr, next);
 		if (next) {
-			next->previous = ptr->previous;
+			free_list_copy_ptr(szone, &next->previous, &ptr->previous);
 		} else {
 			BITMAPV_CLR(tiny_mag_ptr->mag_bitmap, slot);
 		}
 		*the_slot = next;
 		this_msize = msize;
+		tiny_class_stats(szone, tiny_mag_ptr, slot)->bytes_free -= TINY_BYTES_FOR_MSIZE(msize);
 		goto return_tiny_alloc;
 	}
 	//2.通过位操作 分析当前mag_free_list 的使用情况
@@ -3126,14 +3767,16 @@ tiny_malloc_from_free_list(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t
 	if (free_list < limit) {
 		ptr = *free_list;
 		if (ptr) {
-			next = free_list_unchecksum_ptr(szone, &ptr->next);
+			next = free_list_decode_ptr(szone, &ptr->next);
+			free_list_sample_verify(szone, tiny_mag_ptr, ptr, next);
 			*free_list = next;
 			if (next) {
-				next->previous = ptr->previous;
+				free_list_copy_ptr(szone, &next->previous, &ptr->previous);
 			} else {
 				BITMAPV_CLR(tiny_mag_ptr->mag_bitmap, slot);
 			}
 			this_msize = get_tiny_free_size(ptr);
+			tiny_class_stats(szone, tiny_mag_ptr, slot)->bytes_free -= TINY_BYTES_FOR_MSIZE(this_msize);
 			goto add_leftover_and_proceed;
 		}
 	}
@@ -3146,7 +3789,8 @@ tiny_malloc_from_free_list(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t
 	ptr = *limit;
 	if (ptr) {
 		this_msize = get_tiny_free_size(ptr);
-		next = free_list_unchecksum_ptr(szone, &ptr->next);
+		next = free_list_decode_ptr(szone, &ptr->next);
+		free_list_sample_verify(szone, tiny_mag_ptr, ptr, next);
 		if (this_msize - msize >= NUM_TINY_SLOTS) {
 			// the leftover will go back to the free list, so we optimize by
 			// modifying the free list rather than a pop and push of the head
@@ -3154,18 +3798,20 @@ tiny_malloc_from_free_list(szone_t *szone, magazine_t *tiny_mag_ptr, mag_index_t
 			leftover_ptr = (free_list_t *)((unsigned char *)ptr + TINY_BYTES_FOR_MSIZE(msize));
 			*limit = leftover_ptr;
 			if (next) {
-				next->previous.u = free_list_checksum_ptr(szone, leftover_ptr);
+				next->previous.u = free_list_encode_ptr(szone, &next->previous, leftover_ptr);
 			}
-			leftover_ptr->previous = ptr->previous;
-			leftover_ptr->next = ptr->next;
+			free_list_copy_ptr(szone, &leftover_ptr->previous, &ptr->previous);
+			leftover_ptr->next.u = free_list_encode_ptr(szone, &leftover_ptr->next, next);
 			set_tiny_meta_header_free(leftover_ptr, leftover_msize);
 			this_msize = msize;
+			tiny_class_stats(szone, tiny_mag_ptr, NUM_TINY_SLOTS - 1)->bytes_free -= TINY_BYTES_FOR_MSIZE(msize);
 			goto return_tiny_alloc;
 		}
 		if (next) {
-			next->previous = ptr->previous;
+			free_list_copy_ptr(szone, &next->previous, &ptr->previous);
 		}
 		*limit = next;
+		tiny_class_stats(szone, tiny_mag_ptr, NUM_TINY_SLOTS - 1)->bytes_free -= TINY_BYTES_FOR_MSIZE(this_msize);
 		goto add_leftover_and_proceed;
 		/* NOTREACHED */
 	}
@@ -3213,6 +3859,7 @@ return_tiny_alloc:
 	//更新magazine已用内存和可用内存信息
 	tiny_mag_ptr->mag_num_objects++;
 	tiny_mag_ptr->mag_num_bytes_in_objects += TINY_BYTES_FOR_MSIZE(this_msize);
+	tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(this_msize))->num_allocs++;
 
 	// Update this region's bytes in use count
 	region_trailer_t *node = REGION_TRAILER_FOR_TINY_REGION(TINY_REGION_FOR_PTR(ptr));
@@ -3234,6 +3881,48 @@ return_tiny_alloc:
 		set_tiny_meta_header_in_use_1(ptr);
 	return ptr;
 }
+
+// Carves up to count blocks of msize back to back from the unclaimed space at the end of mag_last_region,
+// settling the magazine and region accounting once for the whole run. Returns the number of blocks carved.
+static unsigned
+tiny_malloc_run_from_end_no_lock(szone_t *szone, magazine_t *tiny_mag_ptr, msize_t msize, void **results, unsigned count)
+{
+	size_t		bytes = TINY_BYTES_FOR_MSIZE(msize);
+	unsigned		run = (unsigned)MIN(count, tiny_mag_ptr->mag_bytes_free_at_end / bytes);
+	unsigned char	*ptr;
+	region_trailer_t	*node;
+	unsigned		i;
+
+	// Assumes we've locked the region
+	CHECK_MAGAZINE_PTR_LOCKED(szone, tiny_mag_ptr, __PRETTY_FUNCTION__);
+
+	if (!run)
+		return 0;
+
+	ptr = (unsigned char *)TINY_REGION_END(tiny_mag_ptr->mag_last_region) - tiny_mag_ptr->mag_bytes_free_at_end;
+	for (i = 0; i < run; i++, ptr += bytes) {
+		if (msize > 1)
+			set_tiny_meta_header_in_use(ptr, msize);
+		else
+			set_tiny_meta_header_in_use_1(ptr);
+		results[i] = ptr;
+	}
+
+	tiny_mag_ptr->mag_bytes_free_at_end -= run * bytes;
+	if (tiny_mag_ptr->mag_bytes_free_at_end) {
+		// let's add an in use block after the run to serve as boundary
+		set_tiny_meta_header_in_use_1(ptr);
+	}
+	tiny_mag_ptr->mag_num_objects += run;
+	tiny_mag_ptr->mag_num_bytes_in_objects += run * bytes;
+	tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(msize))->num_allocs += run;
+
+	node = REGION_TRAILER_FOR_TINY_REGION(tiny_mag_ptr->mag_last_region);
+	node->bytes_used += run * bytes;
+	if (node->bytes_used >= DENSITY_THRESHOLD(TINY_REGION_PAYLOAD_BYTES))
+		node->recirc_suitable = FALSE;
+	return run;
+}
 #undef DENSITY_THRESHOLD
 #undef K
 
@@ -3303,7 +3992,7 @@ tiny_malloc_should_clear(szone_t *szone, msize_t msize, boolean_t cleared_reques
 			tiny_mag_ptr->alloc_underway = TRUE;
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
-			fresh_region = allocate_pages_securely(szone, TINY_REGION_SIZE, TINY_BLOCKS_ALIGN, VM_MEMORY_MALLOC_TINY);
+			fresh_region = tiny_region_allocate(szone);
 			SZONE_MAGAZINE_PTR_LOCK(szone, tiny_mag_ptr);
 
 			MAGMALLOC_ALLOCREGION((void *)szone, (int)mag_index, fresh_region, TINY_REGION_SIZE); // DTrace USDT Probe
@@ -3332,10 +4021,64 @@ tiny_malloc_should_clear(szone_t *szone, msize_t msize, boolean_t cleared_reques
 	/* NOTREACHED */
 }
 
-static NOINLINE void
-free_tiny_botch(szone_t *szone, free_list_t *ptr)
+// Fills results with up to count blocks of msize. Unclaimed space at the end of the magazine's last region
+// goes out a whole run at a time; free lists, the Depot and fresh regions (resupplied by the same protocol
+// as tiny_malloc_should_clear()) make up the rest. Returns fewer than count only when out of memory.
+static unsigned
+tiny_batch_malloc(szone_t *szone, msize_t msize, void **results, unsigned count)
 {
-	mag_index_t mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(TINY_REGION_FOR_PTR(ptr));
+	mag_index_t	mag_index = mag_get_thread_index(szone);
+	magazine_t	*tiny_mag_ptr = &(szone->tiny_magazines[mag_index]);
+	unsigned	found = 0;
+	void	*ptr;
+
+	SZONE_MAGAZINE_PTR_LOCK(szone, tiny_mag_ptr);
+	while (found < count) {
+		found += tiny_malloc_run_from_end_no_lock(szone, tiny_mag_ptr, msize, results + found, count - found);
+		if (found == count)
+			break;
+
+		ptr = tiny_malloc_from_free_list(szone, tiny_mag_ptr, mag_index, msize);
+		if (!ptr && tiny_get_region_from_depot(szone, tiny_mag_ptr, mag_index, msize))
+			ptr = tiny_malloc_from_free_list(szone, tiny_mag_ptr, mag_index, msize);
+		if (ptr) {
+			results[found++] = ptr;
+			continue;
+		}
+
+		if (!tiny_mag_ptr->alloc_underway) {
+			void *fresh_region;
+
+			// time to create a new region (do this outside the magazine lock)
+			tiny_mag_ptr->alloc_underway = TRUE;
+			OSMemoryBarrier();
+			SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
+			fresh_region = tiny_region_allocate(szone);
+			SZONE_MAGAZINE_PTR_LOCK(szone, tiny_mag_ptr);
+
+			MAGMALLOC_ALLOCREGION((void *)szone, (int)mag_index, fresh_region, TINY_REGION_SIZE); // DTrace USDT Probe
+
+			if (fresh_region)
+				results[found++] = tiny_malloc_from_region_no_lock(szone, tiny_mag_ptr, mag_index, msize, fresh_region);
+			tiny_mag_ptr->alloc_underway = FALSE;
+			OSMemoryBarrier();
+			if (!fresh_region) // out of memory!
+				break;
+		} else {
+			SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
+			yield();
+			SZONE_MAGAZINE_PTR_LOCK(szone, tiny_mag_ptr);
+		}
+	}
+	SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
+	CHECK(szone, __PRETTY_FUNCTION__);
+	return found;
+}
+
+static NOINLINE void
+free_tiny_botch(szone_t *szone, free_list_t *ptr)
+{
+	mag_index_t mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(TINY_REGION_FOR_PTR(ptr));
 	magazine_t	*tiny_mag_ptr = &(szone->tiny_magazines[mag_index]);
 	SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
 	szone_error(szone, 1, "double free", ptr, NULL);
@@ -3411,6 +4154,8 @@ free_tiny(szone_t *szone, void *ptr, region_t tiny_region, size_t known_size)
 	if (tiny_free_no_lock(szone, tiny_mag_ptr, mag_index, tiny_region, ptr, msize))
 		SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
 
+	szone_scavenger_kick(szone);
+
 	CHECK(szone, __PRETTY_FUNCTION__);
 }
 
@@ -3551,13 +4296,13 @@ tiny_free_list_check(szone_t *szone, grain_t slot)
 				SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
 				return 0;
 			}
-			if (free_list_unchecksum_ptr(szone, &ptr->previous) != previous) {
+			if (free_list_decode_ptr(szone, &ptr->previous) != previous) {
 				malloc_printf("*** previous incorrectly set slot=%d  count=%d ptr=%p\n", slot, count, ptr);
 				SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
 				return 0;
 			}
 			previous = ptr;
-			ptr = free_list_unchecksum_ptr(szone, &ptr->next);
+			ptr = free_list_decode_ptr(szone, &ptr->next);
 			count++;
 		}
 
@@ -3614,14 +4359,15 @@ small_free_list_add_ptr(szone_t *szone, magazine_t *small_mag_ptr, void *ptr, ms
 	small_meta_header_set_is_free(SMALL_META_HEADER_FOR_PTR(ptr), SMALL_META_INDEX_FOR_PTR(ptr), msize);
 
 	if (free_head) {
-		free_head->previous.u = free_list_checksum_ptr(szone, free_ptr);
+		free_head->previous.u = free_list_encode_ptr(szone, &free_head->previous, free_ptr);
 	} else {
 		BITMAPN_SET(small_mag_ptr->mag_bitmap, slot);
 	}
-	free_ptr->previous.u = free_list_checksum_ptr(szone, NULL);
-	free_ptr->next.u = free_list_checksum_ptr(szone, free_head);
+	free_ptr->previous.u = free_list_encode_ptr(szone, &free_ptr->previous, NULL);
+	free_ptr->next.u = free_list_encode_ptr(szone, &free_ptr->next, free_head);
 
 	small_mag_ptr->mag_free_list[slot] = free_ptr;
+	small_class_stats(szone, small_mag_ptr, slot)->bytes_free += SMALL_BYTES_FOR_MSIZE(msize);
 
 	// Store msize at the end of the block denoted by "ptr" (i.e. at a negative offset from "follower")
 	follower = (void *)((uintptr_t)ptr + SMALL_BYTES_FOR_MSIZE(msize));
@@ -3638,22 +4384,21 @@ small_free_list_remove_ptr(szone_t *szone, magazine_t *small_mag_ptr, void *ptr,
 	grain_t	slot = (msize <= szone->num_small_slots) ? msize - 1 : szone->num_small_slots - 1;
 	free_list_t	*free_ptr = ptr, *next, *previous;
 
-	next = free_list_unchecksum_ptr(szone, &free_ptr->next);
-	previous = free_list_unchecksum_ptr(szone, &free_ptr->previous);
+	next = free_list_decode_ptr(szone, &free_ptr->next);
+	previous = free_list_decode_ptr(szone, &free_ptr->previous);
 
+	small_class_stats(szone, small_mag_ptr, slot)->bytes_free -= SMALL_BYTES_FOR_MSIZE(msize);
 	if (!previous) {
 		// The block to remove is the head of the free list
 		small_mag_ptr->mag_free_list[slot] = next;
 		if (!next) BITMAPN_CLR(small_mag_ptr->mag_bitmap, slot);
 	} else {
-		// We know free_ptr is already checksummed, so we don't need to do it
-		// again.
-		previous->next = free_ptr->next;
+		// Both links are decoded already, so they are encoded for their new
+		// slots rather than copied, which XORed links wouldn't survive.
+		previous->next.u = free_list_encode_ptr(szone, &previous->next, next);
 	}
 	if (next) {
-		// We know free_ptr is already checksummed, so we don't need to do it
-		// again.
-		next->previous = free_ptr->previous;
+		next->previous.u = free_list_encode_ptr(szone, &next->previous, previous);
 	}
 }
 
@@ -3956,6 +4701,13 @@ small_free_do_recirc_to_depot(szone_t *szone, magazine_t *small_mag_ptr, mag_ind
 	MAGMALLOC_RECIRCREGION((void *)szone, (int)mag_index, (void *)sparse_region, SMALL_REGION_SIZE,
 						   (int)BYTES_USED_FOR_SMALL_REGION(sparse_region)); // DTrace USDT Probe
 
+	if (szone->scavenge_deferred) {
+		// Leave the madvise and any vm_deallocate() to the scavenger thread
+		scavenge_mark_dirty(szone, node);
+		SZONE_MAGAZINE_PTR_UNLOCK(szone,depot_ptr);
+		return FALSE; // Caller need not unlock the originating magazine
+	}
+
 	// Mark free'd dirty pages with MADV_FREE to reduce memory pressure
 	small_free_scan_madvise_free(szone, depot_ptr, sparse_region);
 
@@ -3963,10 +4715,47 @@ small_free_do_recirc_to_depot(szone_t *szone, magazine_t *small_mag_ptr, mag_ind
 	region_t r_dealloc = small_free_try_depot_unmap_no_lock(szone, depot_ptr, node);
 	SZONE_MAGAZINE_PTR_UNLOCK(szone,depot_ptr);
 	if (r_dealloc)
-		deallocate_pages(szone, r_dealloc, SMALL_REGION_SIZE, 0);
+		small_region_deallocate(szone, r_dealloc);
 	return FALSE; // Caller need not unlock the originating magazine
 }
 
+// Madvise, and where possible vm_deallocate(), up to limit Depot'd regions the free path left dirty.
+// Returns the number of regions cleaned.
+static unsigned
+small_scavenge_depot(szone_t *szone, unsigned limit)
+{
+	magazine_t *depot_ptr = &(szone->small_magazines[DEPOT_MAGAZINE_INDEX]);
+	region_t r_dealloc[SCAVENGE_REGIONS_PER_PASS];
+	unsigned cleaned = 0, n_dealloc = 0, i;
+	region_trailer_t *node, *next;
+
+	if (limit > SCAVENGE_REGIONS_PER_PASS)
+		limit = SCAVENGE_REGIONS_PER_PASS;
+
+	SZONE_MAGAZINE_PTR_LOCK(szone, depot_ptr);
+	for (node = depot_ptr->firstNode; node && cleaned < limit; node = next) {
+		if (!node->scavenge_dirty) {
+			next = node->next;
+			continue;
+		}
+		scavenge_mark_clean(szone, node);
+		cleaned++;
+
+		// Drops and retakes the Depot lock around the madvise's; node stays pinned to the Depot meanwhile
+		small_free_scan_madvise_free(szone, depot_ptr, SMALL_REGION_FOR_PTR(node));
+
+		next = node->next;
+		region_t r = small_free_try_depot_unmap_no_lock(szone, depot_ptr, node);
+		if (r)
+			r_dealloc[n_dealloc++] = r;
+	}
+	SZONE_MAGAZINE_PTR_UNLOCK(szone, depot_ptr);
+
+	for (i = 0; i < n_dealloc; i++)
+		small_region_deallocate(szone, r_dealloc[i]);
+	return cleaned;
+}
+
 static region_t
 small_find_msize_region(szone_t *szone, magazine_t *small_mag_ptr, mag_index_t mag_index, msize_t msize)
 {
@@ -4071,6 +4860,7 @@ small_get_region_from_depot(szone_t *szone, magazine_t *small_mag_ptr, mag_index
 	int objects_in_use = small_free_detach_region(szone, depot_ptr, sparse_region);
 
 	// Transfer ownership of the region
+	scavenge_mark_clean(szone, node);
 	MAGAZINE_INDEX_FOR_SMALL_REGION(sparse_region) = mag_index;
 	node->pinned_to_depot = 0;
 
@@ -4147,6 +4937,7 @@ small_free_no_lock(szone_t *szone, magazine_t *small_mag_ptr, mag_index_t mag_in
 	small_mag_ptr->mag_num_objects--;
 	// we use original_size and not msize to avoid double counting the coalesced blocks
 	small_mag_ptr->mag_num_bytes_in_objects -= original_size;
+	small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, SMALL_MSIZE_FOR_BYTES(original_size)))->num_frees++;
 
 	// Update this region's bytes in use count
 	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(region);
@@ -4181,6 +4972,12 @@ small_free_no_lock(szone_t *szone, magazine_t *small_mag_ptr, mag_index_t mag_in
 
 	} else {
 #endif
+		if (szone->scavenge_deferred && DEPOT_MAGAZINE_INDEX == mag_index) {
+			// Freed to Depot. The scavenger thread will madvise, or return the region to the OS, later.
+			scavenge_mark_dirty(szone, node);
+			return TRUE; // Caller must do SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr)
+		}
+
 		// Freed to Depot. N.B. Lock on small_magazines[DEPOT_MAGAZINE_INDEX] is already held
 		// Calcuate the first page in the coalesced block that would be safe to mark MADV_FREE
 		size_t free_header_size = sizeof(free_list_t) + sizeof(msize_t);
@@ -4228,7 +5025,7 @@ small_free_no_lock(szone_t *szone, magazine_t *small_mag_ptr, mag_index_t mag_in
 			region_t r_dealloc = small_free_try_depot_unmap_no_lock(szone, small_mag_ptr, node);
 			SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
 			if (r_dealloc)
-				deallocate_pages(szone, r_dealloc, SMALL_REGION_SIZE, 0);
+				small_region_deallocate(szone, r_dealloc);
 			return FALSE; // Caller need not unlock
 		}
 	}
@@ -4308,6 +5105,7 @@ small_malloc_from_region_no_lock(szone_t *szone, magazine_t *small_mag_ptr, mag_
 	small_mag_ptr->mag_num_objects++;
 	small_mag_ptr->mag_num_bytes_in_objects += SMALL_BYTES_FOR_MSIZE(msize);
 	small_mag_ptr->num_bytes_in_magazine += SMALL_REGION_PAYLOAD_BYTES;
+	small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, msize))->num_allocs++;
 
 	// add a big free block at the end
 	small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(ptr), offset_msize + msize, NUM_SMALL_BLOCKS - msize - offset_msize);
@@ -4345,6 +5143,8 @@ small_try_shrink_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new
 		small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(ptr), SMALL_META_INDEX_FOR_PTR(ptr), new_msize);
 		small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(q), SMALL_META_INDEX_FOR_PTR(q), mshrinkage);
 		small_mag_ptr->mag_num_objects++;
+		small_class_stats_resize(szone, small_mag_ptr, SMALL_MSIZE_FOR_BYTES(old_size), new_msize);
+		small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, mshrinkage))->num_allocs++;
 
 		SZONE_MAGAZINE_PTR_UNLOCK(szone,small_mag_ptr);
 		szone_free(szone, q); // avoid inlining free_small(szone, q, ...);
@@ -4416,6 +5216,7 @@ small_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t ne
 	}
 	small_meta_header_set_in_use(meta_headers, index, new_msize);
 	small_mag_ptr->mag_num_bytes_in_objects += SMALL_BYTES_FOR_MSIZE(new_msize - old_msize);
+	small_class_stats_resize(szone, small_mag_ptr, old_msize, new_msize);
 
 	// Update this region's bytes in use count
 	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
@@ -4496,8 +5297,8 @@ small_check_region(szone_t *szone, region_t region)
 				return 0;
 			}
 #endif
-			previous = free_list_unchecksum_ptr(szone, &free_head->previous);
-			next = free_list_unchecksum_ptr(szone, &free_head->next);
+			previous = free_list_decode_ptr(szone, &free_head->previous);
+			next = free_list_decode_ptr(szone, &free_head->next);
 			if (previous && !SMALL_PTR_IS_FREE(previous)) {
 				malloc_printf("*** invariant broken for %p (previous %p is not a free pointer)\n",
 							  ptr, free_head->previous);
@@ -4660,14 +5461,16 @@ small_malloc_from_free_list(szone_t *szone, magazine_t *small_mag_ptr, mag_index
 	//
 	ptr = *the_slot;
 	if (ptr) {
-		next = free_list_unchecksum_ptr(szone, &ptr->next);
+		next = free_list_decode_ptr(szone, &ptr->next);
+		free_list_sample_verify(szone, small_mag_ptr, ptr, next);
 		if (next) {
-			next->previous = ptr->previous;
+			free_list_copy_ptr(szone, &next->previous, &ptr->previous);
 		} else {
 			BITMAPN_CLR(small_mag_ptr->mag_bitmap, slot);
 		}
 		*the_slot = next;
 		this_msize = msize;
+		small_class_stats(szone, small_mag_ptr, slot)->bytes_free -= SMALL_BYTES_FOR_MSIZE(msize);
 		goto return_small_alloc;
 	}
 
@@ -4707,14 +5510,16 @@ small_malloc_from_free_list(szone_t *szone, magazine_t *small_mag_ptr, mag_index
 		ptr = *free_list;
 		if (ptr) {
 
-			next = free_list_unchecksum_ptr(szone, &ptr->next);
+			next = free_list_decode_ptr(szone, &ptr->next);
+			free_list_sample_verify(szone, small_mag_ptr, ptr, next);
 			*free_list = next;
 			if (next) {
-				next->previous = ptr->previous;
+				free_list_copy_ptr(szone, &next->previous, &ptr->previous);
 			} else {
 				BITMAPN_CLR(small_mag_ptr->mag_bitmap, slot);
 			}
 			this_msize = SMALL_PTR_SIZE(ptr);
+			small_class_stats(szone, small_mag_ptr, slot)->bytes_free -= SMALL_BYTES_FOR_MSIZE(this_msize);
 			goto add_leftover_and_proceed;
 		}
 	}
@@ -4727,7 +5532,8 @@ small_malloc_from_free_list(szone_t *szone, magazine_t *small_mag_ptr, mag_index
 	ptr = *limit;
 	if (ptr) {
 		this_msize = SMALL_PTR_SIZE(ptr);
-		next = free_list_unchecksum_ptr(szone, &ptr->next);
+		next = free_list_decode_ptr(szone, &ptr->next);
+		free_list_sample_verify(szone, small_mag_ptr, ptr, next);
 		if (this_msize - msize >= szone->num_small_slots) {
 			// the leftover will go back to the free list, so we optimize by
 			// modifying the free list rather than a pop and push of the head
@@ -4735,21 +5541,23 @@ small_malloc_from_free_list(szone_t *szone, magazine_t *small_mag_ptr, mag_index
 			leftover_ptr = (free_list_t *)((unsigned char *)ptr + SMALL_BYTES_FOR_MSIZE(msize));
 			*limit = leftover_ptr;
 			if (next) {
-				next->previous.u = free_list_checksum_ptr(szone, leftover_ptr);
+				next->previous.u = free_list_encode_ptr(szone, &next->previous, leftover_ptr);
 			}
-			leftover_ptr->previous = ptr->previous;
-			leftover_ptr->next = ptr->next;
+			free_list_copy_ptr(szone, &leftover_ptr->previous, &ptr->previous);
+			leftover_ptr->next.u = free_list_encode_ptr(szone, &leftover_ptr->next, next);
 			small_meta_header_set_is_free(SMALL_META_HEADER_FOR_PTR(leftover_ptr),
 										  SMALL_META_INDEX_FOR_PTR(leftover_ptr), leftover_msize);
 			// Store msize at the end of the block denoted by "leftover_ptr" (i.e. at a negative offset from follower)
 			SMALL_PREVIOUS_MSIZE(FOLLOWING_SMALL_PTR(leftover_ptr, leftover_msize)) = leftover_msize; // Access is safe
 			this_msize = msize;
+			small_class_stats(szone, small_mag_ptr, szone->num_small_slots - 1)->bytes_free -= SMALL_BYTES_FOR_MSIZE(msize);
 			goto return_small_alloc;
 		}
 		if (next) {
-			next->previous = ptr->previous;
+			free_list_copy_ptr(szone, &next->previous, &ptr->previous);
 		}
 		*limit = next;
+		small_class_stats(szone, small_mag_ptr, szone->num_small_slots - 1)->bytes_free -= SMALL_BYTES_FOR_MSIZE(this_msize);
 		goto add_leftover_and_proceed;
 	}
 
@@ -4795,6 +5603,7 @@ add_leftover_and_proceed:
 return_small_alloc:
 	small_mag_ptr->mag_num_objects++;
 	small_mag_ptr->mag_num_bytes_in_objects += SMALL_BYTES_FOR_MSIZE(this_msize);
+	small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, this_msize))->num_allocs++;
 
 	// Update this region's bytes in use count
 	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
@@ -4813,6 +5622,48 @@ return_small_alloc:
 	small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(ptr), SMALL_META_INDEX_FOR_PTR(ptr), this_msize);
 	return ptr;
 }
+
+// Carves up to count blocks of msize back to back from the unclaimed space at the end of mag_last_region,
+// settling the magazine and region accounting once for the whole run. Returns the number of blocks carved.
+static unsigned
+small_malloc_run_from_end_no_lock(szone_t *szone, magazine_t *small_mag_ptr, msize_t msize, void **results, unsigned count)
+{
+	size_t		bytes = SMALL_BYTES_FOR_MSIZE(msize);
+	unsigned		run = (unsigned)MIN(count, small_mag_ptr->mag_bytes_free_at_end / bytes);
+	unsigned char	*ptr;
+	msize_t		*meta_headers;
+	region_trailer_t	*node;
+	unsigned		i;
+
+	// Assumes we've locked the region
+	CHECK_MAGAZINE_PTR_LOCKED(szone, small_mag_ptr, __PRETTY_FUNCTION__);
+
+	if (!run)
+		return 0;
+
+	ptr = (unsigned char *)SMALL_REGION_END(small_mag_ptr->mag_last_region) - small_mag_ptr->mag_bytes_free_at_end;
+	meta_headers = SMALL_META_HEADER_FOR_PTR(ptr);
+	for (i = 0; i < run; i++, ptr += bytes) {
+		small_meta_header_set_in_use(meta_headers, SMALL_META_INDEX_FOR_PTR(ptr), msize);
+		results[i] = ptr;
+	}
+
+	small_mag_ptr->mag_bytes_free_at_end -= run * bytes;
+	if (small_mag_ptr->mag_bytes_free_at_end) {
+		// let's mark the remainder as in use to serve as boundary
+		small_meta_header_set_in_use(meta_headers, SMALL_META_INDEX_FOR_PTR(ptr),
+									 SMALL_MSIZE_FOR_BYTES(small_mag_ptr->mag_bytes_free_at_end));
+	}
+	small_mag_ptr->mag_num_objects += run;
+	small_mag_ptr->mag_num_bytes_in_objects += run * bytes;
+	small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, msize))->num_allocs += run;
+
+	node = REGION_TRAILER_FOR_SMALL_REGION(small_mag_ptr->mag_last_region);
+	node->bytes_used += run * bytes;
+	if (node->bytes_used >= DENSITY_THRESHOLD(SMALL_REGION_PAYLOAD_BYTES))
+		node->recirc_suitable = FALSE;
+	return run;
+}
 #undef DENSITY_THRESHOLD
 #undef K
 
@@ -4878,7 +5729,7 @@ small_malloc_should_clear(szone_t *szone, msize_t msize, boolean_t cleared_reque
 			small_mag_ptr->alloc_underway = TRUE;
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
-			fresh_region = allocate_pages_securely(szone, SMALL_REGION_SIZE, SMALL_BLOCKS_ALIGN, VM_MEMORY_MALLOC_SMALL);  //8M
+			fresh_region = small_region_allocate(szone);  //8M
 			SZONE_MAGAZINE_PTR_LOCK(szone, small_mag_ptr);
 
 			MAGMALLOC_ALLOCREGION((void *)szone, (int)mag_index, fresh_region, SMALL_REGION_SIZE); // DTrace USDT Probe
@@ -4907,6 +5758,60 @@ small_malloc_should_clear(szone_t *szone, msize_t msize, boolean_t cleared_reque
 	/* NOTREACHED */
 }
 
+// Fills results with up to count blocks of msize. Unclaimed space at the end of the magazine's last region
+// goes out a whole run at a time; free lists, the Depot and fresh regions (resupplied by the same protocol
+// as small_malloc_should_clear()) make up the rest. Returns fewer than count only when out of memory.
+static unsigned
+small_batch_malloc(szone_t *szone, msize_t msize, void **results, unsigned count)
+{
+	mag_index_t	mag_index = mag_get_thread_index(szone);
+	magazine_t	*small_mag_ptr = &(szone->small_magazines[mag_index]);
+	unsigned	found = 0;
+	void	*ptr;
+
+	SZONE_MAGAZINE_PTR_LOCK(szone, small_mag_ptr);
+	while (found < count) {
+		found += small_malloc_run_from_end_no_lock(szone, small_mag_ptr, msize, results + found, count - found);
+		if (found == count)
+			break;
+
+		ptr = small_malloc_from_free_list(szone, small_mag_ptr, mag_index, msize);
+		if (!ptr && small_get_region_from_depot(szone, small_mag_ptr, mag_index, msize))
+			ptr = small_malloc_from_free_list(szone, small_mag_ptr, mag_index, msize);
+		if (ptr) {
+			results[found++] = ptr;
+			continue;
+		}
+
+		if (!small_mag_ptr->alloc_underway) {
+			void *fresh_region;
+
+			// time to create a new region (do this outside the magazine lock)
+			small_mag_ptr->alloc_underway = TRUE;
+			OSMemoryBarrier();
+			SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
+			fresh_region = small_region_allocate(szone);
+			SZONE_MAGAZINE_PTR_LOCK(szone, small_mag_ptr);
+
+			MAGMALLOC_ALLOCREGION((void *)szone, (int)mag_index, fresh_region, SMALL_REGION_SIZE); // DTrace USDT Probe
+
+			if (fresh_region)
+				results[found++] = small_malloc_from_region_no_lock(szone, small_mag_ptr, mag_index, msize, fresh_region);
+			small_mag_ptr->alloc_underway = FALSE;
+			OSMemoryBarrier();
+			if (!fresh_region) // out of memory!
+				break;
+		} else {
+			SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
+			yield();
+			SZONE_MAGAZINE_PTR_LOCK(szone, small_mag_ptr);
+		}
+	}
+	SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
+	CHECK(szone, __PRETTY_FUNCTION__);
+	return found;
+}
+
 static NOINLINE void
 free_small_botch(szone_t *szone, free_list_t *ptr)
 {
@@ -4986,6 +5891,8 @@ free_small(szone_t *szone, void *ptr, region_t small_region, size_t known_size)
 	if (small_free_no_lock(szone, small_mag_ptr, mag_index, small_region, ptr, msize))
 		SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
 
+	szone_scavenger_kick(szone);
+
 	CHECK(szone, __PRETTY_FUNCTION__);
 }
 
@@ -5115,13 +6022,13 @@ small_free_list_check(szone_t *szone, grain_t slot)
 				SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
 				return 0;
 			}
-			if (free_list_unchecksum_ptr(szone, &ptr->previous) != previous) {
+			if (free_list_decode_ptr(szone, &ptr->previous) != previous) {
 				malloc_printf("*** previous incorrectly set slot=%d  count=%d ptr=%p\n", slot, count, ptr);
 				SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
 				return 0;
 			}
 			previous = ptr;
-			ptr = free_list_unchecksum_ptr(szone, &ptr->next);
+			ptr = free_list_decode_ptr(szone, &ptr->next);
 			count++;
 		}
 
@@ -5140,14 +6047,18 @@ small_free_list_check(szone_t *szone, grain_t slot)
 static void
 large_debug_print(szone_t *szone)
 {
-	unsigned		index;
+	unsigned		shard_index, index;
 	large_entry_t	*range;
 	_SIMPLE_STRING	b = _simple_salloc();
 
 	if (b) {
-		for (index = 0, range = szone->large_entries; index < szone->num_large_entries; index++, range++)
-			if (range->address)
-				_simple_sprintf(b, "%d: %p(%y);  ", index, range->address, range->size);
+		for (shard_index = 0; shard_index < LARGE_ENTRY_SHARDS; shard_index++) {
+			large_shard_t *shard = &szone->large_shards[shard_index];
+
+			for (index = 0, range = shard->large_entries; index < shard->num_large_entries; index++, range++)
+				if (range->address)
+					_simple_sprintf(b, "%d.%d: %p(%y);  ", shard_index, index, range->address, range->size);
+		}
 
 		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "%s\n", _simple_string(b));
 		_simple_sfree(b);
@@ -5156,13 +6067,13 @@ large_debug_print(szone_t *szone)
 #endif
 
 /*
- * Scan the hash ring looking for an entry for the given pointer.
+ * Scan the shard's hash ring looking for an entry for the given pointer.
  */
 static large_entry_t *
-large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr)
+large_entry_for_pointer_no_lock(large_shard_t *shard, const void *ptr)
 {
-	// result only valid with lock held
-	unsigned		num_large_entries = szone->num_large_entries;
+	// result only valid with the shard lock held
+	unsigned		num_large_entries = shard->num_large_entries;
 	unsigned		hash_index;
 	unsigned		index;
 	large_entry_t	*range;
@@ -5174,7 +6085,7 @@ large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr)
 	index = hash_index;
 
 	do {
-		range = szone->large_entries + index;
+		range = shard->large_entries + index;
 		if (range->address == (vm_address_t)ptr)
 			return range;
 		if (0 == range->address)
@@ -5188,17 +6099,17 @@ large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr)
 }
 
 static void
-large_entry_insert_no_lock(szone_t *szone, large_entry_t range)
+large_entry_insert_no_lock(large_shard_t *shard, large_entry_t range)
 {
-	unsigned		num_large_entries = szone->num_large_entries;
+	unsigned		num_large_entries = shard->num_large_entries;
 	unsigned		hash_index = (((uintptr_t)(range.address)) >> vm_page_quanta_shift) % num_large_entries;
 	unsigned		index = hash_index;
 	large_entry_t	*entry;
 
-	// assert(szone->num_large_objects_in_use < szone->num_large_entries); /* must be called with room to spare */
+	// assert(shard->num_large_objects < shard->num_large_entries); /* must be called with room to spare */
 
 	do {
-		entry = szone->large_entries + index;
+		entry = shard->large_entries + index;
 		if (0 == entry->address) {
 			*entry = range;
 			return; // end of chain
@@ -5213,10 +6124,10 @@ large_entry_insert_no_lock(szone_t *szone, large_entry_t range)
 
 // FIXME: can't we simply swap the (now empty) entry with the last entry on the collision chain for this hash slot?
 static INLINE void
-large_entries_rehash_after_entry_no_lock(szone_t *szone, large_entry_t *entry)
+large_entries_rehash_after_entry_no_lock(large_shard_t *shard, large_entry_t *entry)
 {
-	unsigned		num_large_entries = szone->num_large_entries;
-	unsigned		hash_index = entry - szone->large_entries;
+	unsigned		num_large_entries = shard->num_large_entries;
+	unsigned		hash_index = entry - shard->large_entries;
 	unsigned		index = hash_index;
 	large_entry_t	range;
 
@@ -5226,13 +6137,13 @@ large_entries_rehash_after_entry_no_lock(szone_t *szone, large_entry_t *entry)
 		index++;
 		if (index == num_large_entries)
 			index = 0;
-		range = szone->large_entries[index];
+		range = shard->large_entries[index];
 		if (0 == range.address)
 			return;
-		szone->large_entries[index].address = (vm_address_t)0;
-		szone->large_entries[index].size = 0;
-		szone->large_entries[index].did_madvise_reusable = FALSE;
-		large_entry_insert_no_lock(szone, range); // this will reinsert in the
+		shard->large_entries[index].address = (vm_address_t)0;
+		shard->large_entries[index].size = 0;
+		shard->large_entries[index].did_madvise_reusable = FALSE;
+		large_entry_insert_no_lock(shard, range); // this will reinsert in the
 		// proper place
 	} while (index != hash_index);
 
@@ -5262,11 +6173,11 @@ large_entries_free_no_lock(szone_t *szone, large_entry_t *entries, unsigned num,
 }
 
 static large_entry_t *
-large_entries_grow_no_lock(szone_t *szone, vm_range_t *range_to_deallocate)
+large_entries_grow_no_lock(szone_t *szone, large_shard_t *shard, vm_range_t *range_to_deallocate)
 {
 	// sets range_to_deallocate
-	unsigned		old_num_entries = szone->num_large_entries;
-	large_entry_t	*old_entries = szone->large_entries;
+	unsigned		old_num_entries = shard->num_large_entries;
+	large_entry_t	*old_entries = shard->large_entries;
 	// always an odd number for good hashing
 	unsigned		new_num_entries = (old_num_entries) ? old_num_entries * 2 + 1 :
 	((vm_page_quanta_size / sizeof(large_entry_t)) - 1);  //4096/24 - 1 = 169
@@ -5278,14 +6189,14 @@ large_entries_grow_no_lock(szone_t *szone, vm_range_t *range_to_deallocate)
 	if (new_entries == NULL)
 		return NULL;
 
-	szone->num_large_entries = new_num_entries;
-	szone->large_entries = new_entries;
+	shard->num_large_entries = new_num_entries;
+	shard->large_entries = new_entries;
 
 	/* rehash entries into the new list */
 	while (index--) {
 		oldRange = old_entries[index];
 		if (oldRange.address) {
-			large_entry_insert_no_lock(szone, oldRange);
+			large_entry_insert_no_lock(shard, oldRange);
 		}
 	}
 
@@ -5299,16 +6210,62 @@ large_entries_grow_no_lock(szone_t *szone, vm_range_t *range_to_deallocate)
 	return new_entries;
 }
 
+// Enters a block just handed out into its shard of the large_entries hash, growing the shard as needed.
+// Takes the shard lock, so the caller must hold no shard lock (SZONE_LOCK is fine).
+static boolean_t
+large_entry_add(szone_t *szone, vm_address_t addr, size_t size)
+{
+	large_shard_t	*shard = LARGE_SHARD_FOR_PTR(szone, (void *)addr);
+	vm_range_t		range_to_deallocate;
+	large_entry_t	large_entry;
+
+	range_to_deallocate.address = 0;
+	range_to_deallocate.size = 0;
+
+	LARGE_SHARD_LOCK(shard);
+	if ((shard->num_large_objects + 1) * 4 > shard->num_large_entries) {
+		// density of hash table too high; grow table
+		// we do that under lock to avoid a race
+		large_entry_t *entries = large_entries_grow_no_lock(szone, shard, &range_to_deallocate);
+		if (entries == NULL) {
+			LARGE_SHARD_UNLOCK(shard);
+			return FALSE;
+		}
+	}
+
+	large_entry.address = addr;
+	large_entry.size = size;
+	large_entry.did_madvise_reusable = FALSE;
+	large_entry_insert_no_lock(shard, large_entry);
+	shard->num_large_objects++;
+	shard->num_large_allocs++;
+	LARGE_SHARD_UNLOCK(shard);
+
+	__sync_fetch_and_add(&szone->num_large_objects_in_use, 1);
+	__sync_fetch_and_add(&szone->num_bytes_in_large_objects, size);
+
+	if (range_to_deallocate.size) {
+		// we deallocate outside the lock
+		deallocate_pages(szone, (void *)range_to_deallocate.address, range_to_deallocate.size, 0);
+	}
+	return TRUE;
+}
+
 // frees the specific entry in the size table
 // returns a range to truly deallocate
 static vm_range_t
-large_entry_free_no_lock(szone_t *szone, large_entry_t *entry)
+large_entry_free_no_lock(szone_t *szone, large_shard_t *shard, large_entry_t *entry)
 {
 	vm_range_t		range;
 
 	range.address = entry->address;
 	range.size = entry->size;
 
+	shard->num_large_objects--;
+	shard->num_large_frees++;
+	__sync_fetch_and_sub(&szone->num_large_objects_in_use, 1);
+	__sync_fetch_and_sub(&szone->num_bytes_in_large_objects, entry->size);
+
 	if (szone->debug_flags & SCALABLE_MALLOC_ADD_GUARD_PAGES) {
 		protect((void *)range.address, range.size, PROT_READ | PROT_WRITE, szone->debug_flags);
 		range.address -= vm_page_quanta_size;
@@ -5318,7 +6275,7 @@ large_entry_free_no_lock(szone_t *szone, large_entry_t *entry)
 	entry->address = 0;
 	entry->size = 0;
 	entry->did_madvise_reusable = FALSE;
-	large_entries_rehash_after_entry_no_lock(szone, entry);
+	large_entries_rehash_after_entry_no_lock(shard, entry);
 	return range;
 }
 
@@ -5334,6 +6291,9 @@ large_in_use_enumerator(task_t task, void *context, unsigned type_mask, vm_addre
 	vm_range_t		range;
 	large_entry_t	entry;
 
+	if (!num_entries)
+		return 0;
+
 	err = reader(task, large_entries_address, sizeof(large_entry_t) * num_entries, (void **)&entries);
 	if (err)
 		return err;
@@ -5366,6 +6326,292 @@ large_in_use_enumerator(task_t task, void *context, unsigned type_mask, vm_addre
 	return 0;
 }
 
+// Enumerates every shard of a (remote) zone's large_entries hash
+static kern_return_t
+large_shards_in_use_enumerator(task_t task, void *context, unsigned type_mask, szone_t *szone,
+							   memory_reader_t reader, vm_range_recorder_t recorder)
+{
+	unsigned		index;
+	kern_return_t	err;
+
+	for (index = 0; index < LARGE_ENTRY_SHARDS; index++) {
+		err = large_in_use_enumerator(task, context, type_mask,
+									  (vm_address_t)szone->large_shards[index].large_entries,
+									  szone->large_shards[index].num_large_entries, reader, recorder);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+// Deallocates every block (and the hash storage) of every shard; only for zone teardown
+static void
+large_shards_destroy(szone_t *szone)
+{
+	unsigned		shard_index, index;
+	large_entry_t	*large;
+	vm_range_t		range_to_deallocate;
+
+	for (shard_index = 0; shard_index < LARGE_ENTRY_SHARDS; shard_index++) {
+		large_shard_t *shard = &szone->large_shards[shard_index];
+
+		if (!shard->large_entries)
+			continue;
+
+		index = shard->num_large_entries;
+		while (index--) {
+			large = shard->large_entries + index;
+			if (large->address) {
+				// we deallocate_pages, including guard pages
+				deallocate_pages(szone, (void *)(large->address), large->size, szone->debug_flags);
+			}
+		}
+		large_entries_free_no_lock(szone, shard->large_entries, shard->num_large_entries, &range_to_deallocate);
+		if (range_to_deallocate.size)
+			deallocate_pages(szone, (void *)range_to_deallocate.address, (size_t)range_to_deallocate.size, 0);
+	}
+}
+
+static void
+large_locks_init(szone_t *szone)
+{
+	unsigned index;
+
+	_malloc_lock_init(&szone->large_szone_lock);
+	for (index = 0; index < LARGE_ENTRY_SHARDS; index++)
+		_malloc_lock_init(&szone->large_shards[index].large_shard_lock);
+#if LARGE_CACHE
+	for (index = 0; index < TINY_MAX_MAGAZINES; index++)
+		_malloc_lock_init(&szone->large_percpu_caches[index].lock);
+#endif
+}
+
+static void
+large_force_lock(szone_t *szone)
+{
+	unsigned index;
+
+	SZONE_LOCK(szone);
+	for (index = 0; index < LARGE_ENTRY_SHARDS; index++)
+		LARGE_SHARD_LOCK(&szone->large_shards[index]);
+#if LARGE_CACHE
+	for (index = 0; index < TINY_MAX_MAGAZINES; index++)
+		_malloc_lock_lock(&szone->large_percpu_caches[index].lock);
+#endif
+}
+
+static void
+large_force_unlock(szone_t *szone)
+{
+	unsigned index;
+
+#if LARGE_CACHE
+	for (index = 0; index < TINY_MAX_MAGAZINES; index++)
+		_malloc_lock_unlock(&szone->large_percpu_caches[index].lock);
+#endif
+	for (index = 0; index < LARGE_ENTRY_SHARDS; index++)
+		LARGE_SHARD_UNLOCK(&szone->large_shards[index]);
+	SZONE_UNLOCK(szone);
+}
+
+static boolean_t
+large_locked(szone_t *szone)
+{
+	unsigned index;
+
+	if (!SZONE_TRY_LOCK(szone))
+		return 1;
+	SZONE_UNLOCK(szone);
+
+	for (index = 0; index < LARGE_ENTRY_SHARDS; index++) {
+		if (!LARGE_SHARD_TRY_LOCK(&szone->large_shards[index]))
+			return 1;
+		LARGE_SHARD_UNLOCK(&szone->large_shards[index]);
+	}
+#if LARGE_CACHE
+	for (index = 0; index < TINY_MAX_MAGAZINES; index++) {
+		if (!_malloc_lock_trylock(&szone->large_percpu_caches[index].lock))
+			return 1;
+		_malloc_lock_unlock(&szone->large_percpu_caches[index].lock);
+	}
+#endif
+	return 0;
+}
+
+#if LARGE_CACHE
+// The cache byte counters cover death-row and the per-CPU caches alike. The per-CPU caches update them
+// without SZONE_LOCK, so every update is atomic. Blocks that have not been madvise()'d count against
+// large_entry_cache_reserve_limit.
+static INLINE void
+large_cache_charge(szone_t *szone, size_t size, boolean_t dirty)
+{
+	__sync_fetch_and_add(&szone->large_entry_cache_bytes, size);
+	if (dirty)
+		__sync_fetch_and_add(&szone->large_entry_cache_reserve_bytes, size);
+}
+
+static INLINE void
+large_cache_uncharge(szone_t *szone, size_t size, boolean_t dirty)
+{
+	__sync_fetch_and_sub(&szone->large_entry_cache_bytes, size);
+	if (dirty)
+		__sync_fetch_and_sub(&szone->large_entry_cache_reserve_bytes, size);
+}
+
+// Takes death-row's entries out of the counters before the ring is emptied. Called with SZONE_LOCK held.
+static void
+large_entry_cache_uncharge_all_no_lock(szone_t *szone)
+{
+	int idx = szone->large_entry_cache_oldest;
+
+	while (1) {
+		large_entry_t *entry = &szone->large_entry_cache[idx];
+
+		if (entry->address)
+			large_cache_uncharge(szone, entry->size, !entry->did_madvise_reusable);
+		if (idx == szone->large_entry_cache_newest)
+			break;
+		if (++idx == LARGE_ENTRY_CACHE_SIZE)
+			idx = 0;
+	}
+}
+
+static INLINE large_percpu_cache_t *
+large_percpu_cache_for_thread(szone_t *szone)
+{
+	return &szone->large_percpu_caches[mag_get_thread_index(szone) & szone->num_tiny_magazines_mask];
+}
+
+static INLINE boolean_t
+large_percpu_cache_usable(szone_t *szone)
+{
+	// Guard pages, purgeability and Leopard-era mprotect() resets all need the death-row treatment
+	return szone->large_percpu_cache_limit &&
+		!(szone->debug_flags & (SCALABLE_MALLOC_ADD_GUARD_PAGES | SCALABLE_MALLOC_PURGEABLE)) &&
+		!szone->large_legacy_reset_mprotect;
+}
+
+// Best fit (by the same rules as death-row) from this CPU's cache. The block is no longer cached on return,
+// but not yet entered in the large_entries hash either.
+static void *
+large_percpu_cache_take(szone_t *szone, size_t size, unsigned char alignment, size_t *cached_size)
+{
+	large_percpu_cache_t	*cache = large_percpu_cache_for_thread(szone);
+	int				i, best = -1;
+	size_t			best_size = SIZE_T_MAX;
+	void			*addr;
+
+	if (0 == cache->count) // racy peek, rechecked under the lock
+		return NULL;
+
+	_malloc_lock_lock(&cache->lock);
+	for (i = (int)cache->count - 1; i >= 0; --i) { // most recent first
+		size_t this_size = cache->entries[i].size;
+		addr = (void *)cache->entries[i].address;
+
+		if (0 == alignment || 0 == (((uintptr_t) addr) & (((uintptr_t) 1 << alignment) - 1))) {
+			if (size == this_size) {
+				best = i;
+				best_size = this_size;
+				break;
+			}
+			if (size <= this_size && this_size < best_size) {
+				best = i;
+				best_size = this_size;
+			}
+		}
+	}
+
+	if (best < 0 || (best_size - size) >= size) { // limit fragmentation to 50%
+		_malloc_lock_unlock(&cache->lock);
+		return NULL;
+	}
+
+	addr = (void *)cache->entries[best].address;
+	for (i = best; i < (int)cache->count - 1; ++i)
+		cache->entries[i] = cache->entries[i + 1];
+	cache->count--;
+	cache->bytes -= best_size;
+	_malloc_lock_unlock(&cache->lock);
+	large_cache_uncharge(szone, best_size, TRUE);
+
+	*cached_size = best_size;
+	return addr;
+}
+
+// Moves ptr from the large_entries hash into this CPU's cache if there is room. Returns FALSE, having
+// changed nothing, when free_large() must handle ptr the long way (including reporting bad pointers).
+static boolean_t
+large_percpu_cache_put(szone_t *szone, large_shard_t *shard, void *ptr)
+{
+	large_percpu_cache_t	*cache = large_percpu_cache_for_thread(szone);
+	large_entry_t		*entry;
+
+	if (!large_percpu_cache_usable(szone) || cache->count >= LARGE_PERCPU_CACHE_SIZE) // racy peek
+		return FALSE;
+
+	LARGE_SHARD_LOCK(shard);
+	entry = large_entry_for_pointer_no_lock(shard, ptr);
+	if (NULL == entry || entry->size > LARGE_PERCPU_ENTRY_LIMIT) {
+		LARGE_SHARD_UNLOCK(shard);
+		return FALSE;
+	}
+
+	_malloc_lock_lock(&cache->lock);
+	if (cache->count >= LARGE_PERCPU_CACHE_SIZE ||
+		cache->bytes + entry->size > szone->large_percpu_cache_limit) {
+		_malloc_lock_unlock(&cache->lock);
+		LARGE_SHARD_UNLOCK(shard);
+		return FALSE;
+	}
+
+	if (szone->debug_flags & SCALABLE_MALLOC_DO_SCRIBBLE)
+		memset((void *)(entry->address), SCRABBLE_BYTE, entry->size);
+
+	cache->entries[cache->count] = *entry;
+	cache->entries[cache->count].did_madvise_reusable = FALSE;
+	cache->count++;
+	cache->bytes += entry->size;
+	_malloc_lock_unlock(&cache->lock);
+	large_cache_charge(szone, entry->size, TRUE);
+
+	(void)large_entry_free_no_lock(szone, shard, entry); // no guard pages here, so nothing to deallocate
+	LARGE_SHARD_UNLOCK(shard);
+	return TRUE;
+}
+
+// Returns every per-CPU cached block to the OS. Returns the number of bytes released.
+static size_t
+large_percpu_caches_flush(szone_t *szone)
+{
+	large_entry_t	local_entries[LARGE_PERCPU_CACHE_SIZE];
+	unsigned		index, i, count;
+	size_t		total = 0;
+
+	for (index = 0; index < TINY_MAX_MAGAZINES; index++) {
+		large_percpu_cache_t *cache = &szone->large_percpu_caches[index];
+
+		if (0 == cache->count)
+			continue;
+
+		_malloc_lock_lock(&cache->lock);
+		count = cache->count;
+		memcpy(local_entries, cache->entries, count * sizeof(large_entry_t));
+		cache->count = 0;
+		cache->bytes = 0;
+		_malloc_lock_unlock(&cache->lock);
+
+		// deallocate outside the lock
+		for (i = 0; i < count; i++) {
+			deallocate_pages(szone, (void *)local_entries[i].address, local_entries[i].size, 0);
+			large_cache_uncharge(szone, local_entries[i].size, TRUE);
+			total += local_entries[i].size;
+		}
+	}
+	return total;
+}
+#endif /* LARGE_CACHE */
+
 static void *
 large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 			 boolean_t cleared_requested)
@@ -5373,7 +6619,6 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 	void		*addr;
 	vm_range_t		range_to_deallocate;
 	size_t		size;
-	large_entry_t	large_entry;
 
 	if (!num_kernel_pages)
 		num_kernel_pages = 1; // minimal allocation size for this szone
@@ -5381,7 +6626,23 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 	range_to_deallocate.size = 0;
 	range_to_deallocate.address = 0;
 
-#if LARGE_CACHE
+#if LARGE_CACHE
+	if (size <= LARGE_PERCPU_ENTRY_LIMIT) { // Look first in this CPU's cache, no SZONE_LOCK needed
+		size_t cached_size;
+
+		addr = large_percpu_cache_take(szone, size, alignment, &cached_size);
+		if (addr) {
+			if (!large_entry_add(szone, (vm_address_t)addr, cached_size)) {
+				deallocate_pages(szone, addr, cached_size, 0);
+				return NULL;
+			}
+			if (cleared_requested) {
+				memset(addr, 0, size);
+			}
+			return addr;
+		}
+	}
+
 	if (size < LARGE_CACHE_SIZE_ENTRY_LIMIT) { //128M Look for a large_entry_t on the death-row cache?
 		SZONE_LOCK(szone);
 
@@ -5413,7 +6674,7 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 			else
 				idx = LARGE_ENTRY_CACHE_SIZE - 1; // wrap idx
 		}
-		
+
 		//找到可用缓存后更新列表
 		if (best > -1 && (best_size - size) < size) { //limit fragmentation to 50%
 			addr = (void *)szone->large_entry_cache[best].address;
@@ -5459,30 +6720,9 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 				szone->large_entry_cache[best].size = 0;
 				szone->large_entry_cache[best].did_madvise_reusable = FALSE;
 			}
-			
-			//是否需要扩大已分配的内存hash表，减少冲突，增加命中概率
-			if ((szone->num_large_objects_in_use + 1) * 4 > szone->num_large_entries) {
-				// density of hash table too high; grow table
-				// we do that under lock to avoid a race
-				large_entry_t *entries = large_entries_grow_no_lock(szone, &range_to_deallocate);
-				if (entries == NULL) {
-					SZONE_UNLOCK(szone);
-					return NULL;
-				}
-			}
-			
-			//生成新的large_entry内存数据及信息，并插入到hash表中
-			large_entry.address = (vm_address_t)addr;
-			large_entry.size = best_size;
-			large_entry.did_madvise_reusable = FALSE;
-			large_entry_insert_no_lock(szone, large_entry);
-			//更新szone中large分配个数，和缓存信息
-			szone->num_large_objects_in_use ++;
-			szone->num_bytes_in_large_objects += best_size;
-			if (!was_madvised_reusable)
-				szone->large_entry_cache_reserve_bytes -= best_size;
-
-			szone->large_entry_cache_bytes -= best_size;
+
+			//更新szone中缓存信息
+			large_cache_uncharge(szone, best_size, !was_madvised_reusable);
 
 			if (szone->flotsam_enabled && szone->large_entry_cache_bytes < SZONE_FLOTSAM_THRESHOLD_LOW) {
 				szone->flotsam_enabled = FALSE;
@@ -5490,9 +6730,10 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 
 			SZONE_UNLOCK(szone);
 
-			if (range_to_deallocate.size) {
-				// we deallocate outside the lock
-				deallocate_pages(szone, (void *)range_to_deallocate.address, range_to_deallocate.size, 0);
+			//生成新的large_entry内存数据及信息，并插入到hash表中
+			if (!large_entry_add(szone, (vm_address_t)addr, best_size)) {
+				deallocate_pages(szone, addr, best_size, 0);
+				return NULL;
 			}
 
 			// Perform the madvise() outside the lock.
@@ -5500,19 +6741,18 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 			// In the unusual case of failure, reacquire the lock to unwind.
 			if (was_madvised_reusable && -1 == madvise(addr, size, MADV_FREE_REUSE)) {
 				/* -1 return: VM map entry change makes this unfit for reuse. */
-				SZONE_LOCK(szone);
-				szone->num_large_objects_in_use--;
-				szone->num_bytes_in_large_objects -= large_entry.size;
+				large_shard_t *shard = LARGE_SHARD_FOR_PTR(szone, addr);
+				LARGE_SHARD_LOCK(shard);
 
 				// Re-acquire "entry" after interval just above where we let go the lock.
-				large_entry_t *entry = large_entry_for_pointer_no_lock(szone, addr);
+				large_entry_t *entry = large_entry_for_pointer_no_lock(shard, addr);
 				if (NULL == entry) {
 					szone_error(szone, 1, "entry for pointer being discarded from death-row vanished", addr, NULL);
-					SZONE_UNLOCK(szone);
+					LARGE_SHARD_UNLOCK(shard);
 				} else {
 
-					range_to_deallocate = large_entry_free_no_lock(szone, entry);
-					SZONE_UNLOCK(szone);
+					range_to_deallocate = large_entry_free_no_lock(szone, shard, entry);
+					LARGE_SHARD_UNLOCK(shard);
 
 					if (range_to_deallocate.size) {
 						// we deallocate outside the lock
@@ -5531,40 +6771,18 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment,
 			SZONE_UNLOCK(szone);
 		}
 	}
-
-	range_to_deallocate.size = 0;
-	range_to_deallocate.address = 0;
 #endif /* LARGE_CACHE */
-	
+
 	//没有找到或者不支持缓存，直接分配一个页面，
 	addr = allocate_pages(szone, size, alignment, szone->debug_flags, VM_MEMORY_MALLOC_LARGE);
 	if (addr == NULL) {
 		return NULL;
 	}
-	
-	//分配成功插入到hash表更新页面
-	SZONE_LOCK(szone);
-	if ((szone->num_large_objects_in_use + 1) * 4 > szone->num_large_entries) {
-		//size = 2*size + 1, remap entry
-		large_entry_t *entries = large_entries_grow_no_lock(szone, &range_to_deallocate);
-		if (entries == NULL) {
-			SZONE_UNLOCK(szone);
-			return NULL;
-		}
-	}
-
-	large_entry.address = (vm_address_t)addr;
-	large_entry.size = size;
-	large_entry.did_madvise_reusable = FALSE;
-	large_entry_insert_no_lock(szone, large_entry);
 
-	szone->num_large_objects_in_use ++;
-	szone->num_bytes_in_large_objects += size;
-	SZONE_UNLOCK(szone);
-
-	if (range_to_deallocate.size) {
-		//如果更新了size，分配了新的列表 释放掉旧的列表
-		deallocate_pages(szone, (void *)range_to_deallocate.address, range_to_deallocate.size, 0);
+	//分配成功插入到hash表更新页面
+	if (!large_entry_add(szone, (vm_address_t)addr, size)) {
+		deallocate_pages(szone, addr, size, szone->debug_flags);
+		return NULL;
 	}
 	return addr;
 }
@@ -5573,23 +6791,34 @@ static NOINLINE void
 free_large(szone_t *szone, void *ptr)
 {
 	// We have established ptr is page-aligned and neither tiny nor small
+	large_shard_t	*shard = LARGE_SHARD_FOR_PTR(szone, ptr);
 	large_entry_t	*entry;
 	vm_range_t		vm_range_to_deallocate;
 
-	SZONE_LOCK(szone);
-	entry = large_entry_for_pointer_no_lock(szone, ptr);
+#if LARGE_CACHE
+	if (large_percpu_cache_put(szone, shard, ptr))
+		return;
+#endif
+
+	LARGE_SHARD_LOCK(shard);
+	entry = large_entry_for_pointer_no_lock(shard, ptr);
 	if (entry) {
 #if LARGE_CACHE
 		if (entry->size < LARGE_CACHE_SIZE_ENTRY_LIMIT &&
 			-1 != madvise((void *)(entry->address), entry->size, MADV_CAN_REUSE)) { // Put the large_entry_t on the death-row cache?
-			int idx = szone->large_entry_cache_newest, stop_idx = szone->large_entry_cache_oldest;
 			large_entry_t this_entry = *entry; // Make a local copy, "entry" is volatile when lock is let go.
 			boolean_t reusable = TRUE;
-			boolean_t should_madvise = szone->large_entry_cache_reserve_bytes + this_entry.size > szone->large_entry_cache_reserve_limit;
+			boolean_t should_madvise;
+
+			LARGE_SHARD_UNLOCK(shard); // SZONE_LOCK is always taken before a shard lock
+			SZONE_LOCK(szone);
+
+			int idx = szone->large_entry_cache_newest, stop_idx = szone->large_entry_cache_oldest;
+			should_madvise = szone->large_entry_cache_reserve_bytes + this_entry.size > szone->large_entry_cache_reserve_limit;
 
 			//从最新释放的缓存列表查找，要释放的内存是不是被释放掉了
 			while (1) {
-				if (szone->large_entry_cache[idx].address == entry->address) {
+				if (szone->large_entry_cache[idx].address == this_entry.address) {
 					szone_error(szone, 1, "pointer being freed already on death-row", ptr, NULL);
 					SZONE_UNLOCK(szone);
 					return;
@@ -5641,11 +6870,13 @@ free_large(szone_t *szone, void *ptr)
 			}
 
 			SZONE_LOCK(szone);
+			LARGE_SHARD_LOCK(shard);
 
 			// Re-acquire "entry" after interval just above where we let go the lock.
-			entry = large_entry_for_pointer_no_lock(szone, ptr);
+			entry = large_entry_for_pointer_no_lock(shard, ptr);
 			if (NULL == entry) {
 				szone_error(szone, 1, "entry for pointer being freed from death-row vanished", ptr, NULL);
+				LARGE_SHARD_UNLOCK(shard);
 				SZONE_UNLOCK(szone);
 				return;
 			}
@@ -5672,25 +6903,21 @@ free_large(szone_t *szone, void *ptr)
 						// Drop this entry from the cache and deallocate the VM
 						addr = szone->large_entry_cache[idx].address;
 						adjsize = szone->large_entry_cache[idx].size;
-						szone->large_entry_cache_bytes -= adjsize;
-						if (!szone->large_entry_cache[idx].did_madvise_reusable)
-							szone->large_entry_cache_reserve_bytes -= adjsize;
+						large_cache_uncharge(szone, adjsize, !szone->large_entry_cache[idx].did_madvise_reusable);
 					} else {
 						// Using an unoccupied cache slot
 						addr = 0;
 						adjsize = 0;
 					}
 				}
-				
+
 				//更新缓存列表信息
 				if ((szone->debug_flags & SCALABLE_MALLOC_DO_SCRIBBLE))
 					memset((void *)(entry->address), should_madvise ? SCRUBBLE_BYTE : SCRABBLE_BYTE, entry->size);
 
 				entry->did_madvise_reusable = should_madvise; // Was madvise()'d above?
-				if (!should_madvise) // Entered on death-row without madvise() => up the hoard total
-					szone->large_entry_cache_reserve_bytes += entry->size;
-
-				szone->large_entry_cache_bytes += entry->size;
+				// Entered on death-row without madvise() => up the hoard total
+				large_cache_charge(szone, entry->size, !should_madvise);
 
 				if (!szone->flotsam_enabled && szone->large_entry_cache_bytes > SZONE_FLOTSAM_THRESHOLD_HIGH) {
 					szone->flotsam_enabled = TRUE;
@@ -5699,10 +6926,8 @@ free_large(szone_t *szone, void *ptr)
 				szone->large_entry_cache[idx] = *entry;
 				szone->large_entry_cache_newest = idx;
 
-				szone->num_large_objects_in_use--;
-				szone->num_bytes_in_large_objects -= entry->size;
-
-				(void)large_entry_free_no_lock(szone, entry);
+				(void)large_entry_free_no_lock(szone, shard, entry);
+				LARGE_SHARD_UNLOCK(shard);
 
 				if (0 == addr) {
 					SZONE_UNLOCK(szone);
@@ -5723,22 +6948,20 @@ free_large(szone_t *szone, void *ptr)
 				deallocate_pages(szone, (void *)addr, (size_t)adjsize, 0);
 				return;
 			} else {
-				/* fall through to discard an allocation that is not reusable */
+				/* fall through to discard an allocation that is not reusable, under the shard lock alone */
+				SZONE_UNLOCK(szone);
 			}
 		}
 #endif /* LARGE_CACHE */
-		
-		//缓存失败 释放掉内存
-		szone->num_large_objects_in_use--;
-		szone->num_bytes_in_large_objects -= entry->size;
 
-		vm_range_to_deallocate = large_entry_free_no_lock(szone, entry);
+		//缓存失败 释放掉内存
+		vm_range_to_deallocate = large_entry_free_no_lock(szone, shard, entry);
 	} else {
 		szone_error(szone, 1, "pointer being freed was not allocated", ptr, NULL);
-		SZONE_UNLOCK(szone);
+		LARGE_SHARD_UNLOCK(shard);
 		return;
 	}
-	SZONE_UNLOCK(szone); // we release the lock asap
+	LARGE_SHARD_UNLOCK(shard); // we release the lock asap
 	CHECK(szone, __PRETTY_FUNCTION__);
 
 	// we deallocate_pages, including guard pages, outside the lock
@@ -5753,19 +6976,21 @@ large_try_shrink_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new
 	size_t shrinkage = old_size - new_good_size;
 
 	if (shrinkage) {
-		SZONE_LOCK(szone);
+		large_shard_t *shard = LARGE_SHARD_FOR_PTR(szone, ptr);
+
+		LARGE_SHARD_LOCK(shard);
 		/* contract existing large entry */
-		large_entry_t *large_entry = large_entry_for_pointer_no_lock(szone, ptr);
+		large_entry_t *large_entry = large_entry_for_pointer_no_lock(shard, ptr);
 		if (!large_entry) {
 			szone_error(szone, 1, "large entry reallocated is not properly in table", ptr, NULL);
-			SZONE_UNLOCK(szone);
+			LARGE_SHARD_UNLOCK(shard);
 			return ptr;
 		}
 
 		large_entry->address = (vm_address_t)ptr;
 		large_entry->size = new_good_size;
-		szone->num_bytes_in_large_objects -= shrinkage;
-		SZONE_UNLOCK(szone); // we release the lock asap
+		LARGE_SHARD_UNLOCK(shard); // we release the lock asap
+		__sync_fetch_and_sub(&szone->num_bytes_in_large_objects, shrinkage);
 
 		deallocate_pages(szone, (void *)((uintptr_t)ptr + new_good_size), shrinkage, 0);
 	}
@@ -5776,12 +7001,13 @@ static INLINE int
 large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new_size)
 {
 	vm_address_t	addr = (vm_address_t)ptr + old_size;
+	large_shard_t	*shard = LARGE_SHARD_FOR_PTR(szone, (void *)addr);
 	large_entry_t	*large_entry;
 	kern_return_t	err;
 
-	SZONE_LOCK(szone);
-	large_entry = large_entry_for_pointer_no_lock(szone, (void *)addr);
-	SZONE_UNLOCK(szone);
+	LARGE_SHARD_LOCK(shard);
+	large_entry = large_entry_for_pointer_no_lock(shard, (void *)addr);
+	LARGE_SHARD_UNLOCK(shard);
 
 	if (large_entry) { // check if "addr = ptr + old_size" is already spoken for
 		return 0; // large pointer already exists in table - extension is not going to work
@@ -5797,23 +7023,103 @@ large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t ne
 		return 0;
 	}
 
-	SZONE_LOCK(szone);
+	shard = LARGE_SHARD_FOR_PTR(szone, ptr);
+	LARGE_SHARD_LOCK(shard);
 	/* extend existing large entry */
-	large_entry = large_entry_for_pointer_no_lock(szone, ptr);
+	large_entry = large_entry_for_pointer_no_lock(shard, ptr);
 	if (!large_entry) {
 		szone_error(szone, 1, "large entry reallocated is not properly in table", ptr, NULL);
-		SZONE_UNLOCK(szone);
+		LARGE_SHARD_UNLOCK(shard);
 		return 0; // Bail, leaking "addr"
 	}
 
 	large_entry->address = (vm_address_t)ptr;
 	large_entry->size = new_size;
-	szone->num_bytes_in_large_objects += new_size - old_size;
-	SZONE_UNLOCK(szone); // we release the lock asap
+	LARGE_SHARD_UNLOCK(shard); // we release the lock asap
+	__sync_fetch_and_add(&szone->num_bytes_in_large_objects, new_size - old_size);
 
 	return 1;
 }
 
+/*
+ * Moves a large block to a new, larger mapping by remapping its pages instead of copying its bytes:
+ * mremap() where the kernel has it, otherwise mach_vm_remap() of the old pages over the head of a fresh
+ * allocation. Returns the new address (ptr is then gone), or NULL with ptr untouched so the caller can
+ * fall back to malloc/copy/free.
+ */
+static NOINLINE void *
+large_try_realloc_remap(szone_t *szone, void *ptr, size_t old_size, size_t new_size)
+{
+	large_shard_t	*shard = LARGE_SHARD_FOR_PTR(szone, ptr);
+	large_entry_t	*large_entry;
+	void		*new_ptr;
+
+	if (szone->debug_flags & (SCALABLE_MALLOC_ADD_GUARD_PAGES | SCALABLE_MALLOC_PURGEABLE))
+		return NULL; // guard pages and purgeable objects don't survive a remap
+
+	new_size = round_page_quanta(new_size);
+
+	/*
+	 * Take ptr out of the table before its pages move, so a concurrent large_malloc() that is handed
+	 * the vacated address can't collide with a stale entry.
+	 */
+	LARGE_SHARD_LOCK(shard);
+	large_entry = large_entry_for_pointer_no_lock(shard, ptr);
+	if (!large_entry) {
+		szone_error(szone, 1, "large entry reallocated is not properly in table", ptr, NULL);
+		LARGE_SHARD_UNLOCK(shard);
+		return NULL;
+	}
+	(void)large_entry_free_no_lock(szone, shard, large_entry); // no guard pages, nothing to deallocate
+	LARGE_SHARD_UNLOCK(shard);
+
+#if defined(MREMAP_MAYMOVE)
+	new_ptr = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+	if (new_ptr == MAP_FAILED)
+		new_ptr = NULL;
+#else
+	new_ptr = allocate_pages(szone, new_size, 0, szone->debug_flags, VM_MEMORY_MALLOC_LARGE);
+	if (new_ptr) {
+		mach_vm_address_t	vm_addr = (mach_vm_address_t)new_ptr;
+		vm_prot_t		cur_prot, max_prot;
+		kern_return_t		kr;
+
+		// Share (copy == FALSE) the old pages into place; dropping the old mapping then leaves them only here
+		kr = mach_vm_remap(mach_task_self(), &vm_addr, old_size, 0, VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE,
+						   mach_task_self(), (mach_vm_address_t)ptr, FALSE, &cur_prot, &max_prot,
+						   VM_INHERIT_DEFAULT);
+		if (kr) {
+			deallocate_pages(szone, new_ptr, new_size, 0);
+			new_ptr = NULL;
+		} else {
+			deallocate_pages(szone, ptr, old_size, 0);
+		}
+	}
+#endif
+
+	if (!new_ptr) {
+		// Put ptr back just as it was. Other threads may have filled the shard meanwhile, so this can
+		// need to grow the table, and that can fail.
+		if (large_entry_add(szone, (vm_address_t)ptr, old_size))
+			return NULL;
+
+		// ptr can no longer be found, so the caller must not free() it: copy it out here instead.
+		new_ptr = large_malloc(szone, new_size >> vm_page_quanta_shift, 0, FALSE);
+		if (!new_ptr) {
+			szone_error(szone, 0, "can't restore large entry after failed remap", ptr, NULL);
+			return NULL;
+		}
+		memcpy(new_ptr, ptr, old_size);
+		deallocate_pages(szone, ptr, old_size, 0);
+		return new_ptr;
+	}
+
+	if (!large_entry_add(szone, (vm_address_t)new_ptr, new_size)) {
+		szone_error(szone, 0, "can't record remapped large entry", new_ptr, NULL);
+	}
+	return new_ptr;
+}
+
 /*********************	Zone call backs	************************/
 /*
  * Mark these NOINLINE to avoid bloating the purgeable zone call backs
@@ -6002,14 +7308,15 @@ static NOINLINE size_t
 szone_size_try_large(szone_t *szone, const void *ptr)
 {
 	size_t		size = 0;
+	large_shard_t	*shard = LARGE_SHARD_FOR_PTR(szone, ptr);
 	large_entry_t	*entry;
 
-	SZONE_LOCK(szone);
-	entry = large_entry_for_pointer_no_lock(szone, ptr);
+	LARGE_SHARD_LOCK(shard);
+	entry = large_entry_for_pointer_no_lock(shard, ptr);
 	if (entry) {
 		size = entry->size;
 	}
-	SZONE_UNLOCK(szone);
+	LARGE_SHARD_UNLOCK(shard);
 
 	return size;
 }
@@ -6188,6 +7495,12 @@ szone_realloc(szone_t *szone, void *ptr, size_t new_size)
 			if (szone->debug_flags & SCALABLE_MALLOC_DO_SCRIBBLE)
 				memset(ptr + old_size, SCRIBBLE_BYTE, new_good_size - old_size);
 			return ptr;
+		} else if (old_size >= szone->vm_copy_threshold &&
+				   (new_ptr = large_try_realloc_remap(szone, ptr, old_size, new_good_size))) {
+			// moved page tables rather than bytes
+			if (szone->debug_flags & SCALABLE_MALLOC_DO_SCRIBBLE)
+				memset(new_ptr + old_size, SCRIBBLE_BYTE, new_good_size - old_size);
+			return new_ptr;
 		}
 	}
 
@@ -6257,6 +7570,8 @@ szone_memalign(szone_t *szone, size_t alignment, size_t size)
 																		 MAGAZINE_INDEX_FOR_TINY_REGION(TINY_REGION_FOR_PTR(p)));
 			set_tiny_meta_header_in_use(q, msize);
 			tiny_mag_ptr->mag_num_objects++;
+			tiny_class_stats_resize(szone, tiny_mag_ptr, mspan, mpad);
+			tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(mspan - mpad))->num_allocs++;
 
 			// set_tiny_meta_header_in_use() "reaffirms" the block_header on the *following* block, so
 			// now set its in_use bit as well. But only if its within the original allocation made above.
@@ -6279,6 +7594,8 @@ szone_memalign(szone_t *szone, size_t alignment, size_t size)
 																		 MAGAZINE_INDEX_FOR_TINY_REGION(TINY_REGION_FOR_PTR(p)));
 			set_tiny_meta_header_in_use(q, mwaste);
 			tiny_mag_ptr->mag_num_objects++;
+			tiny_class_stats_resize(szone, tiny_mag_ptr, msize + mwaste, msize);
+			tiny_class_stats(szone, tiny_mag_ptr, TINY_SLOT_FOR_MSIZE(mwaste))->num_allocs++;
 			SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
 
 			// Give up mwaste blocks beginning at q to the tiny free list
@@ -6321,6 +7638,8 @@ szone_memalign(szone_t *szone, size_t alignment, size_t size)
 			small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(p), SMALL_META_INDEX_FOR_PTR(p), mpad);
 			small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(q), SMALL_META_INDEX_FOR_PTR(q), msize + mwaste);
 			small_mag_ptr->mag_num_objects++;
+			small_class_stats_resize(szone, small_mag_ptr, mspan, mpad);
+			small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, msize + mwaste))->num_allocs++;
 			SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
 
 			// Give up mpad blocks beginning at p to the small free list
@@ -6338,6 +7657,8 @@ szone_memalign(szone_t *szone, size_t alignment, size_t size)
 			small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(p), SMALL_META_INDEX_FOR_PTR(p), msize);
 			small_meta_header_set_in_use(SMALL_META_HEADER_FOR_PTR(q), SMALL_META_INDEX_FOR_PTR(q), mwaste);
 			small_mag_ptr->mag_num_objects++;
+			small_class_stats_resize(szone, small_mag_ptr, msize + mwaste, msize);
+			small_class_stats(szone, small_mag_ptr, small_slot_for_msize(szone, mwaste))->num_allocs++;
 			SZONE_MAGAZINE_PTR_UNLOCK(szone, small_mag_ptr);
 
 			// Give up mwaste blocks beginning at q to the small free list
@@ -6374,49 +7695,81 @@ szone_memalign(szone_t *szone, size_t alignment, size_t size)
 static NOINLINE unsigned
 szone_batch_malloc(szone_t *szone, size_t size, void **results, unsigned count)
 {
-	msize_t	msize = TINY_MSIZE_FOR_BYTES(size + TINY_QUANTUM - 1);
-	unsigned	found = 0;
-	mag_index_t	mag_index = mag_get_thread_index(szone);
-	magazine_t	*tiny_mag_ptr = &(szone->tiny_magazines[mag_index]);
-
-	// only bother implementing this for tiny
-	if (size > (NUM_TINY_SLOTS - 1)*TINY_QUANTUM)
-		return 0;
-	// make sure to return objects at least one quantum in size
-	if (!msize)
-		msize = 1;
+	msize_t	msize;
+	unsigned	found;
 
 	CHECK(szone, __PRETTY_FUNCTION__);
 
-	// We must lock the zone now, since tiny_malloc_from_free_list assumes that
-	// the caller has done so.
-	SZONE_MAGAZINE_PTR_LOCK(szone, tiny_mag_ptr);
+	if (size <= (NUM_TINY_SLOTS - 1)*TINY_QUANTUM) {
+		msize = TINY_MSIZE_FOR_BYTES(size + TINY_QUANTUM - 1);
+		// make sure to return objects at least one quantum in size
+		if (!msize)
+			msize = 1;
+		found = tiny_batch_malloc(szone, msize, results, count);
+	} else if (size <= szone->large_threshold) {
+		msize = SMALL_MSIZE_FOR_BYTES(size + SMALL_QUANTUM - 1);
+		if (!msize)
+			msize = 1;
+		found = small_batch_malloc(szone, msize, results, count);
+	} else {
+		// large blocks gain nothing from batching
+		return 0;
+	}
 
-	// with the zone locked, allocate objects from the free list until all
-	// sufficiently large objects have been exhausted, or we have met our quota
-	// of objects to allocate.
-	while (found < count) {
-		void *ptr = tiny_malloc_from_free_list(szone, tiny_mag_ptr, mag_index, msize);
-		if (!ptr)
-			break;
+	if ((szone->debug_flags & SCALABLE_MALLOC_DO_SCRIBBLE) && size) {
+		unsigned i;
 
-		*results++ = ptr;
-		found++;
+		for (i = 0; i < found; i++)
+			memset(results[i], SCRIBBLE_BYTE, szone_size(szone, results[i]));
 	}
-	SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
 	return found;
 }
 
-/* Try caching the tiny_region and checking if the next ptr hits there. */
+// In-place heapsort of a batch of pointers by address (NULLs first). No allocation, as we're inside free().
+static void
+batch_sort_by_address(void **ptrs, unsigned count)
+{
+	unsigned	start, end, root, child;
+	void	*t;
+
+	if (count < 2)
+		return;
+
+	for (start = count / 2; start-- > 0; ) {
+		for (root = start; (child = 2 * root + 1) < count; root = child) {
+			if (child + 1 < count && (uintptr_t)ptrs[child] < (uintptr_t)ptrs[child + 1])
+				child++;
+			if ((uintptr_t)ptrs[root] >= (uintptr_t)ptrs[child])
+				break;
+			t = ptrs[root]; ptrs[root] = ptrs[child]; ptrs[child] = t;
+		}
+	}
+	for (end = count - 1; end > 0; end--) {
+		t = ptrs[0]; ptrs[0] = ptrs[end]; ptrs[end] = t;
+		for (root = 0; (child = 2 * root + 1) < end; root = child) {
+			if (child + 1 < end && (uintptr_t)ptrs[child] < (uintptr_t)ptrs[child + 1])
+				child++;
+			if ((uintptr_t)ptrs[root] >= (uintptr_t)ptrs[child])
+				break;
+			t = ptrs[root]; ptrs[root] = ptrs[child]; ptrs[child] = t;
+		}
+	}
+}
+
+/*
+ * Sort the batch by address so pointers into one region sit together, then free each run of them under a
+ * single hold of that region's magazine lock. Anything suspect is left for szone_free() to diagnose.
+ */
 static NOINLINE void
 szone_batch_free(szone_t *szone, void **to_be_freed, unsigned count)
 {
-	unsigned	cc = 0;
+	unsigned	cc;
 	void	*ptr;
 	region_t	tiny_region = NULL;
+	region_t	small_region = NULL;
 	boolean_t	is_free;
 	msize_t	msize;
-	magazine_t	*tiny_mag_ptr = NULL;
+	magazine_t	*mag_ptr = NULL; // non-NULL iff a magazine lock is taken
 	mag_index_t mag_index = -1;
 
 	// frees all the pointers in to_be_freed
@@ -6425,51 +7778,77 @@ szone_batch_free(szone_t *szone, void **to_be_freed, unsigned count)
 		return;
 
 	CHECK(szone, __PRETTY_FUNCTION__);
-	while (cc < count) {
-		ptr = to_be_freed[cc];
-		if (ptr) {
-			if (NULL == tiny_region || tiny_region != TINY_REGION_FOR_PTR(ptr)) { // region same as last iteration?
-				if (tiny_mag_ptr) { // non-NULL iff magazine lock taken
-					SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
-					tiny_mag_ptr = NULL;
-				}
+	batch_sort_by_address(to_be_freed, count);
 
-				tiny_region = tiny_region_for_ptr_no_lock(szone, ptr);
+	for (cc = 0; cc < count; cc++) {
+		ptr = to_be_freed[cc];
+		if (!ptr || ((uintptr_t)ptr & (TINY_QUANTUM - 1)))
+			continue;
 
-				if (tiny_region) {
-					tiny_mag_ptr = mag_lock_zine_for_region_trailer(szone, szone->tiny_magazines,
-																	REGION_TRAILER_FOR_TINY_REGION(tiny_region),
-																	MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region));
-					mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region);
-				}
+		if (!(tiny_region && tiny_region == TINY_REGION_FOR_PTR(ptr)) &&
+			!(small_region && small_region == SMALL_REGION_FOR_PTR(ptr))) { // region same as last iteration?
+			if (mag_ptr) {
+				SZONE_MAGAZINE_PTR_UNLOCK(szone, mag_ptr);
+				mag_ptr = NULL;
 			}
-			if (tiny_region) {
-				// this is a tiny pointer
-				if (TINY_INDEX_FOR_PTR(ptr) >= NUM_TINY_BLOCKS)
-					break; // pointer to metadata; let the standard free deal with it
-				msize = get_tiny_meta_header(ptr, &is_free);
-				if (is_free)
-					break; // a double free; let the standard free deal with it
-
-				if (!tiny_free_no_lock(szone, tiny_mag_ptr, mag_index, tiny_region, ptr, msize)) {
-					// Arrange to re-acquire magazine lock
-					tiny_mag_ptr = NULL;
-					tiny_region = NULL;
-				}
-				to_be_freed[cc] = NULL;
+			small_region = NULL;
+
+			if ((tiny_region = tiny_region_for_ptr_no_lock(szone, ptr)) != NULL) {
+				mag_ptr = mag_lock_zine_for_region_trailer(szone, szone->tiny_magazines,
+														   REGION_TRAILER_FOR_TINY_REGION(tiny_region),
+														   MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region));
+				mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region);
+			} else if ((small_region = small_region_for_ptr_no_lock(szone, ptr)) != NULL) {
+				mag_ptr = mag_lock_zine_for_region_trailer(szone, szone->small_magazines,
+														   REGION_TRAILER_FOR_SMALL_REGION(small_region),
+														   MAGAZINE_INDEX_FOR_SMALL_REGION(small_region));
+				mag_index = MAGAZINE_INDEX_FOR_SMALL_REGION(small_region);
 			} else {
-				// No region in this zone claims ptr; let the standard free deal with it
-				break;
+				continue; // large, or no region in this zone claims ptr; let the standard free deal with it
+			}
+		}
+
+		if (tiny_region) {
+			if (TINY_INDEX_FOR_PTR(ptr) >= NUM_TINY_BLOCKS)
+				continue; // pointer to metadata; let the standard free deal with it
+			msize = get_tiny_meta_header(ptr, &is_free);
+			if (is_free)
+				continue; // a double free; let the standard free deal with it
+#if TINY_CACHE
+			if (ptr == (void *)((uintptr_t)mag_ptr->mag_last_free & ~(TINY_QUANTUM - 1)))
+				continue; // already freed, and parked in the cache
+#endif
+			if (!tiny_free_no_lock(szone, mag_ptr, mag_index, tiny_region, ptr, msize)) {
+				// Arrange to re-acquire magazine lock
+				mag_ptr = NULL;
+				tiny_region = NULL;
+			}
+		} else {
+			if (((uintptr_t)ptr & (SMALL_QUANTUM - 1)) || SMALL_META_INDEX_FOR_PTR(ptr) >= NUM_SMALL_BLOCKS)
+				continue; // misaligned or pointer to metadata; let the standard free deal with it
+			if (SMALL_PTR_IS_FREE(ptr))
+				continue; // a double free; let the standard free deal with it
+#if SMALL_CACHE
+			if (ptr == (void *)((uintptr_t)mag_ptr->mag_last_free & ~(SMALL_QUANTUM - 1)))
+				continue; // already freed, and parked in the cache
+#endif
+			msize = SMALL_PTR_SIZE(ptr);
+			if (!small_free_no_lock(szone, mag_ptr, mag_index, small_region, ptr, msize)) {
+				// Arrange to re-acquire magazine lock
+				mag_ptr = NULL;
+				small_region = NULL;
 			}
 		}
-		cc++;
+		to_be_freed[cc] = NULL;
 	}
 
-	if (tiny_mag_ptr) {
-		SZONE_MAGAZINE_PTR_UNLOCK(szone, tiny_mag_ptr);
-		tiny_mag_ptr = NULL;
+	if (mag_ptr) {
+		SZONE_MAGAZINE_PTR_UNLOCK(szone, mag_ptr);
+		mag_ptr = NULL;
 	}
 
+	szone_scavenger_kick(szone);
+
 	CHECK(szone, __PRETTY_FUNCTION__);
 	while (count--) {
 		ptr = to_be_freed[count];
@@ -6483,10 +7862,16 @@ static void
 szone_destroy(szone_t *szone)
 {
 	size_t		index;
-	large_entry_t	*large;
-	vm_range_t		range_to_deallocate;
+
+	if (szone->scavenger_started == scavenger_generation) {
+		szone->scavenger_stop = TRUE;
+		szone_scavenger_wake(szone);
+		pthread_join(szone->scavenger_thread, NULL);
+	}
 
 #if LARGE_CACHE
+	(void)large_percpu_caches_flush(szone);
+
 	SZONE_LOCK(szone);
 
 	/* disable any memory pressure responder */
@@ -6517,17 +7902,7 @@ szone_destroy(szone_t *szone)
 #endif
 
 	/* destroy large entries */
-	index = szone->num_large_entries;
-	while (index--) {
-		large = szone->large_entries + index;
-		if (large->address) {
-			// we deallocate_pages, including guard pages
-			deallocate_pages(szone, (void *)(large->address), large->size, szone->debug_flags);
-		}
-	}
-	large_entries_free_no_lock(szone, szone->large_entries, szone->num_large_entries, &range_to_deallocate);
-	if (range_to_deallocate.size)
-		deallocate_pages(szone, (void *)range_to_deallocate.address, (size_t)range_to_deallocate.size, 0);
+	large_shards_destroy(szone);
 
 	/* destroy tiny regions */
 	for (index = 0; index < szone->tiny_region_generation->num_regions_allocated; ++index)
@@ -6535,6 +7910,13 @@ szone_destroy(szone_t *szone)
 			(HASHRING_REGION_DEALLOCATED != szone->tiny_region_generation->hashed_regions[index]))
 			deallocate_pages(szone, szone->tiny_region_generation->hashed_regions[index], TINY_REGION_SIZE, 0);
 
+	/* destroy parked halves of huge page tiny arenas (their buddies were unmapped just above) */
+	while (szone->tiny_arena_spares) {
+		region_t r = szone->tiny_arena_spares;
+		szone->tiny_arena_spares = *(region_t *)r;
+		deallocate_pages(szone, r, TINY_REGION_SIZE, 0);
+	}
+
 	/* destroy small regions */
 	for (index = 0; index < szone->small_region_generation->num_regions_allocated; ++index)
 		if ((HASHRING_OPEN_ENTRY != szone->small_region_generation->hashed_regions[index]) &&
@@ -6554,6 +7936,8 @@ szone_destroy(szone_t *szone)
 	/* Now destroy the separate szone region */
 	deallocate_pages(szone, (void *)&(szone->tiny_magazines[-1]), TINY_MAGAZINE_PAGED_SIZE, SCALABLE_MALLOC_ADD_GUARD_PAGES);
 	deallocate_pages(szone, (void *)&(szone->small_magazines[-1]), SMALL_MAGAZINE_PAGED_SIZE, SCALABLE_MALLOC_ADD_GUARD_PAGES);
+	deallocate_pages(szone, (void *)szone->tiny_class_stats, TINY_CLASS_STATS_PAGED_SIZE, 0);
+	deallocate_pages(szone, (void *)szone->small_class_stats, SMALL_CLASS_STATS_PAGED_SIZE, 0);
 	deallocate_pages(szone, (void *)szone, SZONE_PAGED_SIZE, 0);
 }
 
@@ -6697,8 +8081,7 @@ szone_ptr_in_use_enumerator(task_t task, void *context, unsigned type_mask, vm_a
 	err = small_in_use_enumerator(task, context, type_mask, szone, reader, recorder);
 	if (err) return err;
 
-	err = large_in_use_enumerator(task, context, type_mask,
-								  (vm_address_t)szone->large_entries, szone->num_large_entries, reader, recorder);
+	err = large_shards_in_use_enumerator(task, context, type_mask, szone, reader, recorder);
 	return err;
 }
 
@@ -6775,6 +8158,14 @@ szone_print(szone_t *szone, boolean_t verbose)
 	if (szone->num_tiny_regions_dealloc)
 		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX,
 					   "[%lu tiny regions have been vm_deallocate'd]\n", szone->num_tiny_regions_dealloc);
+	if (szone->debug_flags & SCALABLE_MALLOC_HUGE_PAGES)
+		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX,
+					   "[huge pages: mapped=%y released=%y, %u spare tiny arena halves]\n",
+					   szone->huge_page_bytes_mapped, szone->huge_page_bytes_released, szone->num_tiny_arena_spares);
+	if (szone->debug_flags & SCALABLE_MALLOC_BACKGROUND_SCAVENGE)
+		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX,
+					   "[background scavenger: %d dirty depot regions, %lu passes]\n",
+					   szone->scavenge_dirty_regions, szone->scavenge_passes);
 	for (index = 0; index < szone->tiny_region_generation->num_regions_allocated; ++index) {
 		region = szone->tiny_region_generation->hashed_regions[index];
 		if (HASHRING_OPEN_ENTRY != region && HASHRING_REGION_DEALLOCATED != region) {
@@ -6847,7 +8238,8 @@ szone_force_lock(szone_t *szone)
 	}
 	szone_force_lock_magazine(szone, &szone->small_magazines[DEPOT_MAGAZINE_INDEX]);
 
-	SZONE_LOCK(szone);
+	large_force_lock(szone);
+	_malloc_lock_lock(&szone->class_stats_lock);
 }
 
 static void
@@ -6855,7 +8247,8 @@ szone_force_unlock(szone_t *szone)
 {
 	mag_index_t i;
 
-	SZONE_UNLOCK(szone);
+	_malloc_lock_unlock(&szone->class_stats_lock);
+	large_force_unlock(szone);
 
 	for (i = -1; i < szone->num_small_magazines; ++i) {
 		SZONE_MAGAZINE_PTR_UNLOCK(szone, (&(szone->small_magazines[i])));
@@ -6872,10 +8265,8 @@ szone_locked(szone_t *szone)
 	mag_index_t i;
 	int tookLock;
 
-	tookLock = SZONE_TRY_LOCK(szone);
-	if (tookLock == 0)
+	if (large_locked(szone))
 		return 1;
-	SZONE_UNLOCK(szone);
 
 	for (i = -1; i < szone->num_small_magazines; ++i) {
 		tookLock = SZONE_MAGAZINE_PTR_TRY_LOCK(szone, (&(szone->small_magazines[i])));
@@ -6898,6 +8289,14 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 {
 	size_t total = 0;
 
+	if (szone->debug_flags & SCALABLE_MALLOC_BACKGROUND_SCAVENGE) {
+		// The sweep below passes over Depot'd regions, so first finish whatever the scavenger has yet to reach.
+		while (tiny_scavenge_depot(szone, SCAVENGE_REGIONS_PER_PASS))
+			;
+		while (small_scavenge_depot(szone, SCAVENGE_REGIONS_PER_PASS))
+			;
+	}
+
 #if MADVISE_PRESSURE_RELIEF
 	mag_index_t mag_index;
 
@@ -7050,6 +8449,9 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 #endif
 
 #if LARGE_CACHE
+	// Per-CPU large caches hold dirty pages; give them all back
+	total += large_percpu_caches_flush(szone);
+
 	if (szone->flotsam_enabled) {
 		SZONE_LOCK(szone);
 
@@ -7059,11 +8461,10 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 
 		memcpy((void *)local_entry_cache, (void *)szone->large_entry_cache, sizeof(local_entry_cache));
 
+		large_entry_cache_uncharge_all_no_lock(szone); // the per-CPU caches keep their share
 		szone->large_entry_cache_oldest = szone->large_entry_cache_newest = 0;
 		szone->large_entry_cache[0].address = 0x0;
 		szone->large_entry_cache[0].size = 0;
-		szone->large_entry_cache_bytes = 0;
-		szone->large_entry_cache_reserve_bytes = 0;
 
 		szone->flotsam_enabled = FALSE;
 
@@ -7147,6 +8548,171 @@ scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats, unsign
 	return 0;
 }
 
+// Sums one slot over the Depot (row 0) and the magazines, without locking
+static void
+class_stats_sum(class_stats_t *rows, int num_magazines, unsigned stride, grain_t slot, class_stats_t *sum)
+{
+	int	row;
+
+	memset(sum, 0, sizeof(class_stats_t));
+	for (row = 0; row <= num_magazines; row++) {
+		sum->num_allocs += rows[row * stride + slot].num_allocs;
+		sum->num_frees += rows[row * stride + slot].num_frees;
+		sum->bytes_free += rows[row * stride + slot].bytes_free;
+	}
+}
+
+static void
+large_class_stats_sum(szone_t *szone, class_stats_t *sum)
+{
+	unsigned	i;
+
+	memset(sum, 0, sizeof(class_stats_t));
+	for (i = 0; i < LARGE_ENTRY_SHARDS; i++) {
+		sum->num_allocs += szone->large_shards[i].num_large_allocs;
+		sum->num_frees += szone->large_shards[i].num_large_frees;
+	}
+#if LARGE_CACHE
+	// "Free" large memory is what death-row and the per-CPU caches hold for reuse
+	sum->bytes_free = szone->large_entry_cache_bytes;
+#endif
+}
+
+boolean_t
+scalable_zone_class_statistics(malloc_zone_t *zone, unsigned subzone, unsigned slot, scalable_zone_class_statistics_t *stats)
+{
+	szone_t		*szone = (szone_t *)zone;
+	class_stats_t	sum;
+
+	switch (subzone) {
+		case 0:
+			if (!szone->tiny_class_stats || slot >= NUM_TINY_SLOTS)
+				return 0;
+			class_stats_sum(szone->tiny_class_stats, szone->num_tiny_magazines, NUM_TINY_SLOTS, slot, &sum);
+			stats->block_size = TINY_BYTES_FOR_MSIZE(slot + 1);
+			stats->blocks_in_use = sum.num_allocs - sum.num_frees;
+			stats->size_in_use = stats->blocks_in_use * stats->block_size;
+			break;
+		case 1:
+			if (!szone->small_class_stats || slot >= szone->num_small_slots)
+				return 0;
+			class_stats_sum(szone->small_class_stats, szone->num_small_magazines, NUM_SMALL_SLOTS_LARGEMEM, slot, &sum);
+			stats->block_size = SMALL_BYTES_FOR_MSIZE(slot + 1);
+			stats->blocks_in_use = sum.num_allocs - sum.num_frees;
+			stats->size_in_use = stats->blocks_in_use * stats->block_size;
+			break;
+		case 2:
+			if (slot != 0)
+				return 0;
+			large_class_stats_sum(szone, &sum);
+			stats->block_size = 0;
+			stats->blocks_in_use = szone->num_large_objects_in_use;
+			stats->size_in_use = szone->num_bytes_in_large_objects;
+			break;
+		default:
+			return 0;
+	}
+	stats->size_free = sum.bytes_free;
+	stats->total_allocs = sum.num_allocs;
+	stats->total_frees = sum.num_frees;
+	return 1;
+}
+
+void
+scalable_zone_print_class_statistics(malloc_zone_t *zone, int fd, boolean_t json)
+{
+	static const char	*subzone_names[] = { "tiny", "small", "large" };
+	szone_t		*szone = (szone_t *)zone;
+	_SIMPLE_STRING	b = _simple_salloc();
+	struct timeval	now;
+	uint64_t		now_usec, elapsed_usec;
+	unsigned		subzone, slot, num_slots;
+	boolean_t		first = TRUE;
+
+	if (!b)
+		return;
+
+	// Concurrent prints would otherwise interleave their updates of the snapshot rows and the interval
+	_malloc_lock_lock(&szone->class_stats_lock);
+	gettimeofday(&now, NULL);
+	now_usec = (uint64_t)now.tv_sec * 1000000ULL + now.tv_usec;
+	elapsed_usec = szone->class_stats_snapshot_usec ? now_usec - szone->class_stats_snapshot_usec : 0;
+	szone->class_stats_snapshot_usec = now_usec;
+
+	if (json)
+		_simple_sprintf(b, "{\"zone\": \"%p\", \"interval_usec\": %llu, \"classes\": [",
+						szone, (unsigned long long)elapsed_usec);
+	else
+		_simple_sprintf(b, "Scalable zone %p: size classes, rates over the last %llu usec\n"
+						"class\tsize\tin_use\tbytes_in_use\tbytes_free\tallocs\tfrees\tallocs/s\tfrees/s\n",
+						szone, (unsigned long long)elapsed_usec);
+
+	for (subzone = 0; subzone < 3; subzone++) {
+		num_slots = (subzone == 0) ? NUM_TINY_SLOTS : (subzone == 1) ? szone->num_small_slots : 1;
+		for (slot = 0; slot < num_slots; slot++) {
+			scalable_zone_class_statistics_t	stats;
+			class_stats_t	*snapshot;
+			unsigned long long	alloc_rate = 0, free_rate = 0;
+
+			if (!scalable_zone_class_statistics(zone, subzone, slot, &stats))
+				continue;
+			if (!stats.total_allocs && !stats.size_free)
+				continue; // never used
+
+			if (subzone == 0)
+				snapshot = &szone->tiny_class_stats[CLASS_STATS_SNAPSHOT_ROW(TINY_MAX_MAGAZINES) * NUM_TINY_SLOTS + slot];
+			else if (subzone == 1)
+				snapshot = &szone->small_class_stats[CLASS_STATS_SNAPSHOT_ROW(SMALL_MAX_MAGAZINES) * NUM_SMALL_SLOTS_LARGEMEM + slot];
+			else
+				snapshot = &szone->large_class_stats_snapshot;
+			if (elapsed_usec) {
+				alloc_rate = (unsigned long long)(stats.total_allocs - snapshot->num_allocs) * 1000000ULL / elapsed_usec;
+				free_rate = (unsigned long long)(stats.total_frees - snapshot->num_frees) * 1000000ULL / elapsed_usec;
+			}
+			snapshot->num_allocs = stats.total_allocs;
+			snapshot->num_frees = stats.total_frees;
+
+			if (json) {
+				_simple_sprintf(b, "%s\n  {\"class\": \"%s\", \"size\": %llu, \"in_use\": %llu, \"bytes_in_use\": %llu, "
+								"\"bytes_free\": %llu, \"allocs\": %llu, \"frees\": %llu, "
+								"\"allocs_per_sec\": %llu, \"frees_per_sec\": %llu}",
+								first ? "" : ",", subzone_names[subzone], (unsigned long long)stats.block_size,
+								(unsigned long long)stats.blocks_in_use, (unsigned long long)stats.size_in_use,
+								(unsigned long long)stats.size_free, (unsigned long long)stats.total_allocs,
+								(unsigned long long)stats.total_frees, alloc_rate, free_rate);
+			} else {
+				_simple_sprintf(b, "%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+								subzone_names[subzone], (unsigned long long)stats.block_size,
+								(unsigned long long)stats.blocks_in_use, (unsigned long long)stats.size_in_use,
+								(unsigned long long)stats.size_free, (unsigned long long)stats.total_allocs,
+								(unsigned long long)stats.total_frees, alloc_rate, free_rate);
+			}
+			first = FALSE;
+		}
+	}
+	_malloc_lock_unlock(&szone->class_stats_lock);
+	if (json)
+		_simple_sappend(b, "\n]}\n");
+
+	_simple_put(b, fd);
+	_simple_sfree(b);
+}
+
+boolean_t
+scalable_zone_huge_page_statistics(malloc_zone_t *zone, size_t *bytes_mapped, size_t *bytes_released)
+{
+	szone_t *szone = (szone_t *)zone;
+
+	if (!(szone->debug_flags & SCALABLE_MALLOC_HUGE_PAGES))
+		return 0;
+
+	if (bytes_mapped)
+		*bytes_mapped = szone->huge_page_bytes_mapped;
+	if (bytes_released)
+		*bytes_released = szone->huge_page_bytes_released;
+	return 1;
+}
+
 static void
 szone_statistics(szone_t *szone, malloc_statistics_t *stats)
 {
@@ -7365,7 +8931,8 @@ create_scalable_zone(size_t initial_size, unsigned debug_flags)
 	mprotect(szone, sizeof(szone->basic_zone), PROT_READ); /* Prevent overwriting the function pointers in basic_zone. */
 
 	szone->debug_flags = debug_flags;
-	_malloc_lock_init(&szone->large_szone_lock);
+	szone->scavenge_deferred = (debug_flags & SCALABLE_MALLOC_BACKGROUND_SCAVENGE) != 0;
+	large_locks_init(szone);
 
 #if defined(__ppc__) || defined(__ppc64__)
 	/*
@@ -7396,6 +8963,10 @@ create_scalable_zone(size_t initial_size, unsigned debug_flags)
 
 	szone->tiny_magazines = &(tiny_magazines[1]); // szone->tiny_magazines[-1] is the Depot
 
+	szone->tiny_class_stats = allocate_pages(NULL, TINY_CLASS_STATS_PAGED_SIZE, 0, 0, VM_MEMORY_MALLOC);
+	if (NULL == szone->tiny_class_stats)
+		return NULL;
+
 	// The magazines are indexed in [0 .. (num_tiny_magazines - 1)]
 	// Find the smallest power of 2 that exceeds (num_tiny_magazines - 1)
 	szone->num_tiny_magazines_mask_shift = 0;
@@ -7415,6 +8986,11 @@ create_scalable_zone(size_t initial_size, unsigned debug_flags)
 	szone->num_tiny_magazines_mask = i - 1; // A mask used for hashing to a magazine index (and a safety aid)
 	szone->last_tiny_advise = 0;
 
+#if LARGE_CACHE
+	// Each per-CPU large cache may hoard its share of what death-row would hold without madvise()
+	szone->large_percpu_cache_limit = szone->large_entry_cache_reserve_limit / (szone->num_tiny_magazines_mask + 1);
+#endif
+
 	// Init the tiny_magazine locks
 	_malloc_lock_init(&szone->tiny_regions_lock);
 	_malloc_lock_init(&szone->tiny_magazines[DEPOT_MAGAZINE_INDEX].magazine_lock);
@@ -7432,6 +9008,10 @@ create_scalable_zone(size_t initial_size, unsigned debug_flags)
 
 	szone->small_magazines = &(small_magazines[1]); // szone->small_magazines[-1] is the Depot
 
+	szone->small_class_stats = allocate_pages(NULL, SMALL_CLASS_STATS_PAGED_SIZE, 0, 0, VM_MEMORY_MALLOC);
+	if (NULL == szone->small_class_stats)
+		return NULL;
+
 	// The magazines are indexed in [0 .. (num_small_magazines - 1)]
 	// Find the smallest power of 2 that exceeds (num_small_magazines - 1)
 	szone->num_small_magazines_mask_shift = 0;
@@ -7457,6 +9037,8 @@ create_scalable_zone(size_t initial_size, unsigned debug_flags)
 		_malloc_lock_init(&szone->small_magazines[i].magazine_lock);
 	}
 
+	_malloc_lock_init(&szone->class_stats_lock);
+
 	CHECK(szone, __PRETTY_FUNCTION__);
 	return (malloc_zone_t *)szone;
 }
@@ -7522,11 +9104,12 @@ purgeable_valloc(szone_t *szone, size_t size)
 static void
 purgeable_free(szone_t *szone, void *ptr)
 {
+	large_shard_t	*shard = LARGE_SHARD_FOR_PTR(szone, ptr);
 	large_entry_t	*entry;
 
-	SZONE_LOCK(szone);
-	entry = large_entry_for_pointer_no_lock(szone, ptr);
-	SZONE_UNLOCK(szone);
+	LARGE_SHARD_LOCK(shard);
+	entry = large_entry_for_pointer_no_lock(shard, ptr);
+	LARGE_SHARD_UNLOCK(shard);
 	if (entry) {
 		return free_large(szone, ptr);
 	} else {
@@ -7607,20 +9190,7 @@ static void
 purgeable_destroy(szone_t *szone)
 {
 	/* destroy large entries */
-	size_t index = szone->num_large_entries;
-	large_entry_t	*large;
-	vm_range_t		range_to_deallocate;
-	
-	while (index--) {
-		large = szone->large_entries + index;
-		if (large->address) {
-			// we deallocate_pages, including guard pages
-			deallocate_pages(szone, (void *)(large->address), large->size, szone->debug_flags);
-		}
-	}
-	large_entries_free_no_lock(szone, szone->large_entries, szone->num_large_entries, &range_to_deallocate);
-	if (range_to_deallocate.size)
-		deallocate_pages(szone, (void *)range_to_deallocate.address, (size_t)range_to_deallocate.size, 0);
+	large_shards_destroy(szone);
 	
 	/* Now destroy the separate szone region */
 	deallocate_pages(szone, (void *)szone, SZONE_PAGED_SIZE, 0);
@@ -7659,8 +9229,7 @@ purgeable_ptr_in_use_enumerator(task_t task, void *context, unsigned type_mask,
 	err = reader(task, zone_address, sizeof(szone_t), (void **)&szone);
 	if (err) return err;
 	
-	err = large_in_use_enumerator(task, context, type_mask, 
-								  (vm_address_t)szone->large_entries, szone->num_large_entries, reader, recorder);
+	err = large_shards_in_use_enumerator(task, context, type_mask, szone, reader, recorder);
 	return err;
 }
 
@@ -7698,13 +9267,13 @@ purgeable_log(malloc_zone_t *zone, void *log_address)
 static void
 purgeable_force_lock(szone_t *szone)
 {    
-	SZONE_LOCK(szone);
+	large_force_lock(szone);
 }
 
 static void
 purgeable_force_unlock(szone_t *szone)
 {    
-	SZONE_UNLOCK(szone);
+	large_force_unlock(szone);
 }
 
 static void
@@ -7717,13 +9286,7 @@ purgeable_statistics(szone_t *szone, malloc_statistics_t *stats)
 static boolean_t
 purgeable_locked(szone_t *szone) 
 {
-	int tookLock;
-	
-	tookLock = SZONE_TRY_LOCK(szone);
-	if (tookLock == 0)
-		return 1;
-	SZONE_UNLOCK(szone);
-	return 0;
+	return large_locked(szone);
 }
 
 static size_t
@@ -7831,7 +9394,7 @@ create_purgeable_zone(size_t initial_size, malloc_zone_t *malloc_default_zone, u
 		szone->debug_flags &= ~SCALABLE_MALLOC_ADD_GUARD_PAGES;
 	}
 	
-	_malloc_lock_init(&szone->large_szone_lock);
+	large_locks_init(szone);
 	
 	szone->helper_zone = (struct szone_s *)malloc_default_zone;
 	
@@ -29,6 +29,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -139,6 +141,7 @@ static int *pFRZCounterLive= &counterAlice, *pFRZCounterDrain = &counterBob;
 #define DEFAULT_PUREGEABLE_ZONE_STRING "DefaultPurgeableMallocZone"
 
 boolean_t malloc_engaged_nano(void);
+void szone_forked_scavengers(void);
 #if CONFIG_NANOZONE
 extern boolean_t _malloc_engaged_nano;
 malloc_zone_t *create_nano_zone(size_t initial_size, malloc_zone_t *helper_zone, unsigned debug_flags);
@@ -615,6 +618,43 @@ set_flags_from_environment(void) {
 		malloc_debug_flags |= SCALABLE_MALLOC_ABORT_ON_ERROR;
 		_malloc_printf(ASL_LEVEL_INFO, "enabling abort() on bad malloc or free\n");
 	}
+	if (getenv("MallocHugePages")) {
+		malloc_debug_flags |= SCALABLE_MALLOC_HUGE_PAGES;
+		_malloc_printf(ASL_LEVEL_INFO, "backing tiny and small regions with huge pages\n");
+	}
+	if (getenv("MallocFreeListXor")) {
+		malloc_debug_flags |= SCALABLE_MALLOC_XOR_FREE_LIST;
+		_malloc_printf(ASL_LEVEL_INFO, "protecting free list links by XOR with a secret instead of a checksum\n");
+	}
+	if (getenv("MallocBackgroundScavenge")) {
+		malloc_debug_flags |= SCALABLE_MALLOC_BACKGROUND_SCAVENGE;
+		_malloc_printf(ASL_LEVEL_INFO, "returning free memory to the OS from a background thread\n");
+	}
+	flag = getenv("MallocHeapSample");
+	if (flag) {
+		size_t	mean_bytes = strtoul(flag, NULL, 0);
+		int		signo = SIGUSR2;
+		if (mean_bytes == 0) mean_bytes = 512 * 1024;
+		flag = getenv("MallocHeapSampleSignal");
+		if (flag)
+			signo = (int)strtol(flag, NULL, 0);
+		__heap_sample_enable(mean_bytes, signo, getenv("MallocHeapSampleFile"));
+		if (signo > 0)
+			_malloc_printf(ASL_LEVEL_INFO, "sampling one allocation every %lu bytes on average; signal %d writes a heap profile\n", (unsigned long)mean_bytes, signo);
+		else
+			_malloc_printf(ASL_LEVEL_INFO, "sampling one allocation every %lu bytes on average\n", (unsigned long)mean_bytes);
+	}
+	flag = getenv("MallocGuardSample");
+	if (flag) {
+		size_t		rate = strtoul(flag, NULL, 0);
+		unsigned	num_slots = 256;
+		if (rate == 0) rate = 5000;
+		flag = getenv("MallocGuardSampleSlots");
+		if (flag && strtoul(flag, NULL, 0))
+			num_slots = (unsigned)strtoul(flag, NULL, 0);
+		__guard_sample_enable(rate, num_slots);
+		_malloc_printf(ASL_LEVEL_INFO, "guarding one allocation in %lu on average, at most %u at a time\n", (unsigned long)rate, num_slots);
+	}
 #if CONFIG_NANOZONE
 	/* Explicit overrides from the environment */
 	if ((flag = getenv("MallocNanoZone"))) {
@@ -684,6 +724,16 @@ set_flags_from_environment(void) {
 					   "- MallocCorruptionAbort to abort on malloc errors, but not on out of memory for 32-bit processes\n"
 					   "  MallocCorruptionAbort is always set on 64-bit processes\n"
 					   "- MallocErrorAbort to abort on any malloc error, including out of memory\n"
+					   "- MallocHugePages to back tiny and small regions with 2MB aligned, huge page advised memory\n"
+					   "- MallocBackgroundScavenge to madvise and unmap free tiny and small memory off the free() path\n"
+					   "- MallocFreeListXor to protect free list links with an XOR secret and sampled link checks,\n"
+					   "  which is cheaper than the default checksum\n"
+					   "- MallocHeapSample <n> to record the stack of one allocation every <n> bytes on average (default 512KB)\n"
+					   "- MallocHeapSampleSignal <s> to write a pprof heap profile on signal <s> (default SIGUSR2, 0 for none)\n"
+					   "- MallocHeapSampleFile <f> to name heap profiles <f>.<pid>.<n>.heap; default is /tmp/malloc_heap\n"
+					   "- MallocGuardSample <n> to put one allocation in <n> (default 5000) of up to a page between guard pages\n"
+					   "  and report overflows, use after free and double frees of it with the allocation and free stacks\n"
+					   "- MallocGuardSampleSlots <n> to guard at most <n> blocks at a time (default 256)\n"
 					   "- MallocHelp - this help!\n");
 	}
 }
@@ -805,6 +855,53 @@ internal_check(void) {
 	malloc_check_start += malloc_check_each;
 }
 
+/*
+ * Poisson sampling for the heap profile: charge size against this thread's
+ * countdown and only leave the fast path when it runs out.
+ */
+static inline void
+heap_sample_note_allocation(void *ptr, size_t size) {
+	uintptr_t	bytes_left = (uintptr_t)pthread_getspecific(heap_sample_key);
+	if (bytes_left > size)
+		pthread_setspecific(heap_sample_key, (void *)(bytes_left - size));
+	else
+		__heap_sample_allocation(ptr, size, bytes_left);
+}
+
+/*
+ * Guarded sampling: count allocations from the default zone down in the same way
+ * and serve the one that reaches zero from the guard page pool.
+ */
+static inline boolean_t
+guard_sample_take(malloc_zone_t *zone) {
+	uintptr_t	left;
+	if (zone != malloc_zones[0])
+		return FALSE;
+	left = (uintptr_t)pthread_getspecific(guard_sample_key);
+	if (left > 1) {
+		pthread_setspecific(guard_sample_key, (void *)(left - 1));
+		return FALSE;
+	}
+	pthread_setspecific(guard_sample_key, (void *)__guard_sample_next_interval());
+	return left == 1;
+}
+
+static inline boolean_t
+guard_sample_owns(const void *ptr) {
+	return (uintptr_t)ptr - guard_sample_base < guard_sample_bytes;
+}
+
+static void *
+guard_sample_realloc(malloc_zone_t *zone, void *ptr, size_t size) {
+	size_t	old_size = __guard_sample_size(ptr);
+	void	*new_ptr = zone->malloc(zone, size);
+	if (new_ptr) {
+		memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+		__guard_sample_free(ptr);
+	}
+	return new_ptr;
+}
+
 void *
 malloc_zone_malloc(malloc_zone_t *zone, size_t size) {
 	void	*ptr;
@@ -814,7 +911,13 @@ malloc_zone_malloc(malloc_zone_t *zone, size_t size) {
 	if (size > MALLOC_ABSOLUTE_MAX_SIZE) {
 		return NULL;
 	}
-	ptr = zone->malloc(zone, size);
+	ptr = NULL;
+	if (guard_sample_rate && guard_sample_take(zone))
+		ptr = __guard_sample_malloc(size, 0, FALSE);
+	if (!ptr)
+		ptr = zone->malloc(zone, size);
+	if (heap_sample_interval)
+		heap_sample_note_allocation(ptr, size);
 	if (malloc_logger)
 		malloc_logger(MALLOC_LOG_TYPE_ALLOCATE | MALLOC_LOG_TYPE_HAS_ZONE, (uintptr_t)zone, (uintptr_t)size, 0, (uintptr_t)ptr, 0);
 	return ptr;
@@ -829,7 +932,13 @@ malloc_zone_calloc(malloc_zone_t *zone, size_t num_items, size_t size) {
 	if (size > MALLOC_ABSOLUTE_MAX_SIZE) {
 		return NULL;
 	}
-	ptr = zone->calloc(zone, num_items, size);
+	ptr = NULL;
+	if (guard_sample_rate && guard_sample_take(zone) && (!num_items || (num_items * size) / num_items == size))
+		ptr = __guard_sample_malloc(num_items * size, 0, TRUE);
+	if (!ptr)
+		ptr = zone->calloc(zone, num_items, size);
+	if (heap_sample_interval)
+		heap_sample_note_allocation(ptr, num_items * size);
 	if (malloc_logger)
 		malloc_logger(MALLOC_LOG_TYPE_ALLOCATE | MALLOC_LOG_TYPE_HAS_ZONE | MALLOC_LOG_TYPE_CLEARED, (uintptr_t)zone, (uintptr_t)(num_items * size), 0,
 					  (uintptr_t)ptr, 0);
@@ -846,6 +955,8 @@ malloc_zone_valloc(malloc_zone_t *zone, size_t size) {
 		return NULL;
 	}
 	ptr = zone->valloc(zone, size);
+	if (heap_sample_interval)
+		heap_sample_note_allocation(ptr, size);
 	if (malloc_logger)
 		malloc_logger(MALLOC_LOG_TYPE_ALLOCATE | MALLOC_LOG_TYPE_HAS_ZONE, (uintptr_t)zone, (uintptr_t)size, 0, (uintptr_t)ptr, 0);
 	return ptr;
@@ -854,13 +965,29 @@ malloc_zone_valloc(malloc_zone_t *zone, size_t size) {
 void *
 malloc_zone_realloc(malloc_zone_t *zone, void *ptr, size_t size) {
 	void	*new_ptr;
+	boolean_t	sampled = FALSE;
+	size_t	sampled_size = 0;
+	uint32_t	sampled_stack = 0;
 	if (malloc_check_start && (malloc_check_counter++ >= malloc_check_start)) {
 		internal_check();
 	}
 	if (size > MALLOC_ABSOLUTE_MAX_SIZE) {
 		return NULL;
 	}
-	new_ptr = zone->realloc(zone, ptr, size);
+	/*
+	 * Forget ptr before the zone can free it: once it is freed another thread may be
+	 * handed the same address and sample it. Restore the sample if ptr survives.
+	 */
+	if (heap_sample_live && ptr)
+		sampled = __heap_sample_detach(ptr, &sampled_size, &sampled_stack);
+	if (guard_sample_owns(ptr))
+		new_ptr = guard_sample_realloc(zone, ptr, size);
+	else
+		new_ptr = zone->realloc(zone, ptr, size);
+	if (sampled && !new_ptr && size)
+		__heap_sample_reattach(ptr, sampled_size, sampled_stack);
+	if (heap_sample_interval)
+		heap_sample_note_allocation(new_ptr, size);
 	if (malloc_logger)
 		malloc_logger(MALLOC_LOG_TYPE_ALLOCATE | MALLOC_LOG_TYPE_DEALLOCATE | MALLOC_LOG_TYPE_HAS_ZONE, (uintptr_t)zone, (uintptr_t)ptr, (uintptr_t)size,
 					  (uintptr_t)new_ptr, 0);
@@ -871,26 +998,38 @@ void
 malloc_zone_free(malloc_zone_t *zone, void *ptr) {
 	if (malloc_logger)
 		malloc_logger(MALLOC_LOG_TYPE_DEALLOCATE | MALLOC_LOG_TYPE_HAS_ZONE, (uintptr_t)zone, (uintptr_t)ptr, 0, 0, 0);
+	if (heap_sample_live)
+		__heap_sample_free(ptr);
 	if (malloc_check_start && (malloc_check_counter++ >= malloc_check_start)) {
 		internal_check();
 	}
-	zone->free(zone, ptr);
+	if (guard_sample_owns(ptr))
+		__guard_sample_free(ptr);
+	else
+		zone->free(zone, ptr);
 }
 
 static void
 malloc_zone_free_definite_size(malloc_zone_t *zone, void *ptr, size_t size) {
 	if (malloc_logger)
 		malloc_logger(MALLOC_LOG_TYPE_DEALLOCATE | MALLOC_LOG_TYPE_HAS_ZONE, (uintptr_t)zone, (uintptr_t)ptr, 0, 0, 0);
+	if (heap_sample_live)
+		__heap_sample_free(ptr);
 	if (malloc_check_start && (malloc_check_counter++ >= malloc_check_start)) {
 		internal_check();
 	}
-	zone->free_definite_size(zone, ptr, size);
+	if (guard_sample_owns(ptr))
+		__guard_sample_free(ptr);
+	else
+		zone->free_definite_size(zone, ptr, size);
 }
 
 malloc_zone_t *
 malloc_zone_from_ptr(const void *ptr) {
 	if (!ptr)
 		return NULL;
+	else if (guard_sample_owns(ptr))
+		return inline_malloc_default_zone();
 	else
 		return find_registered_zone(ptr, NULL);
 }
@@ -912,7 +1051,13 @@ malloc_zone_memalign(malloc_zone_t *zone, size_t alignment, size_t size) {
 		0 != (alignment & (alignment - 1))) {	// relies on sizeof(void *) being a power of two.
 		return NULL;
 	}
-	ptr = zone->memalign(zone, alignment, size);
+	ptr = NULL;
+	if (guard_sample_rate && guard_sample_take(zone))
+		ptr = __guard_sample_malloc(size, alignment, FALSE);
+	if (!ptr)
+		ptr = zone->memalign(zone, alignment, size);
+	if (heap_sample_interval)
+		heap_sample_note_allocation(ptr, size);
 	if (malloc_logger)
 		malloc_logger(MALLOC_LOG_TYPE_ALLOCATE | MALLOC_LOG_TYPE_HAS_ZONE, (uintptr_t)zone, (uintptr_t)size, 0, (uintptr_t)ptr, 0);
 	return ptr;
@@ -1076,6 +1221,10 @@ free(void *ptr) {
 	size_t		size;
 	if (!ptr)
 		return;
+	if (guard_sample_owns(ptr)) {
+		malloc_zone_free(inline_malloc_default_zone(), ptr);
+		return;
+	}
 	zone = find_registered_zone(ptr, &size);
 	if (!zone) {
 		malloc_printf("*** error for object %p: pointer being freed was not allocated\n"
@@ -1115,7 +1264,7 @@ realloc(void *in_ptr, size_t new_size) {
 	if (!old_ptr) {
 		retval = malloc_zone_malloc(inline_malloc_default_zone(), new_size);
 	} else {
-		zone = find_registered_zone(old_ptr, NULL);
+		zone = guard_sample_owns(old_ptr) ? inline_malloc_default_zone() : find_registered_zone(old_ptr, NULL);
 		if (!zone) {
 			malloc_printf("*** error for object %p: pointer being realloc'd was not allocated\n"
 						  "*** set a breakpoint in malloc_error_break to debug\n", old_ptr);
@@ -1164,6 +1313,8 @@ malloc_size(const void *ptr) {
 
 	if (!ptr)
 		return size;
+	if (guard_sample_owns(ptr))
+		return __guard_sample_size(ptr);
 
 	(void)find_registered_zone(ptr, &size);
 	return size;
@@ -1313,6 +1464,11 @@ malloc_zone_batch_malloc(malloc_zone_t *zone, size_t size, void **results, unsig
 		internal_check();
 	}
 	unsigned	batched = batch_malloc(zone, size, results, num_requested);
+	if (heap_sample_interval) {
+		unsigned	index = 0;
+		while (index < batched)
+			heap_sample_note_allocation(results[index++], size);
+	}
 	if (malloc_logger) {
 		unsigned	index = 0;
 		while (index < batched) {
@@ -1335,6 +1491,20 @@ malloc_zone_batch_free(malloc_zone_t *zone, void **to_be_freed, unsigned num) {
 			index++;
 		}
 	}
+	if (heap_sample_live) {
+		unsigned	index = 0;
+		while (index < num)
+			__heap_sample_free(to_be_freed[index++]);
+	}
+	if (guard_sample_bytes) {
+		unsigned	index = 0;
+		for (; index < num; index++) {
+			if (guard_sample_owns(to_be_freed[index])) {
+				__guard_sample_free(to_be_freed[index]);
+				to_be_freed[index] = NULL;
+			}
+		}
+	}
 	void	(*batch_free)(malloc_zone_t *, void **, unsigned) = zone-> batch_free;
 	if (batch_free) {
 		batch_free(zone, to_be_freed, num);
@@ -1526,13 +1696,17 @@ _malloc_unlock_all(void (*callout)(void)) {
 // surviving threads after the fork.
 void
 _malloc_fork_prepare(void) {
+	__heap_sample_fork_prepare();
+	__guard_sample_fork_prepare();
 	return _malloc_lock_all(&__stack_logging_fork_prepare);
 }
 
 // Called in the parent process after fork() to resume normal operation.
 void
 _malloc_fork_parent(void) {
-	return _malloc_unlock_all(&__stack_logging_fork_parent);
+	_malloc_unlock_all(&__stack_logging_fork_parent);
+	__guard_sample_fork_parent();
+	__heap_sample_fork_parent();
 }
 
 // Called in the child process after fork() to resume normal operation.
@@ -1542,7 +1716,10 @@ _malloc_fork_child(void) {
 	if (_malloc_is_initialized && _malloc_engaged_nano)
 		nano_forked_zone(inline_malloc_default_zone());
 #endif
-	return _malloc_unlock_all(&__stack_logging_fork_child);
+	_malloc_unlock_all(&__stack_logging_fork_child);
+	szone_forked_scavengers();
+	__guard_sample_fork_child();
+	__heap_sample_fork_child();
 }
 
 /*
@@ -48,6 +48,10 @@
 
 #include <os/tsd.h>
 
+#if defined(__linux__)
+#include <sys/rseq.h>
+#endif
+
 #if defined(__x86_64__)
 #define __APPLE_API_PRIVATE
 #include <machine/cpu_capabilities.h>
@@ -86,6 +90,17 @@ extern uint64_t malloc_entropy[2];
 
 #define NANO_MAG_INDEX(nz)		(_os_cpu_number() >> nz->hyper_shift)
 
+/*
+ * Where the kernel offers restartable sequences (Linux rseq, registered per thread by libc) each logical
+ * CPU gets a small cache of free blocks per slot that it pushes and pops with plain loads and stores.
+ * Elsewhere, and for threads without a usable rseq area, everything goes through the atomic slot_LIFO.
+ */
+#if defined(__linux__) && defined(__x86_64__) && defined(RSEQ_SIG)
+#define NANO_RSEQ			1
+#else
+#define NANO_RSEQ			0
+#endif
+
 #define SCRIBBLE_BYTE			0xaa /* allocated scribble */
 #define SCRABBLE_BYTE			0x55 /* free()'d scribble */
 #define SCRUBBLE_BYTE			0xdd /* madvise(..., MADV_FREE) scriblle */
@@ -174,6 +189,15 @@ typedef struct nano_meta_s {
 	unsigned int		slot_objects; // 该slot中可以多少个object(slot总内存/slot_bytes)
 } *nano_meta_admin_t;
 
+#if NANO_RSEQ
+#define NANO_RSEQ_CACHE_DEPTH		15 /* count + blocks fill two cache lines */
+
+typedef struct nano_rseq_cache_s {
+	uintptr_t			count;
+	void				*blocks[NANO_RSEQ_CACHE_DEPTH];
+} nano_rseq_cache_t;
+#endif
+
 typedef struct nanozone_s {				// vm_allocate()'d, so page-aligned to begin with.
 	malloc_zone_t		basic_zone;		// first page will be given read-only protection
 	uint8_t			pad[PAGE_MAX_SIZE - sizeof(malloc_zone_t)];
@@ -194,6 +218,15 @@ typedef struct nanozone_s {				// vm_allocate()'d, so page-aligned to begin with
 	/* security cookie */
 	uintptr_t			cookie;
 
+#if NANO_RSEQ
+	/*
+	 * Per logical CPU block caches, only ever touched by a thread running on that CPU from inside an rseq
+	 * critical section. Each holds blocks of its own magazine only. rseq_ncpus is 0 if rseq is unusable.
+	 */
+	unsigned			rseq_ncpus;
+	nano_rseq_cache_t		rseq_cache[NANO_MAG_SIZE][NANO_SLOT_SIZE] CACHE_ALIGN;
+#endif
+
 	/*
 	 * The nano zone constructed by create_nano_zone() would like to hand off tiny, small, and large
 	 * allocations to the default scalable zone. Record the latter as the "helper" zone here.
@@ -264,6 +297,131 @@ nanozone_error(nanozone_t *nanozone, int is_corruption, const char *msg, const v
 	}
 }
 
+#if NANO_RSEQ
+/*********************	RSEQ PER-CPU CACHES	************************/
+
+/*
+ * The critical sections below share one shape: publish the rseq_cs descriptor (3), then from 1 to the
+ * committing store before 2 check we are still on the CPU whose cache was picked and update it. Any
+ * preemption, migration or signal in between sends the kernel to the abort handler (4), which, like a
+ * failed check, gives up (5) and leaves the caller to take the atomic path.
+ */
+#define NANO_RSEQ_STR2(x)		#x
+#define NANO_RSEQ_STR(x)		NANO_RSEQ_STR2(x)
+
+#define NANO_RSEQ_CS_TABLE \
+	".pushsection __rseq_cs, \"aw\"\n\t" \
+	".balign 32\n\t" \
+	"3:\n\t" \
+	".long 0x0, 0x0\n\t" \
+	".quad 1f, (2f - 1f), 4f\n\t" \
+	".popsection\n\t"
+
+#define NANO_RSEQ_ABORT \
+	".pushsection __rseq_failure, \"ax\"\n\t" \
+	".byte 0x0f, 0xb9, 0x3d\n\t" \
+	".long " NANO_RSEQ_STR(RSEQ_SIG) "\n\t" \
+	"4:\n\t" \
+	"jmp 5f\n\t" \
+	".popsection\n\t"
+
+static INLINE struct rseq *
+nano_rseq_area(void)
+{
+	uintptr_t tp;
+
+	__asm__ ("movq %%fs:0, %0" : "=r" (tp));
+	return (struct rseq *)(tp + __rseq_offset);
+}
+
+// The CPU this thread last ran on; rseq_ncpus or beyond when the per-CPU caches can't be used.
+static INLINE unsigned int
+nano_rseq_cpu(nanozone_t *nanozone)
+{
+	if (0 == nanozone->rseq_ncpus)
+		return 0 - 1U;
+	return *(volatile uint32_t *)&(nano_rseq_area()->cpu_id); // RSEQ_CPU_ID_UNINITIALIZED is -1
+}
+
+static INLINE void *
+nano_rseq_pop(nanozone_t *nanozone, unsigned int cpu, unsigned int slot_key)
+{
+	struct rseq		*rs = nano_rseq_area();
+	nano_rseq_cache_t	*cache = &(nanozone->rseq_cache[cpu][slot_key]);
+	void			*ptr = NULL;
+	uintptr_t		n;
+
+	__asm__ __volatile__ (
+		NANO_RSEQ_CS_TABLE
+		"leaq 3b(%%rip), %%rax\n\t"
+		"movq %%rax, %[rseq_cs]\n\t"
+		"1:\n\t"
+		"cmpl %[cpu], %[cpu_id]\n\t"
+		"jnz 5f\n\t"
+		"movq (%[cache]), %[n]\n\t"
+		"testq %[n], %[n]\n\t"
+		"jz 5f\n\t"
+		"movq (%[cache], %[n], 8), %[ptr]\n\t" // blocks[n - 1]
+		"decq %[n]\n\t"
+		"movq %[n], (%[cache])\n\t" // commit
+		"2:\n\t"
+		"jmp 6f\n\t"
+		NANO_RSEQ_ABORT
+		"5:\n\t"
+		"xorl %k[ptr], %k[ptr]\n\t"
+		"6:\n\t"
+		: [ptr] "+r" (ptr), [n] "=&r" (n), [rseq_cs] "=m" (rs->rseq_cs)
+		: [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [cache] "r" (cache)
+		: "rax", "cc", "memory");
+	return ptr;
+}
+
+static INLINE boolean_t
+nano_rseq_push(nanozone_t *nanozone, unsigned int cpu, unsigned int slot_key, void *ptr)
+{
+	struct rseq		*rs = nano_rseq_area();
+	nano_rseq_cache_t	*cache = &(nanozone->rseq_cache[cpu][slot_key]);
+	int			pushed = 0;
+	uintptr_t		n;
+
+	__asm__ __volatile__ (
+		NANO_RSEQ_CS_TABLE
+		"leaq 3b(%%rip), %%rax\n\t"
+		"movq %%rax, %[rseq_cs]\n\t"
+		"1:\n\t"
+		"cmpl %[cpu], %[cpu_id]\n\t"
+		"jnz 5f\n\t"
+		"movq (%[cache]), %[n]\n\t"
+		"cmpq %[depth], %[n]\n\t"
+		"jae 5f\n\t"
+		"movq %[ptr], 8(%[cache], %[n], 8)\n\t" // blocks[n]
+		"incq %[n]\n\t"
+		"movq %[n], (%[cache])\n\t" // commit
+		"2:\n\t"
+		"movl $1, %[pushed]\n\t"
+		NANO_RSEQ_ABORT
+		"5:\n\t"
+		: [pushed] "+r" (pushed), [n] "=&r" (n), [rseq_cs] "=m" (rs->rseq_cs)
+		: [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [cache] "r" (cache), [ptr] "r" (ptr),
+		  [depth] "i" (NANO_RSEQ_CACHE_DEPTH)
+		: "rax", "cc", "memory");
+	return pushed;
+}
+
+// Racy count of the blocks parked in the caches of every CPU sharing mag_index. For statistics only.
+static unsigned
+nano_rseq_cached_count(nanozone_t *nanozone, unsigned int mag_index, unsigned int slot_key)
+{
+	unsigned	cpu, count = 0;
+
+	for (cpu = 0; cpu < nanozone->rseq_ncpus; cpu++) {
+		if ((cpu >> nanozone->hyper_shift) == mag_index)
+			count += MIN(nanozone->rseq_cache[cpu][slot_key].count, NANO_RSEQ_CACHE_DEPTH);
+	}
+	return count;
+}
+#endif /* NANO_RSEQ */
+
 static void
 protect(void *address, size_t size, unsigned protection, unsigned debug_flags)
 {
@@ -621,6 +779,23 @@ segregated_in_use_enumerator(task_t task, void *context, unsigned type_mask, nan
 				}
 				// N.B. pMeta->slot_LIFO in *this* task is now drained (remote free list has *not* been disturbed)
 
+#if NANO_RSEQ
+				// Blocks parked in the per-CPU caches of this magazine are free too
+				unsigned cpu, k;
+				for (cpu = 0; cpu < nanozone->rseq_ncpus; cpu++) {
+					nano_rseq_cache_t *cache = &(nanozone->rseq_cache[cpu][slot_key]);
+
+					if ((cpu >> nanozone->hyper_shift) != mag_index)
+						continue;
+					for (k = 0; k < cache->count && k < NANO_RSEQ_CACHE_DEPTH; k++) {
+						index_t block_index = offset_to_index(nanozone, pMeta, (uintptr_t)cache->blocks[k] - p.addr);
+
+						if (block_index < slot_objects_mapped)
+							bitarray_set(slot_bitarray, log_size, block_index);
+					}
+				}
+#endif
+
 				// Copy the bitarray_t denoting madvise()'d pages (if any) into *this* task's address space
 				bitarray_t madv_page_bitarray;
 				int log_page_count;
@@ -751,10 +926,21 @@ _nano_malloc_check_clear(nanozone_t *nanozone, size_t size, boolean_t cleared_re
 	//将malloc_size 转成对应的slot_size 16 32 ...256
 	unsigned int	slot_bytes = segregated_size_to_fit(nanozone, size, &slot_key);
 	//选择cpu以及对应的内存大小块
+#if NANO_RSEQ
+	unsigned int	cpu = nano_rseq_cpu(nanozone);
+	unsigned int	mag_index = (cpu < nanozone->rseq_ncpus) ? cpu >> nanozone->hyper_shift : NANO_MAG_INDEX(nanozone);
+#else
 	unsigned int	mag_index = NANO_MAG_INDEX(nanozone);
+#endif
 	nano_meta_admin_t	pMeta = &(nanozone->meta_data[mag_index][slot_key]);
 	
 	//检测是否存在已经释放过，可以直接拿来用的内存
+#if NANO_RSEQ
+	ptr = NULL;
+	if (cpu < nanozone->rseq_ncpus)
+		ptr = nano_rseq_pop(nanozone, cpu, slot_key);
+	if (!ptr)
+#endif
 	ptr = OSAtomicDequeue( &(pMeta->slot_LIFO), offsetof(struct chained_block_s,next));
 	if (ptr) {
 #if NANO_FREE_DEQUEUE_DILIGENCE
@@ -886,6 +1072,14 @@ static void _nano_free_trusted_size_check_scribble(nanozone_t *nanozone, void *p
 		((chained_block_t)ptr)->double_free_guard = (0xBADDC0DEDEADBEADULL ^ nanozone->cookie);
 
 		p.addr = (uint64_t)ptr; // place ptr on the dissecting table
+#if NANO_RSEQ
+		unsigned int cpu = nano_rseq_cpu(nanozone);
+
+		// Only blocks of this CPU's own magazine may be parked in its cache
+		if (cpu < nanozone->rseq_ncpus && (cpu >> nanozone->hyper_shift) == p.fields.nano_mag_index &&
+			nano_rseq_push(nanozone, cpu, p.fields.nano_slot, ptr))
+			return;
+#endif
 		//释放nano内存只需要把内存加入到空闲队列
 		pMeta = &(nanozone->meta_data[p.fields.nano_mag_index][p.fields.nano_slot]);
 		OSAtomicEnqueue( &(pMeta->slot_LIFO), ptr, offsetof(struct chained_block_s,next));
@@ -1661,6 +1855,10 @@ count_free(nanozone_t *nanozone, nano_meta_admin_t pMeta)
 	if (head)
 		OSAtomicEnqueue( &(pMeta->slot_LIFO), head, (uintptr_t)tail - (uintptr_t)head + offsetof(struct chained_block_s,next));
 
+#if NANO_RSEQ
+	unsigned int meta_index = (unsigned int)(pMeta - &(nanozone->meta_data[0][0]));
+	count += nano_rseq_cached_count(nanozone, meta_index / NANO_SLOT_SIZE, meta_index % NANO_SLOT_SIZE);
+#endif
 	return count;
 }
 
@@ -2020,6 +2218,12 @@ create_nano_zone(size_t initial_size, malloc_zone_t *helper_zone, unsigned debug
 	}
 	nanozone->cookie = (uintptr_t)malloc_entropy[0] & 0x0000ffffffff0000ULL; // scramble central 32bits with this cookie
 	
+#if NANO_RSEQ
+	/* Per-CPU caches need libc to have registered an rseq area, and a cache for every logical CPU. */
+	if (__rseq_size && nanozone->logical_ncpus <= NANO_MAG_SIZE)
+		nanozone->rseq_ncpus = nanozone->logical_ncpus;
+#endif
+	
 	/* Nano zone does not support SCALABLE_MALLOC_ADD_GUARD_PAGES. */
 	if (nanozone->debug_flags & SCALABLE_MALLOC_ADD_GUARD_PAGES) {
 		_malloc_printf(ASL_LEVEL_INFO, "nano zone does not support guard pages\n");
@@ -37,6 +37,12 @@
     // allocate objects such that they may be used with VM purgability APIs
 #define SCALABLE_MALLOC_ABORT_ON_CORRUPTION (1 << 6)
     // call abort() on malloc errors, but not on out of memory.
+#define SCALABLE_MALLOC_HUGE_PAGES (1 << 7)
+    // back tiny and small regions with 2MB aligned, huge page advised mappings
+#define SCALABLE_MALLOC_BACKGROUND_SCAVENGE (1 << 8)
+    // return depot'd tiny and small memory to the OS from a background thread rather than in free()
+#define SCALABLE_MALLOC_XOR_FREE_LIST (1 << 9)
+    // protect free list links by XOR with a per-zone secret and sampled link checks instead of a checksum
 
 extern malloc_zone_t *create_scalable_zone(size_t initial_size, unsigned debug_flags);
     /* Create a new zone that scales for small objects or large objects */
@@ -58,3 +64,29 @@ extern boolean_t scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics
     Currently: subzone=0 => tiny; subzone=1 => small; subzone=2 => large; subzone=3 => huge; any other subzone => returns 0 
     */
 
+typedef struct {
+    size_t	block_size;	/* bytes per block; for the last tiny and small slots, the smallest free block they hold; 0 for large */
+    size_t	blocks_in_use;
+    size_t	size_in_use;
+    size_t	size_free;	/* bytes on this size's free lists; for large, held by the death-row and per-CPU caches */
+    size_t	total_allocs;	/* cumulative */
+    size_t	total_frees;	/* cumulative */
+} scalable_zone_class_statistics_t;
+
+extern boolean_t scalable_zone_class_statistics(malloc_zone_t *zone, unsigned subzone, unsigned slot, scalable_zone_class_statistics_t *stats);
+    /* Fills stats for one size class, summing per-magazine counters without taking any lock;
+    subzone=0 => tiny, slot is msize - 1 (16 byte quanta); subzone=1 => small, slot is msize - 1 (512 byte quanta);
+    subzone=2 => large, slot 0.
+    1 is returned on success; 0 is returned for an unknown subzone or slot
+    */
+
+extern void scalable_zone_print_class_statistics(malloc_zone_t *zone, int fd, boolean_t json);
+    /* Writes every size class that has been used to fd, as tab separated text or as JSON, with the
+    alloc and free rates per second since the previous call */
+
+extern boolean_t scalable_zone_huge_page_statistics(malloc_zone_t *zone, size_t *bytes_mapped, size_t *bytes_released);
+    /* Reports the bytes of tiny and small regions currently backed by huge page arenas, and the
+    cumulative bytes returned to the OS as whole huge pages.
+    1 is returned if the zone was created with SCALABLE_MALLOC_HUGE_PAGES; else 0 is returned
+    */
+
@@ -28,12 +28,25 @@
 #include "malloc_internal.h"
 #include "stack_logging.h"
 
+#include <_simple.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <libkern/OSAtomic.h>
 #include <mach/mach.h>
+#include <mach/mach_time.h>
 #include <mach/vm_statistics.h>
+#include <mach-o/dyld.h>
+#include <mach-o/getsect.h>
 #include <os/tsd.h>
+#include <sys/mman.h>
 #include <TargetConditionals.h>
 
 #include <CrashReporterClient.h>
@@ -302,4 +315,1025 @@ kern_return_t stack_logging_frames_for_uniqued_stack(task_t task, memory_reader_
 	return 0;
 }
 
+/***************	Sampled heap profile		***********/
+
+/*
+ * A Poisson-sampled heap profile that is cheap enough to leave on in production.
+ * Each thread counts allocated bytes down from an exponentially distributed
+ * interval of mean heap_sample_interval bytes (kept directly in a TSD slot, so
+ * nothing is allocated per thread); the allocation that crosses zero is sampled.
+ * Only sampled blocks are recorded: the address in an open addressed live table,
+ * its backtrace uniqued into a fixed table of stack buckets that also carry the
+ * in-use and cumulative counts.
+ *
+ * Frees probe the live table without the lock. Freed entries are tombstoned in
+ * place; once tombstones make up a quarter of the table, or an insertion runs out
+ * of probes, the live entries are rehashed into the spare table, which then
+ * becomes current. heap_sample_rehashes is odd while that happens, so an
+ * unlocked probe that overlapped a rehash retries under the lock.
+ *
+ * The profile is written in the legacy text heap format pprof reads
+ * ("heap profile: ... @ heap_v2/<interval>"), on demand or from a signal handler,
+ * so the write path only formats into a static buffer and calls write(). The
+ * mapped libraries come from /proc/self/maps on Linux; elsewhere dyld is not
+ * async-signal-safe, so add- and remove-image callbacks keep a table of image
+ * text ranges from the time sampling is enabled, and the dump reads that.
+ */
+
+#define HEAP_SAMPLE_TABLE_SIZE	(1 << 15)	/* live sampled blocks; power of two */
+#define HEAP_SAMPLE_NUM_STACKS	(1 << 12)	/* distinct sampled stacks; power of two */
+#define HEAP_SAMPLE_MAX_PROBE	32
+#define HEAP_SAMPLE_MAX_FRAMES	64
+#define HEAP_SAMPLE_TOMBSTONE	((uintptr_t)1)
+#define HEAP_SAMPLE_MAX_TOMBSTONES	(HEAP_SAMPLE_TABLE_SIZE / 4)
+#define HEAP_SAMPLE_PROFILE_BUFFER_SIZE	4096
+#define HEAP_SAMPLE_MAX_IMAGES	1024
+
+typedef struct {
+	uintptr_t	address;	/* 0 when empty, HEAP_SAMPLE_TOMBSTONE once freed */
+	size_t		size;
+	uint32_t	stack;
+} heap_sample_t;
+
+typedef struct {
+	uint32_t	hash;
+	uint32_t	num_frames;	/* set last; 0 means the bucket is unused */
+	uint64_t	live_count;
+	uint64_t	live_bytes;
+	uint64_t	total_count;
+	uint64_t	total_bytes;
+	vm_address_t	frames[HEAP_SAMPLE_MAX_FRAMES];
+} heap_sample_stack_t;
+
+typedef struct {
+	uintptr_t	start;
+	uintptr_t	end;		/* set last; 0 means the entry is unused */
+	char		name[PATH_MAX];
+} heap_sample_image_t;
+
+size_t heap_sample_interval = 0;
+pthread_key_t heap_sample_key;
+volatile uint32_t heap_sample_live = 0;
+
+static _malloc_lock_s heap_sample_lock = _MALLOC_LOCK_INIT;
+static heap_sample_t * volatile heap_sample_table = NULL;
+static heap_sample_t *heap_sample_spare_table = NULL;
+static volatile uint32_t heap_sample_rehashes = 0;
+static uint32_t heap_sample_tombstones = 0;
+static heap_sample_stack_t *heap_sample_stacks = NULL;
+static uint32_t heap_sample_num_stacks = 0;
+static uint64_t heap_sample_dropped = 0;
+static boolean_t heap_sample_warned_full = FALSE;
+static volatile int64_t heap_sample_seed = 0;
+static char heap_sample_path[PATH_MAX];
+static int32_t heap_sample_dumps = 0;
+static char heap_sample_profile_buffer[HEAP_SAMPLE_PROFILE_BUFFER_SIZE];
+static size_t heap_sample_profile_length = 0;
+static int heap_sample_profile_fd = -1;
+static boolean_t heap_sample_profile_failed = FALSE;
+static volatile int32_t heap_sample_profiling = 0;
+#if !defined(__linux__)
+static heap_sample_image_t *heap_sample_images = NULL;
+static volatile uint32_t heap_sample_num_images = 0;
+#endif
+
+static inline uint32_t
+heap_sample_hash(uintptr_t address) {
+	return (uint32_t)(((uint64_t)address * 0x9E3779B97F4A7C15ULL) >> 40);
+}
+
+static uint64_t
+heap_sample_random(void) {
+	// splitmix64 over a shared counter: the slow path is rare enough not to need per-thread state
+	uint64_t z = (uint64_t)OSAtomicAdd64(0x9E3779B97F4A7C15LL, &heap_sample_seed);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static size_t
+heap_sample_next_interval(void) {
+	// -ln(U) * mean, with U = q / 2^26 and a cheap polynomial log2 (error < 0.01), as libm may not be loaded yet
+	uint32_t	q = (uint32_t)(heap_sample_random() >> 38) + 1;
+	int		e = 31 - __builtin_clz(q);
+	double		m = (double)q / (double)(1U << e);
+	double		log2q = e + (-0.34484843 * m + 2.02466578) * m - 1.67487759;
+	double		interval = (26.0 - log2q) * 0.69314718055994531 * (double)heap_sample_interval;
+
+	return interval < 1.0 ? 1 : (size_t)interval;
+}
+
+static uint32_t
+heap_sample_intern_stack(vm_address_t *frames, unsigned num_frames) {
+	// returns the bucket index + 1, or 0 if the stack table is full; heap_sample_lock held
+	uint32_t	hash = 0;
+	uint32_t	index, probes;
+	unsigned	i;
+
+	for (i = 0; i < num_frames; i++) {
+		hash = (hash ^ heap_sample_hash(frames[i])) * 16777619;
+	}
+	if (!hash) {
+		hash = 1;
+	}
+	index = hash;
+	for (probes = 0; probes < HEAP_SAMPLE_NUM_STACKS; probes++, index++) {
+		heap_sample_stack_t	*bucket = heap_sample_stacks + (index & (HEAP_SAMPLE_NUM_STACKS - 1));
+
+		if (!bucket->num_frames) {
+			if (heap_sample_num_stacks >= HEAP_SAMPLE_NUM_STACKS * 3 / 4) {
+				return 0;
+			}
+			memcpy(bucket->frames, frames, num_frames * sizeof(vm_address_t));
+			bucket->hash = hash;
+			OSMemoryBarrier();	// a concurrent profile writer may walk the buckets unlocked
+			bucket->num_frames = num_frames;
+			heap_sample_num_stacks++;
+			return (uint32_t)(bucket - heap_sample_stacks) + 1;
+		}
+		if (bucket->hash == hash && bucket->num_frames == num_frames &&
+			!memcmp(bucket->frames, frames, num_frames * sizeof(vm_address_t))) {
+			return (uint32_t)(bucket - heap_sample_stacks) + 1;
+		}
+	}
+	return 0;
+}
+
+static heap_sample_t *
+heap_sample_lookup(heap_sample_t *table, uintptr_t address) {
+	uint32_t	index = heap_sample_hash(address);
+	uint32_t	probes;
+
+	for (probes = 0; probes < HEAP_SAMPLE_MAX_PROBE; probes++, index++) {
+		heap_sample_t	*sample = table + (index & (HEAP_SAMPLE_TABLE_SIZE - 1));
+
+		if (sample->address == address) {
+			return sample;
+		}
+		if (!sample->address) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static heap_sample_t *
+heap_sample_slot_no_lock(uintptr_t address) {
+	// the first reusable slot on address's probe sequence, or NULL if there is none; heap_sample_lock held
+	heap_sample_t	*table = heap_sample_table;
+	uint32_t	index = heap_sample_hash(address);
+	uint32_t	probes;
+
+	for (probes = 0; probes < HEAP_SAMPLE_MAX_PROBE; probes++, index++) {
+		heap_sample_t	*sample = table + (index & (HEAP_SAMPLE_TABLE_SIZE - 1));
+
+		if (sample->address <= HEAP_SAMPLE_TOMBSTONE) {
+			return sample;
+		}
+	}
+	return NULL;
+}
+
+static void
+heap_sample_rehash_no_lock(void) {
+	// moves the live entries into the spare table and makes it current; heap_sample_lock held
+	heap_sample_t	*old_table = heap_sample_table;
+	heap_sample_t	*new_table = heap_sample_spare_table;
+	uint32_t	index;
+
+	heap_sample_rehashes++;
+	OSMemoryBarrier();
+	memset(new_table, 0, HEAP_SAMPLE_TABLE_SIZE * sizeof(heap_sample_t));
+	for (index = 0; index < HEAP_SAMPLE_TABLE_SIZE; index++) {
+		heap_sample_t	*sample = old_table + index;
+		uint32_t	slot, probes;
+
+		if (sample->address <= HEAP_SAMPLE_TOMBSTONE) {
+			continue;
+		}
+		slot = heap_sample_hash(sample->address);
+		for (probes = 0; probes < HEAP_SAMPLE_MAX_PROBE; probes++, slot++) {
+			heap_sample_t	*target = new_table + (slot & (HEAP_SAMPLE_TABLE_SIZE - 1));
+
+			if (!target->address) {
+				*target = *sample;
+				break;
+			}
+		}
+		if (probes == HEAP_SAMPLE_MAX_PROBE) {
+			// no room even in a clean table: drop the sample rather than lose track of the counts
+			heap_sample_stack_t	*bucket = heap_sample_stacks + sample->stack - 1;
+
+			bucket->live_count--;
+			bucket->live_bytes -= sample->size;
+			heap_sample_live--;
+			heap_sample_dropped++;
+		}
+	}
+	heap_sample_table = new_table;
+	heap_sample_spare_table = old_table;
+	heap_sample_tombstones = 0;
+	OSMemoryBarrier();
+	heap_sample_rehashes++;
+}
+
+static void
+heap_sample_insert_no_lock(uintptr_t address, size_t size, uint32_t stack) {
+	heap_sample_t		*slot = heap_sample_slot_no_lock(address);
+	heap_sample_stack_t	*bucket = heap_sample_stacks + stack - 1;
+
+	// rehash once tombstones pile up, or sooner if they are what crowds address out; a table that is
+	// full of live samples is left alone, as rehashing it on every insertion would gain nothing
+	if (heap_sample_tombstones >= HEAP_SAMPLE_MAX_TOMBSTONES ||
+		(!slot && heap_sample_tombstones >= HEAP_SAMPLE_MAX_TOMBSTONES / 8)) {
+		heap_sample_rehash_no_lock();
+		slot = heap_sample_slot_no_lock(address);
+	}
+	if (!slot) {
+		heap_sample_dropped++;
+		return;
+	}
+	if (slot->address == HEAP_SAMPLE_TOMBSTONE) {
+		heap_sample_tombstones--;
+	}
+	bucket->live_count++;
+	bucket->live_bytes += size;
+	slot->size = size;
+	slot->stack = stack;
+	slot->address = address;
+	heap_sample_live++;
+}
+
+static void
+heap_sample_forget_no_lock(heap_sample_t *sample) {
+	heap_sample_stack_t	*bucket = heap_sample_stacks + sample->stack - 1;
+
+	bucket->live_count--;
+	bucket->live_bytes -= sample->size;
+	sample->address = HEAP_SAMPLE_TOMBSTONE;
+	heap_sample_tombstones++;
+	heap_sample_live--;
+}
+
+void
+__heap_sample_allocation(void *ptr, size_t size, uintptr_t bytes_left) {
+	uintptr_t	address = (uintptr_t)ptr;
+	vm_address_t	frames[HEAP_SAMPLE_MAX_FRAMES + 2];
+	unsigned	num_frames = 0;
+	heap_sample_t	*stale;
+	uint32_t	stack;
+	boolean_t	warn = FALSE;
+
+	if (!bytes_left) {
+		// first allocation on this thread: draw its initial interval
+		bytes_left = heap_sample_next_interval();
+		if (bytes_left > size) {
+			pthread_setspecific(heap_sample_key, (void *)(bytes_left - size));
+			return;
+		}
+	}
+	pthread_setspecific(heap_sample_key, (void *)heap_sample_next_interval());
+	if (!address || !heap_sample_table) {
+		return;
+	}
+
+	thread_stack_pcs(frames, HEAP_SAMPLE_MAX_FRAMES + 2, &num_frames);
+	// skip this function and the malloc_zone_* entry point that called it
+	num_frames = num_frames > 2 ? num_frames - 2 : 0;
+
+	_malloc_lock_lock(&heap_sample_lock);
+	stack = heap_sample_intern_stack(frames + 2, num_frames);
+	if (stack) {
+		heap_sample_stack_t	*bucket = heap_sample_stacks + stack - 1;
+		uint64_t		dropped = heap_sample_dropped;
+
+		stale = heap_sample_lookup(heap_sample_table, address);
+		if (stale) {
+			// a free we never saw (e.g. the zone was destroyed); the block was reused
+			heap_sample_forget_no_lock(stale);
+		}
+		bucket->total_count++;
+		bucket->total_bytes += size;
+		heap_sample_insert_no_lock(address, size, stack);
+		if (heap_sample_dropped != dropped && !heap_sample_warned_full) {
+			heap_sample_warned_full = TRUE;
+			warn = TRUE;
+		}
+	} else {
+		heap_sample_dropped++;
+	}
+	_malloc_lock_unlock(&heap_sample_lock);
+
+	if (warn) {
+		malloc_printf("*** heap sampling: live table full, some samples are missing from the profile\n");
+	}
+}
+
+boolean_t
+__heap_sample_detach(void *ptr, size_t *size, uint32_t *stack) {
+	uintptr_t	address = (uintptr_t)ptr;
+	uint32_t	rehashes;
+	heap_sample_t	*sample;
+
+	if (address <= HEAP_SAMPLE_TOMBSTONE || !heap_sample_table) {
+		return FALSE;
+	}
+	rehashes = heap_sample_rehashes;
+	OSMemoryBarrier();
+	if (!(rehashes & 1) && !heap_sample_lookup(heap_sample_table, address)) {
+		OSMemoryBarrier();
+		if (heap_sample_rehashes == rehashes) {
+			return FALSE;	// the common case: not sampled, and no rehash moved it under us
+		}
+	}
+
+	_malloc_lock_lock(&heap_sample_lock);
+	sample = heap_sample_lookup(heap_sample_table, address);
+	if (sample) {
+		if (size) {
+			*size = sample->size;
+		}
+		if (stack) {
+			*stack = sample->stack;
+		}
+		heap_sample_forget_no_lock(sample);
+	}
+	_malloc_lock_unlock(&heap_sample_lock);
+	return sample != NULL;
+}
+
+void
+__heap_sample_reattach(void *ptr, size_t size, uint32_t stack) {
+	_malloc_lock_lock(&heap_sample_lock);
+	heap_sample_insert_no_lock((uintptr_t)ptr, size, stack);
+	_malloc_lock_unlock(&heap_sample_lock);
+}
+
+void
+__heap_sample_free(void *ptr) {
+	(void)__heap_sample_detach(ptr, NULL, NULL);
+}
+
+static void
+heap_sample_flush(void) {
+	size_t	written = 0;
+	ssize_t	result;
+
+	while (written < heap_sample_profile_length && !heap_sample_profile_failed) {
+		result = write(heap_sample_profile_fd, heap_sample_profile_buffer + written, heap_sample_profile_length - written);
+		if (result > 0) {
+			written += result;
+		} else if (result < 0 && errno != EINTR) {
+			heap_sample_profile_failed = TRUE;
+		}
+	}
+	heap_sample_profile_length = 0;
+}
+
+static void
+heap_sample_append_bytes(const char *bytes, size_t length) {
+	while (length) {
+		size_t	room = sizeof(heap_sample_profile_buffer) - heap_sample_profile_length;
+		size_t	chunk = length < room ? length : room;
+
+		memcpy(heap_sample_profile_buffer + heap_sample_profile_length, bytes, chunk);
+		heap_sample_profile_length += chunk;
+		bytes += chunk;
+		length -= chunk;
+		if (heap_sample_profile_length == sizeof(heap_sample_profile_buffer)) {
+			heap_sample_flush();
+		}
+	}
+}
+
+static void
+heap_sample_append(const char *string) {
+	heap_sample_append_bytes(string, strlen(string));
+}
+
+static void
+heap_sample_append_number(uint64_t value, unsigned base) {
+	char	digits[2 * sizeof(value) + 3];
+	char	*cursor = digits + sizeof(digits);
+
+	*--cursor = 0;
+	do {
+		*--cursor = "0123456789abcdef"[value % base];
+		value /= base;
+	} while (value);
+	if (base == 16) {
+		*--cursor = 'x';
+		*--cursor = '0';
+	}
+	heap_sample_append(cursor);
+}
+
+#if !defined(__linux__)
+static void
+heap_sample_add_image(const struct mach_header *header, intptr_t slide) {
+	// called by dyld, under its lock, for every image loaded now and later
+	heap_sample_image_t	*image = NULL;
+	unsigned long		size = 0;
+	uint8_t			*text;
+	Dl_info			info;
+	uint32_t		index;
+
+#if __LP64__
+	text = getsegmentdata((const struct mach_header_64 *)header, "__TEXT", &size);
+#else
+	text = getsegmentdata(header, "__TEXT", &size);
+#endif
+	if (!text || !size || !dladdr(header, &info) || !info.dli_fname) {
+		return;
+	}
+	for (index = 0; index < heap_sample_num_images; index++) {
+		if (!heap_sample_images[index].end) {
+			image = heap_sample_images + index;
+			break;
+		}
+	}
+	if (!image) {
+		if (heap_sample_num_images == HEAP_SAMPLE_MAX_IMAGES) {
+			return;
+		}
+		image = heap_sample_images + heap_sample_num_images;
+	}
+	image->start = (uintptr_t)text;
+	strlcpy(image->name, info.dli_fname, sizeof(image->name));
+	OSMemoryBarrier();
+	image->end = (uintptr_t)text + size;
+	if (image == heap_sample_images + heap_sample_num_images) {
+		OSMemoryBarrier();
+		heap_sample_num_images++;
+	}
+}
+
+static void
+heap_sample_remove_image(const struct mach_header *header, intptr_t slide) {
+	unsigned long	size = 0;
+	uint8_t		*text;
+	uint32_t	index;
+
+#if __LP64__
+	text = getsegmentdata((const struct mach_header_64 *)header, "__TEXT", &size);
+#else
+	text = getsegmentdata(header, "__TEXT", &size);
+#endif
+	for (index = 0; text && index < heap_sample_num_images; index++) {
+		if (heap_sample_images[index].end && heap_sample_images[index].start == (uintptr_t)text) {
+			heap_sample_images[index].end = 0;
+			OSMemoryBarrier();
+			break;
+		}
+	}
+}
+#endif
+
+static void
+heap_sample_write_mapped_libraries(void) {
+#if defined(__linux__)
+	char	buffer[1024];
+	ssize_t	length;
+	int	fd = open("/proc/self/maps", O_RDONLY);
+
+	if (fd < 0) {
+		return;
+	}
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0 || (length < 0 && errno == EINTR)) {
+		if (length > 0) {
+			heap_sample_append_bytes(buffer, length);
+		}
+	}
+	close(fd);
+#else
+	uint32_t	index, count = heap_sample_num_images;
+
+	OSMemoryBarrier();
+	for (index = 0; heap_sample_images && index < count; index++) {
+		heap_sample_image_t	*image = heap_sample_images + index;
+		uintptr_t		end = image->end;
+
+		if (!end) {
+			continue;
+		}
+		OSMemoryBarrier();
+		heap_sample_append_number(image->start, 16);
+		heap_sample_append("-");
+		heap_sample_append_number(end, 16);
+		heap_sample_append(" r-xp 00000000 00:00 0 ");
+		heap_sample_append(image->name);
+		heap_sample_append("\n");
+	}
+#endif
+}
+
+int
+__heap_sample_write_profile(int fd) {
+	uint64_t	live_count = 0, live_bytes = 0, total_count = 0, total_bytes = 0;
+	uint32_t	index, frame;
+	int		result;
+
+	if (!heap_sample_stacks) {
+		return -1;
+	}
+	// one dump at a time: the buffer is static so that a signal handler can write the profile
+	if (!OSAtomicCompareAndSwap32Barrier(0, 1, &heap_sample_profiling)) {
+		errno = EBUSY;
+		return -1;
+	}
+	heap_sample_profile_fd = fd;
+	heap_sample_profile_length = 0;
+	heap_sample_profile_failed = FALSE;
+	// counts are read without the lock so a dump from a signal handler cannot deadlock
+	for (index = 0; index < HEAP_SAMPLE_NUM_STACKS; index++) {
+		heap_sample_stack_t	*bucket = heap_sample_stacks + index;
+
+		if (!bucket->num_frames) {
+			continue;
+		}
+		live_count += bucket->live_count;
+		live_bytes += bucket->live_bytes;
+		total_count += bucket->total_count;
+		total_bytes += bucket->total_bytes;
+	}
+	heap_sample_append("heap profile: ");
+	heap_sample_append_number(live_count, 10);
+	heap_sample_append(": ");
+	heap_sample_append_number(live_bytes, 10);
+	heap_sample_append(" [");
+	heap_sample_append_number(total_count, 10);
+	heap_sample_append(": ");
+	heap_sample_append_number(total_bytes, 10);
+	heap_sample_append("] @ heap_v2/");
+	heap_sample_append_number(heap_sample_interval, 10);
+	heap_sample_append("\n");
+	for (index = 0; index < HEAP_SAMPLE_NUM_STACKS; index++) {
+		heap_sample_stack_t	*bucket = heap_sample_stacks + index;
+		uint32_t		num_frames = bucket->num_frames;
+
+		if (!num_frames) {
+			continue;
+		}
+		OSMemoryBarrier();
+		heap_sample_append_number(bucket->live_count, 10);
+		heap_sample_append(": ");
+		heap_sample_append_number(bucket->live_bytes, 10);
+		heap_sample_append(" [");
+		heap_sample_append_number(bucket->total_count, 10);
+		heap_sample_append(": ");
+		heap_sample_append_number(bucket->total_bytes, 10);
+		heap_sample_append("] @");
+		for (frame = 0; frame < num_frames; frame++) {
+			heap_sample_append(" ");
+			heap_sample_append_number(bucket->frames[frame], 16);
+		}
+		heap_sample_append("\n");
+	}
+	heap_sample_append("\nMAPPED_LIBRARIES:\n");
+	heap_sample_write_mapped_libraries();
+	heap_sample_flush();
+	result = heap_sample_profile_failed ? -1 : 0;
+	OSAtomicCompareAndSwap32Barrier(1, 0, &heap_sample_profiling);
+	return result;
+}
+
+static void
+heap_sample_signal_handler(int signo) {
+	char		path[PATH_MAX + 32];
+	char		digits[24];
+	size_t		length = strlcpy(path, heap_sample_path, PATH_MAX);
+	int32_t		seq = OSAtomicIncrement32(&heap_sample_dumps);
+	uintptr_t	parts[2] = { (uintptr_t)getpid(), (uintptr_t)seq };
+	int		saved_errno = errno;
+	int		fd, i, n;
+
+	// <prefix>.<pid>.<seq>.heap, formatted by hand: snprintf is not async-signal-safe
+	for (i = 0; i < 2; i++) {
+		uintptr_t	value = parts[i];
+
+		n = 0;
+		do {
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while (value);
+		path[length++] = '.';
+		while (n) {
+			path[length++] = digits[--n];
+		}
+	}
+	strlcpy(path + length, ".heap", sizeof(path) - length);
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd >= 0) {
+		__heap_sample_write_profile(fd);
+		close(fd);
+	}
+	errno = saved_errno;
+}
+
+void
+__heap_sample_enable(size_t mean_bytes, int signo, const char *path_prefix) {
+	struct sigaction	action;
+
+	if (!mean_bytes || heap_sample_interval) {
+		return;
+	}
+	if (pthread_key_create(&heap_sample_key, NULL)) {
+		malloc_printf("*** heap sampling disabled: no TSD key available\n");
+		return;
+	}
+	heap_sample_spare_table = allocate_pages(HEAP_SAMPLE_TABLE_SIZE * sizeof(heap_sample_t));
+	heap_sample_stacks = allocate_pages(HEAP_SAMPLE_NUM_STACKS * sizeof(heap_sample_stack_t));
+	heap_sample_seed = (int64_t)mach_absolute_time() ^ ((int64_t)getpid() << 32);
+#if !defined(__linux__)
+	// dyld calls the add callback for every image already loaded before returning
+	heap_sample_images = allocate_pages(HEAP_SAMPLE_MAX_IMAGES * sizeof(heap_sample_image_t));
+	_dyld_register_func_for_add_image(heap_sample_add_image);
+	_dyld_register_func_for_remove_image(heap_sample_remove_image);
+#endif
+	strlcpy(heap_sample_path, path_prefix ? path_prefix : "/tmp/malloc_heap", sizeof(heap_sample_path));
+	if (signo > 0) {
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = heap_sample_signal_handler;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(signo, &action, NULL);
+	}
+	heap_sample_table = allocate_pages(HEAP_SAMPLE_TABLE_SIZE * sizeof(heap_sample_t));
+	heap_sample_interval = mean_bytes;
+}
+
+void
+__heap_sample_fork_prepare(void) {
+	_malloc_lock_lock(&heap_sample_lock);
+}
+
+void
+__heap_sample_fork_parent(void) {
+	_malloc_lock_unlock(&heap_sample_lock);
+}
+
+void
+__heap_sample_fork_child(void) {
+	_malloc_lock_init(&heap_sample_lock);
+}
+
+#pragma mark -
+#pragma mark Guarded sampling
+
+/*
+ * About one allocation in guard_sample_rate is served from a pool of page
+ * sized slots, each between two inaccessible guard pages.  The block is put
+ * against the end of its slot (or, for one block in eight, against its start)
+ * so that running off it faults on the neighbouring guard page, and a freed
+ * slot is made inaccessible and goes to the back of the reuse queue so that a
+ * later use of the block faults too.  The fault handler, and free() for
+ * double and invalid frees, report the allocation and free stacks of the
+ * slot before the process crashes.
+ *
+ * The pool is one contiguous mapping, so telling whether a pointer belongs to
+ * it is a single compare; with sampling off the range is empty.
+ *
+ * Reports are mostly made from the fault handler, so they are formatted into
+ * a static buffer by hand and written out with the non-logging
+ * _malloc_printf() path, neither of which allocates or takes a lock.
+ */
+
+#define GUARD_SAMPLE_MAX_FRAMES	32
+#define GUARD_SAMPLE_REPORT_SIZE	8192
+
+#define GUARD_SLOT_AVAILABLE	0	/* never handed out */
+#define GUARD_SLOT_LIVE		1
+#define GUARD_SLOT_FREED	2
+
+typedef struct {
+	uintptr_t	address;
+	size_t		size;
+	uint32_t	state;
+	uint32_t	num_alloc_frames;
+	uint32_t	num_free_frames;
+	void		*alloc_thread;
+	void		*free_thread;
+	vm_address_t	alloc_frames[GUARD_SAMPLE_MAX_FRAMES];
+	vm_address_t	free_frames[GUARD_SAMPLE_MAX_FRAMES];
+} guard_slot_t;
+
+size_t guard_sample_rate = 0;
+pthread_key_t guard_sample_key;
+uintptr_t guard_sample_base = 0;
+size_t guard_sample_bytes = 0;
+
+static _malloc_lock_s guard_sample_lock = _MALLOC_LOCK_INIT;
+static guard_slot_t *guard_sample_slots = NULL;
+static uint32_t *guard_sample_queue = NULL;	/* ring of slot indexes not in use, oldest free first */
+static uint32_t guard_sample_num_slots = 0;
+static uint32_t guard_sample_queue_head = 0;
+static uint32_t guard_sample_queue_count = 0;
+static struct sigaction guard_sample_old_segv;
+static struct sigaction guard_sample_old_bus;
+static char guard_sample_report_buffer[GUARD_SAMPLE_REPORT_SIZE];
+static size_t guard_sample_report_length = 0;
+static volatile int32_t guard_sample_reporting = 0;
+
+static inline void *
+guard_sample_slot_start(uint32_t index) {
+	return (void *)(guard_sample_base + (2 * (uintptr_t)index + 1) * vm_page_size);
+}
+
+static void
+guard_sample_append(const char *string) {
+	while (*string && guard_sample_report_length < sizeof(guard_sample_report_buffer) - 1)
+		guard_sample_report_buffer[guard_sample_report_length++] = *string++;
+	guard_sample_report_buffer[guard_sample_report_length] = 0;
+}
+
+static void
+guard_sample_append_number(uintptr_t value, unsigned base) {
+	char	digits[2 * sizeof(value) + 3];
+	char	*cursor = digits + sizeof(digits);
+
+	*--cursor = 0;
+	do {
+		*--cursor = "0123456789abcdef"[value % base];
+		value /= base;
+	} while (value);
+	if (base == 16) {
+		*--cursor = 'x';
+		*--cursor = '0';
+	}
+	guard_sample_append(cursor);
+}
+
+static void
+guard_sample_append_stack(const char *what, void *thread, vm_address_t *frames, uint32_t num_frames) {
+	uint32_t	frame;
+
+	guard_sample_append(what);
+	guard_sample_append(" by thread ");
+	guard_sample_append_number((uintptr_t)thread, 16);
+	guard_sample_append(":\n");
+	for (frame = 0; frame < num_frames; frame++) {
+		guard_sample_append("    #");
+		guard_sample_append_number(frame, 10);
+		guard_sample_append(" ");
+		guard_sample_append_number(frames[frame], 16);
+		guard_sample_append("\n");
+	}
+}
+
+static void
+guard_sample_print_mapped_libraries(void) {
+#if defined(__linux__)
+	char	buffer[1024];
+	ssize_t	length;
+	int	fd = open("/proc/self/maps", O_RDONLY);
+
+	if (fd < 0) {
+		return;
+	}
+	_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "MAPPED_LIBRARIES:\n");
+	while ((length = read(fd, buffer, sizeof(buffer) - 1)) > 0) {
+		buffer[length] = 0;
+		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "%s", buffer);
+	}
+	close(fd);
+#endif
+	// walking the dyld image list isn't safe in a signal handler, and the crash report lists the images anyway
+}
+
+static void
+guard_sample_report(const char *error, uintptr_t address, guard_slot_t *slot) {
+	// the first report wins the buffer; the process is crashing, so the others aren't needed
+	if (!OSAtomicCompareAndSwap32Barrier(0, 1, &guard_sample_reporting))
+		return;
+
+	guard_sample_report_length = 0;
+	guard_sample_append("*** guarded sampling: ");
+	guard_sample_append(error);
+	guard_sample_append(" at ");
+	guard_sample_append_number(address, 16);
+	if (slot && slot->state != GUARD_SLOT_AVAILABLE) {
+		if (address < slot->address) {
+			guard_sample_append(", ");
+			guard_sample_append_number(slot->address - address, 10);
+			guard_sample_append(" bytes before");
+		} else if (address >= slot->address + slot->size) {
+			guard_sample_append(", ");
+			guard_sample_append_number(address - slot->address - slot->size, 10);
+			guard_sample_append(" bytes after");
+		} else {
+			guard_sample_append(", ");
+			guard_sample_append_number(address - slot->address, 10);
+			guard_sample_append(" bytes into");
+		}
+		guard_sample_append(" the ");
+		guard_sample_append_number(slot->size, 10);
+		guard_sample_append(" byte block ");
+		guard_sample_append_number(slot->address, 16);
+		guard_sample_append("\n");
+		guard_sample_append_stack("allocated", slot->alloc_thread, slot->alloc_frames, slot->num_alloc_frames);
+		if (slot->state == GUARD_SLOT_FREED)
+			guard_sample_append_stack("freed", slot->free_thread, slot->free_frames, slot->num_free_frames);
+	} else {
+		guard_sample_append(", in an unused slot\n");
+	}
+	_malloc_printf(MALLOC_PRINTF_NOLOG, "%s", guard_sample_report_buffer);
+	guard_sample_print_mapped_libraries();
+	CRSetCrashLogMessage(guard_sample_report_buffer);
+}
+
+static guard_slot_t *
+guard_sample_slot_for_fault(uintptr_t address) {
+	// on a guard page, blame whichever neighbouring block ends nearest to the fault
+	uintptr_t	page = (address - guard_sample_base) / vm_page_size;
+	guard_slot_t	*before, *after;
+
+	if (page & 1)
+		return guard_sample_slots + page / 2;
+	before = page ? guard_sample_slots + page / 2 - 1 : NULL;
+	after = page / 2 < guard_sample_num_slots ? guard_sample_slots + page / 2 : NULL;
+	if (before && before->state == GUARD_SLOT_AVAILABLE) before = NULL;
+	if (after && after->state == GUARD_SLOT_AVAILABLE) after = NULL;
+	if (before && after)
+		return (address - (before->address + before->size) < after->address - address) ? before : after;
+	return before ? before : after;
+}
+
+static void
+guard_sample_fault_handler(int signo, siginfo_t *info, void *context) {
+	uintptr_t		address = (uintptr_t)info->si_addr;
+	struct sigaction	*old = (signo == SIGBUS) ? &guard_sample_old_bus : &guard_sample_old_segv;
+	guard_slot_t		*slot;
+
+	if (address - guard_sample_base >= guard_sample_bytes) {
+		// not ours: hand it to whoever was installed before, and stay installed
+		if (old->sa_flags & SA_SIGINFO) {
+			old->sa_sigaction(signo, info, context);
+		} else if (old->sa_handler == SIG_DFL) {
+			// the default action is to crash, which returning into the access does once it is back
+			sigaction(signo, old, NULL);
+		} else if (old->sa_handler != SIG_IGN) {
+			old->sa_handler(signo);
+		}
+		return;
+	}
+	slot = guard_sample_slot_for_fault(address);
+	if (!slot || slot->state == GUARD_SLOT_AVAILABLE)
+		guard_sample_report("wild access", address, NULL);
+	else if (slot->state == GUARD_SLOT_FREED && (((address - guard_sample_base) / vm_page_size) & 1))
+		guard_sample_report("use after free", address, slot);
+	else
+		guard_sample_report("buffer overflow", address, slot);
+
+	// put the previous handlers back, so returning re-runs the faulting access into them
+	sigaction(SIGSEGV, &guard_sample_old_segv, NULL);
+	sigaction(SIGBUS, &guard_sample_old_bus, NULL);
+}
+
+size_t
+__guard_sample_next_interval(void) {
+	// uniform over [1, 2 * guard_sample_rate], so 1 in guard_sample_rate allocations on average
+	return 1 + (size_t)(heap_sample_random() % (2 * guard_sample_rate));
+}
+
+void *
+__guard_sample_malloc(size_t size, size_t alignment, boolean_t cleared) {
+	guard_slot_t	*slot;
+	uint32_t	index;
+	uintptr_t	start;
+	unsigned	num_frames = 0;
+
+	if (!size) size = 1;
+	if (alignment < 16) alignment = 16;
+	if (size > vm_page_size || alignment > vm_page_size || !guard_sample_slots)
+		return NULL;
+
+	_malloc_lock_lock(&guard_sample_lock);
+	if (!guard_sample_queue_count) {
+		_malloc_lock_unlock(&guard_sample_lock);
+		return NULL;
+	}
+	index = guard_sample_queue[guard_sample_queue_head];
+	guard_sample_queue_head = (guard_sample_queue_head + 1) % guard_sample_num_slots;
+	guard_sample_queue_count--;
+	_malloc_lock_unlock(&guard_sample_lock);
+
+	slot = guard_sample_slots + index;
+	start = (uintptr_t)guard_sample_slot_start(index);
+	if (mprotect((void *)start, vm_page_size, PROT_READ | PROT_WRITE)) {
+		_malloc_lock_lock(&guard_sample_lock);
+		guard_sample_queue[(guard_sample_queue_head + guard_sample_queue_count++) % guard_sample_num_slots] = index;
+		_malloc_lock_unlock(&guard_sample_lock);
+		return NULL;
+	}
+	// seven blocks in eight against the trailing guard page, for overflows; the rest against the leading one, for underflows
+	if ((heap_sample_random() & 7) == 0)
+		slot->address = start;
+	else
+		slot->address = (start + vm_page_size - size) & ~(uintptr_t)(alignment - 1);
+	slot->size = size;
+	if (cleared)
+		memset((void *)slot->address, 0, size);
+
+	thread_stack_pcs(slot->alloc_frames, GUARD_SAMPLE_MAX_FRAMES, &num_frames);
+	slot->num_alloc_frames = num_frames;
+	slot->alloc_thread = _os_tsd_get_direct(__TSD_THREAD_SELF);
+	slot->num_free_frames = 0;
+	slot->state = GUARD_SLOT_LIVE;
+	return (void *)slot->address;
+}
+
+void
+__guard_sample_free(void *ptr) {
+	uintptr_t	address = (uintptr_t)ptr;
+	uintptr_t	page = (address - guard_sample_base) / vm_page_size;
+	guard_slot_t	*slot = (page & 1) ? guard_sample_slots + page / 2 : NULL;
+	unsigned	num_frames = 0;
+
+	if (!slot || slot->state != GUARD_SLOT_LIVE || slot->address != address) {
+		guard_sample_report((slot && slot->state == GUARD_SLOT_FREED && slot->address == address) ? "double free" : "invalid free",
+							address, slot);
+		abort();
+	}
+	thread_stack_pcs(slot->free_frames, GUARD_SAMPLE_MAX_FRAMES, &num_frames);
+	slot->num_free_frames = num_frames;
+	slot->free_thread = _os_tsd_get_direct(__TSD_THREAD_SELF);
+	slot->state = GUARD_SLOT_FREED;
+	mprotect((void *)(address & ~(uintptr_t)(vm_page_size - 1)), vm_page_size, PROT_NONE);
+
+	_malloc_lock_lock(&guard_sample_lock);
+	guard_sample_queue[(guard_sample_queue_head + guard_sample_queue_count++) % guard_sample_num_slots] = (uint32_t)(page / 2);
+	_malloc_lock_unlock(&guard_sample_lock);
+}
+
+size_t
+__guard_sample_size(const void *ptr) {
+	uintptr_t	address = (uintptr_t)ptr;
+	uintptr_t	page = (address - guard_sample_base) / vm_page_size;
+	guard_slot_t	*slot = guard_sample_slots + page / 2;
+
+	if ((page & 1) && slot->state == GUARD_SLOT_LIVE && slot->address == address)
+		return slot->size;
+	return 0;
+}
+
+void
+__guard_sample_enable(size_t rate, unsigned num_slots) {
+	struct sigaction	action;
+	size_t			bytes;
+	void			*pool;
+	unsigned		index;
+
+	if (!rate || !num_slots || guard_sample_rate) return;
+	if (pthread_key_create(&guard_sample_key, NULL)) {
+		malloc_printf("*** guarded sampling disabled: no TSD key available\n");
+		return;
+	}
+	bytes = (2 * (size_t)num_slots + 1) * vm_page_size;
+#if defined(__linux__)
+	pool = mmap(NULL, bytes, PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
+#else
+	pool = mmap(NULL, bytes, PROT_NONE, MAP_ANON | MAP_PRIVATE, VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+#endif
+	if (pool == MAP_FAILED) {
+		malloc_printf("*** guarded sampling disabled: could not reserve %lu bytes\n", (unsigned long)bytes);
+		return;
+	}
+	guard_sample_slots = allocate_pages((unsigned)(num_slots * sizeof(guard_slot_t)));
+	guard_sample_queue = allocate_pages((unsigned)(num_slots * sizeof(uint32_t)));
+	for (index = 0; index < num_slots; index++)
+		guard_sample_queue[index] = index;
+	guard_sample_num_slots = num_slots;
+	guard_sample_queue_count = num_slots;
+	if (!heap_sample_seed)
+		heap_sample_seed = (int64_t)mach_absolute_time() ^ ((int64_t)getpid() << 32);
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = guard_sample_fault_handler;
+	action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, &guard_sample_old_segv);
+	sigaction(SIGBUS, &action, &guard_sample_old_bus);
+
+	guard_sample_base = (uintptr_t)pool;
+	guard_sample_bytes = bytes;
+	OSMemoryBarrier();	// the pool must be complete before the entry points can sample into it
+	guard_sample_rate = rate;
+}
+
+void
+__guard_sample_fork_prepare(void) {
+	_malloc_lock_lock(&guard_sample_lock);
+}
+
+void
+__guard_sample_fork_parent(void) {
+	_malloc_lock_unlock(&guard_sample_lock);
+}
+
+void
+__guard_sample_fork_child(void) {
+	_malloc_lock_init(&guard_sample_lock);
+}
+
 /* vim: set noet:ts=4:sw=4:cindent: */
@@ -23,6 +23,7 @@
 
 #import <malloc/malloc.h>
 #import <mach/vm_statistics.h>
+#import <pthread.h>
 
 #define stack_logging_type_free		0
 #define stack_logging_type_generic	1	/* anything that is not allocation/deallocation */
@@ -134,3 +135,64 @@ extern void thread_stack_pcs(vm_address_t *buffer, unsigned max, unsigned *num);
     num: returned number of frames
     */
 
+
+#pragma mark -
+#pragma mark Sampled heap profile
+
+/* Poisson-sampled heap profiling: about one allocation per heap_sample_interval bytes is recorded with its stack. */
+
+extern size_t heap_sample_interval; /* mean bytes between samples; 0 when sampling is off */
+extern pthread_key_t heap_sample_key; /* per-thread bytes left before the next sample, 0 until first drawn */
+extern volatile uint32_t heap_sample_live; /* number of sampled blocks not yet freed */
+
+extern void __heap_sample_enable(size_t mean_bytes, int signo, const char *path_prefix);
+    /* Starts sampling; if signo > 0, that signal writes <path_prefix>.<pid>.<seq>.heap */
+
+extern void __heap_sample_allocation(void *ptr, size_t size, uintptr_t bytes_left);
+    /* Slow path of the allocation countdown: draws the next interval and records ptr */
+
+extern void __heap_sample_free(void *ptr);
+    /* Forgets ptr if it was sampled */
+
+extern boolean_t __heap_sample_detach(void *ptr, size_t *size, uint32_t *stack);
+    /* Forgets ptr if it was sampled and returns TRUE, with what __heap_sample_reattach needs to restore it */
+
+extern void __heap_sample_reattach(void *ptr, size_t size, uint32_t stack);
+    /* Records ptr again after a failed realloc, without counting a new allocation */
+
+extern int __heap_sample_write_profile(int fd);
+    /* Writes the sampled live heap to fd in the text heap profile format read by pprof; async-signal-safe, returns -1 with errno EBUSY if a dump is already under way */
+
+extern void __heap_sample_fork_prepare(void);
+extern void __heap_sample_fork_parent(void);
+extern void __heap_sample_fork_child(void);
+
+
+#pragma mark -
+#pragma mark Guarded sampling
+
+/* About one allocation in guard_sample_rate is placed in a slot between guard pages, to catch overflows and use after free. */
+
+extern size_t guard_sample_rate; /* mean allocations between guarded ones; 0 when off */
+extern pthread_key_t guard_sample_key; /* per-thread allocations left before the next guarded one, 0 until first drawn */
+extern uintptr_t guard_sample_base; /* start of the slot pool */
+extern size_t guard_sample_bytes; /* size of the slot pool; 0 when off, so the range check always fails */
+
+extern void __guard_sample_enable(size_t rate, unsigned num_slots);
+    /* Reserves num_slots page sized slots and installs the SIGSEGV/SIGBUS handler that reports faults in them */
+
+extern size_t __guard_sample_next_interval(void);
+    /* Draws the number of allocations until the next guarded one */
+
+extern void *__guard_sample_malloc(size_t size, size_t alignment, boolean_t cleared);
+    /* Returns a guarded block, or NULL if size or alignment exceed a page or every slot is in use */
+
+extern void __guard_sample_free(void *ptr);
+    /* Frees a guarded block and protects its slot; reports and aborts on a double or invalid free */
+
+extern size_t __guard_sample_size(const void *ptr);
+    /* Size of a live guarded block, 0 otherwise */
+
+extern void __guard_sample_fork_prepare(void);
+extern void __guard_sample_fork_parent(void);
+extern void __guard_sample_fork_child(void);
@@ -32,6 +32,7 @@
 #include <libkern/OSAtomic.h>
 #include <mach/mach.h>
 #include <mach/mach_vm.h>
+#include <mach/thread_switch.h>
 #include <os/tsd.h>
 #include <sys/sysctl.h>
 #include <sys/stat.h>
@@ -83,6 +84,9 @@
 #define INITIAL_MAX_COLLIDE	19
 #define DEFAULT_UNIQUING_PAGE_SIZE 256
 
+// PC word of a uniquing table node while its inserting thread is still writing the parent word
+#define UNIQUING_NODE_BUSY ((mach_vm_address_t)1)
+
 #pragma mark -
 #pragma mark Macros
 
@@ -206,6 +210,9 @@ extern boolean_t __stack_logging_locked();
 // single-thread access variables
 static stack_buffer_shared_memory *pre_write_buffers;
 static vm_address_t *stack_buffer;
+
+// set once logging is fully set up; read without the lock to unique stacks before taking it
+static backtrace_uniquing_table *volatile shared_uniquing_table = NULL;
 static uintptr_t last_logged_malloc_address = 0;
 
 // Constants to define part of stack logging file path names.
@@ -255,16 +262,42 @@ deallocate_pages(void* memPointer, uint64_t memSize)
 	return mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)(uintptr_t)memPointer, memSize);
 }
 
+// Generation g of the table spans DEFAULT_UNIQUING_PAGE_SIZE << (EXPAND_FACTOR * g) pages.  Only the current
+// generation is mapped.  Expanding first tries to map the next generation's extra pages right after the table, in
+// which case nodes never move and threads still inserting into the previous generation's range are unaffected (the
+// cost of losing such a race is a duplicate node, never a wrong backtrace).  Otherwise the table is copied to a new
+// mapping as it always was, after waiting for the lock-free inserters counted in uniquing_table_inserters to leave.
+static volatile int32_t uniquing_table_generation = 0;
+static volatile int32_t uniquing_table_inserters = 0;
+static volatile int32_t uniquing_table_relocating = 0;
+
+static inline uint64_t
+__uniquing_table_num_pages(int32_t generation)
+{
+	return (uint64_t)DEFAULT_UNIQUING_PAGE_SIZE << (EXPAND_FACTOR * generation);
+}
+
+static inline uint64_t
+__uniquing_table_num_nodes(int32_t generation)
+{
+	return (((__uniquing_table_num_pages(generation) * vm_page_size) / (sizeof(mach_vm_address_t) * 2)) >> 1) << 1; // make sure it's even.
+}
+
 static backtrace_uniquing_table*
 __create_uniquing_table(void)
 {
 	backtrace_uniquing_table *uniquing_table = (backtrace_uniquing_table*)allocate_pages((uint64_t)round_page(sizeof(backtrace_uniquing_table)));
 	if (!uniquing_table) return NULL;
 	bzero(uniquing_table, sizeof(backtrace_uniquing_table));
-	uniquing_table->numPages = DEFAULT_UNIQUING_PAGE_SIZE;
+	uniquing_table_generation = 0;
+	uniquing_table->numPages = __uniquing_table_num_pages(0);
 	uniquing_table->tableSize = uniquing_table->numPages * vm_page_size;
-	uniquing_table->numNodes = ((uniquing_table->tableSize / (sizeof(mach_vm_address_t) * 2)) >> 1) << 1; // make sure it's even.
+	uniquing_table->numNodes = __uniquing_table_num_nodes(0);
 	uniquing_table->u.table = (mach_vm_address_t*)(uintptr_t)allocate_pages(uniquing_table->tableSize);
+	if (!uniquing_table->u.table) {
+		deallocate_pages(uniquing_table, round_page(sizeof(backtrace_uniquing_table)));
+		return NULL;
+	}
 	uniquing_table->table_address = (uintptr_t)uniquing_table->u.table;
 	uniquing_table->max_collide = INITIAL_MAX_COLLIDE;
 	uniquing_table->untouchableNodes = 0;
@@ -283,85 +316,127 @@ __destroy_uniquing_table(backtrace_uniquing_table* table)
 	deallocate_pages(table, sizeof(backtrace_uniquing_table));
 }
 
-static void
-__expand_uniquing_table(backtrace_uniquing_table *uniquing_table)
+// Moves the table from generation 'seen' to the next one; returns 0 if no memory could be had for it.
+// Called with stack_logging_lock held and thread_doing_logging set, so that the vm_allocate()s here are not logged.
+static int
+__expand_uniquing_table(backtrace_uniquing_table *uniquing_table, int32_t seen)
 {
-	mach_vm_address_t *oldTable = uniquing_table->u.table;
-	uint64_t oldsize = uniquing_table->tableSize;
-	uint64_t oldnumnodes = uniquing_table->numNodes;
+	if (seen != uniquing_table_generation) return 1; // already expanded since the caller looked
 
-	uniquing_table->numPages = uniquing_table->numPages << EXPAND_FACTOR;
-	uniquing_table->tableSize = uniquing_table->numPages * vm_page_size;
-	uniquing_table->numNodes = ((uniquing_table->tableSize / (sizeof(mach_vm_address_t) * 2)) >> 1) << 1; // make sure it's even.
-	mach_vm_address_t *newTable = (mach_vm_address_t*)(uintptr_t)allocate_pages(uniquing_table->tableSize);
-
-	uniquing_table->u.table = newTable;
-	uniquing_table->table_address = (uintptr_t)uniquing_table->u.table;
-	uniquing_table->max_collide = uniquing_table->max_collide + COLLISION_GROWTH_RATE;
+	mach_vm_address_t *oldTable = uniquing_table->u.table;
+	uint64_t oldsize = __uniquing_table_num_pages(seen) * vm_page_size;
+	uint64_t newsize = __uniquing_table_num_pages(seen + 1) * vm_page_size;
+	mach_vm_address_t tail = (mach_vm_address_t)(uintptr_t)oldTable + oldsize;
+
+	if (mach_vm_allocate(mach_task_self(), &tail, newsize - oldsize, VM_FLAGS_FIXED | VM_MAKE_TAG(VM_MEMORY_ANALYSIS_TOOL)) != KERN_SUCCESS) {
+		// The pages after the table are taken; copy it to a new mapping instead.
+		mach_vm_address_t *newTable = (mach_vm_address_t*)(uintptr_t)allocate_pages(newsize);
+		if (!newTable) return 0;
+
+		uniquing_table_relocating = 1;
+		OSMemoryBarrier();
+		while (uniquing_table_inserters) {
+			// lock-free inserters are at most one backtrace away from leaving the old table
+			thread_switch(MACH_PORT_NULL, SWITCH_OPTION_DEPRESS, 1);
+		}
+		if (mach_vm_copy(mach_task_self(), (mach_vm_address_t)(uintptr_t)oldTable, oldsize, (mach_vm_address_t)(uintptr_t)newTable) != KERN_SUCCESS) {
+			malloc_printf("expandUniquingTable(): VMCopyFailed\n");
+		}
+		uniquing_table->u.table = newTable;
+		uniquing_table->table_address = (uintptr_t)newTable;
 
-	if (mach_vm_copy(mach_task_self(), (mach_vm_address_t)(uintptr_t)oldTable, oldsize, (mach_vm_address_t)(uintptr_t)newTable) != KERN_SUCCESS) {
-		malloc_printf("expandUniquingTable(): VMCopyFailed\n");
+#if BACKTRACE_UNIQUING_DEBUG
+		malloc_printf("expandUniquingTable(): allocate: %p; end: %p\n", newTable, (void*)((uintptr_t)newTable + (uintptr_t)newsize));
+		malloc_printf("expandUniquingTable(): deallocate: %p; end: %p\n", oldTable, (void*)((uintptr_t)oldTable + (uintptr_t)oldsize));
+#endif
+		if (deallocate_pages(oldTable, oldsize) != KERN_SUCCESS) {
+			malloc_printf("expandUniquingTable(): mach_vm_deallocate failed. [%p]\n", oldTable);
+		}
 	}
-	uniquing_table->untouchableNodes = oldnumnodes;
+
+	uniquing_table->untouchableNodes = __uniquing_table_num_nodes(seen);
+	uniquing_table->numNodes = __uniquing_table_num_nodes(seen + 1);
+	uniquing_table->numPages = __uniquing_table_num_pages(seen + 1);
+	uniquing_table->max_collide = INITIAL_MAX_COLLIDE + (seen + 1) * COLLISION_GROWTH_RATE;
+	OSMemoryBarrier();
+	// remote readers copy tableSize bytes, so it goes last
+	uniquing_table->tableSize = newsize;
+	uniquing_table_generation = seen + 1;
+	OSMemoryBarrier();
+	uniquing_table_relocating = 0;
 
 #if BACKTRACE_UNIQUING_DEBUG
 	malloc_printf("expandUniquingTable(): expanded from nodes full: %lld of: %lld (~%2d%%); to nodes: %lld (inactive = %lld); unique bts: %lld\n",
-				  uniquing_table->nodesFull, oldnumnodes, (int)(((uniquing_table->nodesFull * 100.0) / (double)oldnumnodes) + 0.5),
+				  uniquing_table->nodesFull, uniquing_table->untouchableNodes, (int)(((uniquing_table->nodesFull * 100.0) / (double)uniquing_table->untouchableNodes) + 0.5),
 				  uniquing_table->numNodes, uniquing_table->untouchableNodes, uniquing_table->backtracesContained);
-	malloc_printf("expandUniquingTable(): allocate: %p; end: %p\n", newTable, (void*)((uintptr_t)newTable + (uintptr_t)(uniquing_table->tableSize)));
-	malloc_printf("expandUniquingTable(): deallocate: %p; end: %p\n", oldTable, (void*)((uintptr_t)oldTable + (uintptr_t)oldsize));
 #endif
-
-	if (deallocate_pages(oldTable, oldsize) != KERN_SUCCESS) {
-		malloc_printf("expandUniquingTable(): mach_vm_deallocate failed. [%p]\n", uniquing_table->u.table);
-	}
+	return 1;
 }
 
+// Lock-free: a node is claimed by swapping its PC word from 0 to UNIQUING_NODE_BUSY, the parent is filled in, and
+// only then is the real PC published, so a concurrent lookup never matches a half-written node.
 static int
-__enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundIndex, mach_vm_address_t *frames, int32_t count)
+__enter_frames_in_table(backtrace_uniquing_table *uniquing_table, int32_t *generation, uint64_t *foundIndex, mach_vm_address_t *frames, int32_t count)
 {
 	// The hash values need to be the same size as the addresses (because we use the value -1), for clarity, define a new type
 	typedef mach_vm_address_t hash_index_t;
 
+	int32_t gen = uniquing_table_generation;
+	volatile mach_vm_address_t *table = uniquing_table->u.table;
+	hash_index_t numNodes = __uniquing_table_num_nodes(gen), untouchableNodes = gen ? __uniquing_table_num_nodes(gen - 1) : 0;
+	int32_t max_collide = INITIAL_MAX_COLLIDE + gen * COLLISION_GROWTH_RATE;
+
 	mach_vm_address_t thisPC;
-	hash_index_t hash, uParent = (hash_index_t)(-1ll), modulus = (uniquing_table->numNodes-uniquing_table->untouchableNodes-1);
+	hash_index_t hash, uParent = (hash_index_t)(-1ll), modulus = (numNodes-untouchableNodes-1);
 	int32_t collisions, lcopy = count, returnVal = 1;
-	hash_index_t hash_multiplier = ((uniquing_table->numNodes - uniquing_table->untouchableNodes)/(uniquing_table->max_collide*2+1));
-	mach_vm_address_t *node;
+	hash_index_t hash_multiplier = ((numNodes - untouchableNodes)/(max_collide*2+1));
+	volatile mach_vm_address_t *node;
+
+	*generation = gen;
 	while (--lcopy >= 0) {
 		thisPC = frames[lcopy];
 
 		// hash = initialHash(uniquing_table, uParent, thisPC);
-		hash = uniquing_table->untouchableNodes + (((uParent << 4) ^ (thisPC >> 2)) % modulus);
-		collisions = uniquing_table->max_collide;
+		hash = untouchableNodes + (((uParent << 4) ^ (thisPC >> 2)) % modulus);
+		collisions = max_collide;
 
 		while (collisions--) {
-			node = uniquing_table->u.table + (hash * 2);
-
-			if (*node == 0 && node[1] == 0) {
-				// blank; store this entry!
-				// Note that we need to test for both head[0] and head[1] as (0, -1) is a valid entry
-				node[0] = thisPC;
-				node[1] = uParent;
-				uParent = hash;
+			node = table + (hash * 2);
+
+			if (node[0] == 0 && node[1] == 0) {
+				if (OSAtomicCompareAndSwap64Barrier(0, UNIQUING_NODE_BUSY, (volatile int64_t *)node)) {
+					// blank, and now ours; store this entry!
+					// Note that we need to test for both head[0] and head[1] as (0, -1) is a valid entry
+					node[1] = uParent;
+					OSMemoryBarrier();
+					node[0] = thisPC;
+					uParent = hash;
 #if BACKTRACE_UNIQUING_DEBUG
-				uniquing_table->nodesFull++;
-				if (lcopy == 0) {
-					uniquing_table->backtracesContained++;
-				}
+					OSAtomicIncrement64((volatile int64_t *)&uniquing_table->nodesFull);
+					if (lcopy == 0) {
+						OSAtomicIncrement64((volatile int64_t *)&uniquing_table->backtracesContained);
+					}
 #endif
-				break;
+					break;
+				}
 			}
-			if (*node == thisPC && node[1] == uParent) {
-				// hit! retrieve index and go.
-				uParent = hash;
-				break;
+			while (node[0] == UNIQUING_NODE_BUSY) {
+				// another thread is filling in this node; it is only a couple of stores away
+				thread_switch(MACH_PORT_NULL, SWITCH_OPTION_DEPRESS, 1);
+			}
+			if (node[0] == thisPC) {
+				OSMemoryBarrier();	// pairs with the barrier between the parent and PC stores above
+				if (node[1] == uParent) {
+					// hit! retrieve index and go.
+					uParent = hash;
+					break;
+				}
 			}
 
 			hash += collisions * hash_multiplier + 1;
 
-			if (hash >= uniquing_table->numNodes) {
-				hash -= (uniquing_table->numNodes - uniquing_table->untouchableNodes); // wrap around.
+			if (hash >= numNodes) {
+				hash -= (numNodes - untouchableNodes); // wrap around.
 			}
 		}
 
@@ -852,6 +927,9 @@ __prepare_to_log_stacks(void)
 			}
 			return;
 		}
+
+		OSMemoryBarrier();
+		shared_uniquing_table = pre_write_buffers->uniquing_table;
 	}
 }
 
@@ -894,6 +972,59 @@ __prepare_to_log_stacks_stage2(void)
 }
 
 
+// results of __unique_stack()
+#define UNIQUE_STACK_NOT_YET		0
+#define UNIQUE_STACK_FOUND			1
+#define UNIQUE_STACK_NONE			2	// thread_stack_pcs() didn't give a valid backtrace
+#define UNIQUE_STACK_TABLE_FULL		3	// the table could not grow
+
+// Gathers the calling thread's stack into 'buffer' (STACK_LOGGING_MAX_STACK_SIZE entries) and enters it in the
+// uniquing table.  Inlined so that the number of hot frames to skip is the same as in the caller.  Without
+// stack_logging_lock ('locked' false) it never grows or waits for the table: UNIQUE_STACK_NOT_YET then means
+// try again under the lock.
+static __attribute__((always_inline)) inline int
+__unique_stack(backtrace_uniquing_table *uniquing_table, vm_address_t *buffer, vm_address_t self_thread, uint32_t num_hot_to_skip, uint64_t *uniqueStackIdentifier, boolean_t locked)
+{
+	uint32_t count;
+	int32_t generation;
+
+	thread_stack_pcs(buffer, STACK_LOGGING_MAX_STACK_SIZE-1, &count); // only gather up to STACK_LOGGING_MAX_STACK_SIZE-1 since we append thread id
+	buffer[count++] = self_thread + 1;		// stuffing thread # in the coldest slot.  Add 1 to match what the old stack logging did.
+	num_hot_to_skip += 2;
+	if (count <= num_hot_to_skip) {
+		// Oops!  Didn't get a valid backtrace from thread_stack_pcs().
+		return UNIQUE_STACK_NONE;
+	}
+
+	// unique stack in memory
+	count -= num_hot_to_skip;
+#if __LP64__
+	mach_vm_address_t *frames = (mach_vm_address_t*)buffer + num_hot_to_skip;
+#else
+	mach_vm_address_t frames[STACK_LOGGING_MAX_STACK_SIZE];
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		frames[i] = buffer[i+num_hot_to_skip];
+	}
+#endif
+
+	if (!locked) {
+		int entered = 0;
+
+		OSAtomicIncrement32Barrier(&uniquing_table_inserters);
+		if (!uniquing_table_relocating) {
+			entered = __enter_frames_in_table(uniquing_table, &generation, uniqueStackIdentifier, frames, (int32_t)count);
+		}
+		OSAtomicDecrement32Barrier(&uniquing_table_inserters);
+		return entered ? UNIQUE_STACK_FOUND : UNIQUE_STACK_NOT_YET;
+	}
+
+	while (!__enter_frames_in_table(uniquing_table, &generation, uniqueStackIdentifier, frames, (int32_t)count)) {
+		if (!__expand_uniquing_table(uniquing_table, generation)) return UNIQUE_STACK_TABLE_FULL;
+	}
+	return UNIQUE_STACK_FOUND;
+}
+
 void
 __disk_stack_logging_log_stack(uint32_t type_flags, uintptr_t zone_ptr, uintptr_t arg2, uintptr_t arg3, uintptr_t return_val, uint32_t num_hot_to_skip)
 {
@@ -954,6 +1085,18 @@ __disk_stack_logging_log_stack(uint32_t type_flags, uintptr_t zone_ptr, uintptr_
 		return;
 	}
 
+	// The uniquing table takes concurrent inserts, so once logging is set up the stack is gathered and uniqued
+	// before taking the lock, which then only serializes the index buffer.  A free that compaction is about to
+	// erase needs no stack; last_logged_malloc_address is only a hint here and is checked again under the lock.
+	backtrace_uniquing_table *uniquing_table = shared_uniquing_table;
+	uint64_t uniqueStackIdentifier = (uint64_t)(-1ll);
+	int stack_status = UNIQUE_STACK_NOT_YET;
+	if (uniquing_table && !(last_logged_malloc_address && (type_flags & stack_logging_type_dealloc) && STACK_LOGGING_DISGUISE(ptr_arg) == last_logged_malloc_address)) {
+		vm_address_t local_stack_buffer[STACK_LOGGING_MAX_STACK_SIZE];
+		stack_status = __unique_stack(uniquing_table, local_stack_buffer, self_thread, num_hot_to_skip, &uniqueStackIdentifier, FALSE);
+		if (stack_status == UNIQUE_STACK_NONE) return;
+	}
+
 	// lock and enter
 	_malloc_lock_lock(&stack_logging_lock);
 
@@ -986,35 +1129,20 @@ __disk_stack_logging_log_stack(uint32_t type_flags, uintptr_t zone_ptr, uintptr_
 		return;
 	}
 
-	// gather stack
-	uint32_t count;
-	thread_stack_pcs(stack_buffer, STACK_LOGGING_MAX_STACK_SIZE-1, &count); // only gather up to STACK_LOGGING_MAX_STACK_SIZE-1 since we append thread id
-	stack_buffer[count++] = self_thread + 1;		// stuffing thread # in the coldest slot.  Add 1 to match what the old stack logging did.
-	num_hot_to_skip += 2;
-	if (count <= num_hot_to_skip) {
-		// Oops!  Didn't get a valid backtrace from thread_stack_pcs().
+	if (stack_status == UNIQUE_STACK_NOT_YET) {
+		// logging was only just set up, or the table has to grow; use the shared buffer, we hold the lock
+		stack_status = __unique_stack(pre_write_buffers->uniquing_table, stack_buffer, self_thread, num_hot_to_skip, &uniqueStackIdentifier, TRUE);
+	}
+	if (stack_status != UNIQUE_STACK_FOUND) {
+		if (stack_status == UNIQUE_STACK_TABLE_FULL) {
+			_malloc_printf(ASL_LEVEL_INFO, "backtrace uniquing table can't grow\n");
+			disable_stack_logging();
+		}
 		thread_doing_logging = 0;
 		_malloc_lock_unlock(&stack_logging_lock);
 		return;
 	}
 
-	// unique stack in memory
-	count -= num_hot_to_skip;
-#if __LP64__
-	mach_vm_address_t *frames = (mach_vm_address_t*)stack_buffer + num_hot_to_skip;
-#else
-	mach_vm_address_t frames[STACK_LOGGING_MAX_STACK_SIZE];
-	uint32_t i;
-	for (i = 0; i < count; i++) {
-		frames[i] = stack_buffer[i+num_hot_to_skip];
-	}
-#endif
-
-	uint64_t uniqueStackIdentifier = (uint64_t)(-1ll);
-	while (!__enter_frames_in_table(pre_write_buffers->uniquing_table, &uniqueStackIdentifier, frames, (int32_t)count)) {
-		__expand_uniquing_table(pre_write_buffers->uniquing_table);
-	}
-
 	stack_logging_index_event current_index;
 	if (type_flags & stack_logging_type_alloc || type_flags & stack_logging_type_vm_allocate) {
 		current_index.address = STACK_LOGGING_DISGUISE(return_val);
@@ -0,0 +1,52 @@
+/*
+ * bench_spawn.h:  Shared by the benchmarks that time a malloc feature off
+ *                 and on.  Such a feature is chosen by an environment
+ *                 variable read when malloc initializes, so unless the
+ *                 benchmark was given -once it re-runs itself with -once in
+ *                 a child process for each setting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/*
+ * Re-run 'self' with the NULL terminated option words 'args' followed by
+ * -once.  Every environment variable whose name starts with 'prefix' is left
+ * out of the child's environment, and 'setting' ("Name=value"), if not NULL,
+ * is added.  Returns the child's exit status, or 1 if it did not exit.
+ */
+static int bench_spawn_once(char *self, char **args, const char *prefix, char *setting)
+{
+    char *argv[64], *envp[1024];
+    size_t prefix_len = strlen(prefix);
+    int argc = 0, envc = 0, status, ex;
+    pid_t pid;
+
+    argv[argc++] = self;
+    while (*args && argc < 62)
+	argv[argc++] = *args++;
+    argv[argc++] = "-once";
+    argv[argc] = NULL;
+
+    for (ex = 0; environ[ex] && envc < 1022; ex++) {
+	if (strncmp(environ[ex], prefix, prefix_len) != 0)
+	    envp[envc++] = environ[ex];
+    }
+    if (setting)
+	envp[envc++] = setting;
+    envp[envc] = NULL;
+
+    fflush(stdout);
+    if (posix_spawn(&pid, self, NULL, NULL, argv, envp)) {
+	printf("ERROR:  posix_spawn failed\n");
+	exit(99);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+	return 1;
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,310 @@
+/*
+ * free_list_bench:  Time malloc()/free() on fragmented tiny and small free
+ *                   lists, with the checksummed and the XOR free list links.
+ *
+ * usage:  free_list_bench [options...]
+ *
+ * Default:  Each thread fills a pool of blocks of random size between 16
+ *           bytes and 4KB, frees every other one so that the free lists are
+ *           long and no two free blocks coalesce, then repeatedly frees and
+ *           replaces a random block of the pool, so nearly every malloc() is
+ *           served by popping a free list.  Before that, a single thread
+ *           frees runs of adjacent blocks in random order and allocates
+ *           again, so that blocks are removed from the middle of free lists
+ *           as their neighbours coalesce with them, coalesced blocks grow
+ *           into the last free list, and allocations split them, leaving the
+ *           rest on the list; every block is filled, and checked before it
+ *           is freed.  The run is done twice, in child processes started
+ *           without and with MallocFreeListXor.
+ *
+ * Options:
+ *    -threads #    Number of threads.
+ *    -iters #      free()/malloc() pairs per thread.
+ *    -pool #       Blocks in each thread's pool.
+ *    -max #bytes   Largest block to malloc().
+ *    -stress #     Rounds of freeing and reallocating adjacent blocks.
+ *    -seed #       Set the random seed to #.
+ *    -once         Run once in this process, with whatever free list
+ *                  protection the environment asks for.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the rates)
+ *    1    FAIL (malloc() returned NULL, a block was corrupted, or a child
+ *         run failed)
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "bench_spawn.h"
+
+#define MAX_POOL 65536
+#define STRESS_RUN 512
+
+/* globals */
+int nthreads = 4;          /* threads */
+long iterations = 2000000; /* free()/malloc() pairs per thread */
+int pool = 16384;          /* blocks per thread */
+size_t max_bytes = 4096;
+int stress_rounds = 200;   /* rounds of the adjacent block stress */
+int once = 0;              /* run in this process instead of spawning */
+unsigned rseed;
+
+int failed = 0;
+
+
+/* Display a brief usage message and exit with status 99 */
+void usage()
+{
+    printf("\nusage: free_list_bench [options...]\n");
+    printf("Default: %d threads, %ld free/malloc pairs each over a pool of %d blocks of 16 to %zu bytes,\n",
+	   nthreads, iterations, pool, max_bytes);
+    printf("         with checksummed and then with XOR free list links.\n");
+    printf("\nOptions:\n");
+    printf("   -threads #     Number of threads.\n");
+    printf("   -iters #       free()/malloc() pairs per thread.\n");
+    printf("   -pool #        Blocks in each thread's pool (at most %d).\n", MAX_POOL);
+    printf("   -max #bytes    Largest block size.\n");
+    printf("   -stress #      Rounds of freeing and reallocating adjacent blocks.\n");
+    printf("   -seed #        Set the random seed to this number.\n");
+    printf("   -once          Run once, in this process.\n");
+    exit(99);
+}
+
+
+void *churn(void *arg)
+{
+    unsigned seed = rseed + (unsigned)(long)arg;
+    unsigned char **blocks = calloc(pool, sizeof(unsigned char *));
+    size_t *sizes = calloc(pool, sizeof(size_t));
+    long i;
+    int bx;
+
+    if (blocks == NULL || sizes == NULL) {
+	printf("ERROR:  could not allocate the pool\n");
+	exit(99);
+    }
+    for (bx = 0; bx < pool; bx++) {
+	sizes[bx] = 16 + (size_t)rand_r(&seed) % (max_bytes - 15);
+	blocks[bx] = malloc(sizes[bx]);
+	if (blocks[bx] == NULL) {
+	    printf("FAIL:  malloc(%zu) returned NULL\n", sizes[bx]);
+	    failed = 1;
+	    return NULL;
+	}
+	blocks[bx][0] = (unsigned char)bx;
+    }
+    /* free every other block: the survivors keep the holes from coalescing */
+    for (bx = 0; bx < pool; bx += 2) {
+	free(blocks[bx]);
+	blocks[bx] = NULL;
+    }
+
+    for (i = 0; i < iterations && !failed; i++) {
+	bx = rand_r(&seed) % pool;
+	if (blocks[bx]) {
+	    if (blocks[bx][0] != (unsigned char)bx) {
+		printf("FAIL:  block 0x%llx (%zu bytes) was corrupted\n",
+		       (unsigned long long)blocks[bx], sizes[bx]);
+		failed = 1;
+	    }
+	    free(blocks[bx]);
+	}
+	sizes[bx] = 16 + (size_t)rand_r(&seed) % (max_bytes - 15);
+	blocks[bx] = malloc(sizes[bx]);
+	if (blocks[bx] == NULL) {
+	    printf("FAIL:  malloc(%zu) returned NULL\n", sizes[bx]);
+	    failed = 1;
+	    break;
+	}
+	blocks[bx][0] = (unsigned char)bx;
+    }
+
+    for (bx = 0; bx < pool; bx++)
+	free(blocks[bx]);
+    free(blocks);
+    free(sizes);
+    return NULL;
+}
+
+
+void fill(unsigned char *block, size_t size, unsigned tag)
+{
+    size_t bx;
+
+    for (bx = 0; bx < size; bx++)
+	block[bx] = (unsigned char)(tag + bx);
+}
+
+
+int intact(unsigned char *block, size_t size, unsigned tag)
+{
+    size_t bx;
+
+    for (bx = 0; bx < size; bx++) {
+	if (block[bx] != (unsigned char)(tag + bx)) {
+	    printf("FAIL:  block 0x%llx (%zu bytes) was corrupted at byte %zu\n",
+		   (unsigned long long)block, size, bx);
+	    failed = 1;
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+
+/*
+ * Allocates a run of blocks, which mostly lie next to each other, frees
+ * three quarters of them in random order and then allocates as many blocks
+ * of other sizes.  Freeing a block next to a free one takes that one out of
+ * its free list wherever it is, and the coalesced block goes to a list of
+ * its own, up to the last list, which holds blocks of any larger size;
+ * allocating from the last list splits a block and leaves the rest in its
+ * place.  Every list link those moves touch is written for its new slot.
+ */
+void stress(void)
+{
+    static unsigned char *blocks[STRESS_RUN];
+    static size_t sizes[STRESS_RUN];
+    static unsigned order[STRESS_RUN];
+    unsigned seed = rseed, tmp;
+    int round, bx, ox;
+
+    for (round = 0; round < stress_rounds && !failed; round++) {
+	for (bx = 0; bx < STRESS_RUN; bx++) {
+	    /* mostly tiny blocks, so that runs of them coalesce past the tiny lists */
+	    sizes[bx] = 16 + (size_t)rand_r(&seed) % (rand_r(&seed) % 4 ? 240 : max_bytes - 15);
+	    blocks[bx] = malloc(sizes[bx]);
+	    if (blocks[bx] == NULL) {
+		printf("FAIL:  malloc(%zu) returned NULL\n", sizes[bx]);
+		failed = 1;
+		return;
+	    }
+	    fill(blocks[bx], sizes[bx], round + bx);
+	    order[bx] = bx;
+	}
+	for (bx = STRESS_RUN - 1; bx > 0; bx--) {
+	    ox = rand_r(&seed) % (bx + 1);
+	    tmp = order[bx];
+	    order[bx] = order[ox];
+	    order[ox] = tmp;
+	}
+	for (ox = 0; ox < STRESS_RUN * 3 / 4; ox++) {
+	    bx = order[ox];
+	    intact(blocks[bx], sizes[bx], round + bx);
+	    free(blocks[bx]);
+	    blocks[bx] = NULL;
+	}
+	for (ox = 0; ox < STRESS_RUN * 3 / 4 && !failed; ox++) {
+	    bx = order[ox];
+	    sizes[bx] = 16 + (size_t)rand_r(&seed) % (max_bytes - 15);
+	    blocks[bx] = malloc(sizes[bx]);
+	    if (blocks[bx] == NULL) {
+		printf("FAIL:  malloc(%zu) returned NULL\n", sizes[bx]);
+		failed = 1;
+		return;
+	    }
+	    fill(blocks[bx], sizes[bx], round + bx);
+	}
+	for (bx = 0; bx < STRESS_RUN; bx++) {
+	    if (blocks[bx])
+		intact(blocks[bx], sizes[bx], round + bx);
+	    free(blocks[bx]);
+	}
+    }
+}
+
+
+void run(const char *label)
+{
+    pthread_t threads[256];
+    struct timeval start, end;
+    double elapsed, pairs;
+    int tx;
+
+    stress();
+    if (failed)
+	return;
+    gettimeofday(&start, NULL);
+    for (tx = 0; tx < nthreads; tx++) {
+	if (pthread_create(&threads[tx], NULL, churn, (void *)(long)tx)) {
+	    printf("ERROR:  pthread_create failed\n");
+	    exit(99);
+	}
+    }
+    for (tx = 0; tx < nthreads; tx++)
+	pthread_join(threads[tx], NULL);
+    gettimeofday(&end, NULL);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    pairs = (double)nthreads * iterations;
+    printf("INFO: %-8s free list links: %10.0f pairs/sec aggregate, %6.1f ns per pair per thread\n",
+	   label, pairs / elapsed, elapsed * 1e9 * nthreads / pairs);
+}
+
+
+/* Re-run this benchmark with -once, with or without MallocFreeListXor set */
+int spawn_run(char *self, int xor_links)
+{
+    char threads_arg[32], iters_arg[32], pool_arg[32], max_arg[32], stress_arg[32], seed_arg[32];
+    char *args[] = { "-threads", threads_arg, "-iters", iters_arg, "-pool", pool_arg,
+		     "-max", max_arg, "-stress", stress_arg, "-seed", seed_arg, NULL };
+
+    snprintf(threads_arg, sizeof(threads_arg), "%d", nthreads);
+    snprintf(iters_arg, sizeof(iters_arg), "%ld", iterations);
+    snprintf(pool_arg, sizeof(pool_arg), "%d", pool);
+    snprintf(max_arg, sizeof(max_arg), "%zu", max_bytes);
+    snprintf(stress_arg, sizeof(stress_arg), "%d", stress_rounds);
+    snprintf(seed_arg, sizeof(seed_arg), "%u", rseed);
+    return bench_spawn_once(self, args, "MallocFreeListXor", xor_links ? "MallocFreeListXor=1" : NULL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int argx;
+
+    rseed = (unsigned)time(NULL);
+
+    for (argx = 1; argx < argc; argx++) {
+	if (argx + 1 >= argc && strcmp(argv[argx], "-once") != 0)
+	    usage();
+	if (strcmp(argv[argx], "-threads") == 0)
+	    nthreads = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-iters") == 0)
+	    iterations = atol(argv[++argx]);
+	else if (strcmp(argv[argx], "-pool") == 0)
+	    pool = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-max") == 0)
+	    max_bytes = strtoul(argv[++argx], NULL, 0);
+	else if (strcmp(argv[argx], "-stress") == 0)
+	    stress_rounds = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-seed") == 0)
+	    rseed = (unsigned)strtoul(argv[++argx], NULL, 0);
+	else if (strcmp(argv[argx], "-once") == 0)
+	    once = 1;
+	else
+	    usage();
+    }
+    if (nthreads < 1 || nthreads > 256 || iterations < 1 || pool < 2 ||
+	pool > MAX_POOL || max_bytes < 16 || stress_rounds < 0)
+	usage();
+
+    if (once) {
+	run(getenv("MallocFreeListXor") ? "xor" : "checksum");
+	return failed;
+    }
+
+    printf("INFO: Random seed value = %u\n", rseed);
+    if (spawn_run(argv[0], 0) || spawn_run(argv[0], 1)) {
+	printf("FAIL\n");
+	return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * large_churn_bench:  Time concurrent malloc()/free() churn of large blocks.
+ *
+ * usage:  large_churn_bench [options...]
+ *
+ * Default:  4 threads each repeatedly malloc() a block of random size
+ *           between 64KB and 4MB, touch its first and last page, and
+ *           free() it again, keeping a small window of live blocks.
+ *
+ * Options:
+ *    -threads #    Number of churning threads.
+ *    -iters #      malloc()/free() pairs per thread.
+ *    -min #bytes   Smallest block to malloc().
+ *    -max #bytes   Largest block to malloc().
+ *    -live #       Blocks each thread keeps live at once.
+ *    -seed #       Set the random seed to #.
+ *    -grow         Instead, realloc() one block per thread from -min up to
+ *                  -max bytes in 1/8 steps, checking its contents survive
+ *                  every move.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the aggregate rate)
+ *    1    FAIL (malloc() returned NULL or a block was corrupted)
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define MAX_LIVE 64
+
+/* globals */
+int nthreads = 4;          /* churning threads */
+long iterations = 20000;   /* malloc()/free() pairs per thread */
+size_t min_bytes = 64 * 1024;
+size_t max_bytes = 4 * 1024 * 1024;
+int live_blocks = 4;       /* live window per thread */
+int grow = 0;              /* realloc() growth instead of malloc()/free() */
+unsigned rseed;
+
+int failed = 0;
+
+
+/* Display a brief usage message and exit with status 99 */
+void usage()
+{
+    printf("\nusage: large_churn_bench [options...]\n");
+    printf("Default: %d threads, %ld malloc/free pairs each, sizes %zu to %zu bytes.\n",
+	   nthreads, iterations, min_bytes, max_bytes);
+    printf("\nOptions:\n");
+    printf("   -threads #     Number of churning threads.\n");
+    printf("   -iters #       malloc()/free() pairs per thread.\n");
+    printf("   -min #bytes    Smallest block size.\n");
+    printf("   -max #bytes    Largest block size.\n");
+    printf("   -live #        Blocks each thread keeps live (at most %d).\n", MAX_LIVE);
+    printf("   -seed #        Set the random seed to this number.\n");
+    printf("   -grow          realloc() a block from -min to -max bytes instead.\n");
+    exit(99);
+}
+
+
+/* Fill or check one word per page, so the check itself stays cheap */
+int pattern(long *block, size_t size, long tag, int check)
+{
+    size_t i, words = size / sizeof(long);
+
+    for (i = 0; i < words; i += 4096 / sizeof(long)) {
+	if (check && block[i] != (long)(tag ^ i))
+	    return 0;
+	block[i] = (long)(tag ^ i);
+    }
+    return 1;
+}
+
+
+void *grower(void *arg)
+{
+    long tag = (long)arg + 1;
+    size_t size, new_size, step = (max_bytes - min_bytes) / 8 + 1;
+    long i, *block, *new_block;
+
+    for (i = 0; i < iterations && !failed; i++) {
+	size = min_bytes;
+	block = malloc(size);
+	if (block == NULL) {
+	    printf("FAIL:  malloc(%zu) returned NULL\n", size);
+	    failed = 1;
+	    break;
+	}
+	pattern(block, size, tag, 0);
+	while (size < max_bytes) {
+	    new_size = size + step > max_bytes ? max_bytes : size + step;
+	    new_block = realloc(block, new_size);
+	    if (new_block == NULL) {
+		printf("FAIL:  realloc(%zu) returned NULL\n", new_size);
+		failed = 1;
+		break;
+	    }
+	    if (!pattern(new_block, size, tag, 1)) {
+		printf("FAIL:  realloc(%zu) to 0x%llx lost the old contents\n",
+		       new_size, (unsigned long long)new_block);
+		failed = 1;
+	    }
+	    block = new_block;
+	    size = new_size;
+	    pattern(block, size, tag, 0);
+	}
+	free(block);
+    }
+    return NULL;
+}
+
+
+void *churn(void *arg)
+{
+    unsigned seed = rseed + (unsigned)(long)arg;
+    char *live[MAX_LIVE];
+    size_t sizes[MAX_LIVE];
+    long i;
+    int lx;
+
+    memset(live, 0, sizeof(live));
+    for (i = 0; i < iterations && !failed; i++) {
+	lx = (int)(i % live_blocks);
+	if (live[lx]) {
+	    /* the fill pattern must have survived while the block was live */
+	    if (live[lx][0] != (char)lx || live[lx][sizes[lx] - 1] != (char)lx) {
+		printf("FAIL:  block 0x%llx (%zu bytes) was corrupted\n",
+		       (unsigned long long)live[lx], sizes[lx]);
+		failed = 1;
+	    }
+	    free(live[lx]);
+	}
+
+	sizes[lx] = min_bytes + (size_t)rand_r(&seed) % (max_bytes - min_bytes + 1);
+	live[lx] = malloc(sizes[lx]);
+	if (live[lx] == NULL) {
+	    printf("FAIL:  malloc(%zu) returned NULL\n", sizes[lx]);
+	    failed = 1;
+	    break;
+	}
+	live[lx][0] = (char)lx;
+	live[lx][sizes[lx] - 1] = (char)lx;
+    }
+
+    for (lx = 0; lx < live_blocks; lx++)
+	free(live[lx]);
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_t threads[256];
+    struct timeval start, end;
+    double elapsed;
+    int argx, tx;
+
+    rseed = (unsigned)time(NULL);
+
+    for (argx = 1; argx < argc; argx++) {
+	if (argx + 1 >= argc && strcmp(argv[argx], "-grow") != 0)
+	    usage();
+	if (strcmp(argv[argx], "-threads") == 0)
+	    nthreads = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-iters") == 0)
+	    iterations = atol(argv[++argx]);
+	else if (strcmp(argv[argx], "-min") == 0)
+	    min_bytes = strtoul(argv[++argx], NULL, 0);
+	else if (strcmp(argv[argx], "-max") == 0)
+	    max_bytes = strtoul(argv[++argx], NULL, 0);
+	else if (strcmp(argv[argx], "-live") == 0)
+	    live_blocks = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-grow") == 0)
+	    grow = 1;
+	else if (strcmp(argv[argx], "-seed") == 0)
+	    rseed = (unsigned)strtoul(argv[++argx], NULL, 0);
+	else
+	    usage();
+    }
+    if (nthreads < 1 || nthreads > 256 || iterations < 1 || min_bytes < 1 ||
+	max_bytes < min_bytes || live_blocks < 1 || live_blocks > MAX_LIVE)
+	usage();
+
+    gettimeofday(&start, NULL);
+    for (tx = 0; tx < nthreads; tx++) {
+	if (pthread_create(&threads[tx], NULL, grow ? grower : churn, (void *)(long)tx)) {
+	    printf("ERROR:  pthread_create failed\n");
+	    exit(99);
+	}
+    }
+    for (tx = 0; tx < nthreads; tx++)
+	pthread_join(threads[tx], NULL);
+    gettimeofday(&end, NULL);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    if (grow)
+	printf("INFO: %d threads x %ld realloc() runs of %zu..%zu bytes in %.3f sec\n",
+	       nthreads, iterations, min_bytes, max_bytes, elapsed);
+    else
+	printf("INFO: %d threads x %ld malloc/free pairs of %zu..%zu bytes in %.3f sec\n",
+	       nthreads, iterations, min_bytes, max_bytes, elapsed);
+    printf("INFO: %.0f iterations/sec aggregate, %.0f iterations/sec per thread\n",
+	   nthreads * iterations / elapsed, iterations / elapsed);
+    printf("INFO: Random seed value = %u\n", rseed);
+
+    if (failed) {
+	printf("FAIL\n");
+	return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
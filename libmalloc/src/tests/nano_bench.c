@@ -0,0 +1,152 @@
+/*
+ * nano_bench:  Time malloc()/free() throughput for nano-sized blocks.
+ *
+ * usage:  nano_bench [options...]
+ *
+ * Default:  4 threads each repeatedly malloc() a batch of blocks of
+ *           random size between 16 and 256 bytes and free() them again,
+ *           in the reverse order, which is the pattern the per-CPU caches
+ *           of the nano zone serve best.
+ *
+ * Options:
+ *    -threads #    Number of threads.
+ *    -iters #      Batches per thread.
+ *    -batch #      Blocks per batch.
+ *    -min #bytes   Smallest block to malloc().
+ *    -max #bytes   Largest block to malloc().
+ *    -seed #       Set the random seed to #.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the aggregate rate)
+ *    1    FAIL (malloc() returned NULL or a block was corrupted)
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define MAX_BATCH 4096
+
+/* globals */
+int nthreads = 4;          /* threads */
+long iterations = 100000;  /* batches per thread */
+int batch = 16;            /* blocks per batch */
+size_t min_bytes = 16;
+size_t max_bytes = 256;
+unsigned rseed;
+
+int failed = 0;
+
+
+/* Display a brief usage message and exit with status 99 */
+void usage()
+{
+    printf("\nusage: nano_bench [options...]\n");
+    printf("Default: %d threads, %ld batches of %d blocks each, sizes %zu to %zu bytes.\n",
+	   nthreads, iterations, batch, min_bytes, max_bytes);
+    printf("\nOptions:\n");
+    printf("   -threads #     Number of threads.\n");
+    printf("   -iters #       Batches per thread.\n");
+    printf("   -batch #       Blocks per batch (at most %d).\n", MAX_BATCH);
+    printf("   -min #bytes    Smallest block size.\n");
+    printf("   -max #bytes    Largest block size.\n");
+    printf("   -seed #        Set the random seed to this number.\n");
+    exit(99);
+}
+
+
+void *churn(void *arg)
+{
+    unsigned seed = rseed + (unsigned)(long)arg;
+    unsigned char *blocks[MAX_BATCH];
+    size_t sizes[MAX_BATCH];
+    long i;
+    int bx;
+
+    for (i = 0; i < iterations && !failed; i++) {
+	for (bx = 0; bx < batch; bx++) {
+	    sizes[bx] = min_bytes + (size_t)rand_r(&seed) % (max_bytes - min_bytes + 1);
+	    blocks[bx] = malloc(sizes[bx]);
+	    if (blocks[bx] == NULL) {
+		printf("FAIL:  malloc(%zu) returned NULL\n", sizes[bx]);
+		failed = 1;
+		return NULL;
+	    }
+	    blocks[bx][0] = (unsigned char)bx;
+	    blocks[bx][sizes[bx] - 1] = (unsigned char)bx;
+	}
+	for (bx = batch - 1; bx >= 0; bx--) {
+	    if (blocks[bx][0] != (unsigned char)bx ||
+		blocks[bx][sizes[bx] - 1] != (unsigned char)bx) {
+		printf("FAIL:  block 0x%llx (%zu bytes) was corrupted\n",
+		       (unsigned long long)blocks[bx], sizes[bx]);
+		failed = 1;
+	    }
+	    free(blocks[bx]);
+	}
+    }
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_t threads[256];
+    struct timeval start, end;
+    double elapsed, pairs;
+    int argx, tx;
+
+    rseed = (unsigned)time(NULL);
+
+    for (argx = 1; argx < argc; argx++) {
+	if (argx + 1 >= argc)
+	    usage();
+	if (strcmp(argv[argx], "-threads") == 0)
+	    nthreads = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-iters") == 0)
+	    iterations = atol(argv[++argx]);
+	else if (strcmp(argv[argx], "-batch") == 0)
+	    batch = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-min") == 0)
+	    min_bytes = strtoul(argv[++argx], NULL, 0);
+	else if (strcmp(argv[argx], "-max") == 0)
+	    max_bytes = strtoul(argv[++argx], NULL, 0);
+	else if (strcmp(argv[argx], "-seed") == 0)
+	    rseed = (unsigned)strtoul(argv[++argx], NULL, 0);
+	else
+	    usage();
+    }
+    if (nthreads < 1 || nthreads > 256 || iterations < 1 || batch < 1 ||
+	batch > MAX_BATCH || min_bytes < 1 || max_bytes < min_bytes)
+	usage();
+
+    gettimeofday(&start, NULL);
+    for (tx = 0; tx < nthreads; tx++) {
+	if (pthread_create(&threads[tx], NULL, churn, (void *)(long)tx)) {
+	    printf("ERROR:  pthread_create failed\n");
+	    exit(99);
+	}
+    }
+    for (tx = 0; tx < nthreads; tx++)
+	pthread_join(threads[tx], NULL);
+    gettimeofday(&end, NULL);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    pairs = (double)nthreads * iterations * batch;
+    printf("INFO: %d threads x %ld batches of %d blocks, %zu..%zu bytes, in %.3f sec\n",
+	   nthreads, iterations, batch, min_bytes, max_bytes, elapsed);
+    printf("INFO: %.0f malloc/free pairs/sec aggregate, %.1f ns per pair per thread\n",
+	   pairs / elapsed, elapsed * 1e9 * nthreads / pairs);
+    printf("INFO: Random seed value = %u\n", rseed);
+
+    if (failed) {
+	printf("FAIL\n");
+	return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
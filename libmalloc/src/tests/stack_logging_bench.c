@@ -0,0 +1,177 @@
+/*
+ * stack_logging_bench:  Time malloc()/free() throughput with stack logging
+ *                       on and off, across a range of thread counts.
+ *
+ * usage:  stack_logging_bench [options...]
+ *
+ * Default:  For 1, 2, 4, ... 64 threads, each thread repeatedly malloc()s
+ *           and free()s blocks from one of several call paths of different
+ *           depths, so that the stack uniquing table sees a realistic mix
+ *           of shared and distinct backtraces.  The whole sweep runs twice,
+ *           in child processes started without and with MallocStackLogging.
+ *
+ * Options:
+ *    -threads #    Largest thread count in the sweep.
+ *    -iters #      malloc()/free() pairs per thread.
+ *    -paths #      Distinct call paths to allocate from.
+ *    -seed #       Set the random seed to #.
+ *    -once         Run the sweep once in this process, with whatever stack
+ *                  logging the environment asks for.
+ *
+ * Exits with status code:
+ *    0    PASS (and prints the rates)
+ *    1    FAIL (malloc() returned NULL or a child run failed)
+ *    99   Illegal arguments or internal error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "bench_spawn.h"
+
+/* globals */
+int max_threads = 64;      /* largest thread count in the sweep */
+long iterations = 50000;   /* malloc()/free() pairs per thread */
+int paths = 64;            /* distinct call paths */
+int once = 0;              /* run in this process instead of spawning */
+unsigned rseed;
+
+int failed = 0;
+
+
+/* Display a brief usage message and exit with status 99 */
+void usage()
+{
+    printf("\nusage: stack_logging_bench [options...]\n");
+    printf("Default: 1..%d threads, %ld malloc/free pairs each from %d call paths,\n",
+	   max_threads, iterations, paths);
+    printf("         with stack logging off and then on.\n");
+    printf("\nOptions:\n");
+    printf("   -threads #     Largest thread count in the sweep.\n");
+    printf("   -iters #       malloc()/free() pairs per thread.\n");
+    printf("   -paths #       Distinct call paths to allocate from.\n");
+    printf("   -seed #        Set the random seed to this number.\n");
+    printf("   -once          Run the sweep once, in this process.\n");
+    exit(99);
+}
+
+
+/* Recurse 'depth' frames before allocating, so each path has its own backtrace */
+__attribute__((noinline)) void *alloc_at_depth(int depth, size_t size)
+{
+    void *block;
+
+    if (depth > 0) {
+	block = alloc_at_depth(depth - 1, size);
+	__asm__ __volatile__("" ::: "memory");	/* not a tail call */
+	return block;
+    }
+    return malloc(size);
+}
+
+
+void *churn(void *arg)
+{
+    unsigned seed = rseed + (unsigned)(long)arg;
+    long i;
+
+    for (i = 0; i < iterations && !failed; i++) {
+	int path = rand_r(&seed) % paths;
+	size_t size = 16 + (size_t)rand_r(&seed) % 1024;
+	char *block = alloc_at_depth(path % 16 + path / 16, size);
+
+	if (block == NULL) {
+	    printf("FAIL:  malloc(%zu) returned NULL\n", size);
+	    failed = 1;
+	    break;
+	}
+	block[0] = (char)i;
+	free(block);
+    }
+    return NULL;
+}
+
+
+void sweep(const char *label)
+{
+    pthread_t threads[256];
+    struct timeval start, end;
+    double elapsed;
+    int nthreads, tx;
+
+    for (nthreads = 1; nthreads <= max_threads && !failed; nthreads *= 2) {
+	gettimeofday(&start, NULL);
+	for (tx = 0; tx < nthreads; tx++) {
+	    if (pthread_create(&threads[tx], NULL, churn, (void *)(long)tx)) {
+		printf("ERROR:  pthread_create failed\n");
+		exit(99);
+	    }
+	}
+	for (tx = 0; tx < nthreads; tx++)
+	    pthread_join(threads[tx], NULL);
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	printf("INFO: stack logging %-3s %2d threads: %10.0f pairs/sec aggregate, %8.0f pairs/sec per thread\n",
+	       label, nthreads, nthreads * iterations / elapsed, iterations / elapsed);
+    }
+}
+
+
+/* Re-run this benchmark with -once, with or without MallocStackLogging set */
+int spawn_sweep(char *self, int logging)
+{
+    char threads_arg[32], iters_arg[32], paths_arg[32], seed_arg[32];
+    char *args[] = { "-threads", threads_arg, "-iters", iters_arg, "-paths", paths_arg,
+		     "-seed", seed_arg, NULL };
+
+    snprintf(threads_arg, sizeof(threads_arg), "%d", max_threads);
+    snprintf(iters_arg, sizeof(iters_arg), "%ld", iterations);
+    snprintf(paths_arg, sizeof(paths_arg), "%d", paths);
+    snprintf(seed_arg, sizeof(seed_arg), "%u", rseed);
+    return bench_spawn_once(self, args, "MallocStackLogging", logging ? "MallocStackLogging=1" : NULL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int argx;
+
+    rseed = (unsigned)time(NULL);
+
+    for (argx = 1; argx < argc; argx++) {
+	if (argx + 1 >= argc && strcmp(argv[argx], "-once") != 0)
+	    usage();
+	if (strcmp(argv[argx], "-threads") == 0)
+	    max_threads = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-iters") == 0)
+	    iterations = atol(argv[++argx]);
+	else if (strcmp(argv[argx], "-paths") == 0)
+	    paths = atoi(argv[++argx]);
+	else if (strcmp(argv[argx], "-seed") == 0)
+	    rseed = (unsigned)strtoul(argv[++argx], NULL, 0);
+	else if (strcmp(argv[argx], "-once") == 0)
+	    once = 1;
+	else
+	    usage();
+    }
+    if (max_threads < 1 || max_threads > 256 || iterations < 1 || paths < 1)
+	usage();
+
+    if (once) {
+	sweep(getenv("MallocStackLogging") ? "on" : "off");
+	return failed;
+    }
+
+    printf("INFO: Random seed value = %u\n", rseed);
+    if (spawn_sweep(argv[0], 0) || spawn_sweep(argv[0], 1)) {
+	printf("FAIL\n");
+	return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -8,6 +8,10 @@
 
 #include "mfx_provider.h"
 #include "memfix.h"
+#include <algorithm>
+#ifndef X_OS_WINDOWS
+#include <sys/mman.h>
+#endif
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -15,8 +19,10 @@
 static char THIS_FILE[] = __FILE__;
 #endif
 
-// 对每一个 Pool，页面 vector 的初始长度
-const int MEMFIX_RESERVED_PAGE_VECTOR_SIZE	= 16;
+#ifndef X_OS_WINDOWS
+// 最近分配出去的 MfxMemoryPool 实例代号
+static size_t s_mfxPoolGeneration = 0;
+#endif
 
 MfxMemoryPoolUseHeader& MfxPrivateService::instance()
 {
@@ -24,6 +30,40 @@ MfxMemoryPoolUseHeader& MfxPrivateService::instance()
 	return s_inst;
 }
 
+// -------------------------------------------------------------------------- //
+// 虚拟内存的保留、提交、回收与释放
+// Windows 下转调 g_platform；其他平台直接使用 mmap，保留时不占用提交额度
+
+#ifdef X_OS_WINDOWS
+inline PVOID mfxVirtualReserve(size_t cb)		{ return g_platform->SysVirtualReserve(cb); }
+inline PVOID mfxVirtualCommit(PVOID p, size_t cb)	{ return g_platform->SysVirtualCommit(p, cb); }
+inline void mfxVirtualDecommit(PVOID p, size_t cb)	{ g_platform->SysVirtualDecommit(p, cb); }
+inline void mfxVirtualFree(PVOID p, size_t cb)		{ g_platform->SysVirtualFree(p, cb); }
+#else
+inline PVOID mfxVirtualReserve(size_t cb)
+{
+	PVOID p = mmap(NULL, cb, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+inline PVOID mfxVirtualCommit(PVOID p, size_t cb)
+{
+	return mprotect(p, cb, PROT_READ | PROT_WRITE) == 0 ? p : NULL;
+}
+
+inline void mfxVirtualDecommit(PVOID p, size_t cb)
+{
+	// 先把物理页还给系统，再禁止访问，与 Windows 的 Decommit 行为一致
+	madvise(p, cb, MADV_DONTNEED);
+	mprotect(p, cb, PROT_NONE);
+}
+
+inline void mfxVirtualFree(PVOID p, size_t cb)
+{
+	munmap(p, cb);
+}
+#endif
+
 // -------------------------------------------------------------------------- //
 
 MemoryProviderVirtualP::MemoryProviderVirtualP()
@@ -40,7 +80,7 @@ MemoryProviderVirtualP::~MemoryProviderVirtualP()
 		for (it = m_blockVec.begin(); it != m_blockVec.end(); ++it)
 		{
 			_BLOCK&	blk = *it;
-			g_platform->SysVirtualFree(blk.ptr, VTALC_BLOCK_SIZE);
+			mfxVirtualFree(blk.ptr, VTALC_BLOCK_SIZE);
 			delete blk.pUS;
 		}
 		m_blockVec.clear();
@@ -66,7 +106,7 @@ PVOID MemoryProviderVirtualP::Alloc()
 	if (it == m_blockVec.end())
 	{
 		_BLOCK	b;
-		b.ptr = static_cast<BYTE*>( g_platform->SysVirtualReserve(VTALC_BLOCK_SIZE) );
+		b.ptr = static_cast<BYTE*>( mfxVirtualReserve(VTALC_BLOCK_SIZE) );
 		if (b.ptr == NULL)
 		{
 			// Unable to allocate memory
@@ -95,7 +135,7 @@ PVOID MemoryProviderVirtualP::Alloc()
 		ASSERT(iBit >= 0 && static_cast<UINT>(iBit) < VTALC_BLOCK_SIZE / g_platform->PageSize);
 
 		p = blk.ptr + iBit * g_platform->PageSize;
-		p = static_cast<BYTE*>(g_platform->SysVirtualCommit(p, g_platform->PageSize));
+		p = static_cast<BYTE*>(mfxVirtualCommit(p, g_platform->PageSize));
 		ASSERT(p != NULL);
 
 		if (p != NULL)
@@ -118,13 +158,15 @@ void MemoryProviderVirtualP::Free(PVOID _p)
 	BYTE* p = static_cast<BYTE*>(_p);
 
 	m_spinPool.lock();
-	// 搜索其所在内存块
-	// 这个过程可以被优化掉
-	_BLOCKVEC::iterator	it;
-	for (it = m_blockVec.begin(); it != m_blockVec.end(); ++it)
+	// 搜索其所在内存块：m_blockVec 按起始地址有序，二分找到最后一个起始地址不大于 p 的块
+	_BLOCK	key;
+	key.ptr = p;
+	_BLOCKVEC::iterator	it = std::upper_bound(m_blockVec.begin(), m_blockVec.end(), key, _PR_BLOCK());
+	if (it != m_blockVec.begin())
 	{
+		--it;
 		_BLOCK&		blk = *it;
-		if (p >= blk.ptr && p - blk.ptr < VTALC_BLOCK_SIZE)
+		if (p >= blk.ptr && static_cast<size_t>(p - blk.ptr) < VTALC_BLOCK_SIZE)
 		{
 			//找到了，开始处理
 			int	iBit = (p - blk.ptr) / g_platform->PageSize;
@@ -134,7 +176,7 @@ void MemoryProviderVirtualP::Free(PVOID _p)
 			DiagSubmitFreeAction(PreAlc_Platform, p, g_platform->PageSize);
 			//多次Commit同一块内存是没有关系的，但是哪怕是只Decommit一个字节，该字节的所在
 			//页面也会被Demmit掉，因此有g_platform->PageSize和g_platform->PageSize的比较
-			g_platform->SysVirtualDecommit(p, g_platform->PageSize);
+			mfxVirtualDecommit(p, g_platform->PageSize);
 			blk.pUS->set(iBit, false);
 			++blk.uFree;
 			ASSERT(blk.uFree > 0 && blk.uFree <= VTALC_BLOCK_SIZE / g_platform->PageSize);
@@ -142,7 +184,7 @@ void MemoryProviderVirtualP::Free(PVOID _p)
 			if (blk.uFree >= VTALC_BLOCK_SIZE / g_platform->PageSize)
 			{
 				// 整页删除
-				g_platform->SysVirtualFree(blk.ptr, blk.uFree * g_platform->PageSize);
+				mfxVirtualFree(blk.ptr, blk.uFree * g_platform->PageSize);
 				delete blk.pUS;
 				m_blockVec.erase(it);
 			}
@@ -162,8 +204,9 @@ UINT MemoryProviderVirtualP::AllocatedSize()
 }
 // -------------------------------------------------------------------------- //
 
+// 空闲单元里要存放指向下一个单元的指针，因此单元大小按指针长度对齐（64 位下为 8）
 MfxFixedSinglePool::MfxFixedSinglePool(DWORD dwUnitSize)
-	:m_dwUnitSize(dwUnitSize)
+	:m_dwUnitSize((dwUnitSize + sizeof(PVOID) - 1) & ~(DWORD)(sizeof(PVOID) - 1))
 	,m_dwFreeNode(0)
 	, m_pHead(NULL)
 {
@@ -171,16 +214,16 @@ MfxFixedSinglePool::MfxFixedSinglePool(DWORD dwUnitSize)
 	mrp_nUsed = mrp_nPeakUsed = mrp_nAllocated = mrp_nFreed = 0;
 #endif
 
-	ASSERT((m_dwUnitSize & 3) == 0);
+	ASSERT((m_dwUnitSize & (MFX_UNIT_ALIGN - 1)) == 0);
 
 #ifdef _DEBUG
-	m_dwUnitPage = g_platform->PageSize / (m_dwUnitSize + 4);
+	// Debug 下每个单元后面多留一段 0xAC 用来检查写越界，长度同样按指针对齐
+	m_dwUnitPage = g_platform->PageSize / (m_dwUnitSize + MFX_UNIT_ALIGN);
 #else
 	m_dwUnitPage = g_platform->PageSize / m_dwUnitSize;
 #endif
 
 	ASSERT(m_dwUnitPage > 0);
-	m_Ptrs.reserve(MEMFIX_RESERVED_PAGE_VECTOR_SIZE);
 	PreparePage();
 
 #if ALG_FEATURE_DBGOUT
@@ -227,7 +270,7 @@ void MfxFixedSinglePool::InitPage(PVOID pNewPage)
 	memset(p1, 0xAC, g_platform->PageSize);
 	for (DWORD i = 0; i < m_dwUnitPage - 1; ++i)
 	{
-		p3 = p2 + m_dwUnitSize + 4;
+		p3 = p2 + m_dwUnitSize + MFX_UNIT_ALIGN;
 		*(PVOID*)p2 = p3;
 		p2 = p3;
 	}
@@ -248,7 +291,10 @@ void MfxFixedSinglePool::InitPage(PVOID pNewPage)
 void MfxFixedSinglePool::PreparePage()
 {
 	PVOID	p = g_pMSMP->PageAlloc();
-	m_Ptrs.push_back(p);
+	{
+		ThreadLiteLib::SpinLockHelper spinHlp(&m_spinPtrs);
+		m_Ptrs.insert(p);
+	}
 	InitPage(p);
 	ASSERT(m_dwFreeNode == 0);
 	m_dwFreeNode += m_dwUnitPage;
@@ -284,29 +330,30 @@ void MfxFixedSinglePool::Decommit(PAGEINFO_VEC& PageInfos)
 
 void MfxFixedSinglePool::PreDecommit(PAGEINFO_VEC& PageInfos)
 {
-	if (*((DWORD*)m_pHead) == 0)
+	// 空闲链表的链接是指针，64 位下不能再按 DWORD 读取
+	if (m_pHead == NULL || *(PVOID*)m_pHead == NULL)
 		return;
 
 	// 找出可回收页面
 	// m_pHead所在页面不回收
-	DWORD* p = (DWORD*)(*(DWORD*)m_pHead);
+	PVOID* p = (PVOID*)(*(PVOID*)m_pHead);
 	do
 	{
 		++PageInfos[get_page_idx((PVOID)p)];	
-		p = reinterpret_cast<DWORD*>(*p);
+		p = reinterpret_cast<PVOID*>(*p);
 
 	} while (p != NULL);
 }
 
 void MfxFixedSinglePool::DecommitI(PAGEINFO_VEC& PageInfos)
 {
-	if (*((DWORD*)m_pHead) == 0)
+	if (m_pHead == NULL || *(PVOID*)m_pHead == NULL)
 		return;
 
 	// 再遍历一遍，拆除需要回收的节点，形成新的空闲节点链
-	DWORD* pNewFreeList = NULL;
-	DWORD* pPrevNotFree = NULL;
-	DWORD* p = (DWORD*)m_pHead;
+	PVOID* pNewFreeList = NULL;
+	PVOID* pPrevNotFree = NULL;
+	PVOID* p = (PVOID*)m_pHead;
 	do
 	{
 		if (PageInfos[get_page_idx((PVOID)p)] != m_dwUnitPage)
@@ -314,39 +361,48 @@ void MfxFixedSinglePool::DecommitI(PAGEINFO_VEC& PageInfos)
 			if (pPrevNotFree == NULL)
 				pNewFreeList = p;
 			else
-				*pPrevNotFree = (DWORD)p;
+				*pPrevNotFree = p;
 			pPrevNotFree = p;
 		}
 		
-		p = reinterpret_cast<DWORD*>(*p);
+		p = reinterpret_cast<PVOID*>(*p);
 		
 	} while (p != NULL);
 	
-	if (pPrevNotFree && *pPrevNotFree != 0)
+	if (pPrevNotFree && *pPrevNotFree != NULL)
 	{
 		// 原空闲内存链表 Tail 节点也被提交了，要标记新的 Tail 节点
-		*pPrevNotFree = 0;
+		*pPrevNotFree = NULL;
 	}
 }
 
-void MfxFixedSinglePool::FinDecommit(PAGEINFO_VEC& PageInfos)
+DWORD MfxFixedSinglePool::FinDecommit(PAGEINFO_VEC& PageInfos)
 {
 	// 空闲内存提交给系统。如果空闲内存全部可回收，则需要留一个
-	PagePtrs tmpPtrs;
-	tmpPtrs.reserve(m_Ptrs.size());
-	for (PagePtrs::iterator it = m_Ptrs.begin(); it != m_Ptrs.end(); ++it)
+	DWORD dwFreed = 0;
+	ThreadLiteLib::SpinLockHelper spinHlp(&m_spinPtrs);
+	for (PagePtrs::iterator it = m_Ptrs.begin(); it != m_Ptrs.end(); )
 	{
 		if (PageInfos[get_page_idx(*it)] == m_dwUnitPage)
 		{
 			g_pMSMP->PageFree(*it);
+			++dwFreed;
+			m_Ptrs.erase(it++);
 		}
 		else
 		{
-			tmpPtrs.push_back(*it);
+			++it;
 		}
 	}
 
-	m_Ptrs.swap(tmpPtrs);
+	return dwFreed;
+}
+
+// 增量回收归还页面前，把它从所属内存池的页面表中摘除；页面不属于本内存池时返回 false
+bool MfxFixedSinglePool::RemovePage(PVOID pPage)
+{
+	ThreadLiteLib::SpinLockHelper spinHlp(&m_spinPtrs);
+	return m_Ptrs.erase(pPage) != 0;
 }
 
 ALG_EXPORT_(void*) mfxGlobalAlloc(UINT uSize)
@@ -416,6 +472,13 @@ ALG_EXPORT_(void) MemPoolDecommit(size_t nUnitSize/* = -1*/)
 		g_pMemoryPoolNoHeader->Decommit(nUnitSize);
 }
 
+// 增量回收，可由后台线程或空闲时反复调用；每次最多检查 nBudget 个缓存空闲单元，
+// 不会像 MemPoolDecommit 那样停下所有线程。返回本次归还给系统的字节数
+ALG_EXPORT_(UINT) MemPoolDecommitStep(UINT nBudget)
+{
+	return g_pMemoryPoolNoHeader->DecommitStep(nBudget) + g_pMemoryPoolUseHeader->DecommitStep(nBudget);
+}
+
 
 inline PVOID MfxFixedSinglePool::AllocUnit()
 {
@@ -443,20 +506,14 @@ inline void MfxFixedSinglePool::FreeUnit(PVOID p)
     ASSERT(m_Signature == GetSignature(m_dwUnitSize));
     
 #if defined(_DEBUG) && 0
-    //[2009-2-17 panyong] DEBUG下多了一个DWORD，用来检查是否写出头了
-    ASSERT((*(static_cast<DWORD*>(p)+(m_dwUnitSize>>2))) == 0xACACACAC);
+    //[2009-2-17 panyong] DEBUG下多了一段，用来检查是否写出头了
+    ASSERT(*(DWORD*)(static_cast<BYTE*>(p) + m_dwUnitSize) == 0xACACACAC);
     // 做更细致的检查，确定内存是否为此实例正确分配，这个检查会比较慢
-    size_t	_i;
-    for (_i = 0; _i < m_Ptrs.size(); ++_i)
-    {
-	UINT _page = (UINT)m_Ptrs[_i];
-	if ((UINT)p >= _page && (UINT)p < _page + m_dwPageSize)
-	{
-	    ASSERT( ((UINT)p - _page) % (m_dwUnitSize+4) == 0 );
-	    break;
-	}
-    }
-    ASSERT(_i < m_Ptrs.size());
+    PagePtrs::iterator _it = m_Ptrs.upper_bound(p);
+    ASSERT(_it != m_Ptrs.begin());
+    BYTE* _page = static_cast<BYTE*>(*--_it);
+    ASSERT(static_cast<BYTE*>(p) < _page + g_platform->PageSize);
+    ASSERT( (size_t)(static_cast<BYTE*>(p) - _page) % (m_dwUnitSize + MFX_UNIT_ALIGN) == 0 );
 #endif
     
     *(PVOID*)p = m_pHead;
@@ -468,7 +525,7 @@ inline void MfxFixedSinglePool::FreeUnit(PVOID p)
     
 #ifdef _DEBUG
     // 填上 0xAC 以表明这里是未初始化的
-    memset((PVOID*)p + 1, 0xAC, m_dwUnitSize - sizeof(PVOID)+4);
+    memset((PVOID*)p + 1, 0xAC, m_dwUnitSize - sizeof(PVOID) + MFX_UNIT_ALIGN);
 #endif
     
 #if ALG_FEATURE_REPORT
@@ -478,45 +535,63 @@ inline void MfxFixedSinglePool::FreeUnit(PVOID p)
 #endif
 }
 
+// 数据头占 MFX_UNIT_HEADER 字节，这样返回给调用者的指针保持指针长度对齐
 inline PVOID MfxTraitUseHeader::InitPoolUnit(PVOID p, UINT uSize)
 {
-    DWORD* _p = (DWORD*)p;
+    size_t* _p = (size_t*)p;
     *_p = uSize;
     return ++_p;
 }
 
 inline PVOID MfxTraitUseHeader::InitProxyUnit(PVOID p)
 {
-    DWORD* _p = (DWORD*)p;
+    size_t* _p = (size_t*)p;
     *_p = 0;
     return ++_p;
 }
 
 inline PVOID MfxTraitUseHeader::LeaPtrFrame(PVOID p, UINT& uSize)
 {
-    DWORD*	_p = (DWORD*)p;
+    size_t*	_p = (size_t*)p;
     --_p;
-    uSize = (*_p);
+    uSize = (UINT)(*_p);
     return _p;
 }
 
 
+#ifndef X_OS_WINDOWS
 template<typename _Tr>
-MfxMemoryPool<_Tr>::MfxMemoryPool(PCWSTR alias): m_alias(alias)
+__thread size_t MfxMemoryPool<_Tr>::s_uCurGen = 0;
+template<typename _Tr>
+__thread typename MfxMemoryPool<_Tr>::MfxPoolsRef MfxMemoryPool<_Tr>::s_pCurPools = NULL;
+#endif
+
+template<typename _Tr>
+MfxMemoryPool<_Tr>::MfxMemoryPool(PCWSTR alias): m_alias(alias), m_iDcmtPool(0), m_cbReclaimed(0)
 {
     // 做一些基本的假定检查
     ASSERT(sizeof(BYTE) == 1);
     ASSERT(sizeof(DWORD) == 4);
-    ASSERT(sizeof(PVOID) == 4);
-    ASSERT(sizeof(PBYTE) == 4);
+    ASSERT(sizeof(PVOID) == sizeof(size_t));	// 32 位与 64 位均可
     
     m_iAlcSvr = DiagAlcRegister(this);
+#ifndef X_OS_WINDOWS
+    VERIFY(pthread_key_create(&m_exitKey, _onThreadExit) == 0);
+    m_uGeneration = __sync_add_and_fetch(&s_mfxPoolGeneration, 1);
+#endif
     
     MfxPoolsRef pPools = _createSglPool();
     m_allPools.push_back(pPools);
     m_curPools.set(pPools);
+#ifndef X_OS_WINDOWS
+    pthread_setspecific(m_exitKey, pPools);
+#endif
     for (int i = 0; i < _Tr::PoolNumber; ++i)
+    {
 	m_cachePools[i] = new MfxFixedSinglePool(_Tr::GetPoolUnitExtraSize(i));
+	m_cacheDcmt[i].nDraining = 0;
+	ResetCachePool(i);	// 缓存池构造时自带一页，计入页面空闲单元数
+    }
     
 #if ALG_FEATURE_REPORT
     DiagReportArgs	args;
@@ -530,13 +605,15 @@ MfxMemoryPool<_Tr>::MfxMemoryPool(PCWSTR alias): m_alias(alias)
 template<typename _Tr>
 typename MfxMemoryPool<_Tr>::MfxPoolsRef MfxMemoryPool<_Tr>::_createSglPool()
 {
-    MfxPoolsRef pPools = (MfxPoolsRef)malloc(_Tr::PoolNumber * sizeof(MfxPoolRef));
+    // 多留一项记录所属的 MfxMemoryPool，线程退出时据此交还内存池
+    MfxPoolsRef pPools = (MfxPoolsRef)malloc((_Tr::PoolNumber + 1) * sizeof(MfxPoolRef));
     
     for (UINT	i = 0; i < _Tr::PoolNumber; ++i)
     {
 	MfxFixedSinglePool* pPool = new MfxFixedSinglePool(_Tr::GetPoolUnitExtraSize(i));
 	pPools[i] = pPool;
     }
+    pPools[_Tr::PoolNumber] = reinterpret_cast<MfxPoolRef>(this);
     return pPools;
 }
 
@@ -546,6 +623,9 @@ MfxMemoryPool<_Tr>::~MfxMemoryPool()
 #if ALG_FEATURE_REPORT
     AlgReportUnregister(m_alias);
 #endif
+#ifndef X_OS_WINDOWS
+    pthread_key_delete(m_exitKey);
+#endif
     
     itPVoids it = m_allPools.begin();
     for (; it != m_allPools.end(); ++it)
@@ -563,6 +643,7 @@ MfxMemoryPool<_Tr>::~MfxMemoryPool()
 	delete m_cachePools[i];
     }
     m_allPools.clear();
+    m_idlePools.clear();
     
 #if ALG_FEATURE_REPORT
     DiagAlcUnregister(m_iAlcSvr);
@@ -590,10 +671,10 @@ PVOID MfxMemoryPool<_Tr>::Alloc(UINT uSize)
 #ifdef _DEBUG
 	//Debug下以四字节对齐分配，以免后面Free的时候弹出ASSERT
 	uSize = ((uSize + 3) & (~0x00000003));
-	p = g_pMSMP->ProxyAlloc(uSize + 4);
-	memset(p, 0xAC, uSize+4);
+	p = g_pMSMP->ProxyAlloc(_Tr::GetProxyUnitExtraSize(uSize));
+	memset(p, 0xAC, _Tr::GetProxyUnitExtraSize(uSize));
 #else
-	p = g_pMSMP->ProxyAlloc(uSize + 4);
+	p = g_pMSMP->ProxyAlloc(_Tr::GetProxyUnitExtraSize(uSize));
 #endif
 	
 	p = _Tr::InitProxyUnit(p);
@@ -603,9 +684,7 @@ PVOID MfxMemoryPool<_Tr>::Alloc(UINT uSize)
 	UINT	iPool = _Tr::GetPoolIndex(uSize);
 	ASSERT(iPool >= 0 && iPool < _Tr::PoolNumber);
 	
-	if (m_curPools.get() == NULL)
-	    BeginThread();
-	MfxFixedSinglePool* pPool = m_curPools.get()[iPool];
+	MfxFixedSinglePool* pPool = _curPools()[iPool];
 	
 	//系统这样设计虽然有多线程的逻辑错误，
 	//但并不造成BUG，反而大大加快了运行速率！这时经过实际检验了！所以不要认为这里有BUG
@@ -677,9 +756,7 @@ void MfxMemoryPool<_Tr>::Free(PVOID p)
     {
 	UINT	iPool = _Tr::GetPoolIndex(uSize);
 	ASSERT(iPool >= 0 && iPool < _Tr::PoolNumber);
-	if (m_curPools.get() == NULL)
-	    BeginThread();
-	pPool = ((MfxPoolsRef)m_curPools.get())[iPool];
+	pPool = _curPools()[iPool];
     }
     FreeAction(pPool, p);
     
@@ -689,6 +766,10 @@ void MfxMemoryPool<_Tr>::Free(PVOID p)
 	PVOID newHead = AddCachePage(uSize, realFree, pPool->m_pHead);
 	pPool->SetHeadNode(newHead);
 	pPool->m_dwFreeNode -= realFree;
+	
+	// 缓存池变大了，顺便做一小步回收
+	UINT nBudget = VTALC_DECOMMIT_STEP;
+	_decommitCacheStep(_Tr::GetPoolIndex(uSize), nBudget);
     }
 }
 
@@ -709,9 +790,7 @@ void MfxMemoryPool<_Tr>::Free2(PVOID p, UINT uSize)
     {
 	UINT	iPool = _Tr::GetPoolIndex(uSize);
 	ASSERT(iPool >= 0 && iPool < _Tr::PoolNumber);
-	if (m_curPools.get() == NULL)
-	    BeginThread();
-	pPool = ((MfxPoolsRef)m_curPools.get())[iPool];
+	pPool = _curPools()[iPool];
     }
     
 #ifdef _DEBUG//[2009-2-17 panyong] 检查是否写冒了
@@ -733,6 +812,10 @@ void MfxMemoryPool<_Tr>::Free2(PVOID p, UINT uSize)
 	PVOID newHead = AddCachePage(uSize, realFree, pPool->m_pHead);
 	pPool->SetHeadNode(newHead);
 	pPool->m_dwFreeNode -= realFree;
+	
+	// 缓存池变大了，顺便做一小步回收
+	UINT nBudget = VTALC_DECOMMIT_STEP;
+	_decommitCacheStep(_Tr::GetPoolIndex(uSize), nBudget);
     }
 }
 
@@ -748,6 +831,8 @@ void MfxMemoryPool<_Tr>::Decommit(UINT uUnitSize)
     UINT	iPool = _Tr::GetPoolIndex(uUnitSize);
     ASSERT(iPool >= 0 && iPool < _Tr::PoolNumber);
     
+    _abortAllDrains(iPool);	// 增量回收摘下的单元先挂回去，否则统计不到
+    
     DecommitContext dcmtCtx;
     itPVoids it = m_allPools.begin();
     for (; it != m_allPools.end(); ++it)
@@ -766,13 +851,15 @@ void MfxMemoryPool<_Tr>::Decommit(UINT uUnitSize)
     
     m_cachePools[iPool]->Decommit(dcmtCtx._PageInfos);
     
+    DWORD dwFreed = 0;
     for (it = m_allPools.begin(); it != m_allPools.end(); ++it)
     {
 	MfxFixedSinglePool* pPool = ((MfxFixedSinglePool**)(*it))[iPool];
-	pPool->FinDecommit(dcmtCtx._PageInfos);
+	dwFreed += pPool->FinDecommit(dcmtCtx._PageInfos);
     }
     
-    m_cachePools[iPool]->FinDecommit(dcmtCtx._PageInfos);
+    dwFreed += m_cachePools[iPool]->FinDecommit(dcmtCtx._PageInfos);
+    _addReclaimed(dwFreed);
     
     ResetAllPools();
     ResetCachePool(iPool);
@@ -784,6 +871,7 @@ void MfxMemoryPool<_Tr>::Decommit()
 {
     for (size_t i = 0; i < _Tr::PoolNumber; ++i)
     {
+	_abortAllDrains(i);
 	DecommitContext dcmtCtx;
 	
 	itPVoids it = m_allPools.begin();
@@ -801,12 +889,14 @@ void MfxMemoryPool<_Tr>::Decommit()
 	}
 	m_cachePools[i]->Decommit(dcmtCtx._PageInfos);
 	
+	DWORD dwFreed = 0;
 	for (it = m_allPools.begin(); it != m_allPools.end(); it++)
 	{
 	    MfxFixedSinglePool* pPool = ((MfxFixedSinglePool**)(*it))[i];
-	    pPool->FinDecommit(dcmtCtx._PageInfos);
+	    dwFreed += pPool->FinDecommit(dcmtCtx._PageInfos);
 	}
-	m_cachePools[i]->FinDecommit(dcmtCtx._PageInfos);
+	dwFreed += m_cachePools[i]->FinDecommit(dcmtCtx._PageInfos);
+	_addReclaimed(dwFreed);
     }
     
     
@@ -823,34 +913,134 @@ void MfxMemoryPool<_Tr>::BeginThread()
 {
     if (m_curPools.get() == NULL)
     {
-	MfxPoolsRef pPools = _createSglPool();
+	MfxPoolsRef pPools = NULL;
 	
 	{
+	    // 优先复用已退出线程留下的内存池，线程频繁创建销毁时内存池数目不会一直增长
+	    ThreadLiteLib::SpinLockHelper spinHlp(&m_spinPool);
+	    if (!m_idlePools.empty())
+	    {
+		pPools = m_idlePools.back();
+		m_idlePools.pop_back();
+	    }
+	}
+	if (pPools == NULL)
+	{
+	    pPools = _createSglPool();
 	    ThreadLiteLib::SpinLockHelper spinHlp(&m_spinPool);
 	    m_allPools.push_back(pPools);
 	}
 	m_curPools.set(pPools);
+#ifndef X_OS_WINDOWS
+	pthread_setspecific(m_exitKey, pPools);
+#endif
     }
 }
 
+// 当前线程的内存池。分配与释放的快速路径只访问本线程的内存池，不加锁
 template <typename _Tr>
-PVOID	MfxMemoryPool<_Tr>::AddCachePage(size_t uSize, DWORD& realFree, PVOID pHead)
+inline typename MfxMemoryPool<_Tr>::MfxPoolsRef MfxMemoryPool<_Tr>::_curPools()
 {
-    ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
-    MfxPoolRef pPool = m_cachePools[_Tr::GetPoolIndex(uSize)];
+#ifndef X_OS_WINDOWS
+    // 线程局部的一项缓存：一个线程几乎总是反复使用同一个 MfxMemoryPool，命中时连
+    // Tls 查找也省掉了。按实例代号而不是地址匹配，ReleaseThreadPools 会清掉它
+    if (s_uCurGen == m_uGeneration)
+	return s_pCurPools;
+#endif
+    if (m_curPools.get() == NULL)
+	BeginThread();
+    MfxPoolsRef pPools = m_curPools.get();
+#ifndef X_OS_WINDOWS
+    s_uCurGen = m_uGeneration;
+    s_pCurPools = pPools;
+#endif
+    return pPools;
+}
+
+// 线程退出：把它各个内存池的空闲单元整体挂到缓存池上，内存池本身留给后来的线程
+// 页面仍记在原内存池的 m_Ptrs 中，Decommit 会一并统计所有内存池，因此不受影响
+template <typename _Tr>
+void MfxMemoryPool<_Tr>::ReleaseThreadPools(MfxPoolsRef pPools)
+{
+#ifndef X_OS_WINDOWS
+    // 内存池交出去以后可能被别的线程复用，本线程再分配（例如在其他 TLS 析构函数中）
+    // 时必须重新走 BeginThread，不能再命中线程缓存
+    if (s_pCurPools == pPools)
+	s_uCurGen = 0;
+    if (m_curPools.get() == pPools)
+	m_curPools.set(NULL);
+#endif
+    bool bRefill[_Tr::PoolNumber];
+    {
+	ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+	for (int i = 0; i < _Tr::PoolNumber; ++i)
+	{
+	    MfxPoolRef pPool = pPools[i];
+	    PVOID pHead = pPool->GetHeadNode();
+	    if (pHead == NULL)
+		continue;
+	    
+	    PVOID pTail = pHead;
+	    _cacheUnitIn(i, pTail);
+	    while (*(PVOID*)pTail != NULL)
+	    {
+		pTail = *(PVOID*)pTail;
+		_cacheUnitIn(i, pTail);
+	    }
+	    m_cachePools[i]->AddCacheMemory(pHead, pTail);
+	    m_cachePools[i]->m_dwFreeNode += pPool->m_dwFreeNode;
+	    pPool->SetHeadNode(NULL);
+	    pPool->m_dwFreeNode = 0;
+	}
+	for (int i = 0; i < _Tr::PoolNumber; ++i)
+	    bRefill[i] = m_cacheDcmt[i]._Units.NeedSpare();
+    }
+    for (int i = 0; i < _Tr::PoolNumber; ++i)
+    {
+	if (bRefill[i])
+	    _refillUnits(i);
+    }
     
-    PVOID head = pHead;
+    ThreadLiteLib::SpinLockHelper spinHlp(&m_spinPool);
+    m_idlePools.push_back(pPools);
+}
+
+#ifndef X_OS_WINDOWS
+template <typename _Tr>
+void MfxMemoryPool<_Tr>::_onThreadExit(void* pv)
+{
+    MfxPoolsRef pPools = (MfxPoolsRef)pv;
+    MfxMemoryPool* pThis = reinterpret_cast<MfxMemoryPool*>(pPools[_Tr::PoolNumber]);
+    pThis->ReleaseThreadPools(pPools);
+}
+#endif
+
+template <typename _Tr>
+PVOID	MfxMemoryPool<_Tr>::AddCachePage(size_t uSize, DWORD& realFree, PVOID pHead)
+{
+    const int iPool = _Tr::GetPoolIndex(uSize);
     PVOID tail = pHead;
-    const DWORD cntNum = pPool->m_dwUnitPage * VTALC_CACHEPAGE_NUM;
-    
-    for (; realFree < cntNum; ++realFree)
+    bool bRefill;
     {
-	head = tail;
-	tail = *(PVOID*)tail;
+	ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+	MfxPoolRef pPool = m_cachePools[iPool];
+	
+	PVOID head = pHead;
+	const DWORD cntNum = pPool->m_dwUnitPage * VTALC_CACHEPAGE_NUM;
+	
+	for (; realFree < cntNum; ++realFree)
+	{
+	    head = tail;
+	    tail = *(PVOID*)tail;
+	    _cacheUnitIn(iPool, head);
+	}
+	ASSERT(realFree == cntNum);
+	pPool->AddCacheMemory(pHead, head);
+	pPool->m_dwFreeNode += realFree;
+	bRefill = m_cacheDcmt[iPool]._Units.NeedSpare();
     }
-    ASSERT(realFree == cntNum);
-    pPool->AddCacheMemory(pHead, head);
-    pPool->m_dwFreeNode += realFree;
+    if (bRefill)
+	_refillUnits(iPool);
     return tail;
 }
 
@@ -878,6 +1068,10 @@ PVOID MfxMemoryPool<_Tr>::UseCachePage(int iPool, DWORD& realCnt)
     ASSERT(realCnt == unitPage);
     pPool->m_dwFreeNode -= realCnt;
     pPool->SetHeadNode(pTail);
+    
+    // 先从缓存链表上摘下再更新页面计数，放弃回收时挂回的单元才不会混进交出的链表
+    for (PVOID p = pHead; p != NULL; p = *(PVOID*)p)
+	_cacheUnitOut(iPool, p);
     return pHead;
 }
 
@@ -913,13 +1107,223 @@ void MfxMemoryPool<_Tr>::ResetCachePool(int ipool)  //更新singlepool的内存
     PVOID pTail = pPool->GetHeadNode();
     DWORD realCnt = 0;
     
+    // 顺带重建增量回收用的页面空闲单元数
+    CacheDecommit& dcmt = m_cacheDcmt[ipool];
+    ASSERT(dcmt.nDraining == 0);
+    dcmt._Units.clear();
+    dcmt.pCursor = NULL;
+    dcmt.nFullPages = 0;
+    
     for (; pTail != NULL; ++realCnt)
     {
+	_cacheUnitIn(ipool, pTail);
 	pTail = *(PVOID*)pTail; //p = p->next;类似这样的意思
     }
     
     ASSERT(pPool->m_dwFreeNode >= realCnt);
     pPool->m_dwFreeNode = realCnt;
+    if (dcmt._Units.NeedSpare())
+	dcmt._Units.AddSpare(PAGEINFO_VEC::NewChunk());
+}
+
+// -------------------------------------------------------------------------- //
+// 缓存池的增量回收
+// 以下除 DecommitStep 外都要求调用者持有 m_spinCache
+
+// 页面空闲单元数表用掉了备用组，在锁外分配一个补上，这样 _cacheUnitIn 在锁内
+// 插入新组时通常不用分配内存。调用者不持有 m_spinCache
+template <typename _Tr>
+void MfxMemoryPool<_Tr>::_refillUnits(int iPool)
+{
+    PAGEINFO_VEC::CHUNK* pChunk = PAGEINFO_VEC::NewChunk();
+    ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+    m_cacheDcmt[iPool]._Units.AddSpare(pChunk);
+}
+
+// 一个空闲单元进入缓存池
+template <typename _Tr>
+inline void MfxMemoryPool<_Tr>::_cacheUnitIn(int iPool, PVOID p)
+{
+    CacheDecommit& dcmt = m_cacheDcmt[iPool];
+    if (++dcmt._Units[get_page_idx(p)] == m_cachePools[iPool]->m_dwUnitPage)
+	++dcmt.nFullPages;
+}
+
+// 一个空闲单元离开缓存池。它所在的页面正在回收的话，这个页面已经回收不了了
+template <typename _Tr>
+inline void MfxMemoryPool<_Tr>::_cacheUnitOut(int iPool, PVOID p)
+{
+    CacheDecommit& dcmt = m_cacheDcmt[iPool];
+    size_t idx = get_page_idx(p);
+    DWORD& nUnits = dcmt._Units[idx];
+    ASSERT(nUnits > 0);
+    if (nUnits-- == m_cachePools[iPool]->m_dwUnitPage)
+    {
+	--dcmt.nFullPages;
+	if (dcmt.nDraining != 0)
+	{
+	    DrainChain* pChain = _findDrain(dcmt, idx);
+	    if (pChain != NULL)
+		_abortDrain(iPool, pChain);
+	}
+    }
+    if (p == dcmt.pCursor)
+	dcmt.pCursor = NULL;
+}
+
+// 放弃回收一个页面，把已经摘下的单元挂回缓存池
+template <typename _Tr>
+void MfxMemoryPool<_Tr>::_abortDrain(int iPool, DrainChain* pChain)
+{
+    CacheDecommit& dcmt = m_cacheDcmt[iPool];
+    m_cachePools[iPool]->AddCacheMemory(pChain->pHead, pChain->pTail);
+    m_cachePools[iPool]->m_dwFreeNode += pChain->nUnits;
+    *pChain = dcmt._Draining[--dcmt.nDraining];
+}
+
+// 正在回收的页面中找下标为 idx 的，没有则返回 NULL
+template <typename _Tr>
+inline typename MfxMemoryPool<_Tr>::DrainChain* MfxMemoryPool<_Tr>::_findDrain(CacheDecommit& dcmt, size_t idx)
+{
+    for (DWORD i = 0; i < dcmt.nDraining; ++i)
+    {
+	if (dcmt._Draining[i].idx == idx)
+	    return &dcmt._Draining[i];
+    }
+    return NULL;
+}
+
+template <typename _Tr>
+void MfxMemoryPool<_Tr>::_abortAllDrains(int iPool)
+{
+    ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+    CacheDecommit& dcmt = m_cacheDcmt[iPool];
+    while (dcmt.nDraining != 0)
+	_abortDrain(iPool, &dcmt._Draining[0]);
+}
+
+// 从上一步停下的地方接着扫描缓存链表，把整页空闲页面的单元摘下来，摘齐的页面
+// 归还给系统。最多扫描 nBudget 个单元（扣除实际用掉的），返回归还的字节数
+template <typename _Tr>
+UINT MfxMemoryPool<_Tr>::_decommitCacheStep(int iPool, UINT& nBudget)
+{
+    PVOID	pages[VTALC_DECOMMIT_MAXPAGE];
+    UINT	nPages = 0;
+    
+    {
+	ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+	CacheDecommit& dcmt = m_cacheDcmt[iPool];
+	MfxPoolRef pPool = m_cachePools[iPool];
+	const DWORD dwUnitPage = pPool->m_dwUnitPage;
+	const DWORD dwKeep = dwUnitPage * VTALC_DECOMMIT_KEEPPAGE;
+	
+	PVOID* pLink = dcmt.pCursor != NULL ? (PVOID*)dcmt.pCursor : &pPool->m_pHead;
+	bool bWrapped = (dcmt.pCursor == NULL);
+	while (nBudget > 0 && nPages < VTALC_DECOMMIT_MAXPAGE &&
+	       dcmt.nFullPages > 0 && pPool->m_dwFreeNode > dwKeep)
+	{
+	    PVOID p = *pLink;
+	    if (p == NULL)
+	    {
+		// 到链表尾了，从头再来；一步之内只绕回一次
+		dcmt.pCursor = NULL;
+		if (bWrapped)
+		    break;
+		bWrapped = true;
+		pLink = &pPool->m_pHead;
+		continue;
+	    }
+	    --nBudget;
+	    
+	    size_t idx = get_page_idx(p);
+	    DrainChain* pChain = NULL;
+	    if (dcmt._Units[idx] == dwUnitPage)
+	    {
+		pChain = _findDrain(dcmt, idx);
+		if (pChain == NULL && dcmt.nDraining < VTALC_DECOMMIT_MAXPAGE)
+		{
+		    pChain = &dcmt._Draining[dcmt.nDraining++];
+		    pChain->idx = idx;
+		    pChain->pHead = NULL;
+		    pChain->nUnits = 0;
+		}
+	    }
+	    if (pChain == NULL)
+	    {
+		// 不是整页空闲，或者同时回收的页面已满，留到以后
+		dcmt.pCursor = p;
+		pLink = (PVOID*)p;
+		continue;
+	    }
+	    
+	    // 摘下这个单元，挂到页面的回收链上
+	    *pLink = *(PVOID*)p;
+	    --pPool->m_dwFreeNode;
+	    if (pChain->nUnits == 0)
+		pChain->pTail = p;
+	    *(PVOID*)p = pChain->pHead;
+	    pChain->pHead = p;
+	    
+	    if (++pChain->nUnits == dwUnitPage)
+	    {
+		// 整页摘齐，出锁以后再归还
+		*pChain = dcmt._Draining[--dcmt.nDraining];
+		dcmt._Units[idx] = 0;
+		--dcmt.nFullPages;
+		pages[nPages++] = reinterpret_cast<PVOID>(idx * g_platform->PageSize);
+	    }
+	}
+	m_cbReclaimed += (ULONGLONG)nPages * g_platform->PageSize;
+    }
+    
+    for (UINT i = 0; i < nPages; ++i)
+	_releaseCachePage(iPool, pages[i]);
+    
+    return nPages * g_platform->PageSize;
+}
+
+// 整体回收归还的页面计入统计。调用者不持有 m_spinCache
+template <typename _Tr>
+void MfxMemoryPool<_Tr>::_addReclaimed(DWORD nPages)
+{
+    ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+    m_cbReclaimed += (ULONGLONG)nPages * g_platform->PageSize;
+}
+
+// 把页面从分配它的内存池中摘除并归还。页面已经不在任何空闲链表上，不需要 m_spinCache
+template <typename _Tr>
+void MfxMemoryPool<_Tr>::_releaseCachePage(int iPool, PVOID pPage)
+{
+    bool bFound = m_cachePools[iPool]->RemovePage(pPage);
+    if (!bFound)
+    {
+	ThreadLiteLib::SpinLockHelper spinHlp(&m_spinPool);
+	for (itPVoids it = m_allPools.begin(); it != m_allPools.end() && !bFound; ++it)
+	    bFound = (*it)[iPool]->RemovePage(pPage);
+    }
+    ASSERT(bFound);
+    if (bFound)
+	g_pMSMP->PageFree(pPage);
+}
+
+// 增量回收：各个池轮流做一小步，总共最多扫描 nBudget 个缓存空闲单元
+// 只回收缓存池中的整页空闲页面，不碰各线程自己的内存池，因此不需要停下其他线程
+template <typename _Tr>
+UINT MfxMemoryPool<_Tr>::DecommitStep(UINT nBudget)
+{
+    UINT cbReclaimed = 0;
+    for (int n = 0; n < _Tr::PoolNumber && nBudget > 0; ++n)
+    {
+	int iPool;
+	{
+	    // 可能有多个线程同时调用
+	    ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+	    iPool = m_iDcmtPool;
+	    m_iDcmtPool = (iPool + 1) % _Tr::PoolNumber;
+	}
+	cbReclaimed += _decommitCacheStep(iPool, nBudget);
+    }
+    return cbReclaimed;
 }
 
 
@@ -941,7 +1345,7 @@ UINT MfxMemoryPool<_Tr>::GetAlcSvr(PVOID p) const
 #if ALG_FEATURE_MMS
     if (p == NULL)
 	return m_iAlcSvr;
-    UINT*	p2 = (UINT*)p;
+    size_t*	p2 = (size_t*)p;
     --p2;
     return *p2 == 0 ? PreAlc_MainHeap : m_iAlcSvr;
 #else
@@ -969,6 +1373,18 @@ void MfxMemoryPool<_Tr>::Report(IDiagReportAccpt* pAccpt)
     }
     pAccpt->EndElement(L"pools");
     
+    // 回收：已归还给系统的内存，以及缓存池中整页空闲、还可以回收的页面
+    int nFullPages = 0;
+    ULONGLONG cbReclaimed;
+    {
+	ThreadLiteLib::SpinLockHelper lockHelp(&m_spinCache);
+	for (int i = 0; i < _Tr::PoolNumber; ++i)
+	    nFullPages += m_cacheDcmt[i].nFullPages;
+	cbReclaimed = m_cbReclaimed;
+    }
+    pAccpt->WriteElementEx(L"decommit", L"reclaimed|I64d,reclaimable-pages|d",
+			   cbReclaimed, nFullPages);
+    
     pAccpt->EndDocument();
 #endif
 }
@@ -980,7 +1396,7 @@ UINT MfxMemoryPool<_Tr>::diagGetFrameSize(PVOID, UINT uSize)
     if (uSize > _Tr::MaxPoolUnit)
 	return (uSize + 7 + 8) & 0xFFFFFFF8;	// 采用 CRT 的分配方式，参见 AlgDiag
     else
-	return (uSize + 3 + 4) & 0xFFFFFFFC;
+	return (uSize + MFX_UNIT_HEADER + MFX_UNIT_ALIGN - 1) & ~(UINT)(MFX_UNIT_ALIGN - 1);
 #else
     return uSize;
 #endif
@@ -6,7 +6,11 @@
 // AlgNew / AlgFree 供外部模块使用
 // 分配事件在这两个宏中发送，因此不要直接使用 alg_alloc 或其他内部方法
 #include<vector>
+#include<set>
 #include "mfx_provider.h"
+#ifndef X_OS_WINDOWS
+#include <pthread.h>
+#endif
 
 // -------------------------------------------------------------------------- //
 // 使用 VirtualAlloc 实现的 Memory Provider
@@ -16,6 +20,7 @@
 // 过于分散的内存请求会导致 LDT 表溢出，因此，此类会将其整理成 1MB 为单位的内存
 // 分配请求。这样，如果连续一个单位中有一页还在释放，这个单位就无法归还给系统。
 // 请参见相应文档。 
+// 非 Windows 平台上用 mmap 保留、mprotect 提交、madvise 回收，支持 64 位地址空间
 
 #define VTALC_PAGE_SIZE		0x1000
 #define VTALC_BLOCK_SIZE	0x100000
@@ -24,6 +29,11 @@
 #define VTALC_CACHEPAGE_NUM		 0x0008
 #define VTALC_CACHEPOOL_OUTPAGE	 0x0004
 
+// 增量回收：每一步最多检查的缓存空闲单元数、最多归还的页面数，以及缓存池至少保留的页面数
+#define VTALC_DECOMMIT_STEP		 0x0100
+#define VTALC_DECOMMIT_MAXPAGE	 0x0010
+#define VTALC_DECOMMIT_KEEPPAGE	 0x0010
+
 template<typename _MP>
 class bit_array;
 
@@ -100,24 +110,103 @@ namespace
 {
 	inline size_t get_page_idx(PVOID pAddr)
 	{
-		return reinterpret_cast<size_t>(pAddr) / VTALC_PAGE_SIZE;
+		return reinterpret_cast<size_t>(pAddr) / g_platform->PageSize;
 	}
 }
 
-typedef std::vector<DWORD> PAGEINFO_VEC;
+// 每个页面中空闲单元数目的稀疏表
+// 64 位地址空间无法再按页面下标开稠密数组，这里把 PAGEINFO_CHUNK_PAGES 个相邻页面
+// 分为一组，只为实际出现过的组分配计数。回收时的访问大都落在同一组内，因此缓存
+// 最近一次访问的组
+// 各组按组号散列到固定的桶中，插入新组只是挂上链表。缓存池在自旋锁内更新计数，
+// 调用者可以先在锁外分配好备用组（AddSpare），锁内插入时就不用再分配内存
+#define PAGEINFO_CHUNK_PAGES	0x400
+#define PAGEINFO_BUCKETS		0x100
 
-// 回收内存页面的上下文
-struct DecommitContext
+class PAGEINFO_VEC
 {
-	PAGEINFO_VEC _PageInfos;
-	DecommitContext()
+public:
+	struct CHUNK
+	{
+		size_t	iChunk;
+		CHUNK*	pNext;
+		DWORD	counts[PAGEINFO_CHUNK_PAGES];
+	};
+
+	PAGEINFO_VEC(): m_pLast(NULL), m_pSpare(NULL)
+	{
+		memset(m_buckets, 0, sizeof(m_buckets));
+	}
+
+	~PAGEINFO_VEC()
 	{
-		// 用户进程空间最大为3G（32位系统）
-		// Linux最大为3G，Windows 7及以上系统最大也允许设为3G
-		UINT maxUserSpaceAddr = 0xBFFFFFFF;
-		PVOID maxAdd = (PVOID)maxUserSpaceAddr;
-		_PageInfos.resize(get_page_idx(maxAdd) + 1, 0);
+		clear();
+		while (m_pSpare != NULL)
+		{
+			CHUNK* pChunk = m_pSpare;
+			m_pSpare = pChunk->pNext;
+			delete pChunk;
+		}
 	}
+
+	DWORD& operator[](size_t idx)
+	{
+		size_t	iChunk = idx / PAGEINFO_CHUNK_PAGES;
+		if (m_pLast == NULL || m_pLast->iChunk != iChunk)
+		{
+			CHUNK**	ppBucket = &m_buckets[iChunk % PAGEINFO_BUCKETS];
+			CHUNK*	pChunk = *ppBucket;
+			while (pChunk != NULL && pChunk->iChunk != iChunk)
+				pChunk = pChunk->pNext;
+			if (pChunk == NULL)
+			{
+				pChunk = m_pSpare;
+				if (pChunk != NULL)
+					m_pSpare = pChunk->pNext;
+				else
+					pChunk = NewChunk();
+				pChunk->iChunk = iChunk;
+				memset(pChunk->counts, 0, sizeof(pChunk->counts));
+				pChunk->pNext = *ppBucket;
+				*ppBucket = pChunk;
+			}
+			m_pLast = pChunk;
+		}
+		return m_pLast->counts[idx % PAGEINFO_CHUNK_PAGES];
+	}
+
+	// 清空计数，已分配的组留作备用
+	void clear()
+	{
+		for (size_t i = 0; i < PAGEINFO_BUCKETS; ++i)
+		{
+			while (m_buckets[i] != NULL)
+			{
+				CHUNK* pChunk = m_buckets[i];
+				m_buckets[i] = pChunk->pNext;
+				AddSpare(pChunk);
+			}
+		}
+		m_pLast = NULL;
+	}
+
+	static CHUNK* NewChunk() { return new CHUNK; }
+	void AddSpare(CHUNK* pChunk) { pChunk->pNext = m_pSpare; m_pSpare = pChunk; }
+	bool NeedSpare() const { return m_pSpare == NULL; }
+
+private:
+	PAGEINFO_VEC(const PAGEINFO_VEC&);
+	PAGEINFO_VEC& operator=(const PAGEINFO_VEC&);
+
+	CHUNK*		m_buckets[PAGEINFO_BUCKETS];
+	CHUNK*		m_pLast;
+	CHUNK*		m_pSpare;		// 备用组
+};
+
+// 回收内存页面的上下文
+struct DecommitContext
+{
+	PAGEINFO_VEC _PageInfos;	// 按需增长，不再预先覆盖整个用户地址空间
 };
 
 // -------------------------------------------------------------------------- //
@@ -135,7 +224,7 @@ class MfxFixedSinglePool
 {
 DECLARE_CLASS_DEFRTI(MfxFixedSinglePool)
 
-typedef std::vector<PVOID>	PagePtrs;
+typedef std::set<PVOID>	PagePtrs;	// 有序，增量回收摘除页面时不必线性查找
 friend class MfxMemoryPool<MfxTraitNoHeader>;
 friend class MfxMemoryPool<MfxTraitUseHeader>;
 
@@ -161,13 +250,14 @@ public:
 	void	FreeUnit(PVOID);
 	void	PreDecommit(PAGEINFO_VEC& PageInfos);
 	void	Decommit(PAGEINFO_VEC& PageInfos);
-	void	FinDecommit(PAGEINFO_VEC& PageInfos); 
+	DWORD	FinDecommit(PAGEINFO_VEC& PageInfos); 
 	bool	IsPoolEmpty();
 
 protected:
 	void	InitPage(PVOID pPage);
 	void	PreparePage();
 	void	DecommitI(PAGEINFO_VEC& PageInfos);
+	bool	RemovePage(PVOID pPage);
 	PVOID	GetHeadNode();
 	void	SetHeadNode(PVOID pHead);
 	void	AddCacheMemory(PVOID pHead,PVOID pTail);
@@ -179,6 +269,7 @@ private:
 
 	PVOID		m_pHead;		// 空闲块链表头
 	PagePtrs	m_Ptrs;			// 分配页面
+	ThreadLiteLib::SpinlockExp	m_spinPtrs;	// 保护 m_Ptrs，增量回收会从其他线程摘除页面
 };
 
 // -------------------------------------------------------------------------- //
@@ -190,23 +281,27 @@ private:
 // 者由于不依赖数据头，因此可以进一步减小内存使用量。
 //
 
+// 池按指针长度分档，数据头也占一个指针长度，64 位下返回的指针仍然 8 字节对齐
+#define MFX_UNIT_ALIGN		sizeof(PVOID)
+#define MFX_UNIT_HEADER		sizeof(size_t)
+
 struct MfxTraitUseHeader
 {
 	enum	// 控制内存池的参数
 	{
 		PoolNumber	= 16,							// 池数目
-		MaxPoolUnit	= PoolNumber * sizeof(DWORD),	// 池分配的最大单元（64 字节）
+		MaxPoolUnit	= PoolNumber * MFX_UNIT_ALIGN,	// 池分配的最大单元（32 位 64 字节，64 位 128 字节）
 	};
 
-	static UINT		GetPoolUnitExtraSize(UINT iPool) { return (iPool + 2) * sizeof(DWORD); }
-	static UINT		GetPoolIndex(UINT uSize) { return (uSize - 1) >> 2; }
+	static UINT		GetPoolUnitExtraSize(UINT iPool) { return (iPool + 1) * MFX_UNIT_ALIGN + MFX_UNIT_HEADER; }
+	static UINT		GetPoolIndex(UINT uSize) { return (uSize - 1) / MFX_UNIT_ALIGN; }
 	static PVOID	InitPoolUnit(PVOID p, UINT uSize);
 
-	static UINT		GetProxyUnitExtraSize(UINT uSize) { return uSize + sizeof(DWORD); }
+	static UINT		GetProxyUnitExtraSize(UINT uSize) { return uSize + MFX_UNIT_HEADER; }
 	static PVOID	InitProxyUnit(PVOID);
 
 	static PVOID	LeaPtrFrame(PVOID p, UINT&);
-	static PVOID	GetPtrOrg(PVOID p) { DWORD* _p = (DWORD*)p; return --_p; }
+	static PVOID	GetPtrOrg(PVOID p) { return static_cast<BYTE*>(p) - MFX_UNIT_HEADER; }
 };
 
 struct MfxTraitNoHeader
@@ -214,11 +309,11 @@ struct MfxTraitNoHeader
 	enum	// 控制内存池的参数
 	{
 		PoolNumber	= 16,							// 池数目
-		MaxPoolUnit	= PoolNumber * sizeof(DWORD),	// 池分配的最大单元（64 字节）
+		MaxPoolUnit	= PoolNumber * MFX_UNIT_ALIGN,	// 池分配的最大单元（32 位 64 字节，64 位 128 字节）
 	};
 
-	static UINT		GetPoolUnitExtraSize(UINT iPool) { return (iPool + 1) * sizeof(DWORD); }
-	static UINT		GetPoolIndex(UINT uSize) { return (uSize - 1) >> 2; }	//返回对应内存池号
+	static UINT		GetPoolUnitExtraSize(UINT iPool) { return (iPool + 1) * MFX_UNIT_ALIGN; }
+	static UINT		GetPoolIndex(UINT uSize) { return (uSize - 1) / MFX_UNIT_ALIGN; }	//返回对应内存池号
 	static PVOID	InitPoolUnit(PVOID p, size_t uSize) { return p; }
 
 	static UINT		GetProxyUnitExtraSize(UINT uSize) { return uSize; }
@@ -249,9 +344,19 @@ public:
 
 	void	Decommit(UINT uUnitSize);
 	void	Decommit();
+	UINT	DecommitStep(UINT nBudget = VTALC_DECOMMIT_STEP);
 	void	BeginThread(); 
 
 protected:
+	MfxPoolsRef	_curPools();
+#ifndef X_OS_WINDOWS
+	static __thread size_t		s_uCurGen;		// _curPools 的线程缓存：上次访问的实例代号
+	static __thread MfxPoolsRef	s_pCurPools;	// 以及该实例中本线程的内存池
+#endif
+	void	ReleaseThreadPools(MfxPoolsRef pPools);
+#ifndef X_OS_WINDOWS
+	static void	_onThreadExit(void* pv);
+#endif
 	void	FreeAction(MfxFixedSinglePool* pPool, PVOID ptr);
 	void	Report(IDiagReportAccpt* pAccpt);
 	PCWSTR	diagGetClassName() { return m_alias.c_str(); }
@@ -260,6 +365,38 @@ protected:
 	MfxPoolsRef	_createSglPool();
 
 private:
+	// 缓存池的增量回收状态，均受 m_spinCache 保护
+	// _Units 记录每个页面有多少空闲单元在缓存池中，达到 m_dwUnitPage 即整页空闲，不必
+	// 扫描全部页面就能知道有没有可回收的页面。回收时把整页空闲页面的单元逐个从缓存链表
+	// 摘到 _Draining 中，摘齐了才归还页面；期间缓存池交出了这个页面的单元则放弃回收
+	// 同时在回收的页面最多 VTALC_DECOMMIT_MAXPAGE 个，用定长数组，锁内不分配内存
+	struct DrainChain
+	{
+		size_t	idx;			// 页面下标
+		PVOID	pHead;
+		PVOID	pTail;
+		DWORD	nUnits;
+	};
+
+	struct CacheDecommit
+	{
+		PAGEINFO_VEC	_Units;
+		DrainChain		_Draining[VTALC_DECOMMIT_MAXPAGE];
+		DWORD			nDraining;		// _Draining 中正在回收的页面数
+		PVOID			pCursor;		// 上一步停下的位置（仍在链表中的节点），NULL 表示从头开始
+		DWORD			nFullPages;		// 整页空闲的页面数
+	};
+
+	void	_cacheUnitIn(int iPool, PVOID p);
+	void	_refillUnits(int iPool);
+	void	_cacheUnitOut(int iPool, PVOID p);
+	static DrainChain*	_findDrain(CacheDecommit& dcmt, size_t idx);
+	void	_abortDrain(int iPool, DrainChain* pChain);
+	void	_abortAllDrains(int iPool);
+	UINT	_decommitCacheStep(int iPool, UINT& nBudget);
+	void	_addReclaimed(DWORD nPages);
+	void	_releaseCachePage(int iPool, PVOID pPage);
+
 	void	ResetAllPools();
 	void	ResetCachePool(int ipool);
 	bool    IsCachePoolEmpty(int iPool);
@@ -270,10 +407,18 @@ private:
 	UINT	m_iAlcSvr;	
 	kfc::ks_wstring	m_alias;			// 调试附加数				
 	vecPVoids	m_allPools;						// 所有线程的内存池
+	vecPVoids	m_idlePools;					// 已退出线程留下的内存池，供新线程复用
 	MfxPoolRef m_cachePools[_Tr::PoolNumber]; 
 	ThreadLiteLib::Tls<MfxPoolsRef> m_curPools;	// 当前线程的内存池
 	ThreadLiteLib::SpinlockExp	m_spinPool;
 	ThreadLiteLib::SpinlockExp	m_spinCache;
+	CacheDecommit	m_cacheDcmt[_Tr::PoolNumber];
+	UINT	m_iDcmtPool;			// DecommitStep 轮转到的池，受 m_spinCache 保护
+	ULONGLONG	m_cbReclaimed;		// 回收归还给系统的字节数，受 m_spinCache 保护
+#ifndef X_OS_WINDOWS
+	pthread_key_t	m_exitKey;		// 线程退出时把它的内存池交还给缓存池
+	size_t			m_uGeneration;	// 实例代号，各实例互不相同，析构后地址被复用也不会误中线程缓存
+#endif
 };
 
 // 实现方法